@@ -0,0 +1,1280 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+/*
+ * vspfilter-bench runs vspfilter over every pair of the formats it
+ * accepts, a set of scaling ratios and each way of passing the buffers to
+ * the device, and reports the throughput, the per-frame latency and the
+ * CPU time of each run as JSON.
+ *
+ * The input buffers are prepared before a run and recycled, so that the
+ * numbers reflect the element and the device rather than the source. The
+ * mmap mode is the exception: the buffers come from the pool vspfilter
+ * proposes, so they are written by videotestsrc. The dmabufs are
+ * allocated from a DMA heap, or are memfds on the virtual backend; the
+ * dmabuf mode is skipped on a VSP when there is no DMA heap.
+ *
+ * When no VSP is found, the virtual device backend is used.
+ *
+ * With --tile-size, every case is also converted as tiles of that size
+ * once, and the result is compared to the conversion of the whole frame.
+ * --stripes does the same with the frame split into stripes.
+ *
+ * With --copy, the copy of input buffers which cannot be passed to the
+ * device into MMAP buffers is measured instead, in MB/s, with the copier
+ * of vspfilter and with the row by row memcpy it replaced as the baseline.
+ *
+ * With --compositor, vspcompositor composes videotestsrc inputs placed at
+ * offsets over a background instead, with the same report as vspfilter.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/types.h>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/allocators/gstdmabuf.h>
+
+#include "vspfiltercopy.h"
+
+#define BENCH_FPS 30
+#define RING_SIZE 8
+#define RUN_TIMEOUT (120 * GST_SECOND)
+
+/* bytes added to the rows of the source of the strided copy cases */
+#define COPY_PADDING 128
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+/* the allocation of linux/dma-heap.h, which older headers lack */
+typedef struct
+{
+  __u64 len;
+  __u32 fd;
+  __u32 fd_flags;
+  __u64 heap_flags;
+} BenchHeapAllocation;
+
+#define BENCH_DMA_HEAP_IOCTL_ALLOC _IOWR ('H', 0x0, BenchHeapAllocation)
+
+/* contiguous first, for a VSP which is not behind an IOMMU */
+static const gchar *dma_heaps[] = {
+  "/dev/dma_heap/linux,cma",
+  "/dev/dma_heap/reserved",
+  "/dev/dma_heap/system",
+};
+
+typedef enum
+{
+  IO_MMAP,
+  IO_DMABUF,
+  IO_USERPTR,
+  N_IO
+} BenchIO;
+
+static const gchar *io_names[N_IO] = { "mmap", "dmabuf", "userptr" };
+
+typedef struct
+{
+  const gchar *name;
+  gint in_width, in_height;
+  gint out_width, out_height;
+} BenchScale;
+
+static const BenchScale scales[] = {
+  {"1:1", 1920, 1080, 1920, 1080},
+  {"down-2:1", 1920, 1080, 960, 540},
+  {"up-1080p-4k", 1920, 1080, 3840, 2160},
+  /* beyond the UDS ratio, scaled in two passes */
+  {"thumb-4k", 3840, 2160, 160, 90},
+  /* exercises the rounding of odd sizes of subsampled formats */
+  {"odd", 1279, 719, 641, 361},
+};
+
+typedef struct
+{
+  GstVideoFormat in_format;
+  GstVideoFormat out_format;
+  const BenchScale *scale;
+  BenchIO io;
+} BenchCase;
+
+typedef struct
+{
+  const gchar *name;
+  GstVideoFormat format;
+  gint width, height;
+  /* bytes after each row of the source, which then takes a copy per row */
+  gint src_padding;
+} CopyCase;
+
+static const CopyCase copy_cases[] = {
+  {"1080p-packed", GST_VIDEO_FORMAT_NV12, 1920, 1080, 0},
+  {"1080p-strided", GST_VIDEO_FORMAT_NV12, 1920, 1080, COPY_PADDING},
+  {"4k-packed", GST_VIDEO_FORMAT_NV12, 3840, 2160, 0},
+  {"4k-strided", GST_VIDEO_FORMAT_NV12, 3840, 2160, COPY_PADDING},
+  {"1080p-bgra-strided", GST_VIDEO_FORMAT_BGRA, 1920, 1080, COPY_PADDING},
+};
+
+typedef struct
+{
+  gint xpos, ypos;
+  gint width, height;
+} CompositorInput;
+
+typedef struct
+{
+  const gchar *name;
+  gint width, height;
+  guint n_inputs;
+  CompositorInput inputs[4];
+} CompositorCase;
+
+static const CompositorCase compositor_cases[] = {
+  {"side-by-side", 1920, 1080, 2, {{0, 0, 960, 1080}, {960, 0, 960, 1080}}},
+  {"pip", 1920, 1080, 2, {{0, 0, 1920, 1080}, {1392, 48, 480, 270}}},
+  /* the lowest input does not cover the output, the background shows */
+  {"quad-background", 1920, 1080, 4, {{80, 60, 800, 450},
+          {1040, 60, 800, 450}, {80, 570, 800, 450}, {1040, 570, 800, 450}}},
+};
+
+typedef struct
+{
+  GMutex lock;
+  guint n_frames;
+  gint64 *in_time;
+  gint64 *latency;
+  guint n_out;
+  gint64 start;
+  gint64 last_out;
+} BenchRun;
+
+static gint n_frames = 100;
+static gchar *format_filter;
+static gchar *io_filter;
+static gchar *scale_filter;
+static gchar *output = "-";
+static gint tile_size;
+static gint stripes;
+static gboolean copy_bench;
+/* where the dmabufs of the dmabuf mode come from, NULL if it is skipped */
+static const gchar *dmabuf_source;
+static gboolean compositor_bench;
+
+/* vspfiltercopy.c logs to the category of the plugin */
+GST_DEBUG_CATEGORY (vspfilter_debug);
+
+static GOptionEntry entries[] = {
+  {"frames", 'n', 0, G_OPTION_ARG_INT, &n_frames,
+      "Number of frames per run (default: 100)", "N"},
+  {"formats", 'f', 0, G_OPTION_ARG_STRING, &format_filter,
+      "Comma separated formats to run (default: all)", "FORMATS"},
+  {"io", 'i', 0, G_OPTION_ARG_STRING, &io_filter,
+      "Comma separated I/O modes: mmap, dmabuf, userptr (default: all)",
+      "MODES"},
+  {"scales", 's', 0, G_OPTION_ARG_STRING, &scale_filter,
+      "Comma separated scales: 1:1, down-2:1, up-1080p-4k, thumb-4k, odd, "
+        "or with --copy the copy cases: 1080p-packed, 1080p-strided, "
+        "4k-packed, 4k-strided, 1080p-bgra-strided (default: all)",
+      "SCALES"},
+  {"output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+      "File to write the JSON report to (default: stdout)", "FILE"},
+  {"tile-size", 't', 0, G_OPTION_ARG_INT, &tile_size,
+      "Also check the conversion as tiles of N pixels against the whole "
+        "frame (default: off)", "N"},
+  {"stripes", 'S', 0, G_OPTION_ARG_INT, &stripes,
+      "Also check the conversion in N stripes against the whole frame "
+        "(default: off)", "N"},
+  {"copy", 'c', 0, G_OPTION_ARG_NONE, &copy_bench,
+      "Measure the copy of input buffers into MMAP buffers instead, with "
+        "--frames copies per run", NULL},
+  {"compositor", 'C', 0, G_OPTION_ARG_NONE, &compositor_bench,
+      "Measure vspcompositor instead, with the cases side-by-side, pip and "
+        "quad-background as --scales", NULL},
+  {NULL}
+};
+
+static gboolean
+selected (const gchar * filter, const gchar * name)
+{
+  gchar **names;
+  gboolean found = FALSE;
+  guint i;
+
+  if (!filter)
+    return TRUE;
+
+  names = g_strsplit (filter, ",", -1);
+  for (i = 0; names[i] && !found; i++)
+    found = strcmp (names[i], name) == 0;
+  g_strfreev (names);
+
+  return found;
+}
+
+/* Uses the virtual backend unless a VSP is found or a backend is given */
+static void
+select_backend (void)
+{
+  const gchar *node;
+  gchar *path, *name;
+  gboolean found = FALSE;
+  GDir *dir;
+
+  if (g_getenv ("GST_VSP_FILTER_BACKEND"))
+    return;
+
+  dir = g_dir_open ("/sys/class/video4linux", 0, NULL);
+  while (dir && !found && (node = g_dir_read_name (dir)) != NULL) {
+    path = g_strdup_printf ("/sys/class/video4linux/%s/name", node);
+    if (g_file_get_contents (path, &name, NULL, NULL)) {
+      found = strstr (name, " rpf.") != NULL;
+      g_free (name);
+    }
+    g_free (path);
+  }
+  if (dir)
+    g_dir_close (dir);
+
+  if (!found)
+    g_setenv ("GST_VSP_FILTER_BACKEND", "virtual", TRUE);
+}
+
+/* Returns the formats of the sink pad template of vspfilter */
+static GArray *
+get_formats (GstElementFactory * factory)
+{
+  const GList *l;
+  GstStaticPadTemplate *templ;
+  const GValue *list, *value;
+  GstVideoFormat format;
+  GstStructure *s;
+  GstCaps *caps;
+  GArray *formats;
+  guint i, j, k;
+
+  formats = g_array_new (FALSE, FALSE, sizeof (GstVideoFormat));
+
+  for (l = gst_element_factory_get_static_pad_templates (factory); l;
+      l = l->next) {
+    templ = l->data;
+    if (templ->direction != GST_PAD_SINK)
+      continue;
+
+    caps = gst_static_caps_get (&templ->static_caps);
+    for (i = 0; i < gst_caps_get_size (caps); i++) {
+      s = gst_caps_get_structure (caps, i);
+      list = gst_structure_get_value (s, "format");
+      if (!list || !GST_VALUE_HOLDS_LIST (list))
+        continue;
+      for (j = 0; j < gst_value_list_get_size (list); j++) {
+        value = gst_value_list_get_value (list, j);
+        format = gst_video_format_from_string (g_value_get_string (value));
+        for (k = 0; k < formats->len; k++) {
+          if (g_array_index (formats, GstVideoFormat, k) == format)
+            break;
+        }
+        if (k == formats->len)
+          g_array_append_val (formats, format);
+      }
+    }
+    gst_caps_unref (caps);
+  }
+
+  return formats;
+}
+
+static gint
+alloc_memfd (gsize size)
+{
+  gchar *name;
+  gint fd = -1;
+
+#ifdef SYS_memfd_create
+  fd = syscall (SYS_memfd_create, "vspfilter-bench", MFD_CLOEXEC);
+#endif
+  if (fd < 0) {
+    fd = g_file_open_tmp ("vspfilter-bench-XXXXXX", &name, NULL);
+    if (fd < 0)
+      return -1;
+    unlink (name);
+    g_free (name);
+  }
+
+  if (ftruncate (fd, size) < 0) {
+    close (fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/* Finds the DMA heap the dmabufs are allocated from. A memfd is only a
+ * dmabuf to the virtual backend, which maps whatever it is given. */
+static const gchar *
+find_dmabuf_source (void)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (dma_heaps); i++) {
+    if (access (dma_heaps[i], R_OK | W_OK) == 0)
+      return dma_heaps[i];
+  }
+
+  if (g_strcmp0 (g_getenv ("GST_VSP_FILTER_BACKEND"), "virtual") == 0)
+    return "memfd";
+
+  return NULL;
+}
+
+static gint
+alloc_dmabuf (gsize size)
+{
+  BenchHeapAllocation data;
+  gint heap, ret;
+
+  if (strcmp (dmabuf_source, "memfd") == 0)
+    return alloc_memfd (size);
+
+  heap = open (dmabuf_source, O_RDWR | O_CLOEXEC);
+  if (heap < 0)
+    return -1;
+
+  memset (&data, 0, sizeof (data));
+  data.len = size;
+  data.fd_flags = O_RDWR | O_CLOEXEC;
+  ret = ioctl (heap, BENCH_DMA_HEAP_IOCTL_ALLOC, &data);
+  close (heap);
+
+  return ret < 0 ? -1 : (gint) data.fd;
+}
+
+/* Allocates an input buffer in system memory or with a dmabuf per plane */
+static GstBuffer *
+alloc_input_buffer (GstVideoInfo * info, BenchIO io, GstAllocator * dmabuf)
+{
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gsize size, total = 0;
+  GstBuffer *buffer;
+  guint i, comp;
+  gint fd;
+
+  if (io != IO_DMABUF) {
+    buffer = gst_buffer_new_allocate (NULL, GST_VIDEO_INFO_SIZE (info), NULL);
+    if (!buffer)
+      return NULL;
+    gst_buffer_add_video_meta_full (buffer, GST_VIDEO_FRAME_FLAG_NONE,
+        GST_VIDEO_INFO_FORMAT (info), GST_VIDEO_INFO_WIDTH (info),
+        GST_VIDEO_INFO_HEIGHT (info), GST_VIDEO_INFO_N_PLANES (info),
+        info->offset, info->stride);
+    gst_buffer_memset (buffer, 0, 0x80, GST_VIDEO_INFO_SIZE (info));
+    return buffer;
+  }
+
+  buffer = gst_buffer_new ();
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (info); i++) {
+    for (comp = 0; GST_VIDEO_INFO_COMP_PLANE (info, comp) != i; comp++);
+    size = GST_VIDEO_INFO_PLANE_STRIDE (info, i) *
+        GST_VIDEO_INFO_COMP_HEIGHT (info, comp);
+
+    fd = alloc_dmabuf (size);
+    if (fd < 0) {
+      gst_buffer_unref (buffer);
+      return NULL;
+    }
+    gst_buffer_append_memory (buffer,
+        gst_dmabuf_allocator_alloc (dmabuf, fd, size));
+
+    offset[i] = total;
+    total += size;
+  }
+
+  gst_buffer_add_video_meta_full (buffer, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (info), GST_VIDEO_INFO_WIDTH (info),
+      GST_VIDEO_INFO_HEIGHT (info), GST_VIDEO_INFO_N_PLANES (info), offset,
+      info->stride);
+  gst_buffer_memset (buffer, 0, 0x80, total);
+
+  return buffer;
+}
+
+static guint
+frame_number (GstBuffer * buffer)
+{
+  return gst_util_uint64_scale_round (GST_BUFFER_PTS (buffer), BENCH_FPS,
+      GST_SECOND);
+}
+
+static GstPadProbeReturn
+input_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  BenchRun *run = user_data;
+  guint n = frame_number (GST_PAD_PROBE_INFO_BUFFER (info));
+
+  if (n < run->n_frames)
+    run->in_time[n] = g_get_monotonic_time ();
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+output_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  BenchRun *run = user_data;
+  guint n = frame_number (GST_PAD_PROBE_INFO_BUFFER (info));
+  gint64 now = g_get_monotonic_time ();
+
+  g_mutex_lock (&run->lock);
+  if (n < run->n_frames && run->in_time[n])
+    run->latency[run->n_out++] = now - run->in_time[n];
+  run->last_out = now;
+  g_mutex_unlock (&run->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gint
+compare_gint64 (gconstpointer a, gconstpointer b)
+{
+  gint64 va = *(const gint64 *) a, vb = *(const gint64 *) b;
+
+  return (va > vb) - (va < vb);
+}
+
+static gint64
+percentile (gint64 * sorted, guint n, guint p)
+{
+  if (n == 0)
+    return 0;
+
+  return sorted[MIN (n - 1, (n * p) / 100)];
+}
+
+static gboolean
+append_stat (GQuark field, const GValue * value, gpointer user_data)
+{
+  GString *json = user_data;
+
+  if (G_VALUE_HOLDS_UINT64 (value))
+    g_string_append_printf (json, ", \"%s\": %" G_GUINT64_FORMAT,
+        g_quark_to_string (field), g_value_get_uint64 (value));
+  else if (G_VALUE_HOLDS_UINT (value))
+    g_string_append_printf (json, ", \"%s\": %u", g_quark_to_string (field),
+        g_value_get_uint (value));
+
+  return TRUE;
+}
+
+/* Appends the frame rate, the latency and the CPU time of a run */
+static void
+append_timing (BenchRun * run, struct rusage *ru_start,
+    struct rusage *ru_end, GString * json)
+{
+  gdouble seconds, cpu_ms;
+
+  /* from the first input frame, excluding the negotiation */
+  seconds = (run->last_out - (run->in_time[0] ? run->in_time[0] :
+          run->start)) / (gdouble) G_USEC_PER_SEC;
+  cpu_ms = (ru_end->ru_utime.tv_sec - ru_start->ru_utime.tv_sec +
+      ru_end->ru_stime.tv_sec - ru_start->ru_stime.tv_sec) * 1000.0 +
+      (ru_end->ru_utime.tv_usec - ru_start->ru_utime.tv_usec +
+      ru_end->ru_stime.tv_usec - ru_start->ru_stime.tv_usec) / 1000.0;
+  qsort (run->latency, run->n_out, sizeof (gint64), compare_gint64);
+
+  g_string_append_printf (json, ", \"status\": \"ok\", \"frames\": %u, "
+      "\"fps\": %.2f, \"latency_us\": {\"p50\": %" G_GINT64_FORMAT
+      ", \"p95\": %" G_GINT64_FORMAT ", \"p99\": %" G_GINT64_FORMAT
+      ", \"max\": %" G_GINT64_FORMAT "}, \"cpu_ms\": %.1f, "
+      "\"cpu_us_per_frame\": %.1f", run->n_out,
+      seconds > 0 ? run->n_out / seconds : 0.0,
+      percentile (run->latency, run->n_out, 50),
+      percentile (run->latency, run->n_out, 95),
+      percentile (run->latency, run->n_out, 99),
+      run->n_out ? run->latency[run->n_out - 1] : 0, cpu_ms,
+      run->n_out ? cpu_ms * 1000.0 / run->n_out : 0.0);
+}
+
+static GstElement *
+make_pipeline (BenchCase * bc, GstVideoInfo * in_info, GstElement ** src,
+    GstElement ** vsp)
+{
+  GstElement *pipeline, *in_filter, *out_filter, *sink;
+  GstCaps *in_caps, *out_caps;
+
+  pipeline = gst_pipeline_new (NULL);
+  *src = gst_element_factory_make (bc->io == IO_MMAP ? "videotestsrc" :
+      "appsrc", NULL);
+  in_filter = gst_element_factory_make ("capsfilter", NULL);
+  *vsp = gst_element_factory_make ("vspfilter", NULL);
+  out_filter = gst_element_factory_make ("capsfilter", NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+  if (!*src || !in_filter || !*vsp || !out_filter || !sink) {
+    g_printerr ("Missing elements\n");
+    exit (1);
+  }
+
+  in_caps = gst_video_info_to_caps (in_info);
+  out_caps = gst_caps_new_simple ("video/x-raw",
+      "format", G_TYPE_STRING, gst_video_format_to_string (bc->out_format),
+      "width", G_TYPE_INT, bc->scale->out_width,
+      "height", G_TYPE_INT, bc->scale->out_height, NULL);
+  g_object_set (in_filter, "caps", in_caps, NULL);
+  g_object_set (out_filter, "caps", out_caps, NULL);
+
+  if (bc->io == IO_MMAP) {
+    g_object_set (*src, "num-buffers", n_frames, NULL);
+    gst_util_set_object_arg (G_OBJECT (*src), "pattern", "black");
+  } else {
+    g_object_set (*src, "caps", in_caps, "format", GST_FORMAT_TIME,
+        "block", TRUE, "max-bytes", (guint64) 2 * GST_VIDEO_INFO_SIZE (in_info),
+        NULL);
+  }
+  gst_caps_unref (in_caps);
+  gst_caps_unref (out_caps);
+
+  if (bc->io == IO_USERPTR) {
+    gst_util_set_object_arg (G_OBJECT (*vsp), "input-io-mode",
+        "GST_VSPFILTER_IO_USERPTR");
+    gst_util_set_object_arg (G_OBJECT (*vsp), "output-io-mode",
+        "GST_VSPFILTER_IO_USERPTR");
+  }
+
+  g_object_set (sink, "sync", FALSE, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), *src, in_filter, *vsp, out_filter,
+      sink, NULL);
+  gst_element_link_many (*src, in_filter, *vsp, out_filter, sink, NULL);
+
+  return pipeline;
+}
+
+/* Fills a buffer with noise, the hardest input for the tile and stripe
+ * seams */
+static void
+fill_noise (GstBuffer * buffer)
+{
+  GstMapInfo map;
+  guint32 seed = 1;
+  gsize i;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_WRITE))
+    return;
+  for (i = 0; i < map.size; i++) {
+    seed = seed * 1103515245 + 12345;
+    map.data[i] = seed >> 16;
+  }
+  gst_buffer_unmap (buffer, &map);
+}
+
+static GstPadProbeReturn
+keep_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstBuffer **kept = user_data;
+
+  gst_buffer_replace (kept, GST_PAD_PROBE_INFO_BUFFER (info));
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Converts one frame with an integer property of vspfilter set, if any */
+static GstBuffer *
+convert_frame (BenchCase * bc, GstVideoInfo * in_info, GstBuffer * input,
+    const gchar * prop, gint value)
+{
+  GstElement *pipeline, *src, *vsp, *filter, *sink;
+  GstBuffer *output = NULL;
+  GstMessage *msg = NULL;
+  GstFlowReturn ret;
+  GstCaps *caps;
+  GstPad *pad;
+
+  pipeline = gst_pipeline_new (NULL);
+  src = gst_element_factory_make ("appsrc", NULL);
+  vsp = gst_element_factory_make ("vspfilter", NULL);
+  filter = gst_element_factory_make ("capsfilter", NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+  if (!src || !vsp || !filter || !sink) {
+    g_printerr ("Missing elements\n");
+    exit (1);
+  }
+
+  caps = gst_video_info_to_caps (in_info);
+  g_object_set (src, "caps", caps, "format", GST_FORMAT_TIME, NULL);
+  gst_caps_unref (caps);
+  caps = gst_caps_new_simple ("video/x-raw",
+      "format", G_TYPE_STRING, gst_video_format_to_string (bc->out_format),
+      "width", G_TYPE_INT, bc->scale->out_width,
+      "height", G_TYPE_INT, bc->scale->out_height, NULL);
+  g_object_set (filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  if (prop)
+    g_object_set (vsp, prop, value, NULL);
+
+  pad = gst_element_get_static_pad (vsp, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, keep_probe, &output,
+      NULL);
+  gst_object_unref (pad);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, vsp, filter, sink, NULL);
+  gst_element_link_many (src, vsp, filter, sink, NULL);
+
+  if (gst_element_set_state (pipeline, GST_STATE_PLAYING) !=
+      GST_STATE_CHANGE_FAILURE) {
+    input = gst_buffer_copy (input);
+    GST_BUFFER_PTS (input) = 0;
+    g_signal_emit_by_name (src, "push-buffer", input, &ret);
+    gst_buffer_unref (input);
+    g_signal_emit_by_name (src, "end-of-stream", &ret);
+
+    msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline),
+        RUN_TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  if (!msg || GST_MESSAGE_TYPE (msg) != GST_MESSAGE_EOS)
+    gst_buffer_replace (&output, NULL);
+  if (msg)
+    gst_message_unref (msg);
+
+  return output;
+}
+
+/* Converts a frame split as the property of vspfilter says and as a
+ * whole, and appends the largest difference and the PSNR of the split
+ * frame to the report as the object of the given name, e.g. "tiles" with
+ * the "size" of tile-size */
+static void
+check_split (BenchCase * bc, GstVideoInfo * in_info, const gchar * prop,
+    gint value, const gchar * name, const gchar * field, GString * json)
+{
+  GstBuffer *split = NULL, *whole = NULL;
+  GstVideoFrame split_frame, whole_frame;
+  GstVideoInfo out_info;
+  GstBuffer *input;
+  guint8 *a, *b;
+  guint i, comp, x, y, bytes, rows, max_diff = 0;
+  gdouble sse = 0.0, n = 0.0, d;
+
+  input = alloc_input_buffer (in_info, IO_USERPTR, NULL);
+  if (!input)
+    goto failed;
+  fill_noise (input);
+
+  split = convert_frame (bc, in_info, input, prop, value);
+  whole = convert_frame (bc, in_info, input, NULL, 0);
+  gst_buffer_unref (input);
+  if (!split || !whole)
+    goto failed;
+
+  gst_video_info_set_format (&out_info, bc->out_format,
+      bc->scale->out_width, bc->scale->out_height);
+  if (!gst_video_frame_map (&split_frame, &out_info, split, GST_MAP_READ))
+    goto failed;
+  if (!gst_video_frame_map (&whole_frame, &out_info, whole, GST_MAP_READ)) {
+    gst_video_frame_unmap (&split_frame);
+    goto failed;
+  }
+
+  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (&whole_frame); i++) {
+    for (comp = 0; GST_VIDEO_FRAME_COMP_PLANE (&whole_frame, comp) != i;
+        comp++);
+    bytes = GST_VIDEO_FRAME_COMP_WIDTH (&whole_frame, comp) *
+        GST_VIDEO_FRAME_COMP_PSTRIDE (&whole_frame, comp);
+    rows = GST_VIDEO_FRAME_COMP_HEIGHT (&whole_frame, comp);
+    for (y = 0; y < rows; y++) {
+      a = (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&split_frame, i) +
+          y * GST_VIDEO_FRAME_PLANE_STRIDE (&split_frame, i);
+      b = (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&whole_frame, i) +
+          y * GST_VIDEO_FRAME_PLANE_STRIDE (&whole_frame, i);
+      for (x = 0; x < bytes; x++) {
+        d = ABS ((gint) a[x] - (gint) b[x]);
+        max_diff = MAX (max_diff, (guint) d);
+        sse += d * d;
+      }
+      n += bytes;
+    }
+  }
+
+  gst_video_frame_unmap (&whole_frame);
+  gst_video_frame_unmap (&split_frame);
+
+  g_string_append_printf (json, ", \"%s\": {\"%s\": %d, "
+      "\"max_diff\": %u, \"psnr\": %.2f}", name, field, value, max_diff,
+      sse > 0.0 ? 10.0 * log10 (255.0 * 255.0 * n / sse) : 99.0);
+  goto done;
+
+failed:
+  g_string_append_printf (json, ", \"%s\": {\"%s\": %d, "
+      "\"status\": \"error\"}", name, field, value);
+done:
+  if (split)
+    gst_buffer_unref (split);
+  if (whole)
+    gst_buffer_unref (whole);
+}
+
+/* Runs a case and appends its JSON object to the report */
+static void
+run_case (BenchCase * bc, GstAllocator * dmabuf, GString * json)
+{
+  GstElement *pipeline, *src, *vsp;
+  GstBuffer *ring[RING_SIZE] = { NULL };
+  GstStructure *stats = NULL;
+  GstVideoInfo in_info;
+  GstMessage *msg = NULL;
+  GstBuffer *buffer;
+  GstFlowReturn ret;
+  GstPad *pad;
+  struct rusage ru_start, ru_end;
+  BenchRun run;
+  gchar *error = NULL;
+  guint i;
+
+  gst_video_info_set_format (&in_info, bc->in_format, bc->scale->in_width,
+      bc->scale->in_height);
+  GST_VIDEO_INFO_FPS_N (&in_info) = BENCH_FPS;
+  GST_VIDEO_INFO_FPS_D (&in_info) = 1;
+
+  memset (&run, 0, sizeof (run));
+  g_mutex_init (&run.lock);
+  run.n_frames = n_frames;
+  run.in_time = g_new0 (gint64, n_frames);
+  run.latency = g_new0 (gint64, n_frames);
+
+  pipeline = make_pipeline (bc, &in_info, &src, &vsp);
+
+  pad = gst_element_get_static_pad (vsp, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, input_probe, &run, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (vsp, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, output_probe, &run, NULL);
+  gst_object_unref (pad);
+
+  if (bc->io != IO_MMAP) {
+    for (i = 0; i < RING_SIZE; i++) {
+      ring[i] = alloc_input_buffer (&in_info, bc->io, dmabuf);
+      if (!ring[i]) {
+        error = g_strdup ("cannot allocate input buffers");
+        goto done;
+      }
+    }
+  }
+
+  getrusage (RUSAGE_SELF, &ru_start);
+  run.start = g_get_monotonic_time ();
+
+  if (gst_element_set_state (pipeline, GST_STATE_PLAYING) ==
+      GST_STATE_CHANGE_FAILURE) {
+    error = g_strdup ("cannot start the pipeline");
+    goto done;
+  }
+
+  if (bc->io != IO_MMAP) {
+    for (i = 0; i < (guint) n_frames; i++) {
+      buffer = gst_buffer_copy (ring[i % RING_SIZE]);
+      GST_BUFFER_PTS (buffer) =
+          gst_util_uint64_scale (i, GST_SECOND, BENCH_FPS);
+      GST_BUFFER_DURATION (buffer) =
+          gst_util_uint64_scale (1, GST_SECOND, BENCH_FPS);
+      g_signal_emit_by_name (src, "push-buffer", buffer, &ret);
+      gst_buffer_unref (buffer);
+      if (ret != GST_FLOW_OK)
+        break;
+    }
+    g_signal_emit_by_name (src, "end-of-stream", &ret);
+  }
+
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline), RUN_TIMEOUT,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  getrusage (RUSAGE_SELF, &ru_end);
+
+  if (!msg) {
+    error = g_strdup ("timeout");
+  } else if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    GError *err;
+
+    gst_message_parse_error (msg, &err, NULL);
+    error = g_strdup (err->message);
+    g_error_free (err);
+  }
+
+  g_object_get (vsp, "stats", &stats, NULL);
+
+done:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_string_append_printf (json, "%s\n    {\"input\": \"%s\", \"output\": "
+      "\"%s\", \"scale\": \"%s\", \"in_size\": \"%dx%d\", \"out_size\": "
+      "\"%dx%d\", \"io\": \"%s\"", json->len > 2 ? "," : "",
+      gst_video_format_to_string (bc->in_format),
+      gst_video_format_to_string (bc->out_format), bc->scale->name,
+      bc->scale->in_width, bc->scale->in_height, bc->scale->out_width,
+      bc->scale->out_height, io_names[bc->io]);
+  if (bc->io == IO_DMABUF)
+    g_string_append_printf (json, ", \"dmabuf\": \"%s\"", dmabuf_source);
+
+  if (error) {
+    gchar *escaped = g_strescape (error, NULL);
+
+    g_string_append_printf (json, ", \"status\": \"error\", \"error\": "
+        "\"%s\"}", escaped);
+    g_free (escaped);
+  } else {
+    append_timing (&run, &ru_start, &ru_end, json);
+
+    if (tile_size > 0)
+      check_split (bc, &in_info, "tile-size", tile_size, "tiles", "size",
+          json);
+    if (stripes > 1)
+      check_split (bc, &in_info, "stripes", stripes, "stripes", "count",
+          json);
+
+    if (stats) {
+      g_string_append (json, ", \"stats\": {\"name\": \"");
+      g_string_append (json, gst_structure_get_name (stats));
+      g_string_append_c (json, '"');
+      gst_structure_foreach (stats, append_stat, json);
+      g_string_append_c (json, '}');
+    }
+    g_string_append_c (json, '}');
+  }
+
+  if (stats)
+    gst_structure_free (stats);
+  if (msg)
+    gst_message_unref (msg);
+  for (i = 0; i < RING_SIZE; i++) {
+    if (ring[i])
+      gst_buffer_unref (ring[i]);
+  }
+  gst_object_unref (pipeline);
+  g_free (run.in_time);
+  g_free (run.latency);
+  g_mutex_clear (&run.lock);
+  g_free (error);
+}
+
+/* The copy of the input vspfilter did before the copier, the baseline */
+static void
+copy_scalar (const VspfilterCopyRegion * regions, guint n_regions)
+{
+  const guint8 *sp;
+  guint8 *dp;
+  guint i, j;
+
+  for (i = 0; i < n_regions; i++) {
+    sp = regions[i].src;
+    dp = regions[i].dest;
+    for (j = 0; j < regions[i].height; j++) {
+      memcpy (dp, sp, regions[i].width);
+      dp += regions[i].dest_stride;
+      sp += regions[i].src_stride;
+    }
+  }
+}
+
+/* Copies a frame n_frames times with the copier of the given threads, or
+ * with the scalar copy if NULL, and appends the MB/s to the report */
+static void
+run_copy (const CopyCase * cc, const gchar * method,
+    VspfilterCopier * copier, GString * json)
+{
+  VspfilterCopyRegion regions[GST_VIDEO_MAX_PLANES];
+  GstVideoInfo info;
+  guint8 *src, *dest;
+  gsize src_size = 0, dest_size = 0, bytes = 0;
+  gint64 start, elapsed;
+  guint i, comp, n_planes;
+  gint n;
+
+  gst_video_info_set_format (&info, cc->format, cc->width, cc->height);
+  n_planes = GST_VIDEO_INFO_N_PLANES (&info);
+
+  for (i = 0; i < n_planes; i++) {
+    for (comp = 0; GST_VIDEO_INFO_COMP_PLANE (&info, comp) != i; comp++);
+    regions[i].width = GST_VIDEO_INFO_COMP_WIDTH (&info, comp) *
+        GST_VIDEO_INFO_COMP_PSTRIDE (&info, comp);
+    regions[i].height = GST_VIDEO_INFO_COMP_HEIGHT (&info, comp);
+    regions[i].dest_stride = GST_VIDEO_INFO_PLANE_STRIDE (&info, i);
+    regions[i].src_stride = regions[i].dest_stride + cc->src_padding;
+    src_size += (gsize) regions[i].src_stride * regions[i].height;
+    dest_size += (gsize) regions[i].dest_stride * regions[i].height;
+    bytes += regions[i].width * regions[i].height;
+  }
+
+  src = g_malloc (src_size);
+  dest = g_malloc (dest_size);
+  memset (src, 0x80, src_size);
+  memset (dest, 0, dest_size);
+
+  src_size = dest_size = 0;
+  for (i = 0; i < n_planes; i++) {
+    regions[i].src = src + src_size;
+    regions[i].dest = dest + dest_size;
+    src_size += (gsize) regions[i].src_stride * regions[i].height;
+    dest_size += (gsize) regions[i].dest_stride * regions[i].height;
+  }
+
+  /* the first copy faults the pages in */
+  if (copier)
+    vspfilter_copier_copy (copier, regions, n_planes);
+  else
+    copy_scalar (regions, n_planes);
+
+  start = g_get_monotonic_time ();
+  for (n = 0; n < n_frames; n++) {
+    if (copier)
+      vspfilter_copier_copy (copier, regions, n_planes);
+    else
+      copy_scalar (regions, n_planes);
+  }
+  elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+  g_string_append_printf (json, "%s\n    {\"copy\": \"%s\", \"format\": "
+      "\"%s\", \"size\": \"%dx%d\", \"src_padding\": %d, \"method\": "
+      "\"%s\", \"threads\": %u, \"frames\": %d, \"us_per_frame\": %.1f, "
+      "\"mbps\": %.1f}", json->len > 2 ? "," : "", cc->name,
+      gst_video_format_to_string (cc->format), cc->width, cc->height,
+      cc->src_padding, method, copier ?
+      vspfilter_copier_get_n_threads (copier) : 1, n_frames,
+      elapsed / (gdouble) n_frames, bytes * (gdouble) n_frames / elapsed);
+
+  g_free (src);
+  g_free (dest);
+}
+
+/* Runs every copy case with the scalar copy, the copier on one thread and
+ * the copier with the default threads of vspfilter */
+static guint
+run_copy_cases (GString * json)
+{
+  VspfilterCopier *single, *multi;
+  guint i, n_cases = 0;
+
+  single = vspfilter_copier_new (1);
+  multi = vspfilter_copier_new (0);
+
+  for (i = 0; i < G_N_ELEMENTS (copy_cases); i++) {
+    if (!selected (scale_filter, copy_cases[i].name))
+      continue;
+    g_printerr ("copy %s\n", copy_cases[i].name);
+    run_copy (&copy_cases[i], "scalar", NULL, json);
+    run_copy (&copy_cases[i], "copier", single, json);
+    run_copy (&copy_cases[i], "copier", multi, json);
+    n_cases += 3;
+  }
+
+  vspfilter_copier_free (single);
+  vspfilter_copier_free (multi);
+
+  return n_cases;
+}
+
+/* Composes the inputs of a case in a format and appends its JSON object
+ * to the report */
+static void
+run_compositor (const CompositorCase * cc, GstVideoFormat format,
+    GString * json)
+{
+  GstElement *pipeline, *src, *filter, *comp, *sink;
+  GstMessage *msg = NULL;
+  GstCaps *caps;
+  GstPad *pad, *peer;
+  struct rusage ru_start, ru_end;
+  BenchRun run;
+  gchar *error = NULL;
+  guint i;
+
+  memset (&run, 0, sizeof (run));
+  g_mutex_init (&run.lock);
+  run.n_frames = n_frames;
+  run.in_time = g_new0 (gint64, n_frames);
+  run.latency = g_new0 (gint64, n_frames);
+
+  pipeline = gst_pipeline_new (NULL);
+  comp = gst_element_factory_make ("vspcompositor", NULL);
+  filter = gst_element_factory_make ("capsfilter", NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+  if (!comp || !filter || !sink) {
+    g_printerr ("Missing elements\n");
+    exit (1);
+  }
+  g_object_set (comp, "background", 0x204060, NULL);
+  caps = gst_caps_new_simple ("video/x-raw",
+      "format", G_TYPE_STRING, gst_video_format_to_string (format),
+      "width", G_TYPE_INT, cc->width, "height", G_TYPE_INT, cc->height, NULL);
+  g_object_set (filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (sink, "sync", FALSE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), comp, filter, sink, NULL);
+  gst_element_link_many (comp, filter, sink, NULL);
+
+  for (i = 0; i < cc->n_inputs; i++) {
+    src = gst_element_factory_make ("videotestsrc", NULL);
+    filter = gst_element_factory_make ("capsfilter", NULL);
+    if (!src || !filter) {
+      g_printerr ("Missing elements\n");
+      exit (1);
+    }
+    g_object_set (src, "num-buffers", n_frames, NULL);
+    gst_util_set_object_arg (G_OBJECT (src), "pattern",
+        i == 0 ? "black" : "smpte");
+    caps = gst_caps_new_simple ("video/x-raw",
+        "format", G_TYPE_STRING, gst_video_format_to_string (format),
+        "width", G_TYPE_INT, cc->inputs[i].width,
+        "height", G_TYPE_INT, cc->inputs[i].height,
+        "framerate", GST_TYPE_FRACTION, BENCH_FPS, 1, NULL);
+    g_object_set (filter, "caps", caps, NULL);
+    gst_caps_unref (caps);
+    gst_bin_add_many (GST_BIN (pipeline), src, filter, NULL);
+    gst_element_link (src, filter);
+
+    pad = gst_element_get_request_pad (comp, "sink_%u");
+    g_object_set (pad, "xpos", cc->inputs[i].xpos, "ypos",
+        cc->inputs[i].ypos, NULL);
+    peer = gst_element_get_static_pad (filter, "src");
+    gst_pad_link (peer, pad);
+    gst_object_unref (peer);
+    /* every input is timed alike, the first one stands for them */
+    if (i == 0)
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, input_probe, &run,
+          NULL);
+    gst_object_unref (pad);
+  }
+
+  pad = gst_element_get_static_pad (comp, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, output_probe, &run, NULL);
+  gst_object_unref (pad);
+
+  getrusage (RUSAGE_SELF, &ru_start);
+  run.start = g_get_monotonic_time ();
+
+  if (gst_element_set_state (pipeline, GST_STATE_PLAYING) ==
+      GST_STATE_CHANGE_FAILURE) {
+    error = g_strdup ("cannot start the pipeline");
+    goto done;
+  }
+
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline), RUN_TIMEOUT,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  getrusage (RUSAGE_SELF, &ru_end);
+
+  if (!msg) {
+    error = g_strdup ("timeout");
+  } else if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    GError *err;
+
+    gst_message_parse_error (msg, &err, NULL);
+    error = g_strdup (err->message);
+    g_error_free (err);
+  }
+
+done:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_string_append_printf (json, "%s\n    {\"compositor\": \"%s\", "
+      "\"format\": \"%s\", \"out_size\": \"%dx%d\", \"inputs\": %u",
+      json->len > 2 ? "," : "", cc->name, gst_video_format_to_string (format),
+      cc->width, cc->height, cc->n_inputs);
+
+  if (error) {
+    gchar *escaped = g_strescape (error, NULL);
+
+    g_string_append_printf (json, ", \"status\": \"error\", \"error\": "
+        "\"%s\"}", escaped);
+    g_free (escaped);
+  } else {
+    append_timing (&run, &ru_start, &ru_end, json);
+    g_string_append_c (json, '}');
+  }
+
+  if (msg)
+    gst_message_unref (msg);
+  gst_object_unref (pipeline);
+  g_free (run.in_time);
+  g_free (run.latency);
+  g_mutex_clear (&run.lock);
+  g_free (error);
+}
+
+/* Runs every compositor case in each format vspcompositor accepts */
+static guint
+run_compositor_cases (GString * json)
+{
+  GstElementFactory *factory;
+  GstVideoFormat format;
+  GArray *formats;
+  const gchar *name;
+  guint i, f, n_cases = 0;
+
+  factory = gst_element_factory_find ("vspcompositor");
+  if (!factory) {
+    g_printerr ("vspcompositor not found, check GST_PLUGIN_PATH\n");
+    exit (1);
+  }
+  formats = get_formats (factory);
+  gst_object_unref (factory);
+
+  for (i = 0; i < G_N_ELEMENTS (compositor_cases); i++) {
+    if (!selected (scale_filter, compositor_cases[i].name))
+      continue;
+    for (f = 0; f < formats->len; f++) {
+      format = g_array_index (formats, GstVideoFormat, f);
+      name = gst_video_format_to_string (format);
+      if (!selected (format_filter, name))
+        continue;
+      g_printerr ("compositor %s %s\n", compositor_cases[i].name, name);
+      run_compositor (&compositor_cases[i], format, json);
+      n_cases++;
+    }
+  }
+
+  g_array_free (formats, TRUE);
+
+  return n_cases;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElementFactory *factory;
+  GstAllocator *dmabuf = NULL;
+  GArray *formats = NULL;
+  GString *json;
+  BenchCase bc;
+  guint i, o, s, io, n_cases = 0;
+  const gchar *in_name, *out_name;
+
+  ctx = g_option_context_new ("- vspfilter throughput benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (n_frames <= 0) {
+    g_printerr ("The number of frames must be positive\n");
+    return 1;
+  }
+
+  /* before the plugin selects its device backend */
+  select_backend ();
+  gst_init (&argc, &argv);
+  GST_DEBUG_CATEGORY_INIT (vspfilter_debug, "vspfilter", 0,
+      "vspfilter copy benchmark");
+
+  if (copy_bench) {
+    json = g_string_new ("[");
+    n_cases = run_copy_cases (json);
+    goto write;
+  }
+
+  g_printerr ("device backend: %s\n", g_getenv ("GST_VSP_FILTER_BACKEND") ?
+      g_getenv ("GST_VSP_FILTER_BACKEND") : "linux");
+
+  if (compositor_bench) {
+    json = g_string_new ("[");
+    n_cases = run_compositor_cases (json);
+    goto write;
+  }
+
+  factory = gst_element_factory_find ("vspfilter");
+  if (!factory) {
+    g_printerr ("vspfilter not found, check GST_PLUGIN_PATH\n");
+    return 1;
+  }
+  formats = get_formats (factory);
+  gst_object_unref (factory);
+
+  dmabuf = gst_dmabuf_allocator_new ();
+  dmabuf_source = find_dmabuf_source ();
+  if (!dmabuf_source && selected (io_filter, io_names[IO_DMABUF]))
+    g_printerr ("no DMA heap to allocate dmabufs from, dmabuf skipped\n");
+  json = g_string_new ("[");
+
+  for (io = 0; io < N_IO; io++) {
+    if (!selected (io_filter, io_names[io]) ||
+        (io == IO_DMABUF && !dmabuf_source))
+      continue;
+    for (s = 0; s < G_N_ELEMENTS (scales); s++) {
+      if (!selected (scale_filter, scales[s].name))
+        continue;
+      for (i = 0; i < formats->len; i++) {
+        bc.in_format = g_array_index (formats, GstVideoFormat, i);
+        in_name = gst_video_format_to_string (bc.in_format);
+        if (!selected (format_filter, in_name))
+          continue;
+        for (o = 0; o < formats->len; o++) {
+          bc.out_format = g_array_index (formats, GstVideoFormat, o);
+          out_name = gst_video_format_to_string (bc.out_format);
+          if (!selected (format_filter, out_name))
+            continue;
+
+          bc.scale = &scales[s];
+          bc.io = io;
+          g_printerr ("%s %s -> %s %s\n", io_names[io], in_name, out_name,
+              scales[s].name);
+          run_case (&bc, dmabuf, json);
+          n_cases++;
+        }
+      }
+    }
+  }
+
+write:
+  g_string_append (json, "\n]\n");
+
+  if (strcmp (output, "-") == 0) {
+    fputs (json->str, stdout);
+  } else if (!g_file_set_contents (output, json->str, json->len, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+
+  g_printerr ("%u runs\n", n_cases);
+
+  g_string_free (json, TRUE);
+  if (formats)
+    g_array_free (formats, TRUE);
+  if (dmabuf)
+    gst_object_unref (dmabuf);
+
+  return 0;
+}
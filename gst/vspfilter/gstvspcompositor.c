@@ -0,0 +1,1478 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:element-vspcompositor
+ *
+ * Composes the frames of its sink pads into one output with the BRU of a
+ * VSP. Every input is read by an RPF, placed at the position of its pad,
+ * and blended over the ones of a lower zorder. One frame is taken from
+ * every sink pad for each output frame, timed like the one of the lowest
+ * zorder.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch-1.0 vspcompositor name=c sink_1::xpos=960 ! kmssink \
+ *     videotestsrc ! video/x-raw,width=960,height=1080 ! c. \
+ *     videotestsrc pattern=ball ! video/x-raw,width=960,height=1080 ! c.
+ * ]|
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "gstvspcompositor.h"
+#include "vspfilterutils.h"
+#include "vspfilterpool.h"
+#include "vspfilterdevice.h"
+
+#include <gst/video/gstvideometa.h>
+#include <gst/allocators/gstdmabuf.h>
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+GST_DEBUG_CATEGORY_STATIC (vspcompositor_debug);
+#define GST_CAT_DEFAULT vspcompositor_debug
+
+/* the BRU blends in ARGB, which the RPFs and the WPF convert to and from */
+#define PROC_FORMAT GST_VIDEO_FORMAT_ARGB
+
+#define COMPOSITOR_VIDEO_CAPS \
+    "video/x-raw, " \
+        "format = (string) {I420, NV12, NV21, NV16, UYVY, YUY2}," \
+        "width = [ 1, 8190 ], " \
+        "height = [ 1, 8190 ], " \
+        "framerate = " GST_VIDEO_FPS_RANGE ";" \
+    "video/x-raw, " \
+        "format = (string) {RGB16, RGB, BGR, ARGB, xRGB, BGRA, BGRx}," \
+        "width = [ 1, 8190 ], " \
+        "height = [ 1, 8190 ], " \
+        "framerate = " GST_VIDEO_FPS_RANGE
+
+static GstStaticPadTemplate gst_vsp_compositor_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (COMPOSITOR_VIDEO_CAPS)
+    );
+
+static GstStaticPadTemplate gst_vsp_compositor_sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS (COMPOSITOR_VIDEO_CAPS)
+    );
+
+enum
+{
+  PROP_0,
+  PROP_DEVFILE,
+  PROP_BACKGROUND
+};
+
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_XPOS,
+  PROP_PAD_YPOS,
+  PROP_PAD_WIDTH,
+  PROP_PAD_HEIGHT,
+  PROP_PAD_ALPHA,
+  PROP_PAD_ZORDER
+};
+
+G_DEFINE_TYPE (GstVspCompositorPad, gst_vsp_compositor_pad, GST_TYPE_PAD);
+
+#define gst_vsp_compositor_parent_class parent_class
+G_DEFINE_TYPE (GstVspCompositor, gst_vsp_compositor, GST_TYPE_ELEMENT);
+
+static void
+gst_vsp_compositor_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVspCompositorPad *pad = GST_VSP_COMPOSITOR_PAD (object);
+
+  GST_OBJECT_LOCK (pad);
+  switch (prop_id) {
+    case PROP_PAD_XPOS:
+      pad->xpos = g_value_get_int (value);
+      break;
+    case PROP_PAD_YPOS:
+      pad->ypos = g_value_get_int (value);
+      break;
+    case PROP_PAD_WIDTH:
+      pad->width = g_value_get_int (value);
+      break;
+    case PROP_PAD_HEIGHT:
+      pad->height = g_value_get_int (value);
+      break;
+    case PROP_PAD_ALPHA:
+      pad->alpha = g_value_get_double (value);
+      break;
+    case PROP_PAD_ZORDER:
+      pad->zorder = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (pad);
+}
+
+static void
+gst_vsp_compositor_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVspCompositorPad *pad = GST_VSP_COMPOSITOR_PAD (object);
+
+  GST_OBJECT_LOCK (pad);
+  switch (prop_id) {
+    case PROP_PAD_XPOS:
+      g_value_set_int (value, pad->xpos);
+      break;
+    case PROP_PAD_YPOS:
+      g_value_set_int (value, pad->ypos);
+      break;
+    case PROP_PAD_WIDTH:
+      g_value_set_int (value, pad->width);
+      break;
+    case PROP_PAD_HEIGHT:
+      g_value_set_int (value, pad->height);
+      break;
+    case PROP_PAD_ALPHA:
+      g_value_set_double (value, pad->alpha);
+      break;
+    case PROP_PAD_ZORDER:
+      g_value_set_uint (value, pad->zorder);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (pad);
+}
+
+static void
+gst_vsp_compositor_pad_class_init (GstVspCompositorPadClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->set_property = gst_vsp_compositor_pad_set_property;
+  gobject_class->get_property = gst_vsp_compositor_pad_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_PAD_XPOS,
+      g_param_spec_int ("xpos", "X position",
+          "Left of the input in the output", G_MININT, G_MAXINT,
+          DEFAULT_PAD_XPOS,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAD_YPOS,
+      g_param_spec_int ("ypos", "Y position",
+          "Top of the input in the output", G_MININT, G_MAXINT,
+          DEFAULT_PAD_YPOS,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAD_WIDTH,
+      g_param_spec_int ("width", "Width",
+          "Width of the input shown from its left, which the RPF can only "
+          "crop (0 = the width of the frames)", 0, G_MAXINT,
+          DEFAULT_PAD_WIDTH,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAD_HEIGHT,
+      g_param_spec_int ("height", "Height",
+          "Height of the input shown from its top, which the RPF can only "
+          "crop (0 = the height of the frames)", 0, G_MAXINT,
+          DEFAULT_PAD_HEIGHT,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAD_ALPHA,
+      g_param_spec_double ("alpha", "Alpha",
+          "Opacity of an input without an alpha channel", 0.0, 1.0,
+          DEFAULT_PAD_ALPHA,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAD_ZORDER,
+      g_param_spec_uint ("zorder", "Z-Order",
+          "Inputs of a higher zorder are blended over the others", 0,
+          G_MAXUINT, 0,
+          G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE |
+          G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_vsp_compositor_pad_init (GstVspCompositorPad * pad)
+{
+  pad->xpos = DEFAULT_PAD_XPOS;
+  pad->ypos = DEFAULT_PAD_YPOS;
+  pad->width = DEFAULT_PAD_WIDTH;
+  pad->height = DEFAULT_PAD_HEIGHT;
+  pad->alpha = DEFAULT_PAD_ALPHA;
+}
+
+static gboolean
+set_control (GstVspCompositor * comp, gint fd, const gchar * name, guint32 id,
+    gint32 value)
+{
+  struct v4l2_control ctrl;
+
+  CLEAR (ctrl);
+  ctrl.id = id;
+  ctrl.value = value;
+
+  if (-1 == xioctl (fd, VIDIOC_S_CTRL, &ctrl)) {
+    GST_ERROR_OBJECT (comp, "VIDIOC_S_CTRL 0x%x for %s failed", id, name);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+stop_streaming (GstVspCompositor * comp)
+{
+  enum v4l2_buf_type buftype;
+  guint i;
+
+  for (i = 0; i < comp->n_rpfs; i++) {
+    buftype = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if (comp->rpfs[i].is_stream_started &&
+        -1 == xioctl (comp->rpfs[i].fd, VIDIOC_STREAMOFF, &buftype))
+      GST_ERROR_OBJECT (comp, "VIDIOC_STREAMOFF for %s failed",
+          comp->rpfs[i].dev_name);
+    comp->rpfs[i].is_stream_started = FALSE;
+  }
+
+  buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  if (comp->is_stream_started &&
+      -1 == xioctl (comp->wpf_fd, VIDIOC_STREAMOFF, &buftype))
+    GST_ERROR_OBJECT (comp, "VIDIOC_STREAMOFF for %s failed", comp->dev_name);
+  comp->is_stream_started = FALSE;
+  comp->n_queued = 0;
+}
+
+/* Unmaps and releases the frames of a job, and its output buffer unless
+ * it was taken */
+static void
+gst_vsp_compositor_free_job (GstVspCompositorJob * job)
+{
+  guint i;
+
+  for (i = 0; i < job->n_frames; i++) {
+    if (job->frames[i].mapped)
+      gst_video_frame_unmap (&job->frames[i].vframe);
+    gst_buffer_unref (job->frames[i].buffer);
+  }
+  if (job->outbuf)
+    gst_buffer_unref (job->outbuf);
+  memset (job, 0, sizeof (*job));
+}
+
+/* Stops the nodes before the frames in flight are released */
+static void
+gst_vsp_compositor_drop_jobs (GstVspCompositor * comp)
+{
+  guint i;
+
+  if (comp->wpf_fd >= 0)
+    stop_streaming (comp);
+
+  for (i = 0; i < comp->n_jobs; i++)
+    gst_vsp_compositor_free_job (&comp->jobs[i]);
+  comp->n_jobs = 0;
+}
+
+static void
+gst_vsp_compositor_close (GstVspCompositor * comp)
+{
+  GstVspCompositorRpf *rpf;
+  guint i;
+
+  for (i = 0; i < comp->n_rpfs; i++) {
+    rpf = &comp->rpfs[i];
+    if (rpf->subdev_fd >= 0)
+      vspfilter_device_close (rpf->subdev_fd);
+    vspfilter_device_close (rpf->fd);
+    g_free (rpf->entity_name);
+    g_free (rpf->dev_name);
+  }
+  memset (comp->rpfs, 0, sizeof (comp->rpfs));
+  comp->n_rpfs = 0;
+
+  if (comp->bru_subdev_fd >= 0)
+    vspfilter_device_close (comp->bru_subdev_fd);
+  if (comp->wpf_subdev_fd >= 0)
+    vspfilter_device_close (comp->wpf_subdev_fd);
+  if (comp->wpf_fd >= 0)
+    vspfilter_device_close (comp->wpf_fd);
+  comp->bru_subdev_fd = comp->wpf_subdev_fd = comp->wpf_fd = -1;
+
+  if (comp->media)
+    vspfilter_media_unref (comp->media);
+  comp->media = NULL;
+
+  g_free (comp->ip_name);
+  g_free (comp->dev_name);
+  comp->ip_name = comp->dev_name = NULL;
+}
+
+/* Opens the RPFs of the VSP, up to the inputs of its BRU. Those which
+ * vspfilter elements read their frames with may be among them. */
+static void
+gst_vsp_compositor_open_rpfs (GstVspCompositor * comp)
+{
+  GstVspCompositorRpf *rpf;
+  gchar name[16];
+  gchar tmp[256];
+  gchar path[256];
+  gchar *node;
+  guint i;
+  gint fd;
+
+  for (i = 0; i < MAX_RPFS && comp->n_rpfs < comp->n_bru_inputs; i++) {
+    sprintf (name, "rpf.%u", i);
+
+    node = vspfilter_media_find_input_node (comp->ip_name, name);
+    if (!node)
+      continue;
+
+    fd = vspfilter_device_open (node, O_RDWR);
+    if (fd < 0) {
+      GST_DEBUG_OBJECT (comp, "cannot open %s: %s", node, strerror (errno));
+      g_free (node);
+      continue;
+    }
+
+    rpf = &comp->rpfs[comp->n_rpfs];
+    rpf->dev_name = node;
+    rpf->entity_name = g_strdup (name);
+    rpf->fd = fd;
+    rpf->alpha = 255;
+    rpf->subdev_fd = vspfilter_subdev_open (comp->ip_name, name, path,
+        sizeof (path));
+    sprintf (tmp, "%s %s", comp->ip_name, name);
+    if (rpf->subdev_fd < 0 ||
+        !vspfilter_media_find_entity (comp->media, tmp, &rpf->entity)) {
+      GST_DEBUG_OBJECT (comp, "cannot open a subdev file for %s", name);
+      if (rpf->subdev_fd >= 0)
+        vspfilter_device_close (rpf->subdev_fd);
+      vspfilter_device_close (fd);
+      g_free (rpf->dev_name);
+      g_free (rpf->entity_name);
+      memset (rpf, 0, sizeof (*rpf));
+      continue;
+    }
+    comp->n_rpfs++;
+
+    GST_DEBUG_OBJECT (comp, "%s %s on %s reads an input", comp->ip_name,
+        name, node);
+  }
+}
+
+/* Opens the VSP of a WPF output video node if it has a BRU */
+static gboolean
+gst_vsp_compositor_open_vsp (GstVspCompositor * comp, const gchar * dev_name)
+{
+  struct v4l2_capability cap;
+  gchar tmp[256];
+  gchar path[256];
+  gchar *ip_name, *entity_name;
+
+  comp->wpf_fd = vspfilter_device_open (dev_name, O_RDWR);
+  if (comp->wpf_fd < 0) {
+    GST_DEBUG_OBJECT (comp, "Cannot open '%s': %d, %s", dev_name, errno,
+        strerror (errno));
+    return FALSE;
+  }
+  comp->dev_name = g_strdup (dev_name);
+
+  if (-1 == xioctl (comp->wpf_fd, VIDIOC_QUERYCAP, &cap)) {
+    GST_DEBUG_OBJECT (comp, "VIDIOC_QUERYCAP for %s errno=%d", dev_name,
+        errno);
+    goto failed;
+  }
+  if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) ||
+      !(cap.capabilities & V4L2_CAP_STREAMING)) {
+    GST_DEBUG_OBJECT (comp, "%s is not a WPF output", dev_name);
+    goto failed;
+  }
+
+  /* "<ip> wpf.N output" */
+  ip_name = strtok ((gchar *) cap.card, " ");
+  entity_name = strtok (NULL, " ");
+  if (!ip_name || !entity_name) {
+    GST_DEBUG_OBJECT (comp, "entity name not found in %s", cap.card);
+    goto failed;
+  }
+  comp->ip_name = g_strdup (ip_name);
+
+  comp->bru_subdev_fd = vspfilter_subdev_open (comp->ip_name, "bru", path,
+      sizeof (path));
+  if (comp->bru_subdev_fd < 0) {
+    GST_DEBUG_OBJECT (comp, "%s has no BRU", comp->ip_name);
+    goto failed;
+  }
+
+  comp->wpf_subdev_fd = vspfilter_subdev_open (comp->ip_name, entity_name,
+      path, sizeof (path));
+  if (comp->wpf_subdev_fd < 0) {
+    GST_DEBUG_OBJECT (comp, "cannot open a subdev file for %s", entity_name);
+    goto failed;
+  }
+
+  comp->media = vspfilter_media_get (dev_name);
+  if (!comp->media)
+    goto failed;
+
+  sprintf (tmp, "%s bru", comp->ip_name);
+  if (!vspfilter_media_find_entity (comp->media, tmp, &comp->bru_entity))
+    goto failed;
+  sprintf (tmp, "%s %s", comp->ip_name, entity_name);
+  if (!vspfilter_media_find_entity (comp->media, tmp, &comp->wpf_entity))
+    goto failed;
+
+  /* the source pad comes after the sink pads */
+  comp->n_bru_inputs = comp->bru_entity.pads - 1;
+
+  gst_vsp_compositor_open_rpfs (comp);
+  if (comp->n_rpfs == 0) {
+    GST_DEBUG_OBJECT (comp, "%s has no RPF input", comp->ip_name);
+    goto failed;
+  }
+
+  GST_DEBUG_OBJECT (comp, "%s composes %u inputs on %s", comp->ip_name,
+      comp->n_rpfs, dev_name);
+
+  return TRUE;
+
+failed:
+  gst_vsp_compositor_close (comp);
+  return FALSE;
+}
+
+static gboolean
+gst_vsp_compositor_open (GstVspCompositor * comp)
+{
+  VspfilterVideoPair *pair;
+  GList *pairs, *l;
+  gchar *devfile;
+  gboolean ret = FALSE;
+
+  GST_OBJECT_LOCK (comp);
+  devfile = g_strdup (comp->devfile);
+  GST_OBJECT_UNLOCK (comp);
+
+  if (devfile) {
+    ret = gst_vsp_compositor_open_vsp (comp, devfile);
+  } else {
+    pairs = vspfilter_media_find_video_pairs ();
+    for (l = pairs; l && !ret; l = l->next) {
+      pair = l->data;
+      ret = gst_vsp_compositor_open_vsp (comp, pair->output);
+    }
+    g_list_free_full (pairs, (GDestroyNotify) vspfilter_video_pair_free);
+  }
+
+  if (!ret)
+    GST_ELEMENT_ERROR (comp, RESOURCE, NOT_FOUND, (NULL),
+        ("no VSP with a BRU found at %s", devfile ? devfile : "any node"));
+  g_free (devfile);
+
+  return ret;
+}
+
+/* Forgets the setup of the output, which is negotiated again with the
+ * next frames */
+static void
+gst_vsp_compositor_reset (GstVspCompositor * comp)
+{
+  gst_vsp_compositor_drop_jobs (comp);
+
+  if (comp->pool) {
+    gst_buffer_pool_set_active (comp->pool, FALSE);
+    gst_object_unref (comp->pool);
+    comp->pool = NULL;
+  }
+
+  comp->negotiated = FALSE;
+  comp->configured = FALSE;
+}
+
+/* The output covers the inputs as they are placed, at the framerate of
+ * the one of the lowest zorder */
+static gboolean
+gst_vsp_compositor_negotiate (GstVspCompositor * comp,
+    GstVspCompositorFrame * frames, guint n_frames)
+{
+  GstVspCompositorPad *pad;
+  GstStructure *structure;
+  GstCaps *templ, *caps;
+  GstQuery *query;
+  GstVideoInfo info;
+  GstStructure *config;
+  GList *l;
+  gint width = 1, height = 1;
+  gint w, h;
+  guint min = 0, buf_cnt;
+
+  GST_OBJECT_LOCK (comp);
+  for (l = GST_ELEMENT (comp)->sinkpads; l; l = l->next) {
+    pad = l->data;
+    if (!pad->have_info)
+      continue;
+    GST_OBJECT_LOCK (pad);
+    w = pad->width > 0 ? pad->width : GST_VIDEO_INFO_WIDTH (&pad->info);
+    h = pad->height > 0 ? pad->height : GST_VIDEO_INFO_HEIGHT (&pad->info);
+    width = MAX (width, pad->xpos + MIN (w, GST_VIDEO_INFO_WIDTH (&pad->info)));
+    height = MAX (height,
+        pad->ypos + MIN (h, GST_VIDEO_INFO_HEIGHT (&pad->info)));
+    GST_OBJECT_UNLOCK (pad);
+  }
+  GST_OBJECT_UNLOCK (comp);
+
+  templ = gst_pad_get_pad_template_caps (comp->srcpad);
+  caps = gst_pad_peer_query_caps (comp->srcpad, templ);
+  gst_caps_unref (templ);
+  if (gst_caps_is_empty (caps)) {
+    gst_caps_unref (caps);
+    GST_ERROR_OBJECT (comp, "no output caps accepted downstream");
+    return FALSE;
+  }
+
+  caps = gst_caps_truncate (caps);
+  caps = gst_caps_make_writable (caps);
+  structure = gst_caps_get_structure (caps, 0);
+  gst_structure_fixate_field_nearest_int (structure, "width", width);
+  gst_structure_fixate_field_nearest_int (structure, "height", height);
+  pad = frames[0].data->pad;
+  if (GST_VIDEO_INFO_FPS_N (&pad->info) > 0)
+    gst_structure_fixate_field_nearest_fraction (structure, "framerate",
+        GST_VIDEO_INFO_FPS_N (&pad->info), GST_VIDEO_INFO_FPS_D (&pad->info));
+  caps = gst_caps_fixate (caps);
+
+  if (!gst_video_info_from_caps (&info, caps) ||
+      set_colorspace (GST_VIDEO_INFO_FORMAT (&info), NULL, NULL,
+          &comp->n_planes) < 0) {
+    GST_ERROR_OBJECT (comp, "unsupported output caps %" GST_PTR_FORMAT, caps);
+    gst_caps_unref (caps);
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (comp, "output caps %" GST_PTR_FORMAT, caps);
+
+  if (comp->send_stream_start) {
+    gchar *stream_id;
+
+    stream_id = gst_pad_create_stream_id (comp->srcpad, GST_ELEMENT (comp),
+        NULL);
+    gst_pad_push_event (comp->srcpad, gst_event_new_stream_start (stream_id));
+    g_free (stream_id);
+    comp->send_stream_start = FALSE;
+  }
+
+  if (!gst_pad_set_caps (comp->srcpad, caps)) {
+    gst_caps_unref (caps);
+    return FALSE;
+  }
+
+  /* The frames are written by the WPF into the buffers of its node,
+   * exported as dmabuf */
+  gst_vsp_compositor_reset (comp);
+
+  query = gst_query_new_allocation (caps, TRUE);
+  if (gst_pad_peer_query (comp->srcpad, query) &&
+      gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_parse_nth_allocation_pool (query, 0, NULL, NULL, &min, NULL);
+  gst_query_unref (query);
+  buf_cnt = MIN (MAX (3, min + COMPOSITOR_FRAMES), VIDEO_MAX_FRAME);
+
+  comp->pool = vspfilter_buffer_pool_new (comp->wpf_fd,
+      V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+  config = gst_buffer_pool_get_config (comp->pool);
+  gst_buffer_pool_config_set_params (config, caps, info.size, buf_cnt,
+      buf_cnt);
+  gst_caps_unref (caps);
+  if (!gst_buffer_pool_set_config (comp->pool, config) ||
+      !gst_buffer_pool_set_active (comp->pool, TRUE)) {
+    GST_ERROR_OBJECT (comp, "cannot set up the buffers of %s",
+        comp->dev_name);
+    gst_object_unref (comp->pool);
+    comp->pool = NULL;
+    return FALSE;
+  }
+
+  comp->info = info;
+  comp->negotiated = TRUE;
+
+  return TRUE;
+}
+
+/* Sets up how an RPF reads a frame and where the BRU places it. Returns
+ * FALSE if nothing of it would be seen. */
+static gboolean
+gst_vsp_compositor_place_input (GstVspCompositor * comp,
+    GstVspCompositorFrame * frame, GstVspCompositorInput * input)
+{
+  GstVspCompositorPad *pad = frame->data->pad;
+  GstVideoInfo *info = &pad->info;
+  const GstVideoFormatInfo *finfo = info->finfo;
+  enum v4l2_mbus_pixelcode code;
+  GstVideoMeta *meta;
+  GstMemory *mem;
+  gint xpos, ypos, w, h, x0, y0, x1, y1;
+  gdouble alpha;
+  guint i;
+
+  GST_OBJECT_LOCK (pad);
+  xpos = pad->xpos;
+  ypos = pad->ypos;
+  w = pad->width > 0 ? MIN (pad->width, GST_VIDEO_INFO_WIDTH (info)) :
+      GST_VIDEO_INFO_WIDTH (info);
+  h = pad->height > 0 ? MIN (pad->height, GST_VIDEO_INFO_HEIGHT (info)) :
+      GST_VIDEO_INFO_HEIGHT (info);
+  alpha = pad->alpha;
+  GST_OBJECT_UNLOCK (pad);
+
+  /* the part inside the output */
+  x0 = MAX (xpos, 0);
+  y0 = MAX (ypos, 0);
+  x1 = MIN ((gint64) xpos + w, (gint64) GST_VIDEO_INFO_WIDTH (&comp->info));
+  y1 = MIN ((gint64) ypos + h, (gint64) GST_VIDEO_INFO_HEIGHT (&comp->info));
+  if (x1 <= x0 || y1 <= y0)
+    return FALSE;
+
+  input->crop.x = round_down_width (finfo, x0 - xpos);
+  input->crop.y = round_down_height (finfo, y0 - ypos);
+  input->crop.w = round_down_width (finfo, x1 - x0);
+  input->crop.h = round_down_height (finfo, y1 - y0);
+  if (input->crop.w == 0 || input->crop.h == 0)
+    return FALSE;
+  input->compose.x = x0;
+  input->compose.y = y0;
+  input->compose.w = input->crop.w;
+  input->compose.h = input->crop.h;
+
+  set_colorspace (GST_VIDEO_INFO_FORMAT (info), &input->fourcc, &code,
+      &input->n_planes);
+  input->code = code;
+  input->width = round_up_width (finfo, GST_VIDEO_INFO_WIDTH (info));
+  input->height = round_up_height (finfo, GST_VIDEO_INFO_HEIGHT (info));
+  input->encoding = set_encoding (info->colorimetry.matrix);
+  input->quant = set_quantization (info->colorimetry.range);
+  input->alpha = (guint) (alpha * 255 + 0.5);
+
+  meta = gst_buffer_get_video_meta (frame->buffer);
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (info); i++)
+    input->stride[i] = meta ? meta->stride[i] :
+        GST_VIDEO_INFO_PLANE_STRIDE (info, i);
+
+  /* Buffers with a dmabuf per plane are imported, the others read
+   * through userptr */
+  mem = gst_buffer_peek_memory (frame->buffer, 0);
+  if (gst_is_dmabuf_memory (mem) &&
+      gst_buffer_n_memory (frame->buffer) == input->n_planes)
+    input->io = V4L2_MEMORY_DMABUF;
+  else
+    input->io = V4L2_MEMORY_USERPTR;
+
+  return TRUE;
+}
+
+/* Sets up an RPF and its video node to read an input into the BRU */
+static gboolean
+gst_vsp_compositor_set_rpf (GstVspCompositor * comp, guint index,
+    const GstVspCompositorInput * input, guint proc_code)
+{
+  GstVspCompositorRpf *rpf = &comp->rpfs[index];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  GstVideoRectangle crop = input->crop;
+  GstVideoRectangle compose;
+  guint n_bufs;
+
+  /* the format only changes while the node has no buffers */
+  n_bufs = 0;
+  if (!request_buffers (rpf->fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, &n_bufs,
+          input->io))
+    goto node_failed;
+  memcpy (stride, input->stride, sizeof (stride));
+  if (!set_format (rpf->fd, input->width, input->height, input->fourcc,
+          stride, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, input->io,
+          input->encoding, input->quant) ||
+      memcmp (stride, input->stride, sizeof (gint) * input->n_planes) != 0)
+    goto node_failed;
+  n_bufs = COMPOSITOR_FRAMES;
+  if (!request_buffers (rpf->fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, &n_bufs,
+          input->io) || n_bufs < COMPOSITOR_FRAMES)
+    goto node_failed;
+
+  /* The RPF may round the crop to the subsampling of the format */
+  if (!set_subdev_format (rpf->subdev_fd, 0, input->width, input->height,
+          input->code) ||
+      !set_subdev_selection (rpf->subdev_fd, 0, V4L2_SEL_TGT_CROP,
+          V4L2_SEL_FLAG_LE, &crop) ||
+      !set_subdev_format (rpf->subdev_fd, 1, crop.w, crop.h, proc_code)) {
+    GST_ERROR_OBJECT (comp, "cannot set up %s for a %ux%u input",
+        rpf->entity_name, input->width, input->height);
+    return FALSE;
+  }
+
+  compose.x = input->compose.x;
+  compose.y = input->compose.y;
+  compose.w = crop.w;
+  compose.h = crop.h;
+  if (!set_subdev_format (comp->bru_subdev_fd, index, crop.w, crop.h,
+          proc_code) ||
+      !set_subdev_selection (comp->bru_subdev_fd, index,
+          V4L2_SEL_TGT_COMPOSE, 0, &compose)) {
+    GST_ERROR_OBJECT (comp, "cannot place %s at %d,%d in the BRU",
+        rpf->entity_name, compose.x, compose.y);
+    return FALSE;
+  }
+
+  /* The control is left alone as long as it is not used */
+  if (input->alpha != rpf->alpha) {
+    if (!set_control (comp, rpf->subdev_fd, rpf->entity_name,
+            V4L2_CID_ALPHA_COMPONENT, input->alpha))
+      return FALSE;
+    rpf->alpha = input->alpha;
+  }
+
+  if (vspfilter_media_activate_link (comp->media, &rpf->entity,
+          &comp->bru_entity, index, 0)) {
+    GST_ERROR_OBJECT (comp, "Cannot enable a link from %s to bru",
+        rpf->entity_name);
+    return FALSE;
+  }
+
+  return TRUE;
+
+  /* ERRORS */
+node_failed:
+  {
+    GST_ERROR_OBJECT (comp, "cannot set up %s for a %ux%u input",
+        rpf->dev_name, input->width, input->height);
+    return FALSE;
+  }
+}
+
+/* Links the RPFs of the inputs through the BRU to the WPF, unless they
+ * already are as the layout wants */
+static gboolean
+gst_vsp_compositor_configure (GstVspCompositor * comp,
+    const GstVspCompositorLayout * layout)
+{
+  enum v4l2_mbus_pixelcode proc_code;
+  guint i;
+
+  if (comp->configured && memcmp (layout, &comp->layout,
+          sizeof (*layout)) == 0)
+    return TRUE;
+
+  GST_DEBUG_OBJECT (comp, "composing %u inputs into %ux%u", layout->n_inputs,
+      layout->out_width, layout->out_height);
+
+  stop_streaming (comp);
+  comp->configured = FALSE;
+
+  set_colorspace (PROC_FORMAT, NULL, &proc_code, NULL);
+
+  for (i = 0; i < comp->n_rpfs; i++)
+    vspfilter_media_deactivate_link (comp->media, &comp->rpfs[i].entity);
+  vspfilter_media_deactivate_link (comp->media, &comp->bru_entity);
+
+  for (i = 0; i < layout->n_inputs; i++) {
+    if (!gst_vsp_compositor_set_rpf (comp, i, &layout->inputs[i], proc_code))
+      return FALSE;
+  }
+
+  if (!set_subdev_format (comp->bru_subdev_fd, comp->n_bru_inputs,
+          layout->out_width, layout->out_height, proc_code)) {
+    GST_ERROR_OBJECT (comp, "cannot set the output of the BRU to %ux%u",
+        layout->out_width, layout->out_height);
+    return FALSE;
+  }
+  if ((layout->background != DEFAULT_PROP_BACKGROUND ||
+          comp->layout.background != DEFAULT_PROP_BACKGROUND) &&
+      !set_control (comp, comp->bru_subdev_fd, "bru", V4L2_CID_BG_COLOR,
+          layout->background))
+    return FALSE;
+
+  if (!set_subdev_format (comp->wpf_subdev_fd, 0, layout->out_width,
+          layout->out_height, proc_code) ||
+      !set_subdev_format (comp->wpf_subdev_fd, 1, layout->out_width,
+          layout->out_height, layout->out_code)) {
+    GST_ERROR_OBJECT (comp, "cannot set up %s for a %ux%u output",
+        comp->wpf_entity.name, layout->out_width, layout->out_height);
+    return FALSE;
+  }
+
+  if (vspfilter_media_activate_link (comp->media, &comp->bru_entity,
+          &comp->wpf_entity, 0, 0)) {
+    GST_ERROR_OBJECT (comp, "Cannot enable a link from bru to %s",
+        comp->wpf_entity.name);
+    return FALSE;
+  }
+
+  comp->layout = *layout;
+  comp->configured = TRUE;
+
+  return TRUE;
+}
+
+static gboolean
+queue_input (GstVspCompositor * comp, GstVspCompositorRpf * rpf,
+    const GstVspCompositorInput * input, GstVspCompositorFrame * frame,
+    guint index)
+{
+  GstVideoInfo *info = &frame->data->pad->info;
+  struct v4l2_plane planes[GST_VIDEO_MAX_PLANES];
+  struct v4l2_buffer buf;
+  guint i, plane_height;
+
+  CLEAR (buf);
+  memset (planes, 0, sizeof (planes));
+
+  if (input->io == V4L2_MEMORY_USERPTR) {
+    if (!gst_video_frame_map (&frame->vframe, info, frame->buffer,
+            GST_MAP_READ)) {
+      GST_ERROR_OBJECT (comp, "cannot map a frame of %s",
+          GST_PAD_NAME (frame->data->pad));
+      return FALSE;
+    }
+    frame->mapped = TRUE;
+  }
+
+  for (i = 0; i < input->n_planes; i++) {
+    if (input->io == V4L2_MEMORY_DMABUF)
+      planes[i].m.fd = gst_dmabuf_memory_get_fd (gst_buffer_peek_memory
+          (frame->buffer, i));
+    else
+      planes[i].m.userptr = (unsigned long) frame->vframe.data[i];
+    plane_height = GST_VIDEO_SUB_SCALE (GST_VIDEO_FORMAT_INFO_H_SUB
+        (info->finfo, i), input->height);
+    planes[i].length = input->stride[i] * plane_height;
+    planes[i].bytesused = planes[i].length;
+  }
+
+  buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  buf.memory = input->io;
+  buf.index = index;
+  buf.m.planes = planes;
+  buf.length = input->n_planes;
+
+  if (-1 == xioctl (rpf->fd, VIDIOC_QBUF, &buf)) {
+    GST_ERROR_OBJECT (comp, "VIDIOC_QBUF for %s failed errno=%d",
+        rpf->dev_name, errno);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+dequeue_buffer (GstVspCompositor * comp, gint fd, const gchar * name,
+    enum v4l2_buf_type buftype, enum v4l2_memory io, guint n_planes)
+{
+  struct v4l2_plane planes[GST_VIDEO_MAX_PLANES];
+  struct v4l2_buffer buf;
+
+  CLEAR (buf);
+
+  buf.type = buftype;
+  buf.memory = io;
+  buf.m.planes = planes;
+  buf.length = n_planes;
+
+  if (-1 == xioctl (fd, VIDIOC_DQBUF, &buf)) {
+    GST_ERROR_OBJECT (comp, "VIDIOC_DQBUF for %s failed", name);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Queues the frames to be composed into an output buffer of the WPF,
+ * behind the frames in flight. The job holds the frames from then on. */
+static GstFlowReturn
+gst_vsp_compositor_queue (GstVspCompositor * comp,
+    GstVspCompositorFrame * frames, const GstVspCompositorLayout * layout,
+    GstClockTime pts, GstClockTime duration)
+{
+  GstVspCompositorJob *job = &comp->jobs[comp->n_jobs];
+  struct v4l2_plane planes[GST_VIDEO_MAX_PLANES];
+  struct v4l2_buffer buf;
+  enum v4l2_buf_type buftype;
+  GstFlowReturn ret;
+  guint index = comp->n_queued % COMPOSITOR_FRAMES;
+  guint i;
+
+  ret = gst_buffer_pool_acquire_buffer (comp->pool, &job->outbuf, NULL);
+  if (ret != GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (comp, "no output buffer: %s", gst_flow_get_name (ret));
+    return ret;
+  }
+  job->pts = pts;
+  job->duration = duration;
+  for (i = 0; i < layout->n_inputs; i++) {
+    job->frames[i] = frames[i];
+    gst_buffer_ref (job->frames[i].buffer);
+  }
+  job->n_frames = layout->n_inputs;
+  comp->n_jobs++;
+
+  for (i = 0; i < layout->n_inputs; i++) {
+    if (!queue_input (comp, &comp->rpfs[i], &layout->inputs[i],
+            &job->frames[i], index))
+      goto failed;
+  }
+
+  CLEAR (buf);
+  memset (planes, 0, sizeof (planes));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.index = vspfilter_buffer_pool_get_buffer_index (job->outbuf);
+  buf.m.planes = planes;
+  buf.length = comp->n_planes;
+  if (-1 == xioctl (comp->wpf_fd, VIDIOC_QBUF, &buf)) {
+    GST_ERROR_OBJECT (comp, "VIDIOC_QBUF for %s failed errno=%d",
+        comp->dev_name, errno);
+    goto failed;
+  }
+
+  for (i = 0; i < layout->n_inputs; i++) {
+    if (comp->rpfs[i].is_stream_started)
+      continue;
+    buftype = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if (-1 == xioctl (comp->rpfs[i].fd, VIDIOC_STREAMON, &buftype)) {
+      GST_ERROR_OBJECT (comp, "VIDIOC_STREAMON for %s failed",
+          comp->rpfs[i].dev_name);
+      goto failed;
+    }
+    comp->rpfs[i].is_stream_started = TRUE;
+  }
+  if (!comp->is_stream_started) {
+    buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (-1 == xioctl (comp->wpf_fd, VIDIOC_STREAMON, &buftype)) {
+      GST_ERROR_OBJECT (comp, "VIDIOC_STREAMON for %s failed",
+          comp->dev_name);
+      goto failed;
+    }
+    comp->is_stream_started = TRUE;
+  }
+  comp->n_queued++;
+
+  return GST_FLOW_OK;
+
+failed:
+  /* whatever was queued is dropped */
+  gst_vsp_compositor_drop_jobs (comp);
+  GST_ELEMENT_ERROR (comp, RESOURCE, FAILED, (NULL),
+      ("composing on %s failed", comp->ip_name));
+  return GST_FLOW_ERROR;
+}
+
+/* Waits for the oldest frame in flight and pushes it. The layout has not
+ * changed since it was queued. */
+static GstFlowReturn
+gst_vsp_compositor_finish (GstVspCompositor * comp)
+{
+  const GstVspCompositorLayout *layout = &comp->layout;
+  GstVspCompositorJob job;
+  GstBuffer *outbuf;
+  guint i;
+  gint r;
+
+  if (comp->n_jobs == 0)
+    return GST_FLOW_OK;
+
+  r = vspfilter_device_poll (comp->wpf_fd, COMPOSITOR_TIMEOUT_USEC);
+  if (r <= 0) {
+    GST_ERROR_OBJECT (comp, "%s did not complete a frame%s", comp->dev_name,
+        r == 0 ? " in time" : "");
+    goto failed;
+  }
+
+  if (!dequeue_buffer (comp, comp->wpf_fd, comp->dev_name,
+          V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP,
+          comp->n_planes))
+    goto failed;
+  for (i = 0; i < layout->n_inputs; i++) {
+    if (!dequeue_buffer (comp, comp->rpfs[i].fd, comp->rpfs[i].dev_name,
+            V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, layout->inputs[i].io,
+            layout->inputs[i].n_planes))
+      goto failed;
+  }
+
+  job = comp->jobs[0];
+  comp->n_jobs--;
+  memmove (&comp->jobs[0], &comp->jobs[1],
+      comp->n_jobs * sizeof (GstVspCompositorJob));
+
+  outbuf = job.outbuf;
+  GST_BUFFER_PTS (outbuf) = job.pts;
+  GST_BUFFER_DURATION (outbuf) = job.duration;
+  job.outbuf = NULL;
+  gst_vsp_compositor_free_job (&job);
+
+  return gst_pad_push (comp->srcpad, outbuf);
+
+failed:
+  gst_vsp_compositor_drop_jobs (comp);
+  GST_ELEMENT_ERROR (comp, RESOURCE, FAILED, (NULL),
+      ("composing on %s failed", comp->ip_name));
+  return GST_FLOW_ERROR;
+}
+
+/* Pushes the frames in flight, the others are dropped once one is not */
+static GstFlowReturn
+gst_vsp_compositor_drain (GstVspCompositor * comp)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  while (comp->n_jobs > 0 && ret == GST_FLOW_OK)
+    ret = gst_vsp_compositor_finish (comp);
+  if (comp->n_jobs > 0)
+    gst_vsp_compositor_drop_jobs (comp);
+
+  return ret;
+}
+
+static GstFlowReturn
+gst_vsp_compositor_collected (GstCollectPads * pads, gpointer user_data)
+{
+  GstVspCompositor *comp = GST_VSP_COMPOSITOR_CAST (user_data);
+  GstVspCompositorFrame frames[MAX_RPFS];
+  GstVspCompositorFrame shown[MAX_RPFS];
+  GstVspCompositorFrame tmp;
+  GstVspCompositorCollectData *data;
+  GstVspCompositorLayout layout;
+  enum v4l2_mbus_pixelcode out_code;
+  GstBuffer *buffer;
+  GstClockTime pts, duration;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GSList *l;
+  guint n_frames = 0, n_shown = 0;
+  guint i, j;
+
+  for (l = pads->data; l; l = l->next) {
+    data = l->data;
+    buffer = gst_collect_pads_pop (pads, &data->collect);
+    if (!buffer)
+      continue;
+    if (!data->pad->have_info || n_frames == MAX_RPFS) {
+      gst_buffer_unref (buffer);
+      continue;
+    }
+    memset (&frames[n_frames], 0, sizeof (frames[n_frames]));
+    frames[n_frames].data = data;
+    frames[n_frames].buffer = buffer;
+    n_frames++;
+  }
+
+  if (n_frames == 0) {
+    GST_DEBUG_OBJECT (comp, "all the inputs are at their end");
+    gst_vsp_compositor_drain (comp);
+    gst_pad_push_event (comp->srcpad, gst_event_new_eos ());
+    return GST_FLOW_EOS;
+  }
+
+  /* from the bottom up, in the order of the pads for the same zorder */
+  for (i = 1; i < n_frames; i++) {
+    tmp = frames[i];
+    for (j = i; j > 0 &&
+        frames[j - 1].data->pad->zorder > tmp.data->pad->zorder; j--)
+      frames[j] = frames[j - 1];
+    frames[j] = tmp;
+  }
+
+  if (!comp->negotiated || gst_pad_check_reconfigure (comp->srcpad)) {
+    /* the frames in flight go with the caps they were made for */
+    ret = gst_vsp_compositor_drain (comp);
+    if (ret != GST_FLOW_OK) {
+      gst_pad_mark_reconfigure (comp->srcpad);
+      goto done;
+    }
+    if (!gst_vsp_compositor_negotiate (comp, frames, n_frames)) {
+      gst_pad_mark_reconfigure (comp->srcpad);
+      ret = GST_FLOW_NOT_NEGOTIATED;
+      goto done;
+    }
+  }
+
+  if (comp->send_segment) {
+    GstSegment segment;
+
+    gst_segment_init (&segment, GST_FORMAT_TIME);
+    gst_pad_push_event (comp->srcpad, gst_event_new_segment (&segment));
+    comp->send_segment = FALSE;
+  }
+
+  /* The output is timed like the lowest input, in running time */
+  data = frames[0].data;
+  pts = gst_segment_to_running_time (&data->collect.segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (frames[0].buffer));
+  duration = GST_BUFFER_DURATION (frames[0].buffer);
+
+  CLEAR (layout);
+  layout.out_width = GST_VIDEO_INFO_WIDTH (&comp->info);
+  layout.out_height = GST_VIDEO_INFO_HEIGHT (&comp->info);
+  set_colorspace (GST_VIDEO_INFO_FORMAT (&comp->info), NULL, &out_code,
+      NULL);
+  layout.out_code = out_code;
+  GST_OBJECT_LOCK (comp);
+  layout.background = comp->background;
+  GST_OBJECT_UNLOCK (comp);
+
+  for (i = 0; i < n_frames; i++) {
+    if (!gst_vsp_compositor_place_input (comp, &frames[i],
+            &layout.inputs[n_shown]))
+      continue;
+    shown[n_shown++] = frames[i];
+  }
+
+  if (n_shown > comp->n_rpfs) {
+    GST_ELEMENT_ERROR (comp, RESOURCE, FAILED, (NULL),
+        ("%u inputs shown, %s only has %u RPFs for them", n_shown,
+            comp->ip_name, comp->n_rpfs));
+    ret = GST_FLOW_ERROR;
+    goto done;
+  }
+
+  /* The BRU needs an input to run */
+  if (n_shown == 0) {
+    GST_LOG_OBJECT (comp, "no input inside the output");
+    ret = gst_vsp_compositor_drain (comp);
+    gst_pad_push_event (comp->srcpad, gst_event_new_gap (pts, duration));
+    goto done;
+  }
+  layout.n_inputs = n_shown;
+
+  /* The VSP is only set up again once the frames in flight are done */
+  if (comp->n_jobs > 0 && memcmp (&layout, &comp->layout,
+          sizeof (layout)) != 0) {
+    ret = gst_vsp_compositor_drain (comp);
+    if (ret != GST_FLOW_OK)
+      goto done;
+  }
+
+  if (!gst_vsp_compositor_configure (comp, &layout)) {
+    GST_ELEMENT_ERROR (comp, RESOURCE, SETTINGS, (NULL),
+        ("cannot compose %u inputs on %s", n_shown, comp->ip_name));
+    ret = GST_FLOW_ERROR;
+    goto done;
+  }
+
+  /* The oldest frame is pushed while the VSP composes the next one */
+  ret = gst_vsp_compositor_queue (comp, shown, &layout, pts, duration);
+  if (ret == GST_FLOW_OK && comp->n_jobs == COMPOSITOR_FRAMES)
+    ret = gst_vsp_compositor_finish (comp);
+
+done:
+  for (i = 0; i < n_frames; i++)
+    gst_buffer_unref (frames[i].buffer);
+
+  return ret;
+}
+
+static gboolean
+gst_vsp_compositor_sink_event (GstCollectPads * pads, GstCollectData * cdata,
+    GstEvent * event, gpointer user_data)
+{
+  GstVspCompositor *comp = GST_VSP_COMPOSITOR_CAST (user_data);
+  GstVspCompositorPad *pad = GST_VSP_COMPOSITOR_PAD_CAST (cdata->pad);
+  GstVideoInfo info;
+  GstCaps *caps;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:
+      gst_event_parse_caps (event, &caps);
+      if (!gst_video_info_from_caps (&info, caps) ||
+          set_colorspace (GST_VIDEO_INFO_FORMAT (&info), NULL, NULL,
+              NULL) < 0) {
+        GST_ERROR_OBJECT (pad, "unsupported caps %" GST_PTR_FORMAT, caps);
+        gst_event_unref (event);
+        return FALSE;
+      }
+      pad->info = info;
+      pad->have_info = TRUE;
+      /* the output may have to be larger */
+      gst_pad_mark_reconfigure (comp->srcpad);
+      gst_event_unref (event);
+      return TRUE;
+    case GST_EVENT_FLUSH_STOP:
+      /* the frames in flight are not pushed anymore */
+      GST_COLLECT_PADS_STREAM_LOCK (pads);
+      gst_vsp_compositor_drop_jobs (comp);
+      GST_COLLECT_PADS_STREAM_UNLOCK (pads);
+      comp->send_segment = TRUE;
+      break;
+    default:
+      break;
+  }
+
+  return gst_collect_pads_event_default (pads, cdata, event, FALSE);
+}
+
+static gboolean
+gst_vsp_compositor_sink_query (GstCollectPads * pads, GstCollectData * cdata,
+    GstQuery * query, gpointer user_data)
+{
+  GstCaps *filter, *caps;
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+      gst_query_parse_caps (query, &filter);
+      caps = gst_pad_get_pad_template_caps (cdata->pad);
+      if (filter) {
+        GstCaps *intersection;
+
+        intersection = gst_caps_intersect_full (filter, caps,
+            GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref (caps);
+        caps = intersection;
+      }
+      gst_query_set_caps_result (query, caps);
+      gst_caps_unref (caps);
+      return TRUE;
+    case GST_QUERY_ALLOCATION:
+      /* any buffer is read in place, dmabuf ones without mapping them */
+      gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+      return TRUE;
+    default:
+      break;
+  }
+
+  return gst_collect_pads_query_default (pads, cdata, query, FALSE);
+}
+
+static GstPad *
+gst_vsp_compositor_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * req_name, const GstCaps * caps)
+{
+  GstVspCompositor *comp = GST_VSP_COMPOSITOR_CAST (element);
+  GstVspCompositorPad *pad;
+  GstVspCompositorCollectData *data;
+  gchar *name;
+  guint max_inputs;
+
+  GST_OBJECT_LOCK (comp);
+  max_inputs = comp->n_rpfs ? comp->n_rpfs : MAX_RPFS;
+  if (element->numsinkpads >= max_inputs) {
+    GST_OBJECT_UNLOCK (comp);
+    GST_WARNING_OBJECT (comp, "no more than %u inputs", max_inputs);
+    return NULL;
+  }
+  name = req_name ? g_strdup (req_name) :
+      g_strdup_printf ("sink_%u", comp->next_sinkpad);
+  comp->next_sinkpad++;
+  GST_OBJECT_UNLOCK (comp);
+
+  pad = g_object_new (GST_TYPE_VSP_COMPOSITOR_PAD, "name", name,
+      "direction", GST_PAD_SINK, "template", templ, NULL);
+  g_free (name);
+  /* on top of the inputs requested before */
+  pad->zorder = element->numsinkpads;
+
+  data = (GstVspCompositorCollectData *) gst_collect_pads_add_pad
+      (comp->collect, GST_PAD (pad), sizeof (GstVspCompositorCollectData),
+      NULL, TRUE);
+  data->pad = pad;
+
+  if (!gst_element_add_pad (element, GST_PAD (pad))) {
+    gst_collect_pads_remove_pad (comp->collect, GST_PAD (pad));
+    gst_object_unref (pad);
+    return NULL;
+  }
+
+  GST_DEBUG_OBJECT (comp, "added %s", GST_PAD_NAME (pad));
+
+  return GST_PAD (pad);
+}
+
+static void
+gst_vsp_compositor_release_pad (GstElement * element, GstPad * pad)
+{
+  GstVspCompositor *comp = GST_VSP_COMPOSITOR_CAST (element);
+
+  GST_DEBUG_OBJECT (comp, "releasing %s", GST_PAD_NAME (pad));
+
+  gst_collect_pads_remove_pad (comp->collect, pad);
+  gst_element_remove_pad (element, pad);
+}
+
+static GstStateChangeReturn
+gst_vsp_compositor_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstVspCompositor *comp = GST_VSP_COMPOSITOR_CAST (element);
+  GstStateChangeReturn ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      if (!gst_vsp_compositor_open (comp))
+        return GST_STATE_CHANGE_FAILURE;
+      break;
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      comp->send_stream_start = TRUE;
+      comp->send_segment = TRUE;
+      gst_collect_pads_start (comp->collect);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_collect_pads_stop (comp->collect);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_vsp_compositor_reset (comp);
+      break;
+    case GST_STATE_CHANGE_READY_TO_NULL:
+      gst_vsp_compositor_close (comp);
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static void
+gst_vsp_compositor_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVspCompositor *comp = GST_VSP_COMPOSITOR (object);
+
+  GST_OBJECT_LOCK (comp);
+  switch (property_id) {
+    case PROP_DEVFILE:
+      g_free (comp->devfile);
+      comp->devfile = g_value_dup_string (value);
+      break;
+    case PROP_BACKGROUND:
+      comp->background = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (comp);
+}
+
+static void
+gst_vsp_compositor_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVspCompositor *comp = GST_VSP_COMPOSITOR (object);
+
+  GST_OBJECT_LOCK (comp);
+  switch (property_id) {
+    case PROP_DEVFILE:
+      g_value_set_string (value, comp->devfile);
+      break;
+    case PROP_BACKGROUND:
+      g_value_set_uint (value, comp->background);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (comp);
+}
+
+static void
+gst_vsp_compositor_finalize (GObject * obj)
+{
+  GstVspCompositor *comp = GST_VSP_COMPOSITOR (obj);
+
+  gst_object_unref (comp->collect);
+  g_free (comp->devfile);
+
+  G_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
+static void
+gst_vsp_compositor_class_init (GstVspCompositorClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstElementClass *gstelement_class = (GstElementClass *) klass;
+
+  GST_DEBUG_CATEGORY_INIT (vspcompositor_debug, "vspcompositor", 0,
+      "Video compositor with the VSP1 BRU");
+
+  gobject_class->set_property = gst_vsp_compositor_set_property;
+  gobject_class->get_property = gst_vsp_compositor_get_property;
+  gobject_class->finalize = gst_vsp_compositor_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_DEVFILE,
+      g_param_spec_string ("devfile", "Device File",
+          "WPF output video node of the VSP to compose on (NULL = the "
+          "first VSP found with a BRU)", DEFAULT_PROP_COMPOSITOR_DEVFILE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_BACKGROUND,
+      g_param_spec_uint ("background", "Background",
+          "RGB color of the output not covered by any input", 0, 0xffffff,
+          DEFAULT_PROP_BACKGROUND,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&gst_vsp_compositor_src_template));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&gst_vsp_compositor_sink_template));
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "Video Compositor with VSP1 V4L2",
+      "Filter/Editor/Video/Compositor",
+      "Composes the video of several inputs with the BRU",
+      "Renesas Electronics Corporation");
+
+  gstelement_class->change_state = gst_vsp_compositor_change_state;
+  gstelement_class->request_new_pad = gst_vsp_compositor_request_new_pad;
+  gstelement_class->release_pad = gst_vsp_compositor_release_pad;
+}
+
+static void
+gst_vsp_compositor_init (GstVspCompositor * comp)
+{
+  comp->srcpad =
+      gst_pad_new_from_static_template (&gst_vsp_compositor_src_template,
+      "src");
+  gst_element_add_pad (GST_ELEMENT (comp), comp->srcpad);
+
+  comp->collect = gst_collect_pads_new ();
+  gst_collect_pads_set_function (comp->collect,
+      gst_vsp_compositor_collected, comp);
+  gst_collect_pads_set_event_function (comp->collect,
+      gst_vsp_compositor_sink_event, comp);
+  gst_collect_pads_set_query_function (comp->collect,
+      gst_vsp_compositor_sink_query, comp);
+
+  comp->devfile = g_strdup (DEFAULT_PROP_COMPOSITOR_DEVFILE);
+  comp->background = DEFAULT_PROP_BACKGROUND;
+  comp->wpf_fd = comp->wpf_subdev_fd = comp->bru_subdev_fd = -1;
+}
@@ -0,0 +1,216 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_VSP_COMPOSITOR_H__
+#define __GST_VSP_COMPOSITOR_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/base/gstcollectpads.h>
+
+#include <linux/media.h>
+#include <linux/videodev2.h>
+
+#include "gstvspfilter.h"
+#include "vspfiltermedia.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_VSP_COMPOSITOR            (gst_vsp_compositor_get_type())
+#define GST_VSP_COMPOSITOR(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_VSP_COMPOSITOR,GstVspCompositor))
+#define GST_VSP_COMPOSITOR_CAST(obj)       ((GstVspCompositor *)(obj))
+
+#define GST_TYPE_VSP_COMPOSITOR_PAD        (gst_vsp_compositor_pad_get_type())
+#define GST_VSP_COMPOSITOR_PAD(obj)        (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_VSP_COMPOSITOR_PAD,GstVspCompositorPad))
+#define GST_VSP_COMPOSITOR_PAD_CAST(obj)   ((GstVspCompositorPad *)(obj))
+
+/* the WPF node of the first VSP with a BRU if NULL */
+#define DEFAULT_PROP_COMPOSITOR_DEVFILE NULL
+/* RGB of the output not covered by any input */
+#define DEFAULT_PROP_BACKGROUND 0x000000
+
+#define DEFAULT_PAD_XPOS 0
+#define DEFAULT_PAD_YPOS 0
+/* the size of the frames if 0 */
+#define DEFAULT_PAD_WIDTH 0
+#define DEFAULT_PAD_HEIGHT 0
+#define DEFAULT_PAD_ALPHA 1.0
+
+/* how long a frame is waited for */
+#define COMPOSITOR_TIMEOUT_USEC G_USEC_PER_SEC
+/* frames in flight, the next one is queued while one is composed */
+#define COMPOSITOR_FRAMES 2
+
+typedef struct _GstVspCompositor GstVspCompositor;
+typedef struct _GstVspCompositorClass GstVspCompositorClass;
+typedef struct _GstVspCompositorPad GstVspCompositorPad;
+typedef struct _GstVspCompositorPadClass GstVspCompositorPadClass;
+typedef struct _GstVspCompositorCollectData GstVspCompositorCollectData;
+typedef struct _GstVspCompositorRpf GstVspCompositorRpf;
+typedef struct _GstVspCompositorInput GstVspCompositorInput;
+typedef struct _GstVspCompositorLayout GstVspCompositorLayout;
+typedef struct _GstVspCompositorFrame GstVspCompositorFrame;
+typedef struct _GstVspCompositorJob GstVspCompositorJob;
+
+/* A sink pad and the place of its frames in the output. The properties
+ * are read with the object lock of the pad. */
+struct _GstVspCompositorPad {
+  GstPad parent;
+
+  gint xpos;
+  gint ypos;
+  gint width;
+  gint height;
+  gdouble alpha;
+  guint zorder;
+
+  /* the format of the caps, set with the stream lock of the collect
+   * pads */
+  GstVideoInfo info;
+  gboolean have_info;
+};
+
+struct _GstVspCompositorPadClass {
+  GstPadClass parent_class;
+};
+
+struct _GstVspCompositorCollectData {
+  GstCollectData collect;
+  GstVspCompositorPad *pad;
+};
+
+/* An RPF and its input video node */
+struct _GstVspCompositorRpf {
+  gchar *entity_name;
+  gchar *dev_name;
+  gint fd;
+  gint subdev_fd;
+  struct media_entity_desc entity;
+  /* V4L2_CID_ALPHA_COMPONENT as last set */
+  guint alpha;
+  gboolean is_stream_started;
+};
+
+/* The format of an input as its RPF reads it, and the part of the frames
+ * which goes to the output and its place there */
+struct _GstVspCompositorInput {
+  guint width;
+  guint height;
+  guint fourcc;
+  guint n_planes;
+  gint stride[GST_VIDEO_MAX_PLANES];
+  enum v4l2_memory io;
+  enum v4l2_ycbcr_encoding encoding;
+  enum v4l2_quantization quant;
+  guint code;
+  GstVideoRectangle crop;
+  GstVideoRectangle compose;
+  guint alpha;
+};
+
+/* What the VSP is set up for, the inputs from the bottom up, each on the
+ * RPF and the BRU sink pad of its index */
+struct _GstVspCompositorLayout {
+  guint n_inputs;
+  GstVspCompositorInput inputs[MAX_RPFS];
+  guint out_width;
+  guint out_height;
+  guint out_code;
+  guint background;
+};
+
+/* A buffer collected from a sink pad and the mapping it is queued with */
+struct _GstVspCompositorFrame {
+  GstVspCompositorCollectData *data;
+  GstBuffer *buffer;
+  GstVideoFrame vframe;
+  gboolean mapped;
+};
+
+/* A frame queued to the VSP: the buffer it is written to, the frames it
+ * is composed of, which are held and mapped until it is done, and its
+ * timing */
+struct _GstVspCompositorJob {
+  GstBuffer *outbuf;
+  GstVspCompositorFrame frames[MAX_RPFS];
+  guint n_frames;
+  GstClockTime pts;
+  GstClockTime duration;
+};
+
+/**
+ * GstVspCompositor:
+ *
+ * Opaque object data structure.
+ */
+struct _GstVspCompositor {
+  GstElement element;
+
+  GstPad *srcpad;
+  GstCollectPads *collect;
+  guint next_sinkpad;
+
+  /* properties, read with the object lock */
+  gchar *devfile;
+  guint background;
+
+  /* the VSP opened in READY: the WPF the output is written by, the BRU
+   * and the RPFs left to feed it, up to its number of inputs */
+  gchar *dev_name;
+  gchar *ip_name;
+  VspfilterMedia *media;
+  gint wpf_fd;
+  gint wpf_subdev_fd;
+  struct media_entity_desc wpf_entity;
+  gboolean is_stream_started;
+  gint bru_subdev_fd;
+  struct media_entity_desc bru_entity;
+  guint n_bru_inputs;
+  GstVspCompositorRpf rpfs[MAX_RPFS];
+  guint n_rpfs;
+
+  /* the output caps and the pool of the WPF node they are written to */
+  GstVideoInfo info;
+  guint n_planes;
+  gboolean negotiated;
+  GstBufferPool *pool;
+  gboolean send_stream_start;
+  gboolean send_segment;
+
+  GstVspCompositorLayout layout;
+  gboolean configured;
+
+  /* the frames in flight, the oldest first, and how many were queued
+   * since the nodes were started, which picks the next V4L2 buffer of
+   * the RPFs */
+  GstVspCompositorJob jobs[COMPOSITOR_FRAMES];
+  guint n_jobs;
+  guint n_queued;
+};
+
+struct _GstVspCompositorClass {
+  GstElementClass parent_class;
+};
+
+GType gst_vsp_compositor_get_type (void);
+GType gst_vsp_compositor_pad_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_VSP_COMPOSITOR_H__ */
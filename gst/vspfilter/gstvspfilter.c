@@ -33,8 +33,12 @@
 #endif
 
 #include "gstvspfilter.h"
+#include "gstvspcompositor.h"
+#include "gstvspfilterbin.h"
 #include "vspfilterutils.h"
 #include "vspfilterpool.h"
+#include "vspfilterdevice.h"
+#include "vspfiltermeta.h"
 
 #include <gst/video/video.h>
 #include <gst/video/gstvideometa.h>
@@ -62,21 +66,48 @@ enum
   PROP_VSP_DEVFILE_OUTPUT,
   PROP_INPUT_IO_MODE,
   PROP_OUTPUT_IO_MODE,
-  PROP_INPUT_COLOR_RANGE
+  PROP_INPUT_COLOR_RANGE,
+  PROP_QUEUE_DEPTH,
+  PROP_ASYNC_OUTPUT,
+  PROP_IMPORT_CACHE_HITS,
+  PROP_IMPORT_CACHE_MISSES,
+  PROP_COPY_THREADS,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_DEVICE_POOL,
+  PROP_STRIPES,
+  PROP_TILE_SIZE,
+  PROP_ROI_BATCH,
+  PROP_ADD_BORDERS,
+  PROP_BORDER_COLOR,
+  PROP_ROTATION,
+  PROP_FLIP,
+  PROP_OVERLAY,
+  PROP_GAMMA,
+  PROP_BRIGHTNESS,
+  PROP_CONTRAST,
+  PROP_CLU_FILE,
+  PROP_HISTOGRAM
 };
 
-#define CSP_VIDEO_CAPS \
-    "video/x-raw, " \
+/* MAX_TILES_PER_LINE * VSP_MAX_SIZE, frames over VSP_MAX_SIZE are tiled */
+#define CSP_VIDEO_CAPS_WITH_FEATURES(features) \
+    "video/x-raw" features ", " \
         "format = (string) {I420, NV12, NV21, NV16, UYVY, YUY2}," \
-        "width = [ 1, 8190 ], " \
-        "height = [ 1, 8190 ], " \
+        "width = [ 1, 32760 ], " \
+        "height = [ 1, 32760 ], " \
         "framerate = " GST_VIDEO_FPS_RANGE ";" \
-    "video/x-raw, " \
+    "video/x-raw" features ", " \
         "format = (string) {RGB16, RGB, BGR, ARGB, xRGB, BGRA, BGRx}," \
-        "width = [ 1, 8190 ], " \
-        "height = [ 1, 8190 ], " \
+        "width = [ 1, 32760 ], " \
+        "height = [ 1, 32760 ], " \
         "framerate = " GST_VIDEO_FPS_RANGE
 
+#define CSP_VIDEO_CAPS CSP_VIDEO_CAPS_WITH_FEATURES ("")
+/* frames with an overlay composition meta, blended with overlay=true */
+#define CSP_VIDEO_OVERLAY_CAPS CSP_VIDEO_CAPS_WITH_FEATURES ( \
+    "(" GST_CAPS_FEATURE_META_GST_VIDEO_OVERLAY_COMPOSITION ")")
+
 static GstStaticPadTemplate gst_vsp_filter_src_template =
 GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
@@ -84,11 +115,19 @@ GST_STATIC_PAD_TEMPLATE ("src",
     GST_STATIC_CAPS (CSP_VIDEO_CAPS)
     );
 
+/* the input converted once more on a VSP of its own */
+static GstStaticPadTemplate gst_vsp_filter_request_src_template =
+GST_STATIC_PAD_TEMPLATE ("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS (CSP_VIDEO_CAPS)
+    );
+
 static GstStaticPadTemplate gst_vsp_filter_sink_template =
 GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (CSP_VIDEO_CAPS)
+    GST_STATIC_CAPS (CSP_VIDEO_CAPS ";" CSP_VIDEO_OVERLAY_CAPS)
     );
 
 static void gst_vsp_filter_set_property (GObject * object,
@@ -97,12 +136,31 @@ static void gst_vsp_filter_get_property (GObject * object,
     guint property_id, GValue * value, GParamSpec * pspec);
 
 static GstFlowReturn gst_vsp_filter_transform_frame_process (GstVideoFilter *
-    filter, GstVspFilterFrameInfo * in_vframe_info,
+    filter, GstVspFilterVspInfo * vsp_info, const GstVspFilterTile * tile,
+    GstVspFilterFrameInfo * in_vframe_info,
     GstVspFilterFrameInfo * out_vframe_info,
     gint in_stride[GST_VIDEO_MAX_PLANES],
-    gint out_stride[GST_VIDEO_MAX_PLANES], guint in_index, guint out_index);
+    gint out_stride[GST_VIDEO_MAX_PLANES], guint * in_index,
+    guint * out_index);
+static GstFlowReturn gst_vsp_filter_complete_job (GstVspFilter * space,
+    gboolean wait, GstBuffer ** outbuf);
+static GstFlowReturn gst_vsp_filter_complete_output_job (GstVspFilter *
+    space, GstVspFilterOutput * out, GstBuffer ** outbuf);
+static gint wait_for_capture (GstVspFilter * space,
+    GstVspFilterVspInfo * vsp_info, glong timeout_usec);
 
 static gboolean gst_vsp_filter_stop (GstBaseTransform *trans);
+static gboolean gst_vsp_filter_apply_crop_meta (GstVspFilter * space,
+    GstBuffer * inbuf);
+static void gst_vsp_filter_pass_crop_meta (GstVspFilter * space,
+    GstBuffer * inbuf, GstBuffer * outbuf);
+static void gst_vsp_filter_apply_orientation (GstVspFilter * space);
+static void gst_vsp_filter_apply_overlays (GstVspFilter * space,
+    GstBuffer * inbuf);
+static void gst_vsp_filter_clear_overlays (GstVspFilter * space);
+static guint get_tile_align (const GstVideoFormatInfo * finfo);
+static void gst_vsp_filter_close_output (GstVspFilter * space,
+    GstVspFilterOutput * out);
 
 #define GST_TYPE_VSPFILTER_COLOR_RANGE (gst_vsp_filter_color_range_get_type ())
 static GType
@@ -143,6 +201,93 @@ gst_vsp_filter_io_mode_get_type (void)
   return vspfilter_io_mode;
 }
 
+#define GST_TYPE_VSPFILTER_DEVICE_POOL (gst_vsp_filter_device_pool_get_type ())
+static GType
+gst_vsp_filter_device_pool_get_type (void)
+{
+  static GType vspfilter_device_pool = 0;
+
+  if (!vspfilter_device_pool) {
+    static const GEnumValue device_pools[] = {
+      {GST_VSPFILTER_DEVICE_POOL_NONE, "GST_VSPFILTER_DEVICE_POOL_NONE",
+          "none"},
+      {GST_VSPFILTER_DEVICE_POOL_ROUND_ROBIN,
+          "GST_VSPFILTER_DEVICE_POOL_ROUND_ROBIN", "round-robin"},
+      {GST_VSPFILTER_DEVICE_POOL_LEAST_LOADED,
+          "GST_VSPFILTER_DEVICE_POOL_LEAST_LOADED", "least-loaded"},
+      {0, NULL, NULL}
+    };
+    vspfilter_device_pool =
+        g_enum_register_static ("GstVspfilterDevicePool", device_pools);
+  }
+  return vspfilter_device_pool;
+}
+
+#define GST_TYPE_VSPFILTER_ROTATION (gst_vsp_filter_rotation_get_type ())
+static GType
+gst_vsp_filter_rotation_get_type (void)
+{
+  static GType vspfilter_rotation = 0;
+
+  if (!vspfilter_rotation) {
+    static const GEnumValue rotations[] = {
+      {GST_VSPFILTER_ROTATION_0, "GST_VSPFILTER_ROTATION_0", "0"},
+      {GST_VSPFILTER_ROTATION_90, "GST_VSPFILTER_ROTATION_90", "90"},
+      {GST_VSPFILTER_ROTATION_180, "GST_VSPFILTER_ROTATION_180", "180"},
+      {GST_VSPFILTER_ROTATION_270, "GST_VSPFILTER_ROTATION_270", "270"},
+      {GST_VSPFILTER_ROTATION_AUTO, "GST_VSPFILTER_ROTATION_AUTO", "auto"},
+      {0, NULL, NULL}
+    };
+    vspfilter_rotation =
+        g_enum_register_static ("GstVspfilterRotation", rotations);
+  }
+  return vspfilter_rotation;
+}
+
+#define GST_TYPE_VSPFILTER_FLIP (gst_vsp_filter_flip_get_type ())
+static GType
+gst_vsp_filter_flip_get_type (void)
+{
+  static GType vspfilter_flip = 0;
+
+  if (!vspfilter_flip) {
+    static const GEnumValue flips[] = {
+      {GST_VSPFILTER_FLIP_NONE, "GST_VSPFILTER_FLIP_NONE", "none"},
+      {GST_VSPFILTER_FLIP_HORIZONTAL, "GST_VSPFILTER_FLIP_HORIZONTAL",
+          "horizontal"},
+      {GST_VSPFILTER_FLIP_VERTICAL, "GST_VSPFILTER_FLIP_VERTICAL",
+          "vertical"},
+      {GST_VSPFILTER_FLIP_BOTH, "GST_VSPFILTER_FLIP_BOTH", "both"},
+      {0, NULL, NULL}
+    };
+    vspfilter_flip = g_enum_register_static ("GstVspfilterFlip", flips);
+  }
+  return vspfilter_flip;
+}
+
+/* a quarter turn swaps the width and the height */
+#define SWAPS_SIZE(o) ((o)->rotate == 90 || (o)->rotate == 270)
+#define IS_IDENTITY(o) ((o)->rotate == 0 && !(o)->hflip && !(o)->vflip)
+
+/* The orientation the frames are to be converted with */
+static void
+gst_vsp_filter_get_orientation (GstVspFilter * space,
+    GstVspFilterOrientation * orientation)
+{
+  if (space->rotation == GST_VSPFILTER_ROTATION_AUTO) {
+    *orientation = space->tag_orientation;
+  } else {
+    orientation->rotate = space->rotation * 90;
+    orientation->hflip = orientation->vflip = FALSE;
+  }
+
+  /* both flips come before the rotation */
+  if (space->flip & GST_VSPFILTER_FLIP_HORIZONTAL)
+    orientation->hflip = !orientation->hflip;
+  if (space->flip & GST_VSPFILTER_FLIP_VERTICAL)
+    orientation->vflip = !orientation->vflip;
+}
+
 /* copies the given caps */
 static GstCaps *
 gst_vsp_filter_caps_remove_format_info (GstCaps * caps)
@@ -183,7 +328,6 @@ gst_vsp_filter_is_caps_format_supported_for_vsp (GstVspFilter * space,
   GstStructure *ins, *outs;
   GstVideoFormat in_fmt, out_fmt;
   guint in_v4l2pix, out_v4l2pix;
-  struct v4l2_format v4l2fmt;
   gint ret;
 
   vsp_info = space->vsp_info;
@@ -229,30 +373,16 @@ gst_vsp_filter_is_caps_format_supported_for_vsp (GstVspFilter * space,
   gst_structure_get_int (outs, "width", &out_w);
   gst_structure_get_int (outs, "height", &out_h);
 
-  CLEAR (v4l2fmt);
-  v4l2fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-  v4l2fmt.fmt.pix_mp.width = in_w;
-  v4l2fmt.fmt.pix_mp.height = in_h;
-  v4l2fmt.fmt.pix_mp.pixelformat = in_v4l2pix;
-  v4l2fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
-
-  ret = xioctl (vsp_info->v4lout_fd, VIDIOC_TRY_FMT, &v4l2fmt);
-  if (ret < 0) {
+  if (!try_format (vsp_info->v4lout_fd, in_w, in_h, in_v4l2pix,
+          V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, NULL)) {
     GST_ERROR_OBJECT (space,
         "VIDIOC_TRY_FMT failed. (%dx%d pixelformat=%d)", in_w, in_h,
         in_v4l2pix);
     return FALSE;
   }
 
-  CLEAR (v4l2fmt);
-  v4l2fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-  v4l2fmt.fmt.pix_mp.width = out_w;
-  v4l2fmt.fmt.pix_mp.height = out_h;
-  v4l2fmt.fmt.pix_mp.pixelformat = out_v4l2pix;
-  v4l2fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
-
-  ret = xioctl (vsp_info->v4lcap_fd, VIDIOC_TRY_FMT, &v4l2fmt);
-  if (ret < 0) {
+  if (!try_format (vsp_info->v4lcap_fd, out_w, out_h, out_v4l2pix,
+          V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, NULL)) {
     GST_ERROR_OBJECT (space,
         "VIDIOC_TRY_FMT failed. (%dx%d pixelformat=%d)", out_w, out_h,
         out_v4l2pix);
@@ -292,6 +422,7 @@ gst_vsp_filter_fixate_caps (GstBaseTransform * trans,
   gint w = 0, h = 0;
   GstStructure *ins, *outs;
   GstVspFilter *space;
+  GstVspFilterOrientation orientation;
   const GValue *in_format;
 
   space = GST_VSP_FILTER_CAST (trans);
@@ -319,6 +450,14 @@ gst_vsp_filter_fixate_caps (GstBaseTransform * trans,
   gst_structure_get_int (ins, "width", &from_w);
   gst_structure_get_int (ins, "height", &from_h);
 
+  gst_vsp_filter_get_orientation (space, &orientation);
+  if (SWAPS_SIZE (&orientation)) {
+    gint tmp = from_w;
+
+    from_w = from_h;
+    from_h = tmp;
+  }
+
   gst_structure_get_int (outs, "width", &w);
   gst_structure_get_int (outs, "height", &h);
 
@@ -408,6 +547,90 @@ gst_vspfilter_set_colorimetry (GstCaps * caps, GstCaps * caps_intersected)
   }
 }
 
+/* The BRU fills the borders with its background when every VSP has one.
+ * Its background is opaque, so borders with alpha in an output format
+ * with alpha are filled by the CPU. */
+static gboolean
+gst_vsp_filter_has_bru_borders (GstVspFilter * space, GstVideoInfo * out_info)
+{
+  guint i;
+
+  if (GST_VIDEO_INFO_HAS_ALPHA (out_info) && space->border_color >> 24 != 0xff)
+    return FALSE;
+
+  for (i = 0; i < space->n_vsps; i++) {
+    if (space->vsps[i]->bru_subdev_fd < 0)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* The borders the CPU fills around the picture the VSP writes through
+ * userptr at its place in the output buffer */
+static inline gboolean
+gst_vsp_filter_cpu_borders (GstVspFilter * space)
+{
+  return space->borders.w > 0 && !space->bru_borders;
+}
+
+/* The BRU blends the overlays with the RPFs the frames do not go through,
+ * every VSP needs one */
+static gboolean
+gst_vsp_filter_has_overlay_rpfs (GstVspFilter * space)
+{
+  guint i;
+
+  if (!space->overlay)
+    return FALSE;
+
+  for (i = 0; i < space->n_vsps; i++) {
+    if (space->vsps[i]->n_overlay_rpfs == 0)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Every VSP needs an HGO and its histogram node to add the histograms */
+static gboolean
+gst_vsp_filter_has_histogram (GstVspFilter * space)
+{
+  guint i;
+
+  if (!space->histogram)
+    return FALSE;
+
+  for (i = 0; i < space->n_vsps; i++) {
+    if (space->vsps[i]->hgo_fd < 0)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Adds the caps with the overlay composition meta in front of the sink
+ * caps, so that upstream attaches its overlays instead of blending them */
+static GstCaps *
+gst_vsp_filter_add_overlay_caps (GstCaps * caps)
+{
+  GstCaps *res;
+  GstStructure *st;
+  gint i, n;
+
+  res = gst_caps_new_empty ();
+
+  n = gst_caps_get_size (caps);
+  for (i = 0; i < n; i++) {
+    st = gst_structure_copy (gst_caps_get_structure (caps, i));
+    gst_caps_append_structure_full (res, st,
+        gst_caps_features_new
+        (GST_CAPS_FEATURE_META_GST_VIDEO_OVERLAY_COMPOSITION, NULL));
+  }
+
+  return gst_caps_merge (res, caps);
+}
+
 /* The caps can be transformed into any other caps with format info removed.
  * However, we should prefer passthrough, so if passthrough is possible,
  * put it first in the list. */
@@ -421,8 +644,11 @@ gst_vsp_filter_transform_caps (GstBaseTransform * btrans,
   GstCaps *caps_intersected;
   GstCaps *template;
   GstStructure *structure;
+  GstVspFilter *space;
   gint i, n;
 
+  space = GST_VSP_FILTER_CAST (btrans);
+
   /* Get all possible caps that we can transform to */
   tmp = gst_vsp_filter_caps_remove_format_info (caps);
 
@@ -452,8 +678,13 @@ gst_vsp_filter_transform_caps (GstBaseTransform * btrans,
   gst_caps_unref (caps_format_removed);
   gst_caps_unref (template);
 
+  /* Upstream leaves the overlays to the VSP only if it blends them as a
+   * rule, the CPU blends those of the frames it converts otherwise */
   if (direction == GST_PAD_SINK)
     gst_vspfilter_set_colorimetry (caps, caps_intersected);
+  else if (gst_vsp_filter_has_overlay_rpfs (space) && space->stripes <= 1 &&
+      space->tile_size >= VSP_MAX_SIZE && !space->roi_batch)
+    caps_intersected = gst_vsp_filter_add_overlay_caps (caps_intersected);
 
   if (filter) {
     result = gst_caps_intersect_full (filter, caps_intersected,
@@ -470,10 +701,41 @@ gst_vsp_filter_transform_caps (GstBaseTransform * btrans,
   return result;
 }
 
+/* The crop meta of the input is only read through the RPF, borders are only
+ * added and overlays only blended, for frames that are converted in one
+ * piece */
+static inline gboolean
+gst_vsp_filter_whole_frames (GstVspFilter * space)
+{
+  return space->n_tiles == 1 && space->n_stripes == 1 &&
+      space->n_passes == 1 && !space->roi_batch;
+}
+
 static gboolean
 gst_vsp_filter_transform_meta (GstBaseTransform * trans, GstBuffer * outbuf,
     GstMeta * meta, GstBuffer * inbuf)
 {
+  GstVspFilter *space = GST_VSP_FILTER_CAST (trans);
+
+  /* every crop gets a meta of its own region */
+  if (space->roi_batch &&
+      meta->info->api == GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE)
+    return FALSE;
+
+  /* the VSP has done the crop, or the one it could not do is moved to
+   * the output picture, and it has blended the overlays, else the CPU
+   * blends them on the output */
+  if (meta->info->api == GST_VIDEO_CROP_META_API_TYPE)
+    return FALSE;
+  if (gst_vsp_filter_has_overlay_rpfs (space) &&
+      gst_vsp_filter_whole_frames (space) &&
+      meta->info->api == GST_VIDEO_OVERLAY_COMPOSITION_META_API_TYPE)
+    return FALSE;
+
+  /* the histogram of the input is not the one of the output */
+  if (meta->info->api == VSPFILTER_HISTOGRAM_META_API_TYPE)
+    return FALSE;
+
   /* copy other metadata */
   return TRUE;
 }
@@ -481,37 +743,16 @@ gst_vsp_filter_transform_meta (GstBaseTransform * trans, GstBuffer * outbuf,
 static gint
 fgets_with_openclose (gchar * fname, gchar * buf, size_t maxlen)
 {
-  FILE *fp;
-  gchar *s;
+  gchar *contents;
 
-  if ((fp = fopen (fname, "r")) != NULL) {
-    s = fgets (buf, maxlen, fp);
-    fclose (fp);
-    return (s != NULL) ? strlen (buf) : 0;
-  } else {
+  contents = vspfilter_device_read_attr (fname);
+  if (!contents)
     return -1;
-  }
-}
-
-static gint
-open_v4lsubdev (gchar * prefix, const gchar * target, gchar * path)
-{
-  gint i;
-  gchar subdev_name[256];
 
-  for (i = 0; i < 256; i++) {
-    snprintf (path, 255, "/sys/class/video4linux/v4l-subdev%d/name", i);
-    if (fgets_with_openclose (path, subdev_name, 255) < 0)
-      break;
-    if (((prefix &&
-                (strncmp (subdev_name, prefix, strlen (prefix)) == 0)) ||
-            (prefix == NULL)) && (strstr (subdev_name, target) != NULL)) {
-      snprintf (path, 255, "/dev/v4l-subdev%d", i);
-      return open (path, O_RDWR /* required | O_NONBLOCK */ , 0);
-    }
-  }
+  g_strlcpy (buf, contents, maxlen);
+  g_free (contents);
 
-  return -1;
+  return strlen (buf);
 }
 
 static gint
@@ -535,221 +776,108 @@ get_symlink_target_name (gchar * filename, gchar ** link_target)
   return str_size;
 }
 
+/* The HGO only reads what goes through its source */
 static gint
-open_media_device (GstVspFilter * space)
+activate_link (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    struct media_entity_desc *src, struct media_entity_desc *sink,
+    guint sink_pad)
 {
-  GstVspFilterVspInfo *vsp_info;
-  struct stat st;
-  gchar path[256];
-  gchar *dev;
-  gchar *link_target = NULL;
-  gint str_size;
-  gint ret;
-  gint i;
-
-  vsp_info = space->vsp_info;
-
-  str_size = get_symlink_target_name (vsp_info->dev_name[CAP], &link_target);
-
-  dev =
-      g_path_get_basename ((link_target) ? link_target :
-      vsp_info->dev_name[CAP]);
-
-  for (i = 0; i < 256; i++) {
-    sprintf (path, "/sys/class/video4linux/%s/device/media%d", dev, i);
-    if (0 == stat (path, &st)) {
-      sprintf (path, "/dev/media%d", i);
-      GST_DEBUG_OBJECT (space, "media device = %s", path);
-      ret = open (path, O_RDWR);
-      goto leave;
-    }
-  }
-
-  GST_ERROR_OBJECT (space, "No media device for %s", vsp_info->ip_name);
-
-  ret = -1;
-
-leave:
-  if (link_target)
-    g_slice_free1 (str_size, link_target);
-
-  g_free (dev);
-
-  return ret;
+  return vspfilter_media_activate_link (vsp_info->media, src, sink, sink_pad,
+      vsp_info->hgo_entity.id);
 }
 
 static gint
-get_media_entity (GstVspFilter * space, gchar * name,
-    struct media_entity_desc *entity)
+deactivate_link (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    struct media_entity_desc *src)
 {
-  gint i, ret;
-
-  for (i = 0; i < 256; i++) {
-    CLEAR (*entity);
-    entity->id = i | MEDIA_ENT_ID_FLAG_NEXT;
-    ret = ioctl (space->vsp_info->media_fd, MEDIA_IOC_ENUM_ENTITIES, entity);
-    if (ret < 0) {
-      if (errno == EINVAL)
-        break;
-    } else if (strcmp (entity->name, name) == 0) {
-      return i;
-    }
-  }
-
-  GST_ERROR_OBJECT (space, "No media entity for %s", name);
-
-  return -1;
+  return vspfilter_media_deactivate_link (vsp_info->media, src);
 }
 
-static gint
-activate_link (GstVspFilter * space, struct media_entity_desc *src,
-    struct media_entity_desc *sink)
+static gboolean
+set_control (GstVspFilter * space, GstVspFilterVspInfo * vsp_info, gint fd,
+    guint dev_index, guint32 id, gint32 value)
 {
-  struct media_links_enum links;
-  struct media_link_desc *target_link;
-  gint ret, i;
-  GstVspFilterVspInfo *vsp_info;
-
-  vsp_info = space->vsp_info;
-
-  target_link = NULL;
-  CLEAR (links);
-  links.pads = g_malloc0 (sizeof (struct media_pad_desc) * src->pads);
-  links.links = g_malloc0 (sizeof (struct media_link_desc) * src->links);
-
-  links.entity = src->id;
-  ret = ioctl (vsp_info->media_fd, MEDIA_IOC_ENUM_LINKS, &links);
-  if (ret) {
-    GST_ERROR_OBJECT (space, "MEDIA_IOC_ENUM_LINKS failed");
-    goto leave;
-  }
+  struct v4l2_control ctrl;
 
-  for (i = 0; i < src->links; i++) {
-    if (links.links[i].sink.entity == sink->id) {
-      target_link = &links.links[i];
-    } else if (links.links[i].flags & MEDIA_LNK_FL_ENABLED) {
-      GST_WARNING_OBJECT (space, "An active link to %02x found.",
-          links.links[i].sink.entity);
-      ret = -1;
-      goto leave;
-    }
-  }
+  CLEAR (ctrl);
+  ctrl.id = id;
+  ctrl.value = value;
 
-  if (!target_link) {
-    ret = -1;
-    goto leave;
+  if (-1 == xioctl (fd, VIDIOC_S_CTRL, &ctrl)) {
+    GST_ERROR_OBJECT (space, "VIDIOC_S_CTRL 0x%x for %s failed", id,
+        vsp_info->entity_name[dev_index]);
+    return FALSE;
   }
 
-  target_link->flags |= MEDIA_LNK_FL_ENABLED;
-  ret = ioctl (vsp_info->media_fd, MEDIA_IOC_SETUP_LINK, target_link);
-
-leave:
-  g_free (links.pads);
-  g_free (links.links);
-
-  return ret;
+  return TRUE;
 }
 
-static gint
-deactivate_link (GstVspFilter * space, struct media_entity_desc *src)
+/* Sets the flips and the rotation of the WPF. The controls are left alone
+ * as long as they are not used, for the WPFs which do not have them. */
+static gboolean
+set_wpf_orientation (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    const GstVspFilterOrientation * orientation)
 {
-  struct media_links_enum links;
-  struct media_link_desc *target_link;
-  gint ret, i;
-  GstVspFilterVspInfo *vsp_info;
-
-  vsp_info = space->vsp_info;
-
-  CLEAR (links);
-  links.pads = g_malloc0 (sizeof (struct media_pad_desc) * src->pads);
-  links.links = g_malloc0 (sizeof (struct media_link_desc) * src->links);
-
-  links.entity = src->id;
-  ret = ioctl (vsp_info->media_fd, MEDIA_IOC_ENUM_LINKS, &links);
-  if (ret) {
-    GST_ERROR_OBJECT (space, "MEDIA_IOC_ENUM_LINKS failed");
-    goto leave;
-  }
+  const GstVspFilterOrientation *prev = &vsp_info->pipe_config.orientation;
+  gint fd = vsp_info->v4lsub_fd[CAP];
 
-  for (i = 0; i < src->links; i++) {
-    if ((links.links[i].flags & MEDIA_LNK_FL_ENABLED) &&
-        !(links.links[i].flags & MEDIA_LNK_FL_IMMUTABLE)) {
-      struct media_entity_desc next;
-
-      target_link = &links.links[i];
-      CLEAR (next);
-      next.id = target_link->sink.entity;
-      ret = ioctl (vsp_info->media_fd, MEDIA_IOC_ENUM_ENTITIES, &next);
-      if (ret) {
-        GST_ERROR_OBJECT (space, "ioctl(MEDIA_IOC_ENUM_ENTITIES, %d) failed.",
-            target_link->sink.entity);
-        goto leave;
-      }
-      ret = deactivate_link (space, &next);
-      if (ret)
-        GST_ERROR_OBJECT (space, "deactivate_link(%s) failed.", next.name);
-      target_link->flags &= ~MEDIA_LNK_FL_ENABLED;
-      ret = ioctl (vsp_info->media_fd, MEDIA_IOC_SETUP_LINK, target_link);
-      if (ret)
-        GST_ERROR_OBJECT (space, "MEDIA_IOC_SETUP_LINK failed.");
-      GST_DEBUG_OBJECT (space, "A link from %s to %s deactivated.", src->name,
-          next.name);
-    }
-  }
-
-leave:
-  g_free (links.pads);
-  g_free (links.links);
+  if ((orientation->hflip || prev->hflip) &&
+      !set_control (space, vsp_info, fd, CAP, V4L2_CID_HFLIP,
+          orientation->hflip))
+    return FALSE;
+  if ((orientation->vflip || prev->vflip) &&
+      !set_control (space, vsp_info, fd, CAP, V4L2_CID_VFLIP,
+          orientation->vflip))
+    return FALSE;
+  if ((orientation->rotate || prev->rotate) &&
+      !set_control (space, vsp_info, fd, CAP, V4L2_CID_ROTATE,
+          orientation->rotate))
+    return FALSE;
 
-  return ret;
+  return TRUE;
 }
 
 static gboolean
-set_crop (GstVspFilter * space, gint fd, guint * width, guint * height)
+set_crop (GstVspFilter * space, gint fd, guint left, guint top,
+    guint * width, guint * height)
 {
-  struct v4l2_subdev_selection sel = {
-    .pad = 0,
-    .which = V4L2_SUBDEV_FORMAT_ACTIVE,
-    .target = V4L2_SEL_TGT_CROP,
-    .flags = V4L2_SEL_FLAG_LE,
-  };
+  GstVideoRectangle rect = { left, top, *width, *height };
 
-  sel.r.top = 0;
-  sel.r.left = 0;
-  sel.r.width = *width;
-  sel.r.height = *height;
-
-  if (-1 == xioctl (fd, VIDIOC_SUBDEV_S_SELECTION, &sel)) {
+  if (!set_subdev_selection (fd, 0, V4L2_SEL_TGT_CROP, V4L2_SEL_FLAG_LE,
+          &rect)) {
     GST_ERROR_OBJECT (space, "V4L2_SEL_TGT_CROP failed.");
     return FALSE;
   }
 
   /* crop size may have changed */
-  *width = sel.r.width;
-  *height = sel.r.height;
+  *width = rect.w;
+  *height = rect.h;
 
   return TRUE;
 }
 
+/* Places the input of a sink pad of the BRU in its output */
 static gboolean
-init_entity_pad (GstVspFilter * space, gint fd, guint dev_index, guint pad,
-    guint width, guint height, guint code)
+set_compose (GstVspFilter * space, gint fd, guint pad,
+    const GstVideoRectangle * rect)
 {
-  struct v4l2_subdev_format sfmt;
+  GstVideoRectangle r = *rect;
 
-  CLEAR (sfmt);
+  if (!set_subdev_selection (fd, pad, V4L2_SEL_TGT_COMPOSE, 0, &r)) {
+    GST_ERROR_OBJECT (space, "V4L2_SEL_TGT_COMPOSE for pad %u failed.", pad);
+    return FALSE;
+  }
 
-  sfmt.which = V4L2_SUBDEV_FORMAT_ACTIVE;
-  sfmt.pad = pad;
-  sfmt.format.width = width;
-  sfmt.format.height = height;
-  sfmt.format.code = code;
-  sfmt.format.field = V4L2_FIELD_NONE;
-  sfmt.format.colorspace = V4L2_COLORSPACE_SRGB;
+  return TRUE;
+}
 
-  if (-1 == xioctl (fd, VIDIOC_SUBDEV_S_FMT, &sfmt)) {
-    GST_ERROR_OBJECT (space, "VIDIOC_SUBDEV_S_FMT for %s failed.",
-        space->vsp_info->entity_name[dev_index]);
+static gboolean
+init_entity_pad (GstVspFilter * space, gint fd, const gchar * name, guint pad,
+    guint width, guint height, guint code)
+{
+  if (!set_subdev_format (fd, pad, width, height, code)) {
+    GST_ERROR_OBJECT (space, "VIDIOC_SUBDEV_S_FMT for %s pad %u failed.",
+        name, pad);
     return FALSE;
   }
 
@@ -796,168 +924,665 @@ leave:
   return ret;
 }
 
+/* Sets the format of a video node used with imported buffers and allocates
+ * its V4L2 buffers, unless the node is already set up that way */
 static gboolean
-set_vsp_entities (GstVspFilter * space, GstVideoInfo *in_info,
-    gint in_stride[GST_VIDEO_MAX_PLANES], GstVideoInfo *out_info,
-    gint out_stride[GST_VIDEO_MAX_PLANES], enum v4l2_memory io[MAX_DEVICES])
+setup_video_node (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    guint dev_index, GstVspFilterNodeConfig * config,
+    gint stride[GST_VIDEO_MAX_PLANES])
 {
-  GstVspFilterVspInfo *vsp_info;
-  const GstVideoFormatInfo *in_finfo;
-  gint ret;
-  gchar tmp[256];
+  enum v4l2_buf_type buftype;
   guint n_bufs;
-  GstVideoFormat in_fmt, out_fmt;
-  gint in_width, in_height, out_width, out_height;
-  guint in_buf_width, in_buf_height;
-  guint in_img_width, in_img_height;
-
-  vsp_info = space->vsp_info;
+  gint fd;
 
-  in_fmt = in_info->finfo->format;
-  out_fmt = out_info->finfo->format;
+  if (dev_index == OUT) {
+    fd = vsp_info->v4lout_fd;
+    buftype = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  } else {
+    fd = vsp_info->v4lcap_fd;
+    buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  }
 
-  in_width = in_info->width;
-  in_height = in_info->height;
-  out_width = out_info->width;
-  out_height = out_info->height;
+  memcpy (config->stride, stride, sizeof (config->stride));
 
-  if (vsp_info->already_setup_info)
+  if (vsp_info->node_configured[dev_index] &&
+      memcmp (config, &vsp_info->node_config[dev_index],
+          sizeof (*config)) == 0) {
+    GST_DEBUG_OBJECT (space, "%s: format unchanged",
+        vsp_info->dev_name[dev_index]);
+    memcpy (stride, vsp_info->node_stride[dev_index],
+        sizeof (vsp_info->node_stride[dev_index]));
     return TRUE;
+  }
+  vsp_info->node_configured[dev_index] = FALSE;
 
-  ret = set_colorspace (in_fmt, &vsp_info->format[OUT], &vsp_info->code[OUT],
-      &vsp_info->n_planes[OUT]);
-  if (ret < 0) {
-    GST_ERROR_OBJECT (space, "set_colorspace() failed");
+  if (!set_format (fd, config->width, config->height, config->fourcc, stride,
+          buftype, config->io, config->encoding, config->quant)) {
+    GST_ERROR_OBJECT (space, "set_format for %s failed (%dx%d)",
+        vsp_info->dev_name[dev_index], config->width, config->height);
     return FALSE;
   }
-  ret = set_colorspace (out_fmt, &vsp_info->format[CAP], &vsp_info->code[CAP],
-      &vsp_info->n_planes[CAP]);
-  if (ret < 0) {
-    GST_ERROR_OBJECT (space, "set_colorspace() failed");
+
+  n_bufs = config->n_bufs;
+  if (!request_buffers (fd, buftype, &n_bufs, config->io)) {
+    GST_ERROR_OBJECT (space, "request_buffers for %s failed.",
+        vsp_info->dev_name[dev_index]);
     return FALSE;
   }
-  GST_DEBUG_OBJECT (space, "in format=%d  out format=%d", in_fmt, out_fmt);
+  vsp_info->n_buffers[dev_index] = MIN (n_bufs, VIDEO_MAX_FRAME);
 
-  GST_DEBUG_OBJECT (space, "set_colorspace[OUT]: format=%d code=%d n_planes=%d",
-      vsp_info->format[OUT], vsp_info->code[OUT], vsp_info->n_planes[OUT]);
-  GST_DEBUG_OBJECT (space, "set_colorspace[CAP]: format=%d code=%d n_planes=%d",
-      vsp_info->format[CAP], vsp_info->code[CAP], vsp_info->n_planes[CAP]);
+  vspfilter_index_cache_free (vsp_info->index_cache[dev_index]);
+  vsp_info->index_cache[dev_index] =
+      vspfilter_index_cache_new (vsp_info->n_buffers[dev_index]);
 
-  n_bufs = N_BUFFERS;
+  vsp_info->node_config[dev_index] = *config;
+  memcpy (vsp_info->node_stride[dev_index], stride,
+      sizeof (vsp_info->node_stride[dev_index]));
+  vsp_info->node_configured[dev_index] = TRUE;
 
-  in_finfo = gst_video_format_get_info (in_fmt);
+  return TRUE;
+}
 
-  /*in case odd size of yuv buffer, separate buffer and image size*/
-  in_buf_width = round_up_width (in_finfo, in_width);
-  in_buf_height = round_up_height (in_finfo, in_height);
-  in_img_width = round_down_width (in_finfo, in_width);
-  in_img_height = round_down_height (in_finfo, in_height);
+/* Disables the links of the RPFs of the overlays */
+static gboolean
+deactivate_overlays (GstVspFilter * space, GstVspFilterVspInfo * vsp_info)
+{
+  gchar tmp[256];
+  guint i;
 
-  if (io[OUT] != V4L2_MEMORY_MMAP) {
-    enum v4l2_ycbcr_encoding in_encoding;
-    enum v4l2_quantization in_quant;
+  for (i = 0; i < vsp_info->n_overlay_rpfs; i++) {
+    sprintf (tmp, "%s %s", vsp_info->ip_name,
+        vsp_info->overlay_entity_name[i]);
+    if (!vspfilter_media_find_entity (vsp_info->media, tmp,
+            &vsp_info->overlay_entity[i]))
+      return FALSE;
+    deactivate_link (space, vsp_info, &vsp_info->overlay_entity[i]);
+  }
 
-    in_encoding = set_encoding (in_info->colorimetry.matrix);
-    if (space->input_color_range != GST_VSPFILTER_DEFAULT_COLOR_RANGE)
-      in_quant = space->input_color_range;
-    else
-      in_quant = set_quantization (in_info->colorimetry.range);
+  return TRUE;
+}
+
+/* Sets up the RPFs of the overlays of pipe and the BRU blending them over
+ * the picture of the given size, which comes in on its first sink pad, and
+ * links them up to the WPF. The output of the BRU is out_width by
+ * out_height, with the picture at the compose rectangle of pipe over the
+ * background, if it has one. */
+static gboolean
+set_bru_entities (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    const GstVspFilterPipeConfig * pipe, guint width, guint height,
+    guint out_width, guint out_height)
+{
+  const GstVideoRectangle *rect;
+  GstVideoRectangle placed;
+  gint stride[GST_VIDEO_MAX_PLANES] = { 0 };
+  struct v4l2_control ctrl;
+  enum v4l2_mbus_pixelcode code;
+  gchar tmp[256];
+  gchar path[256];
+  guint fourcc, n_bufs, source_pad, i;
+  gint fd;
+
+  if (set_colorspace (GST_VIDEO_OVERLAY_COMPOSITION_FORMAT_RGB, &fourcc,
+          &code, NULL) < 0) {
+    GST_ERROR_OBJECT (space, "set_colorspace() failed");
+    return FALSE;
+  }
 
-    if (!set_format (vsp_info->v4lout_fd, in_buf_width, in_buf_height,
-            vsp_info->format[OUT], in_stride,
-            V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, io[OUT], in_encoding, in_quant)) {
-      GST_ERROR_OBJECT (space, "set_format for %s failed (%dx%d)",
-          vsp_info->dev_name[OUT], in_width, in_height);
+  if (vsp_info->bru_subdev_fd < 0) {
+    vsp_info->bru_subdev_fd = vspfilter_subdev_open (vsp_info->ip_name,
+        "bru", path, sizeof (path));
+    if (vsp_info->bru_subdev_fd < 0) {
+      GST_ERROR_OBJECT (space, "cannot open a subdev file for bru");
       return FALSE;
     }
+  }
+  sprintf (tmp, "%s bru", vsp_info->ip_name);
+  if (!vspfilter_media_find_entity (vsp_info->media, tmp,
+          &vsp_info->bru_entity))
+    return FALSE;
 
-    if (!request_buffers (vsp_info->v4lout_fd,
-            V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, &n_bufs, io[OUT])) {
-      GST_ERROR_OBJECT (space, "request_buffers for %s failed.",
-          vsp_info->dev_name[OUT]);
+  /* the source pad comes after the sink pads */
+  source_pad = vsp_info->bru_entity.pads - 1;
+  if (pipe->n_overlays >= source_pad) {
+    GST_ERROR_OBJECT (space, "the BRU only has %u inputs", source_pad);
+    return FALSE;
+  }
+
+  if (!init_entity_pad (space, vsp_info->bru_subdev_fd, "bru", 0, width,
+          height, pipe->proc_code) ||
+      !init_entity_pad (space, vsp_info->bru_subdev_fd, "bru", source_pad,
+          out_width, out_height, pipe->proc_code))
+    return FALSE;
+
+  /* the picture is placed once the output is large enough for it */
+  if (pipe->compose.w > 0) {
+    if (!set_compose (space, vsp_info->bru_subdev_fd, 0, &pipe->compose))
+      return FALSE;
+
+    CLEAR (ctrl);
+    ctrl.id = V4L2_CID_BG_COLOR;
+    ctrl.value = pipe->bg_color;
+    if (-1 == xioctl (vsp_info->bru_subdev_fd, VIDIOC_S_CTRL, &ctrl)) {
+      GST_ERROR_OBJECT (space, "cannot set the background of bru to 0x%06x",
+          pipe->bg_color);
       return FALSE;
     }
   }
 
-  if (io[CAP] != V4L2_MEMORY_MMAP) {
-    enum v4l2_ycbcr_encoding out_encoding;
-    enum v4l2_quantization out_quant;
+  vsp_info->n_overlay_bufs = VIDEO_MAX_FRAME;
+  vsp_info->overlay_index = 0;
+
+  for (i = 0; i < pipe->n_overlays; i++) {
+    rect = &pipe->overlay_rect[i];
+    fd = vsp_info->overlay_fd[i];
+
+    /* the format only changes while the node has no buffers */
+    n_bufs = 0;
+    if (!request_buffers (fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, &n_bufs,
+            V4L2_MEMORY_USERPTR))
+      goto node_failed;
+    stride[0] = space->overlays[i].stride;
+    if (!set_format (fd, rect->w, rect->h, fourcc, stride,
+            V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_USERPTR,
+            V4L2_YCBCR_ENC_DEFAULT, V4L2_QUANTIZATION_DEFAULT) ||
+        stride[0] != space->overlays[i].stride)
+      goto node_failed;
+    n_bufs = VIDEO_MAX_FRAME;
+    if (!request_buffers (fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, &n_bufs,
+            V4L2_MEMORY_USERPTR) || n_bufs == 0)
+      goto node_failed;
+    vsp_info->n_overlay_bufs = MIN (vsp_info->n_overlay_bufs, n_bufs);
+
+    if (!init_entity_pad (space, vsp_info->overlay_subdev_fd[i],
+            vsp_info->overlay_entity_name[i], 0, rect->w, rect->h, code) ||
+        !init_entity_pad (space, vsp_info->overlay_subdev_fd[i],
+            vsp_info->overlay_entity_name[i], 1, rect->w, rect->h,
+            pipe->proc_code) ||
+        !init_entity_pad (space, vsp_info->bru_subdev_fd, "bru", i + 1,
+            rect->w, rect->h, pipe->proc_code))
+      return FALSE;
 
-    out_encoding = set_encoding (out_info->colorimetry.matrix);
-    out_quant = set_quantization (out_info->colorimetry.range);
+    /* the overlays are placed on the picture */
+    placed = *rect;
+    placed.x += pipe->compose.x;
+    placed.y += pipe->compose.y;
+    if (!set_compose (space, vsp_info->bru_subdev_fd, i + 1, &placed))
+      return FALSE;
 
-    if (!set_format (vsp_info->v4lcap_fd, out_width, out_height,
-            vsp_info->format[CAP], out_stride,
-            V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, io[CAP], out_encoding, out_quant)) {
-      GST_ERROR_OBJECT (space, "set_format for %s failed (%dx%d)",
-          vsp_info->dev_name[CAP], out_width, out_height);
+    if (activate_link (space, vsp_info, &vsp_info->overlay_entity[i],
+            &vsp_info->bru_entity, i + 1)) {
+      GST_ERROR_OBJECT (space, "Cannot enable a link from %s to bru",
+          vsp_info->overlay_entity_name[i]);
       return FALSE;
     }
+  }
 
-    if (!request_buffers (vsp_info->v4lcap_fd,
-            V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, &n_bufs, io[CAP])) {
-      GST_ERROR_OBJECT (space, "request_buffers for %s failed.",
-          vsp_info->dev_name[CAP]);
+  if (activate_link (space, vsp_info, &vsp_info->bru_entity,
+          &vsp_info->entity[CAP], 0)) {
+    GST_ERROR_OBJECT (space, "Cannot enable a link from bru to %s",
+        vsp_info->entity_name[CAP]);
+    return FALSE;
+  }
+
+  return TRUE;
+
+  /* ERRORS */
+node_failed:
+  {
+    GST_ERROR_OBJECT (space, "cannot set up %s for a %dx%d overlay",
+        vsp_info->overlay_dev_name[i], rect->w, rect->h);
+    return FALSE;
+  }
+}
+
+/* Sets up the LUT, the CLU or the HGO for a picture of the given size,
+ * opening its subdev the first time, and sets its controls */
+static gboolean
+set_proc_entity (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    const gchar * name, gint * fd, struct media_entity_desc *entity,
+    guint width, guint height, guint code, struct v4l2_ext_control *ctrl,
+    guint n_ctrls)
+{
+  struct v4l2_ext_controls ctrls;
+  gchar tmp[256];
+  gchar path[256];
+
+  if (*fd < 0) {
+    *fd = vspfilter_subdev_open (vsp_info->ip_name, name, path,
+        sizeof (path));
+    if (*fd < 0) {
+      GST_ERROR_OBJECT (space, "cannot open a subdev file for %s", name);
+      return FALSE;
+    }
+  }
+  sprintf (tmp, "%s %s", vsp_info->ip_name, name);
+  if (!vspfilter_media_find_entity (vsp_info->media, tmp, entity)) {
+    GST_ERROR_OBJECT (space, "Entity for %s not found.", name);
+    return FALSE;
+  }
+
+  if (!init_entity_pad (space, *fd, name, 0, width, height, code) ||
+      !init_entity_pad (space, *fd, name, 1, width, height, code))
+    return FALSE;
+
+  CLEAR (ctrls);
+  ctrls.ctrl_class = V4L2_CTRL_ID2CLASS (ctrl[0].id);
+  ctrls.count = n_ctrls;
+  ctrls.controls = ctrl;
+  if (-1 == xioctl (*fd, VIDIOC_S_EXT_CTRLS, &ctrls)) {
+    GST_ERROR_OBJECT (space, "VIDIOC_S_EXT_CTRLS for %s failed", name);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Links the entity the picture comes out of to the first sink pad of the
+ * next one, which the picture then comes out of */
+static gboolean
+link_picture (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    struct media_entity_desc **src, const gchar ** src_name,
+    struct media_entity_desc *sink, const gchar * sink_name)
+{
+  if (activate_link (space, vsp_info, *src, sink, 0)) {
+    GST_ERROR_OBJECT (space, "Cannot enable a link from %s to %s",
+        *src_name, sink_name);
+    return FALSE;
+  }
+  GST_DEBUG_OBJECT (space, "A link from %s to %s enabled.", *src_name,
+      sink_name);
+
+  *src = sink;
+  *src_name = sink_name;
+
+  return TRUE;
+}
+
+/* Builds the tables of the LUT and the CLU from the properties. The LUT
+ * table is NULL if the colors are left alone, the CLU one without a
+ * clu-file. */
+static gboolean
+gst_vsp_filter_update_color_tables (GstVspFilter * space)
+{
+  if (space->tables_seqnum == space->color_seqnum)
+    return TRUE;
+
+  g_free (space->lut_table);
+  space->lut_table = NULL;
+  if (space->gamma != DEFAULT_PROP_GAMMA ||
+      space->brightness != DEFAULT_PROP_BRIGHTNESS ||
+      space->contrast != DEFAULT_PROP_CONTRAST) {
+    space->lut_table = g_new (guint32, LUT_SIZE);
+    fill_lut_table (space->lut_table, space->gamma, space->brightness,
+        space->contrast);
+  }
+
+  g_free (space->clu_table);
+  space->clu_table = NULL;
+  if (space->clu_file) {
+    space->clu_table = g_new (guint32, CLU_SIZE);
+    if (!load_clu_table (space->clu_file, space->clu_table)) {
+      GST_ERROR_OBJECT (space, "cannot load a 3D LUT from %s",
+          space->clu_file);
+      g_free (space->clu_table);
+      space->clu_table = NULL;
       return FALSE;
     }
   }
 
+  space->tables_seqnum = space->color_seqnum;
+
+  return TRUE;
+}
+
+/* Flips, then rotates clockwise a rectangle of a picture of width by
+ * height, like the WPF does. res may be rect. */
+static void
+turn_rect (const GstVspFilterOrientation * orientation, gint width,
+    gint height, const GstVideoRectangle * rect, GstVideoRectangle * res)
+{
+  GstVideoRectangle r = *rect;
+
+  if (orientation->hflip)
+    r.x = width - r.x - r.w;
+  if (orientation->vflip)
+    r.y = height - r.y - r.h;
+
+  *res = r;
+  switch (orientation->rotate) {
+    case 90:
+      res->x = height - r.y - r.h;
+      res->y = r.x;
+      break;
+    case 180:
+      res->x = width - r.x - r.w;
+      res->y = height - r.y - r.h;
+      break;
+    case 270:
+      res->x = r.y;
+      res->y = width - r.x - r.w;
+      break;
+    default:
+      break;
+  }
+  if (SWAPS_SIZE (orientation)) {
+    res->w = r.h;
+    res->h = r.w;
+  }
+}
+
+/* Finds the rectangle which the flips, then the clockwise rotation of the
+ * WPF turn into rect of an output of out_width by out_height */
+static void
+unturn_rect (const GstVspFilterOrientation * orientation, gint out_width,
+    gint out_height, const GstVideoRectangle * rect, GstVideoRectangle * res)
+{
+  gint width = out_width, height = out_height;
+
+  *res = *rect;
+  switch (orientation->rotate) {
+    case 90:
+      res->x = rect->y;
+      res->y = out_width - rect->x - rect->w;
+      break;
+    case 180:
+      res->x = out_width - rect->x - rect->w;
+      res->y = out_height - rect->y - rect->h;
+      break;
+    case 270:
+      res->x = out_height - rect->y - rect->h;
+      res->y = rect->x;
+      break;
+    default:
+      break;
+  }
+  if (SWAPS_SIZE (orientation)) {
+    res->w = rect->h;
+    res->h = rect->w;
+    width = out_height;
+    height = out_width;
+  }
+
+  if (orientation->hflip)
+    res->x = width - res->x - res->w;
+  if (orientation->vflip)
+    res->y = height - res->y - res->h;
+}
+
+static gboolean
+set_vsp_entities (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    GstVideoInfo *in_info, gint in_stride[GST_VIDEO_MAX_PLANES],
+    GstVideoInfo *out_info, gint out_stride[GST_VIDEO_MAX_PLANES],
+    enum v4l2_memory io[MAX_DEVICES], guint n_slots[MAX_DEVICES])
+{
+  const GstVideoFormatInfo *in_finfo;
+  gint ret;
+  gchar tmp[256];
+  guint n_bufs[MAX_DEVICES];
+  GstVideoFormat in_fmt, out_fmt;
+  gint in_width, in_height, out_width, out_height;
+  guint in_buf_width, in_buf_height;
+  guint in_img_left, in_img_top, in_img_width, in_img_height;
+  guint scaled_width, scaled_height, mixed_width, mixed_height;
+  GstVspFilterNodeConfig node;
+  GstVspFilterPipeConfig pipe;
+  struct v4l2_ext_control ctrl[2];
+  struct media_entity_desc *mixer, *src;
+  const gchar *mixer_name, *src_name;
+  gboolean color;
+  guint i, n_tiles;
+
+  in_fmt = in_info->finfo->format;
+  out_fmt = out_info->finfo->format;
+
+  in_width = in_info->width;
+  in_height = in_info->height;
+  out_width = out_info->width;
+  out_height = out_info->height;
+
+  /* Tiles are queued at an offset in the frames, with their strides. The
+   * request src pads always get whole frames. */
+  n_tiles = vsp_info->output ? 1 : space->n_tiles;
+  if (n_tiles > 1) {
+    in_width = space->tiles[0].in_rect.w;
+    in_height = space->tiles[0].in_rect.h;
+    out_width = space->tiles[0].out_rect.w;
+    out_height = space->tiles[0].out_rect.h;
+  }
+
+  if (vsp_info->already_setup_info)
+    return TRUE;
+
+  /* The colors are only adjusted by the last pass */
+  color = vsp_info->output || space->n_passes <= 1 ||
+      vsp_info == space->vsps[space->n_passes - 1];
+  if (color && !gst_vsp_filter_update_color_tables (space))
+    return FALSE;
+
+  ret = set_colorspace (in_fmt, &vsp_info->format[OUT], &vsp_info->code[OUT],
+      &vsp_info->n_planes[OUT]);
+  if (ret < 0) {
+    GST_ERROR_OBJECT (space, "set_colorspace() failed");
+    return FALSE;
+  }
+  ret = set_colorspace (out_fmt, &vsp_info->format[CAP], &vsp_info->code[CAP],
+      &vsp_info->n_planes[CAP]);
+  if (ret < 0) {
+    GST_ERROR_OBJECT (space, "set_colorspace() failed");
+    return FALSE;
+  }
+  GST_DEBUG_OBJECT (space, "in format=%d  out format=%d", in_fmt, out_fmt);
+
+  GST_DEBUG_OBJECT (space, "set_colorspace[OUT]: format=%d code=%d n_planes=%d",
+      vsp_info->format[OUT], vsp_info->code[OUT], vsp_info->n_planes[OUT]);
+  GST_DEBUG_OBJECT (space, "set_colorspace[CAP]: format=%d code=%d n_planes=%d",
+      vsp_info->format[CAP], vsp_info->code[CAP], vsp_info->n_planes[CAP]);
+
+  /* Every frame in flight needs its own V4L2 buffer. Imported buffers
+   * also keep their index as long as the pool they come from fits. */
+  n_bufs[OUT] = MAX (n_slots[OUT], space->queue_depth * n_tiles);
+  n_bufs[OUT] = MIN (n_bufs[OUT], VIDEO_MAX_FRAME);
+  n_bufs[CAP] = MAX (n_slots[CAP], space->queue_depth * n_tiles);
+  n_bufs[CAP] = MIN (n_bufs[CAP], VIDEO_MAX_FRAME);
+
+  in_finfo = gst_video_format_get_info (in_fmt);
+
+  /*in case odd size of yuv buffer, separate buffer and image size*/
+  /* A region of interest is queued from the aligned address left of it,
+   * see process_rois() */
+  if (space->roi_batch && !vsp_info->output) {
+    in_width = vsp_info->in_rect.x + vsp_info->in_rect.w;
+    in_height = vsp_info->in_rect.h;
+  }
+
+  in_buf_width = round_up_width (in_finfo, in_width);
+  in_buf_height = round_up_height (in_finfo, in_height);
+  in_img_left = in_img_top = 0;
+  in_img_width = round_down_width (in_finfo, in_width);
+  in_img_height = round_down_height (in_finfo, in_height);
+
+  /* A stripe of the frame is read through the crop of the RPF and written
+   * to the rows of the output buffer it is queued with */
+  if (vsp_info->out_rect.w > 0) {
+    in_img_left = vsp_info->in_rect.x;
+    in_img_top = vsp_info->in_rect.y;
+    in_img_width = vsp_info->in_rect.w;
+    in_img_height = vsp_info->in_rect.h;
+    out_width = vsp_info->out_rect.w;
+    out_height = vsp_info->out_rect.h;
+  }
+
+  if (io[OUT] != V4L2_MEMORY_MMAP) {
+    CLEAR (node);
+    node.width = in_buf_width;
+    node.height = in_buf_height;
+    node.fourcc = vsp_info->format[OUT];
+    node.io = io[OUT];
+    node.encoding = set_encoding (in_info->colorimetry.matrix);
+    if (space->input_color_range != GST_VSPFILTER_DEFAULT_COLOR_RANGE)
+      node.quant = space->input_color_range;
+    else
+      node.quant = set_quantization (in_info->colorimetry.range);
+    node.n_bufs = n_bufs[OUT];
+
+    if (!setup_video_node (space, vsp_info, OUT, &node, in_stride))
+      return FALSE;
+  }
+
+  if (io[CAP] != V4L2_MEMORY_MMAP) {
+    CLEAR (node);
+    node.width = out_width;
+    node.height = out_height;
+    node.fourcc = vsp_info->format[CAP];
+    node.io = io[CAP];
+    node.encoding = set_encoding (out_info->colorimetry.matrix);
+    node.quant = set_quantization (out_info->colorimetry.range);
+    node.n_bufs = n_bufs[CAP];
+
+    if (!setup_video_node (space, vsp_info, CAP, &node, out_stride))
+      return FALSE;
+  }
+
   GST_DEBUG_OBJECT (space,
       "in_info->width=%d in_info->height=%d out_info->width=%d out_info->height=%d",
       in_width, in_height, out_width, out_height);
 
+  /* The subdev formats and links only depend on the geometry */
+  CLEAR (pipe);
+  pipe.in_buf_width = in_buf_width;
+  pipe.in_buf_height = in_buf_height;
+  pipe.in_img_left = in_img_left;
+  pipe.in_img_top = in_img_top;
+  pipe.in_img_width = in_img_width;
+  pipe.in_img_height = in_img_height;
+  pipe.out_width = out_width;
+  pipe.out_height = out_height;
+  pipe.in_code = vsp_info->code[OUT];
+  pipe.out_code = vsp_info->code[CAP];
+  pipe.orientation = space->orientation;
+  pipe.n_overlays = vsp_info->output ? 0 : space->n_overlays;
+  for (i = 0; i < pipe.n_overlays; i++)
+    pipe.overlay_rect[i] = space->overlays[i].rect;
+
+  /* The tables are made for RGB, which the RPF converts the picture to and
+   * the WPF back */
+  pipe.lut = color && space->lut_table != NULL;
+  pipe.clu = color && space->clu_table != NULL;
+  pipe.proc_code = vsp_info->code[CAP];
+  if (pipe.lut || pipe.clu) {
+    pipe.proc_code = V4L2_MBUS_FMT_ARGB8888_1X32;
+    pipe.color_seqnum = space->tables_seqnum;
+  }
+  pipe.histogram = !vsp_info->output && gst_vsp_filter_has_histogram (space)
+      && gst_vsp_filter_whole_frames (space);
+
+  /* The BRU places the picture in the frame, over the color of the
+   * borders. It is in the pipeline format, RGB or the YUV of the output. */
+  if (!vsp_info->output && space->bru_borders && space->borders.w > 0) {
+    unturn_rect (&pipe.orientation, out_width, out_height, &space->borders,
+        &pipe.compose);
+    pipe.bg_color = pipe.proc_code == V4L2_MBUS_FMT_ARGB8888_1X32 ?
+        space->border_color & 0xffffff : space->border_pixel;
+  }
+
+  /* The picture is scaled to the size it has before the WPF turns it */
+  mixed_width = out_width;
+  mixed_height = out_height;
+  if (SWAPS_SIZE (&pipe.orientation)) {
+    mixed_width = out_height;
+    mixed_height = out_width;
+  }
+  scaled_width = pipe.compose.w > 0 ? pipe.compose.w : mixed_width;
+  scaled_height = pipe.compose.w > 0 ? pipe.compose.h : mixed_height;
+
+  if (vsp_info->pipe_configured &&
+      memcmp (&pipe, &vsp_info->pipe_config, sizeof (pipe)) == 0) {
+    GST_DEBUG_OBJECT (space, "media pipeline unchanged");
+    vsp_info->already_setup_info = TRUE;
+    return TRUE;
+  }
+  vsp_info->pipe_configured = FALSE;
+
   /* sink pad in RPF */
-  if (!init_entity_pad (space, vsp_info->v4lsub_fd[OUT], OUT, 0, in_buf_width,
-          in_buf_height, vsp_info->code[OUT])) {
+  if (!init_entity_pad (space, vsp_info->v4lsub_fd[OUT],
+          vsp_info->entity_name[OUT], 0, in_buf_width, in_buf_height,
+          vsp_info->code[OUT])) {
     GST_ERROR_OBJECT (space, "init_entity_pad failed");
     return FALSE;
   }
-  if (in_buf_width != in_img_width || in_buf_height != in_img_height) {
-    if (!set_crop (space, vsp_info->v4lsub_fd[OUT],
+  if (in_buf_width != in_img_width || in_buf_height != in_img_height ||
+      in_img_left != 0 || in_img_top != 0) {
+    if (!set_crop (space, vsp_info->v4lsub_fd[OUT], in_img_left, in_img_top,
           &in_img_width, &in_img_height)) {
       GST_ERROR_OBJECT (space, "set_crop failed");
       return FALSE;
     }
   }
   /* source pad in RPF */
-  if (!init_entity_pad (space, vsp_info->v4lsub_fd[OUT], OUT, 1, in_img_width,
-          in_img_height, vsp_info->code[CAP])) {
+  if (!init_entity_pad (space, vsp_info->v4lsub_fd[OUT],
+          vsp_info->entity_name[OUT], 1, in_img_width, in_img_height,
+          pipe.proc_code)) {
     GST_ERROR_OBJECT (space, "init_entity_pad failed");
     return FALSE;
   }
-  /* sink pad in WPF */
-  if (!init_entity_pad (space, vsp_info->v4lsub_fd[CAP], CAP, 0, out_width,
-          out_height, vsp_info->code[CAP])) {
+  /* sink pad in WPF, which propagates a turned size to its source pad */
+  if (!set_wpf_orientation (space, vsp_info, &pipe.orientation))
+    return FALSE;
+  if (!init_entity_pad (space, vsp_info->v4lsub_fd[CAP],
+          vsp_info->entity_name[CAP], 0, mixed_width, mixed_height,
+          pipe.proc_code)) {
     GST_ERROR_OBJECT (space, "init_entity_pad failed");
     return FALSE;
   }
   /* source pad in WPF */
-  if (!init_entity_pad (space, vsp_info->v4lsub_fd[CAP], CAP, 1, out_width,
-          out_height, vsp_info->code[CAP])) {
+  if (!init_entity_pad (space, vsp_info->v4lsub_fd[CAP],
+          vsp_info->entity_name[CAP], 1, out_width, out_height,
+          vsp_info->code[CAP])) {
     GST_ERROR_OBJECT (space, "init_entity_pad failed");
     return FALSE;
   }
 
   sprintf (tmp, "%s %s", vsp_info->ip_name, vsp_info->entity_name[OUT]);
-  ret = get_media_entity (space, tmp, &vsp_info->entity[OUT]);
-  GST_DEBUG_OBJECT (space, "ret = %d, entity[OUT] = %s", ret,
-      vsp_info->entity[OUT].name);
+  if (!vspfilter_media_find_entity (vsp_info->media, tmp,
+          &vsp_info->entity[OUT]))
+    return FALSE;
+  GST_DEBUG_OBJECT (space, "entity[OUT] = %s", vsp_info->entity[OUT].name);
   sprintf (tmp, "%s %s", vsp_info->ip_name, vsp_info->entity_name[CAP]);
-  ret = get_media_entity (space, tmp, &vsp_info->entity[CAP]);
-  GST_DEBUG_OBJECT (space, "ret = %d, entity[CAP] = %s", ret,
-      vsp_info->entity[CAP].name);
+  if (!vspfilter_media_find_entity (vsp_info->media, tmp,
+          &vsp_info->entity[CAP]))
+    return FALSE;
+  GST_DEBUG_OBJECT (space, "entity[CAP] = %s", vsp_info->entity[CAP].name);
 
   /* Deactivate the current pipeline. */
-  deactivate_link (space, &vsp_info->entity[OUT]);
+  deactivate_link (space, vsp_info, &vsp_info->entity[OUT]);
+  if (!deactivate_overlays (space, vsp_info))
+    return FALSE;
+
+  /* The picture goes to the WPF, or to the BRU blending the overlays over
+   * it and adding the borders */
+  if (pipe.n_overlays > 0 || pipe.compose.w > 0) {
+    if (!set_bru_entities (space, vsp_info, &pipe, scaled_width,
+            scaled_height, mixed_width, mixed_height))
+      return FALSE;
+    mixer = &vsp_info->bru_entity;
+    mixer_name = "bru";
+  } else {
+    mixer = &vsp_info->entity[CAP];
+    mixer_name = vsp_info->entity_name[CAP];
+  }
 
-  /* link up entities for VSP1 V4L2 */
-  if ((in_img_width != out_width) || (in_img_height != out_height)) {
+  /* The picture goes through the UDS when it is scaled, then the LUT and
+   * the CLU when they are used */
+  src = &vsp_info->entity[OUT];
+  src_name = vsp_info->entity_name[OUT];
+
+  if ((in_img_width != scaled_width) || (in_img_height != scaled_height)) {
     gchar path[256];
     const gchar *resz_entity_name = "uds.0";
 
     if (vsp_info->resz_subdev_fd < 0) {
-      vsp_info->resz_subdev_fd =
-          open_v4lsubdev (vsp_info->ip_name, resz_entity_name, path);
+      vsp_info->resz_subdev_fd = vspfilter_subdev_open (vsp_info->ip_name,
+          resz_entity_name, path, sizeof (path));
       if (vsp_info->resz_subdev_fd < 0) {
         GST_ERROR_OBJECT (space, "cannot open a subdev file for %s",
             resz_entity_name);
@@ -966,85 +1591,108 @@ set_vsp_entities (GstVspFilter * space, GstVideoInfo *in_info,
     }
 
     sprintf (tmp, "%s %s", vsp_info->ip_name, resz_entity_name);
-    ret = get_media_entity (space, tmp, &vsp_info->entity[RESZ]);
-    if (ret < 0) {
+    if (!vspfilter_media_find_entity (vsp_info->media, tmp,
+            &vsp_info->entity[RESZ])) {
       GST_ERROR_OBJECT (space, "Entity for %s not found.", resz_entity_name);
       return FALSE;
     }
     GST_DEBUG_OBJECT (space, "A entity for %s found.", resz_entity_name);
-    ret =
-        activate_link (space, &vsp_info->entity[OUT], &vsp_info->entity[RESZ]);
-    if (ret) {
-      GST_ERROR_OBJECT (space, "Cannot enable a link from %s to %s",
-          vsp_info->entity_name[OUT], resz_entity_name);
-      return FALSE;
-    }
-
-    GST_DEBUG_OBJECT (space, "A link from %s to %s enabled.",
-        vsp_info->entity_name[OUT], resz_entity_name);
-
-    ret =
-        activate_link (space, &vsp_info->entity[RESZ], &vsp_info->entity[CAP]);
-    if (ret) {
-      GST_ERROR_OBJECT (space, "Cannot enable a link from %s to %s",
-          resz_entity_name, vsp_info->entity_name[CAP]);
+    if (!link_picture (space, vsp_info, &src, &src_name,
+            &vsp_info->entity[RESZ], resz_entity_name))
       return FALSE;
-    }
 
-    GST_DEBUG_OBJECT (space, "A link from %s to %s enabled.",
-        resz_entity_name, vsp_info->entity_name[CAP]);
-
-    if (!init_entity_pad (space, vsp_info->resz_subdev_fd, RESZ, 0, in_img_width,
-            in_img_height, vsp_info->code[CAP])) {
+    if (!init_entity_pad (space, vsp_info->resz_subdev_fd,
+            resz_entity_name, 0, in_img_width, in_img_height,
+            pipe.proc_code)) {
       GST_ERROR_OBJECT (space, "init_entity_pad failed");
       return FALSE;
     }
-    if (!init_entity_pad (space, vsp_info->resz_subdev_fd, RESZ, 1, out_width,
-            out_height, vsp_info->code[CAP])) {
+    if (!init_entity_pad (space, vsp_info->resz_subdev_fd,
+            resz_entity_name, 1, scaled_width, scaled_height,
+            pipe.proc_code)) {
       GST_ERROR_OBJECT (space, "init_entity_pad failed");
       return FALSE;
     }
   } else {
     if (vsp_info->resz_subdev_fd >= 0) {
-      close (vsp_info->resz_subdev_fd);
+      vspfilter_device_close (vsp_info->resz_subdev_fd);
       vsp_info->resz_subdev_fd = -1;
     }
+  }
+
+  if (pipe.lut) {
+    CLEAR (ctrl);
+    ctrl[0].id = V4L2_CID_VSP1_LUT_TABLE;
+    ctrl[0].size = LUT_SIZE * sizeof (guint32);
+    ctrl[0].p_u32 = space->lut_table;
+    if (!set_proc_entity (space, vsp_info, "lut", &vsp_info->lut_subdev_fd,
+            &vsp_info->entity[LUT], scaled_width, scaled_height,
+            pipe.proc_code, ctrl, 1) ||
+        !link_picture (space, vsp_info, &src, &src_name,
+            &vsp_info->entity[LUT], "lut"))
+      return FALSE;
+  }
+
+  if (pipe.clu) {
+    CLEAR (ctrl);
+    ctrl[0].id = V4L2_CID_VSP1_CLU_MODE;
+    ctrl[0].value = V4L2_CID_VSP1_CLU_MODE_3D;
+    ctrl[1].id = V4L2_CID_VSP1_CLU_TABLE;
+    ctrl[1].size = CLU_SIZE * sizeof (guint32);
+    ctrl[1].p_u32 = space->clu_table;
+    if (!set_proc_entity (space, vsp_info, "clu", &vsp_info->clu_subdev_fd,
+            &vsp_info->entity[CLU], scaled_width, scaled_height,
+            pipe.proc_code, ctrl, 2) ||
+        !link_picture (space, vsp_info, &src, &src_name,
+            &vsp_info->entity[CLU], "clu"))
+      return FALSE;
+  }
 
-    ret = activate_link (space, &vsp_info->entity[OUT], &vsp_info->entity[CAP]);
-    if (ret) {
-      GST_ERROR_OBJECT (space, "Cannot enable a link from %s to %s",
-          vsp_info->entity_name[OUT], vsp_info->entity_name[CAP]);
+  /* The HGO reads the picture on the side, before the overlays */
+  if (pipe.histogram) {
+    CLEAR (ctrl);
+    ctrl[0].id = V4L2_CID_VSP1_HGO_NUM_BINS;
+    ctrl[0].value = HGO_NUM_BINS;
+    ctrl[1].id = V4L2_CID_VSP1_HGO_MAX_RGB;
+    ctrl[1].value = pipe.proc_code == V4L2_MBUS_FMT_ARGB8888_1X32;
+    if (!set_proc_entity (space, vsp_info, "hgo", &vsp_info->hgo_subdev_fd,
+            &vsp_info->hgo_entity, scaled_width, scaled_height,
+            pipe.proc_code, ctrl, 2))
+      return FALSE;
+    if (activate_link (space, vsp_info, src, &vsp_info->hgo_entity, 0)) {
+      GST_ERROR_OBJECT (space, "Cannot enable a link from %s to hgo",
+          src_name);
       return FALSE;
     }
-    GST_DEBUG_OBJECT (space, "A link from %s to %s enabled.",
-        vsp_info->entity_name[OUT], vsp_info->entity_name[CAP]);
   }
 
+  if (!link_picture (space, vsp_info, &src, &src_name, mixer, mixer_name))
+    return FALSE;
+
+  vsp_info->pipe_config = pipe;
+  vsp_info->pipe_configured = TRUE;
   vsp_info->already_setup_info = TRUE;
 
   return TRUE;
 }
 
 static void
-close_device (GstVspFilter * space, gint fd, guint dev_index)
+close_device (GstVspFilter * space, GstVspFilterVspInfo * vsp_info, gint fd,
+    guint dev_index)
 {
   GST_DEBUG_OBJECT (space, "closing the device ...");
 
-  if (-1 == close (fd)) {
+  if (-1 == vspfilter_device_close (fd)) {
     GST_ERROR_OBJECT (space, "close for %s failed",
-        space->vsp_info->dev_name[dev_index]);
+        vsp_info->dev_name[dev_index]);
     return;
   }
 }
 
 static void
-stop_capturing (GstVspFilter * space, int fd, guint dev_index,
-    enum v4l2_buf_type buftype)
+stop_capturing (GstVspFilter * space, GstVspFilterVspInfo * vsp_info, int fd,
+    guint dev_index, enum v4l2_buf_type buftype)
 {
-  GstVspFilterVspInfo *vsp_info;
-
-  vsp_info = space->vsp_info;
-
   GST_DEBUG_OBJECT (space, "stop streaming... ");
 
   if (-1 == xioctl (fd, VIDIOC_STREAMOFF, &buftype)) {
@@ -1054,6 +1702,34 @@ stop_capturing (GstVspFilter * space, int fd, guint dev_index,
   }
 }
 
+/* Stops the frame nodes of a VSP and the nodes of the overlays it blends
+ * and of its histograms */
+static void
+stop_streaming (GstVspFilter * space, GstVspFilterVspInfo * vsp_info)
+{
+  enum v4l2_buf_type buftype = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  guint i;
+
+  stop_capturing (space, vsp_info, vsp_info->v4lout_fd, OUT,
+      V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+  stop_capturing (space, vsp_info, vsp_info->v4lcap_fd, CAP,
+      V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+  for (i = 0; i < vsp_info->pipe_config.n_overlays; i++) {
+    if (-1 == xioctl (vsp_info->overlay_fd[i], VIDIOC_STREAMOFF, &buftype))
+      GST_ERROR_OBJECT (space, "VIDIOC_STREAMOFF for %s failed",
+          vsp_info->overlay_dev_name[i]);
+  }
+
+  buftype = V4L2_BUF_TYPE_META_CAPTURE;
+  if (vsp_info->pipe_config.histogram &&
+      -1 == xioctl (vsp_info->hgo_fd, VIDIOC_STREAMOFF, &buftype))
+    GST_ERROR_OBJECT (space, "VIDIOC_STREAMOFF for %s failed",
+        vsp_info->hgo_dev_name);
+
+  vsp_info->is_stream_started = FALSE;
+}
+
 static void
 gst_vsp_filter_finalize (GObject * obj)
 {
@@ -1067,21 +1743,26 @@ gst_vsp_filter_finalize (GObject * obj)
   g_free (vsp_info->dev_name[CAP]);
 
   g_free (space->vsp_info);
+  g_free (space->border_line);
+  g_free (space->clu_file);
+  g_free (space->lut_table);
+  g_free (space->clu_table);
+
+  g_mutex_clear (&space->jobs_lock);
+  g_cond_clear (&space->jobs_cond);
+  gst_flow_combiner_free (space->flow_combiner);
 
   G_OBJECT_CLASS (parent_class)->finalize (obj);
 }
 
 static gboolean
-init_device (GstVspFilter * space, gint fd, guint dev_index, guint captype,
-    enum v4l2_buf_type buftype)
+init_device (GstVspFilter * space, GstVspFilterVspInfo * vsp_info, gint fd,
+    guint dev_index, guint captype, enum v4l2_buf_type buftype)
 {
-  GstVspFilterVspInfo *vsp_info;
   struct v4l2_capability cap;
   gchar *p;
   gchar path[256];
 
-  vsp_info = space->vsp_info;
-
   if (vsp_info->already_device_initialized[dev_index]) {
     GST_WARNING_OBJECT (space, "The device is already initialized");
     return FALSE;
@@ -1113,8 +1794,8 @@ init_device (GstVspFilter * space, gint fd, guint dev_index, guint captype,
   GST_DEBUG_OBJECT (space, "ENTITY NAME[%d] = %s",
       dev_index, vsp_info->entity_name[dev_index]);
 
-  vsp_info->v4lsub_fd[dev_index] = open_v4lsubdev (vsp_info->ip_name,
-      (const char *) vsp_info->entity_name[dev_index], path);
+  vsp_info->v4lsub_fd[dev_index] = vspfilter_subdev_open (vsp_info->ip_name,
+      vsp_info->entity_name[dev_index], path, sizeof (path));
   if (vsp_info->v4lsub_fd[dev_index] < 0) {
     GST_ERROR_OBJECT (space, "Cannot open '%s': %d, %s",
         path, errno, strerror (errno));
@@ -1141,18 +1822,16 @@ init_device (GstVspFilter * space, gint fd, guint dev_index, guint captype,
 }
 
 static gint
-open_device (GstVspFilter * space, guint dev_index)
+open_device (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    guint dev_index)
 {
-  GstVspFilterVspInfo *vsp_info;
   struct stat st;
   gint fd;
   const gchar *name;
 
-  vsp_info = space->vsp_info;
-
   name = vsp_info->dev_name[dev_index];
 
-  if (-1 == stat (name, &st)) {
+  if (-1 == vspfilter_device_stat (name, &st)) {
     GST_ERROR_OBJECT (space, "Cannot identify '%s': %d, %s",
         name, errno, strerror (errno));
     return -1;
@@ -1163,7 +1842,7 @@ open_device (GstVspFilter * space, guint dev_index)
     return -1;
   }
 
-  fd = open (name, O_RDWR /* required | O_NONBLOCK */ , 0);
+  fd = vspfilter_device_open (name, O_RDWR /* required | O_NONBLOCK */ );
 
   if (-1 == fd) {
     GST_ERROR_OBJECT (space, "Cannot open '%s': %d, %s",
@@ -1174,119 +1853,486 @@ open_device (GstVspFilter * space, guint dev_index)
   return fd;
 }
 
-static gboolean
-gst_vsp_filter_vsp_device_init (GstVspFilter * space)
+/* Opens the input video nodes and subdevs of the RPFs which the frames do
+ * not go through, up to MAX_OVERLAYS of them, for the BRU to blend overlays
+ * with */
+static void
+gst_vsp_filter_open_overlays (GstVspFilter * space,
+    GstVspFilterVspInfo * vsp_info)
 {
-  GstVspFilterVspInfo *vsp_info;
-  static const gchar *config_name = "gstvspfilter.conf";
-  static const gchar *env_config_name = "GST_VSP_FILTER_CONFIG_DIR";
-  gchar filename[256];
-  gchar str[256];
-  FILE *fp;
+  gchar name[16];
+  gchar path[256];
+  gchar *node;
+  guint i, n;
+  gint fd;
 
-  vsp_info = space->vsp_info;
+  for (i = 0; i < MAX_RPFS && vsp_info->n_overlay_rpfs < MAX_OVERLAYS; i++) {
+    sprintf (name, "rpf.%u", i);
+    if (strcmp (name, vsp_info->entity_name[OUT]) == 0)
+      continue;
 
-  /* Set the default path of gstvspfilter.conf */
-  g_setenv (env_config_name, "/etc", FALSE);
+    node = vspfilter_media_find_input_node (vsp_info->ip_name, name);
+    if (!node)
+      continue;
 
-  snprintf (filename, sizeof (filename), "%s/%s", g_getenv (env_config_name),
-      config_name);
+    fd = vspfilter_device_open (node, O_RDWR);
+    if (fd < 0) {
+      GST_DEBUG_OBJECT (space, "cannot open %s: %s", node, strerror (errno));
+      g_free (node);
+      continue;
+    }
 
-  GST_DEBUG_OBJECT (space, "Configuration scanning: read from %s", filename);
+    n = vsp_info->n_overlay_rpfs++;
+    vsp_info->overlay_dev_name[n] = node;
+    vsp_info->overlay_entity_name[n] = g_strdup (name);
+    vsp_info->overlay_fd[n] = fd;
+    vsp_info->overlay_subdev_fd[n] = vspfilter_subdev_open (vsp_info->ip_name,
+        name, path, sizeof (path));
+    if (vsp_info->overlay_subdev_fd[n] < 0) {
+      GST_DEBUG_OBJECT (space, "cannot open a subdev file for %s", name);
+      vsp_info->n_overlay_rpfs--;
+      vspfilter_device_close (fd);
+      g_free (vsp_info->overlay_dev_name[n]);
+      g_free (vsp_info->overlay_entity_name[n]);
+      continue;
+    }
 
-  fp = fopen (filename, "r");
-  if (!fp) {
-    GST_WARNING_OBJECT (space, "failed to read gstvspfilter.conf");
-    goto skip_config;
+    GST_DEBUG_OBJECT (space, "%s %s on %s feeds overlays", vsp_info->ip_name,
+        name, node);
   }
 
-  while (fgets (str, sizeof (str), fp) != NULL) {
-    if (strncmp (str, VSP_CONF_ITEM_INPUT, strlen (VSP_CONF_ITEM_INPUT)) == 0 &&
-        !vsp_info->prop_dev_name[OUT]) {
-      str[strlen (str) - 1] = '\0';
-      g_free (vsp_info->dev_name[OUT]);
-      vsp_info->dev_name[OUT] = g_strdup (str + strlen (VSP_CONF_ITEM_INPUT));
-      continue;
-    }
+  if (vsp_info->n_overlay_rpfs == 0)
+    GST_WARNING_OBJECT (space, "%s has no spare RPF, overlays are not "
+        "blended", vsp_info->ip_name);
+}
 
-    if (strncmp (str, VSP_CONF_ITEM_OUTPUT, strlen (VSP_CONF_ITEM_OUTPUT)) == 0
-        && !vsp_info->prop_dev_name[CAP]) {
-      str[strlen (str) - 1] = '\0';
-      g_free (vsp_info->dev_name[CAP]);
-      vsp_info->dev_name[CAP] = g_strdup (str + strlen (VSP_CONF_ITEM_OUTPUT));
-      continue;
-    }
+/* Opens the subdev of the BRU, which blends the overlays and fills the
+ * borders. The CPU fills the borders of a VSP without one. */
+static void
+gst_vsp_filter_open_bru (GstVspFilter * space, GstVspFilterVspInfo * vsp_info)
+{
+  gchar path[256];
+
+  vsp_info->bru_subdev_fd = vspfilter_subdev_open (vsp_info->ip_name, "bru",
+      path, sizeof (path));
+  if (vsp_info->bru_subdev_fd < 0)
+    GST_DEBUG_OBJECT (space, "%s has no BRU", vsp_info->ip_name);
+}
+
+/* Opens the histogram video node of the HGO and gives it userptr buffers
+ * for the histograms of the frames */
+static void
+gst_vsp_filter_open_histogram (GstVspFilter * space,
+    GstVspFilterVspInfo * vsp_info)
+{
+  struct v4l2_format fmt;
+  gchar *node;
+  guint n_bufs, i;
+  gint fd;
+
+  node = vspfilter_media_find_video_node (vsp_info->ip_name, "hgo histo");
+  if (!node)
+    goto no_hgo;
+
+  fd = vspfilter_device_open (node, O_RDWR);
+  if (fd < 0) {
+    GST_DEBUG_OBJECT (space, "cannot open %s: %s", node, strerror (errno));
+    g_free (node);
+    goto no_hgo;
   }
 
-  fclose (fp);
+  CLEAR (fmt);
+  fmt.type = V4L2_BUF_TYPE_META_CAPTURE;
+  fmt.fmt.meta.dataformat = V4L2_META_FMT_VSP1_HGO;
+  fmt.fmt.meta.buffersize = HGO_DATA_SIZE;
+  n_bufs = VIDEO_MAX_FRAME;
+  if (-1 == xioctl (fd, VIDIOC_S_FMT, &fmt) ||
+      fmt.fmt.meta.dataformat != V4L2_META_FMT_VSP1_HGO ||
+      fmt.fmt.meta.buffersize < HGO_DATA_SIZE ||
+      !request_buffers (fd, V4L2_BUF_TYPE_META_CAPTURE, &n_bufs,
+          V4L2_MEMORY_USERPTR) || n_bufs == 0) {
+    GST_DEBUG_OBJECT (space, "cannot set up %s", node);
+    vspfilter_device_close (fd);
+    g_free (node);
+    goto no_hgo;
+  }
 
-skip_config:
-  GST_DEBUG_OBJECT (space, "input device=%s output device=%s",
-      vsp_info->dev_name[OUT], vsp_info->dev_name[CAP]);
+  vsp_info->hgo_dev_name = node;
+  vsp_info->hgo_fd = fd;
+  vsp_info->n_hgo_bufs = n_bufs;
+  vsp_info->hgo_index = 0;
+  for (i = 0; i < n_bufs; i++)
+    vsp_info->hgo_data[i] = g_malloc0 (HGO_DATA_SIZE);
+
+  GST_DEBUG_OBJECT (space, "%s hgo histograms on %s", vsp_info->ip_name,
+      node);
 
-  vsp_info->v4lout_fd = open_device (space, OUT);
-  vsp_info->v4lcap_fd = open_device (space, CAP);
+  return;
 
-  if (!init_device (space, vsp_info->v4lout_fd, OUT,
+  /* ERRORS */
+no_hgo:
+  {
+    GST_WARNING_OBJECT (space, "%s has no usable HGO, no histograms are "
+        "added", vsp_info->ip_name);
+    return;
+  }
+}
+
+/* Opens the video nodes named in vsp_info and the media device */
+static gboolean
+gst_vsp_filter_open_vsp (GstVspFilter * space, GstVspFilterVspInfo * vsp_info)
+{
+  vsp_info->v4lout_fd = open_device (space, vsp_info, OUT);
+  vsp_info->v4lcap_fd = open_device (space, vsp_info, CAP);
+
+  if (!init_device (space, vsp_info, vsp_info->v4lout_fd, OUT,
           V4L2_CAP_VIDEO_OUTPUT_MPLANE, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)) {
     GST_ERROR_OBJECT (space, "init_device for %s failed",
         vsp_info->dev_name[OUT]);
     return FALSE;
   }
 
-  if (!init_device (space, vsp_info->v4lcap_fd, CAP,
+  if (!init_device (space, vsp_info, vsp_info->v4lcap_fd, CAP,
           V4L2_CAP_VIDEO_CAPTURE_MPLANE, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)) {
     GST_ERROR_OBJECT (space, "init_device for %s failed",
         vsp_info->dev_name[CAP]);
     return FALSE;
   }
 
-  vsp_info->media_fd = open_media_device (space);
-  if (vsp_info->media_fd < 0) {
+  vsp_info->media = vspfilter_media_get (vsp_info->dev_name[CAP]);
+  if (!vsp_info->media) {
     GST_ERROR_OBJECT (space, "cannot open a media file for %s",
         vsp_info->ip_name);
     return FALSE;
   }
 
+  if ((space->overlay || space->add_borders) && !vsp_info->output)
+    gst_vsp_filter_open_bru (space, vsp_info);
+  if (space->overlay && !vsp_info->output)
+    gst_vsp_filter_open_overlays (space, vsp_info);
+  if (space->histogram && !vsp_info->output)
+    gst_vsp_filter_open_histogram (space, vsp_info);
+
   return TRUE;
 }
 
 static void
-gst_vsp_filter_vsp_device_deinit (GstVspFilter * space)
+gst_vsp_filter_close_vsp (GstVspFilter * space, GstVspFilterVspInfo * vsp_info)
 {
-  GstVspFilterVspInfo *vsp_info;
-
-  vsp_info = space->vsp_info;
+  guint i;
 
-  if (vsp_info->is_stream_started) {
-    stop_capturing (space, vsp_info->v4lout_fd, OUT,
-        V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
-    stop_capturing (space, vsp_info->v4lcap_fd, CAP,
-        V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
-    vsp_info->is_stream_started = FALSE;
-  }
+  if (vsp_info->is_stream_started)
+    stop_streaming (space, vsp_info);
 
   if (vsp_info->resz_subdev_fd >= 0) {
-    close (vsp_info->resz_subdev_fd);
+    vspfilter_device_close (vsp_info->resz_subdev_fd);
     vsp_info->resz_subdev_fd = -1;
   }
 
-  close (vsp_info->v4lsub_fd[OUT]);
-  close (vsp_info->v4lsub_fd[CAP]);
+  for (i = 0; i < vsp_info->n_overlay_rpfs; i++) {
+    vspfilter_device_close (vsp_info->overlay_subdev_fd[i]);
+    vspfilter_device_close (vsp_info->overlay_fd[i]);
+    vsp_info->overlay_subdev_fd[i] = vsp_info->overlay_fd[i] = -1;
+    g_free (vsp_info->overlay_dev_name[i]);
+    g_free (vsp_info->overlay_entity_name[i]);
+    vsp_info->overlay_dev_name[i] = vsp_info->overlay_entity_name[i] = NULL;
+  }
+  vsp_info->n_overlay_rpfs = 0;
 
-  close (vsp_info->media_fd);
+  if (vsp_info->bru_subdev_fd >= 0) {
+    vspfilter_device_close (vsp_info->bru_subdev_fd);
+    vsp_info->bru_subdev_fd = -1;
+  }
+  if (vsp_info->lut_subdev_fd >= 0) {
+    vspfilter_device_close (vsp_info->lut_subdev_fd);
+    vsp_info->lut_subdev_fd = -1;
+  }
+  if (vsp_info->clu_subdev_fd >= 0) {
+    vspfilter_device_close (vsp_info->clu_subdev_fd);
+    vsp_info->clu_subdev_fd = -1;
+  }
 
-  close_device (space, vsp_info->v4lout_fd, OUT);
-  close_device (space, vsp_info->v4lcap_fd, CAP);
+  if (vsp_info->hgo_subdev_fd >= 0) {
+    vspfilter_device_close (vsp_info->hgo_subdev_fd);
+    vsp_info->hgo_subdev_fd = -1;
+  }
+  if (vsp_info->hgo_fd >= 0) {
+    vspfilter_device_close (vsp_info->hgo_fd);
+    vsp_info->hgo_fd = -1;
+  }
+  for (i = 0; i < vsp_info->n_hgo_bufs; i++) {
+    g_free (vsp_info->hgo_data[i]);
+    vsp_info->hgo_data[i] = NULL;
+  }
+  vsp_info->n_hgo_bufs = 0;
+  g_free (vsp_info->hgo_dev_name);
+  vsp_info->hgo_dev_name = NULL;
+  memset (&vsp_info->hgo_entity, 0, sizeof (struct media_entity_desc));
+
+  if (vsp_info->v4lsub_fd[OUT] >= 0)
+    vspfilter_device_close (vsp_info->v4lsub_fd[OUT]);
+  if (vsp_info->v4lsub_fd[CAP] >= 0)
+    vspfilter_device_close (vsp_info->v4lsub_fd[CAP]);
+  vsp_info->v4lsub_fd[OUT] = vsp_info->v4lsub_fd[CAP] = -1;
+
+  vspfilter_media_unref (vsp_info->media);
+  vsp_info->media = NULL;
+
+  if (vsp_info->v4lout_fd >= 0)
+    close_device (space, vsp_info, vsp_info->v4lout_fd, OUT);
+  if (vsp_info->v4lcap_fd >= 0)
+    close_device (space, vsp_info, vsp_info->v4lcap_fd, CAP);
+  vsp_info->v4lout_fd = vsp_info->v4lcap_fd = -1;
 
   g_free (vsp_info->ip_name);
   vsp_info->ip_name = NULL;
 
   g_free (vsp_info->entity_name[OUT]);
   g_free (vsp_info->entity_name[CAP]);
+  vsp_info->entity_name[OUT] = vsp_info->entity_name[CAP] = NULL;
+
+  vspfilter_index_cache_free (vsp_info->index_cache[OUT]);
+  vspfilter_index_cache_free (vsp_info->index_cache[CAP]);
+  vsp_info->index_cache[OUT] = vsp_info->index_cache[CAP] = NULL;
 
   vsp_info->already_device_initialized[OUT] =
       vsp_info->already_device_initialized[CAP] = FALSE;
+  vsp_info->node_configured[OUT] = vsp_info->node_configured[CAP] = FALSE;
+  vsp_info->pipe_configured = FALSE;
+  vsp_info->n_jobs = 0;
+  vsp_info->disabled = FALSE;
+}
+
+static void
+gst_vsp_filter_free_vsp (GstVspFilter * space, GstVspFilterVspInfo * vsp_info)
+{
+  gst_vsp_filter_close_vsp (space, vsp_info);
+  g_free (vsp_info->dev_name[OUT]);
+  g_free (vsp_info->dev_name[CAP]);
+  g_free (vsp_info);
+}
+
+/* TRUE if the VSP is already opened for the src pad, its device pool or a
+ * request src pad */
+static gboolean
+gst_vsp_filter_vsp_in_use (GstVspFilter * space, const gchar * ip_name)
+{
+  GstVspFilterOutput *out;
+  guint i;
+
+  for (i = 0; i < space->n_vsps; i++) {
+    if (g_strcmp0 (space->vsps[i]->ip_name, ip_name) == 0)
+      return TRUE;
+  }
+  for (i = 0; i < MAX_OUTPUTS; i++) {
+    out = space->outputs[i];
+    if (out && out->vsp_info &&
+        g_strcmp0 (out->vsp_info->ip_name, ip_name) == 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Opens the next VSP with an RPF input and a WPF output video node which
+ * is not in use yet, NULL if none is left */
+static GstVspFilterVspInfo *
+gst_vsp_filter_open_spare_vsp (GstVspFilter * space, GList ** pairs,
+    gboolean output)
+{
+  GstVspFilterVspInfo *vsp_info;
+  VspfilterVideoPair *pair;
+  GList *l;
+
+  while ((l = *pairs)) {
+    pair = l->data;
+    *pairs = g_list_delete_link (*pairs, l);
+
+    if (gst_vsp_filter_vsp_in_use (space, pair->ip_name)) {
+      vspfilter_video_pair_free (pair);
+      continue;
+    }
+
+    vsp_info = g_malloc0 (sizeof (GstVspFilterVspInfo));
+    vsp_info->dev_name[OUT] = g_strdup (pair->input);
+    vsp_info->dev_name[CAP] = g_strdup (pair->output);
+    vsp_info->v4lout_fd = vsp_info->v4lcap_fd = -1;
+    vsp_info->v4lsub_fd[OUT] = vsp_info->v4lsub_fd[CAP] = -1;
+    vsp_info->resz_subdev_fd = vsp_info->bru_subdev_fd = -1;
+    vsp_info->lut_subdev_fd = vsp_info->clu_subdev_fd = -1;
+    vsp_info->hgo_fd = vsp_info->hgo_subdev_fd = -1;
+    vsp_info->output = output;
+
+    if (!gst_vsp_filter_open_vsp (space, vsp_info)) {
+      GST_WARNING_OBJECT (space, "%s is not usable", pair->ip_name);
+      gst_vsp_filter_free_vsp (space, vsp_info);
+      vspfilter_video_pair_free (pair);
+      continue;
+    }
+
+    vspfilter_video_pair_free (pair);
+    return vsp_info;
+  }
+
+  return NULL;
+}
+
+/* Adds every other VSP which can be opened to the device pool, up to
+ * max_vsps VSPs in all */
+static void
+gst_vsp_filter_open_device_pool (GstVspFilter * space, guint max_vsps)
+{
+  GstVspFilterVspInfo *vsp_info;
+  GList *pairs;
+
+  pairs = vspfilter_media_find_video_pairs ();
+
+  while (space->n_vsps < max_vsps &&
+      (vsp_info = gst_vsp_filter_open_spare_vsp (space, &pairs, FALSE))) {
+    GST_INFO_OBJECT (space, "pooled %s (%s, %s)", vsp_info->ip_name,
+        vsp_info->dev_name[OUT], vsp_info->dev_name[CAP]);
+    space->vsps[space->n_vsps++] = vsp_info;
+  }
+
+  g_list_free_full (pairs, (GDestroyNotify) vspfilter_video_pair_free);
+
+  GST_INFO_OBJECT (space, "device pool of %u VSPs", space->n_vsps);
+}
+
+/* Opens a VSP of its own for a request src pad */
+static gboolean
+gst_vsp_filter_open_output (GstVspFilter * space, GstVspFilterOutput * out)
+{
+  GList *pairs;
+
+  pairs = vspfilter_media_find_video_pairs ();
+  out->vsp_info = gst_vsp_filter_open_spare_vsp (space, &pairs, TRUE);
+  g_list_free_full (pairs, (GDestroyNotify) vspfilter_video_pair_free);
+  if (!out->vsp_info)
+    return FALSE;
+
+  out->vsp_info->in_info = &out->in_info;
+  out->vsp_info->out_info = &out->info;
+  GST_INFO_OBJECT (space, "%s converted by %s (%s, %s)",
+      GST_PAD_NAME (out->pad), out->vsp_info->ip_name,
+      out->vsp_info->dev_name[OUT], out->vsp_info->dev_name[CAP]);
+
+  return TRUE;
+}
+
+static gboolean
+gst_vsp_filter_vsp_device_init (GstVspFilter * space)
+{
+  GstVspFilterVspInfo *vsp_info;
+  GstVspFilterOutput *out;
+  static const gchar *config_name = "gstvspfilter.conf";
+  static const gchar *env_config_name = "GST_VSP_FILTER_CONFIG_DIR";
+  gchar filename[256];
+  gchar str[256];
+  FILE *fp;
+  guint i;
+
+  vsp_info = space->vsp_info;
+
+  /* Set the default path of gstvspfilter.conf */
+  g_setenv (env_config_name, "/etc", FALSE);
+
+  snprintf (filename, sizeof (filename), "%s/%s", g_getenv (env_config_name),
+      config_name);
+
+  GST_DEBUG_OBJECT (space, "Configuration scanning: read from %s", filename);
+
+  fp = fopen (filename, "r");
+  if (!fp) {
+    GST_WARNING_OBJECT (space, "failed to read gstvspfilter.conf");
+    goto skip_config;
+  }
+
+  while (fgets (str, sizeof (str), fp) != NULL) {
+    if (strncmp (str, VSP_CONF_ITEM_INPUT, strlen (VSP_CONF_ITEM_INPUT)) == 0 &&
+        !vsp_info->prop_dev_name[OUT]) {
+      str[strlen (str) - 1] = '\0';
+      g_free (vsp_info->dev_name[OUT]);
+      vsp_info->dev_name[OUT] = g_strdup (str + strlen (VSP_CONF_ITEM_INPUT));
+      continue;
+    }
+
+    if (strncmp (str, VSP_CONF_ITEM_OUTPUT, strlen (VSP_CONF_ITEM_OUTPUT)) == 0
+        && !vsp_info->prop_dev_name[CAP]) {
+      str[strlen (str) - 1] = '\0';
+      g_free (vsp_info->dev_name[CAP]);
+      vsp_info->dev_name[CAP] = g_strdup (str + strlen (VSP_CONF_ITEM_OUTPUT));
+      continue;
+    }
+  }
+
+  fclose (fp);
+
+skip_config:
+  GST_DEBUG_OBJECT (space, "input device=%s output device=%s",
+      vsp_info->dev_name[OUT], vsp_info->dev_name[CAP]);
+
+  if (!gst_vsp_filter_open_vsp (space, vsp_info))
+    return FALSE;
+
+  space->vsps[0] = vsp_info;
+  space->n_vsps = 1;
+  space->next_vsp = 0;
+
+  if (space->stripes > 1)
+    gst_vsp_filter_open_device_pool (space, space->stripes);
+  else if (space->device_pool != GST_VSPFILTER_DEVICE_POOL_NONE)
+    gst_vsp_filter_open_device_pool (space, MAX_VSPS);
+
+  /* The request src pads get the VSPs left over */
+  for (i = 0; i < MAX_OUTPUTS; i++) {
+    out = space->outputs[i];
+    if (out && !gst_vsp_filter_open_output (space, out)) {
+      GST_ELEMENT_ERROR (space, RESOURCE, NOT_FOUND, (NULL),
+          ("no VSP left for %s", GST_PAD_NAME (out->pad)));
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+gst_vsp_filter_vsp_device_deinit (GstVspFilter * space)
+{
+  guint i;
+
+  for (i = 0; i < MAX_OUTPUTS; i++) {
+    if (space->outputs[i])
+      gst_vsp_filter_close_output (space, space->outputs[i]);
+  }
+
+  for (i = 1; i < space->n_vsps; i++) {
+    gst_vsp_filter_free_vsp (space, space->vsps[i]);
+    space->vsps[i] = NULL;
+  }
+  space->n_vsps = 1;
+  space->n_stripes = 1;
+  space->n_passes = 1;
+  memset (&space->crop, 0, sizeof (GstVideoRectangle));
+  gst_vsp_filter_clear_overlays (space);
+  memset (&space->vsp_info->in_rect, 0, sizeof (GstVideoRectangle));
+  memset (&space->vsp_info->out_rect, 0, sizeof (GstVideoRectangle));
+
+  gst_vsp_filter_close_vsp (space, space->vsp_info);
+}
+
+static void
+gst_vsp_filter_clear_pass_pools (GstVspFilter * space)
+{
+  guint k;
+
+  for (k = 0; k < MAX_PASSES - 1; k++) {
+    if (!space->pass_pools[k])
+      continue;
+    gst_buffer_pool_set_active (space->pass_pools[k], FALSE);
+    g_clear_object (&space->pass_pools[k]);
+  }
 }
 
 static GstStateChangeReturn
@@ -1316,6 +2362,7 @@ gst_vsp_filter_change_state (GstElement * element, GstStateChange transition)
     case GST_STATE_CHANGE_READY_TO_NULL:
       g_clear_object (&space->in_pool);
       g_clear_object (&space->out_pool);
+      gst_vsp_filter_clear_pass_pools (space);
       gst_vsp_filter_vsp_device_deinit (space);
       break;
     default:
@@ -1325,13 +2372,45 @@ gst_vsp_filter_change_state (GstElement * element, GstStateChange transition)
   return ret;
 }
 
+/* Frames kept in flight on all the VSPs of the device pool together. A
+ * frame split into stripes or scaled in passes takes all of them. */
+static guint
+gst_vsp_filter_get_max_frames (GstVspFilter * space)
+{
+  guint i, n = 0, depth;
+
+  /* every tile in flight takes a V4L2 buffer */
+  depth = MIN (space->queue_depth, VIDEO_MAX_FRAME / space->n_tiles);
+
+  if (space->n_stripes > 1 || space->n_passes > 1)
+    return depth;
+
+  for (i = 0; i < space->n_vsps; i++) {
+    if (!space->vsps[i]->disabled)
+      n++;
+  }
+
+  return depth * MAX (n, 1);
+}
+
+/* A frame split into stripes or tiles makes a job of each */
+static guint
+gst_vsp_filter_get_max_jobs (GstVspFilter * space)
+{
+  return gst_vsp_filter_get_max_frames (space) * space->n_stripes *
+      space->n_tiles;
+}
+
 static GstBufferPool *
 gst_vsp_filter_setup_pool (gint fd, enum v4l2_buf_type buftype, GstCaps * caps,
-    gsize size, guint num_buf)
+    gsize size, guint num_buf, guint queue_depth)
 {
   GstBufferPool *pool;
   GstStructure *structure;
-  guint buf_cnt = MAX(3, num_buf);
+  guint buf_cnt;
+
+  /* Buffers held by the frames in flight are not available to the peer */
+  buf_cnt = MIN (MAX (3, num_buf) + queue_depth - 1, VIDEO_MAX_FRAME);
 
   pool = vspfilter_buffer_pool_new (fd, buftype);
 
@@ -1348,6 +2427,47 @@ gst_vsp_filter_setup_pool (gint fd, enum v4l2_buf_type buftype, GstCaps * caps,
   return pool;
 }
 
+/* Frames converted as tiles do not fit the video nodes, so they are kept in
+ * system memory. The buffers have a row of slack below every plane (see
+ * has_tile_slack()) and strides the device accepts. */
+static GstBufferPool *
+gst_vsp_filter_setup_tile_pool (GstCaps * caps, guint num_buf,
+    guint queue_depth)
+{
+  GstBufferPool *pool;
+  GstStructure *structure;
+  GstVideoAlignment align;
+  GstVideoInfo vinfo;
+  guint i;
+
+  if (!gst_video_info_from_caps (&vinfo, caps))
+    return NULL;
+
+  gst_video_alignment_reset (&align);
+  /* two rows keep the chroma planes of 4:2:0 formats a row of slack */
+  align.padding_bottom = 2;
+  for (i = 0; i < GST_VIDEO_MAX_PLANES; i++)
+    align.stride_align[i] = 127;
+  gst_video_info_align (&vinfo, &align);
+
+  pool = gst_video_buffer_pool_new ();
+
+  structure = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (structure, caps, vinfo.size,
+      MAX (3, num_buf) + queue_depth - 1, 0);
+  gst_buffer_pool_config_add_option (structure,
+      GST_BUFFER_POOL_OPTION_VIDEO_META);
+  gst_buffer_pool_config_add_option (structure,
+      GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT);
+  gst_buffer_pool_config_set_video_alignment (structure, &align);
+  if (!gst_buffer_pool_set_config (pool, structure)) {
+    gst_object_unref (pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
 /* configure the allocation query that was answered downstream, we can configure
  * some properties on it. Only called when not in passthrough mode. */
 static gboolean
@@ -1368,7 +2488,8 @@ gst_vsp_filter_decide_allocation (GstBaseTransform * trans, GstQuery * query)
   guint i;
 
   space = GST_VSP_FILTER_CAST (trans);
-  vsp_info = space->vsp_info;
+  /* the VSP of the last scaling pass writes the output */
+  vsp_info = space->vsps[space->n_passes - 1];
 
   n_allocators = gst_query_get_n_allocation_params (query);
   for (i = 0; i < n_allocators; i++) {
@@ -1399,8 +2520,32 @@ gst_vsp_filter_decide_allocation (GstBaseTransform * trans, GstQuery * query)
   if (n_pools > 0)
     gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
 
+  if (space->n_tiles > 1 || space->roi_batch ||
+      gst_vsp_filter_cpu_borders (space)) {
+    GstCaps *caps;
+
+    /* Tiles are written through userptr into buffers with slack. The
+     * crops of a frame are all held until they are pushed, so the pool
+     * has no maximum. */
+    gst_query_parse_allocation (query, &caps, NULL);
+    if (pool)
+      gst_object_unref (pool);
+    pool = gst_vsp_filter_setup_tile_pool (caps, min,
+        gst_vsp_filter_get_max_frames (space));
+    if (!pool) {
+      GST_ERROR_OBJECT (space, "failed to setup pool");
+      return FALSE;
+    }
+    GST_DEBUG_OBJECT (space, "use our tile pool %p", pool);
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_get_params (config, NULL, &size, &min, &max);
+    gst_structure_free (config);
+    goto done;
+  }
+
+  /* Stripes are written to system memory through userptr */
   if (space->prop_out_mode == GST_VSPFILTER_IO_AUTO && !have_dmabuf
-        && !space->out_pool) {
+        && !space->out_pool && space->n_stripes <= 1) {
     GstCaps *caps;
     GstVideoInfo vinfo;
 
@@ -1412,14 +2557,16 @@ gst_vsp_filter_decide_allocation (GstBaseTransform * trans, GstQuery * query)
         min, max);
     size = MAX(vinfo.size, size);
     space->out_pool = gst_vsp_filter_setup_pool (vsp_info->v4lcap_fd,
-        V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, caps, size, min);
+        V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, caps, size, min,
+        gst_vsp_filter_get_max_frames (space));
     if (!space->out_pool) {
       GST_ERROR_OBJECT (space, "failed to setup pool");
       return FALSE;
     }
+    vsp_info->node_configured[CAP] = FALSE;
   }
 
-  if (space->out_pool) {
+  if (space->out_pool && space->n_stripes <= 1) {
     gst_object_replace ((GstObject **) &pool, (GstObject *) space->out_pool);
     GST_DEBUG_OBJECT (space, "use our pool %p", pool);
     config = gst_buffer_pool_get_config (pool);
@@ -1427,6 +2574,11 @@ gst_vsp_filter_decide_allocation (GstBaseTransform * trans, GstQuery * query)
     gst_structure_free (config);
   }
 
+  if (!pool && space->n_stripes > 1) {
+    GST_DEBUG_OBJECT (space, "no downstream pool, use a video buffer pool");
+    pool = gst_video_buffer_pool_new ();
+  }
+
   /* We need a bufferpool for userptr. */
   if (!pool) {
     GST_ERROR_OBJECT (space, "no pool");
@@ -1434,12 +2586,18 @@ gst_vsp_filter_decide_allocation (GstBaseTransform * trans, GstQuery * query)
   }
 
   if (pool != space->out_pool) {
+    /* The downstream pool has to cover the frames we keep in flight */
+    min += gst_vsp_filter_get_max_frames (space) - 1;
+    if (max && max < min)
+      max = min;
+
     config = gst_buffer_pool_get_config (pool);
     gst_buffer_pool_config_add_option (config,
         GST_BUFFER_POOL_OPTION_VIDEO_META);
     gst_buffer_pool_set_config (pool, config);
   }
 
+done:
   if (n_pools > 0)
     gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
   else
@@ -1462,59 +2620,167 @@ get_stride (GstBuffer * buffer, GstVideoInfo * vinfo, gint plane_index)
       vinfo->stride[plane_index];
 }
 
-static void
-gst_vsp_filter_copy_frame (GstVideoFrame * dest_frame,
-    GstVideoFrame * src_frame, GstVideoInfo * vinfo)
+/* The first component stored in a plane */
+static inline guint
+get_plane_comp (const GstVideoFormatInfo * finfo, guint plane)
 {
-  gint width, height;
-  guint8 *sp, *dp;
-  gint ss, ds;
-  gint i, j;
+  guint comp;
 
-  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (src_frame); i++) {
-    sp = src_frame->data[i];
-    dp = dest_frame->data[i];
+  for (comp = 0; comp < GST_VIDEO_FORMAT_INFO_N_COMPONENTS (finfo); comp++) {
+    if (GST_VIDEO_FORMAT_INFO_PLANE (finfo, comp) == plane)
+      break;
+  }
 
-    width = GST_VIDEO_FRAME_COMP_WIDTH (dest_frame, i) *
-        GST_VIDEO_FRAME_COMP_PSTRIDE (dest_frame, i);
-    height = GST_VIDEO_FRAME_COMP_HEIGHT (dest_frame, i);
+  return comp;
+}
 
-    ss = get_stride (src_frame->buffer, vinfo, i);
-    ds = get_stride (dest_frame->buffer, vinfo, i);
+/* Offset in a plane of the top left pixel of a rectangle */
+static inline gsize
+get_plane_offset (const GstVideoFormatInfo * finfo, guint plane,
+    const GstVideoRectangle * rect, gint stride)
+{
+  guint comp = get_plane_comp (finfo, plane);
 
-    for (j = 0; j < height; j++) {
-      memcpy (dp, sp, width);
-      dp += ds;
-      sp += ss;
-    }
-  }
+  return (gsize) GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, comp, rect->y) *
+      stride + GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, comp, rect->x) *
+      GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp);
 }
 
-static GstFlowReturn
-gst_vsp_filter_prepare_video_frame (GstVspFilter * space,
-    GstVspfilterIOMode io_mode, GstBuffer * buffer,
-    GstMemory * gmem[GST_VIDEO_MAX_PLANES], gint n_mem, GstBufferPool * pool,
-    GstVideoInfo * vinfo, GstVspFilterFrameInfo * vframe_info, guint * buf_index)
+/* The userptr span of a tile is stride * rows from its top left pixel, so
+ * the tiles of the bottom row reach past the plane by up to a row. TRUE if
+ * the memory of every plane has that row. */
+static gboolean
+has_tile_slack (GstBuffer * buffer, GstVideoInfo * vinfo)
 {
-  GstBuffer *mmap_buf;
-  GstVideoFrame frame;
-  GstFlowReturn ret;
-  guint _index;
-  gint i;
+  GstVideoMeta *meta;
+  GstMemory *mem;
+  gsize offset, skip;
+  guint i, idx, len, rows;
 
-  switch (io_mode) {
-    case GST_VSPFILTER_IO_AUTO:
-      _index = vspfilter_buffer_pool_get_buffer_index (buffer);
+  meta = gst_buffer_get_video_meta (buffer);
 
-      if (_index != VSPFILTER_INDEX_INVALID && buffer->pool == pool) {
-        /* This buffer is from our MMAP buffer pool. */
-        vframe_info->io = V4L2_MEMORY_MMAP;
-        *buf_index = _index;
-      } else if (gst_is_dmabuf_memory (gmem[0])) {
-        vframe_info->io = V4L2_MEMORY_DMABUF;
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (vinfo); i++) {
+    offset = meta ? meta->offset[i] : vinfo->offset[i];
+    if (!gst_buffer_find_memory (buffer, offset, 1, &idx, &len, &skip))
+      return FALSE;
+
+    mem = gst_buffer_peek_memory (buffer, idx);
+    rows = GST_VIDEO_INFO_COMP_HEIGHT (vinfo,
+        get_plane_comp (vinfo->finfo, i));
+    if (skip + (gsize) get_stride (buffer, vinfo, i) * (rows + 1) >
+        mem->size)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+gst_vsp_filter_copy_frame (GstVspFilter * space, GstVideoFrame * dest_frame,
+    GstVideoFrame * src_frame, GstVideoInfo * vinfo)
+{
+  VspfilterCopyRegion regions[GST_VIDEO_MAX_PLANES];
+  gint i;
+
+  if (!space->copier) {
+    space->copier = vspfilter_copier_new (space->copy_threads);
+    GST_DEBUG_OBJECT (space, "copying with %u threads",
+        vspfilter_copier_get_n_threads (space->copier));
+  }
+
+  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (src_frame); i++) {
+    regions[i].src = src_frame->data[i];
+    regions[i].dest = dest_frame->data[i];
+
+    regions[i].width = GST_VIDEO_FRAME_COMP_WIDTH (dest_frame, i) *
+        GST_VIDEO_FRAME_COMP_PSTRIDE (dest_frame, i);
+    regions[i].height = GST_VIDEO_FRAME_COMP_HEIGHT (dest_frame, i);
+
+    regions[i].src_stride = get_stride (src_frame->buffer, vinfo, i);
+    regions[i].dest_stride = get_stride (dest_frame->buffer, vinfo, i);
+  }
+
+  vspfilter_copier_copy (space->copier, regions,
+      GST_VIDEO_FRAME_N_PLANES (src_frame));
+}
+
+/* Number of buffers the pool of an upstream buffer may hold, 0 if unknown */
+static guint
+get_pool_size (GstBuffer * buffer)
+{
+  GstStructure *config;
+  guint min = 0, max = 0;
+
+  if (!buffer->pool)
+    return 0;
+
+  config = gst_buffer_pool_get_config (buffer->pool);
+  gst_buffer_pool_config_get_params (config, NULL, NULL, &min, &max);
+  gst_structure_free (config);
+
+  return max ? max : min;
+}
+
+/* The VSP which has the buffers of one of our MMAP pools on its video node.
+ * The other VSPs import them as dmabuf. */
+static GstVspFilterVspInfo *
+gst_vsp_filter_get_pool_vsp (GstVspFilter * space, GstBufferPool * pool)
+{
+  guint k;
+
+  for (k = 0; k + 1 < space->n_passes; k++) {
+    if (pool == space->pass_pools[k])
+      return space->vsps[k + 1];
+  }
+  for (k = 0; k < MAX_OUTPUTS; k++) {
+    if (space->outputs[k] && pool == space->outputs[k]->pool)
+      return space->outputs[k]->vsp_info;
+  }
+  if (pool == space->out_pool)
+    return space->vsps[space->n_passes - 1];
+
+  return space->vsp_info;
+}
+
+static GstFlowReturn
+gst_vsp_filter_prepare_video_frame (GstVspFilter * space,
+    GstVspFilterVspInfo * vsp_info, GstVspfilterIOMode io_mode,
+    GstBuffer * buffer,
+    GstMemory * gmem[GST_VIDEO_MAX_PLANES], gint n_mem, GstBufferPool * pool,
+    GstVideoInfo * vinfo, GstVspFilterFrameInfo * vframe_info, guint * buf_index)
+{
+  GstMemory *pool_mem[GST_VIDEO_MAX_PLANES];
+  GstVspFilterVspInfo *pool_vsp;
+  GstBuffer *mmap_buf;
+  GstVideoFrame frame;
+  GstFlowReturn ret;
+  guint _index;
+  gint n_pool_mem;
+  gint64 start;
+  gint i;
+
+  pool_vsp = gst_vsp_filter_get_pool_vsp (space, pool);
+
+  switch (io_mode) {
+    case GST_VSPFILTER_IO_AUTO:
+      _index = vspfilter_buffer_pool_get_buffer_index (buffer);
+
+      if (_index != VSPFILTER_INDEX_INVALID && buffer->pool == pool &&
+          vsp_info == pool_vsp) {
+        /* This buffer is from our MMAP buffer pool. The other VSPs of the
+         * device pool import it as dmabuf below. */
+        vframe_info->io = V4L2_MEMORY_MMAP;
+        *buf_index = _index;
+      } else if (gst_is_dmabuf_memory (gmem[0])) {
+        vframe_info->io = V4L2_MEMORY_DMABUF;
         for (i = 0; i < n_mem; i++)
           vframe_info->vframe.dmafd[i] = gst_dmabuf_memory_get_fd (gmem[i]);
-        *buf_index = 0;
+        if (!vspfilter_buffer_key_from_dmabuf (&vframe_info->key, gmem, n_mem))
+          vframe_info->key.n_planes = 0;
+        if (!vsp_info->already_setup_info)
+          vframe_info->n_slots = get_pool_size (buffer);
+        /* assigned when the frame is queued */
+        *buf_index = VSPFILTER_INDEX_INVALID;
       } else {
         /* Only input buffers can pass this route. */
         GST_LOG_OBJECT (space, "Copy buffer %p to MMAP memory", buffer);
@@ -1523,9 +2789,14 @@ gst_vsp_filter_prepare_video_frame (GstVspFilter * space,
           goto activate_failed;
 
         /* Get a buffer from our MMAP buffer pool */
+        start = g_get_monotonic_time ();
         ret = gst_buffer_pool_acquire_buffer (pool, &mmap_buf, NULL);
         if (ret != GST_FLOW_OK)
           goto no_buffer;
+        vframe_info->staging_usec = g_get_monotonic_time () - start;
+        vspfilter_stats_record (&space->stats, VSPFILTER_STAGE_STAGING,
+            vframe_info->staging_usec);
+        vspfilter_stats_count (&space->stats, VSPFILTER_COUNTER_COPIES);
 
         if (!gst_video_frame_map (&frame, vinfo, buffer, GST_MAP_READ))
           goto invalid_buffer;
@@ -1536,12 +2807,30 @@ gst_vsp_filter_prepare_video_frame (GstVspFilter * space,
         }
         gst_buffer_unref (mmap_buf);
 
-        gst_vsp_filter_copy_frame (&vframe_info->vframe.frame, &frame, vinfo);
+        gst_vsp_filter_copy_frame (space, &vframe_info->vframe.frame, &frame,
+            vinfo);
 
         gst_video_frame_unmap (&frame);
 
-        vframe_info->io = V4L2_MEMORY_MMAP;
-        *buf_index = vspfilter_buffer_pool_get_buffer_index (mmap_buf);
+        if (vsp_info == pool_vsp) {
+          vframe_info->io = V4L2_MEMORY_MMAP;
+          *buf_index = vspfilter_buffer_pool_get_buffer_index (mmap_buf);
+        } else {
+          n_pool_mem = gst_buffer_n_memory (mmap_buf);
+          for (i = 0; i < n_pool_mem; i++)
+            pool_mem[i] = gst_buffer_peek_memory (mmap_buf, i);
+
+          vframe_info->io = V4L2_MEMORY_DMABUF;
+          for (i = 0; i < n_pool_mem; i++)
+            vframe_info->vframe.dmafd[i] =
+                gst_dmabuf_memory_get_fd (pool_mem[i]);
+          if (!vspfilter_buffer_key_from_dmabuf (&vframe_info->key, pool_mem,
+                  n_pool_mem))
+            vframe_info->key.n_planes = 0;
+          if (!vsp_info->already_setup_info)
+            vframe_info->n_slots = get_pool_size (mmap_buf);
+          *buf_index = VSPFILTER_INDEX_INVALID;
+        }
       }
       break;
     case GST_VSPFILTER_IO_USERPTR:
@@ -1550,7 +2839,12 @@ gst_vsp_filter_prepare_video_frame (GstVspFilter * space,
         goto invalid_buffer;
 
       vframe_info->io = V4L2_MEMORY_USERPTR;
-      *buf_index = 0;
+      vspfilter_buffer_key_from_userptr (&vframe_info->key,
+          &vframe_info->vframe.frame);
+      if (!vsp_info->already_setup_info)
+        vframe_info->n_slots = get_pool_size (buffer);
+      /* assigned when the frame is queued */
+      *buf_index = VSPFILTER_INDEX_INVALID;
       break;
     default:
       g_assert_not_reached ();
@@ -1577,25 +2871,304 @@ invalid_buffer:
   }
 }
 
+/* Gives back the V4L2 buffers and the mappings the job was queued with.
+ * Must be called with jobs_lock held */
+static void
+gst_vsp_filter_release_frames (GstVspFilter * space, GstVspFilterJob * job)
+{
+  GstVspFilterVspInfo *vsp_info;
+
+  vsp_info = job->vsp_info;
+
+  if (job->in_vframe_info.io != V4L2_MEMORY_MMAP)
+    vspfilter_index_cache_release (vsp_info->index_cache[OUT], job->in_index);
+  if (job->out_vframe_info.io != V4L2_MEMORY_MMAP)
+    vspfilter_index_cache_release (vsp_info->index_cache[CAP], job->out_index);
+
+  if (job->in_vframe_info.vframe.frame.buffer)
+    gst_video_frame_unmap (&job->in_vframe_info.vframe.frame);
+  if (job->out_vframe_info.vframe.frame.buffer)
+    gst_video_frame_unmap (&job->out_vframe_info.vframe.frame);
+
+  memset (&job->in_vframe_info, 0, sizeof (job->in_vframe_info));
+  memset (&job->out_vframe_info, 0, sizeof (job->out_vframe_info));
+  job->in_index = job->out_index = VSPFILTER_INDEX_INVALID;
+}
+
+/* Must be called with jobs_lock held */
+static void
+gst_vsp_filter_free_job (GstVspFilter * space, GstVspFilterJob * job)
+{
+  guint k;
+
+  gst_vsp_filter_release_frames (space, job);
+
+  if (job->inbuf)
+    gst_buffer_unref (job->inbuf);
+  if (job->outbuf)
+    gst_buffer_unref (job->outbuf);
+  for (k = 0; k < MAX_PASSES - 1; k++) {
+    if (job->pass_buf[k])
+      gst_buffer_unref (job->pass_buf[k]);
+  }
+
+  g_slice_free (GstVspFilterJob, job);
+}
+
+/* Posts the statistics as an element message every stats-interval */
+static void
+gst_vsp_filter_post_stats (GstVspFilter * space)
+{
+  gint64 now;
+
+  if (!space->stats_interval)
+    return;
+
+  now = g_get_monotonic_time ();
+  if (space->last_stats_post &&
+      now - space->last_stats_post <
+      space->stats_interval * G_GINT64_CONSTANT (1000))
+    return;
+  space->last_stats_post = now;
+
+  gst_element_post_message (GST_ELEMENT_CAST (space),
+      gst_message_new_element (GST_OBJECT_CAST (space),
+          vspfilter_stats_to_structure (&space->stats)));
+}
+
 static GstFlowReturn
-gst_vsp_filter_transform (GstBaseTransform * trans, GstBuffer * inbuf,
-    GstBuffer * outbuf)
+gst_vsp_filter_prepare_output_buffer (GstBaseTransform * trans,
+    GstBuffer * input, GstBuffer ** outbuf)
 {
-  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (trans);
-  GstVspFilter *space;
+  GstVspFilter *space = GST_VSP_FILTER_CAST (trans);
+  GstFlowReturn ret;
+  gint64 start;
+
+  start = g_get_monotonic_time ();
+  ret = GST_BASE_TRANSFORM_CLASS (parent_class)->prepare_output_buffer (trans,
+      input, outbuf);
+  vspfilter_stats_record (&space->stats, VSPFILTER_STAGE_ACQUIRE,
+      g_get_monotonic_time () - start);
+
+  return ret;
+}
+
+/* Chooses the VSP of the device pool the next frame is queued to, either
+ * in turn or the one with the fewest frames in flight. The search starts
+ * after the last one chosen so that ties are spread out.
+ * Must be called with jobs_lock held */
+static GstVspFilterVspInfo *
+gst_vsp_filter_pick_vsp (GstVspFilter * space)
+{
+  GstVspFilterVspInfo *vsp_info, *best = NULL;
+  guint i, n, best_n = 0;
+
+  for (i = 0; i < space->n_vsps; i++) {
+    n = (space->next_vsp + i) % space->n_vsps;
+    vsp_info = space->vsps[n];
+    if (vsp_info->disabled)
+      continue;
+
+    if (!best || vsp_info->n_jobs < best->n_jobs) {
+      best = vsp_info;
+      best_n = n;
+    }
+    if (space->device_pool != GST_VSPFILTER_DEVICE_POOL_LEAST_LOADED)
+      break;
+  }
+
+  /* the first VSP is never disabled */
+  if (!best)
+    return space->vsp_info;
+
+  space->next_vsp = best_n + 1;
+
+  return best;
+}
+
+/* Takes a buffer of every pool between the scaling passes for a frame */
+static GstFlowReturn
+gst_vsp_filter_acquire_pass_buffers (GstVspFilter * space,
+    GstVspFilterJob * job)
+{
+  GstFlowReturn ret;
+  guint k;
+
+  for (k = 0; k + 1 < space->n_passes; k++) {
+    if (!gst_buffer_pool_set_active (space->pass_pools[k], TRUE)) {
+      GST_ERROR_OBJECT (space, "Failed to activate bufferpool");
+      return GST_FLOW_ERROR;
+    }
+    ret = gst_buffer_pool_acquire_buffer (space->pass_pools[k],
+        &job->pass_buf[k], NULL);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* Prepares the buffers of a job and queues them to its VSP, the input
+ * buffer and queued_out, which is outbuf unless it is scaled in passes.
+ * The job is then added to queue, which holds it from now on. When the
+ * input has to be copied, *staged is set to the buffer of our pool it was
+ * copied to. */
+static GstFlowReturn
+gst_vsp_filter_start_job (GstVspFilter * space, GstVspFilterJob * job,
+    GstBuffer * inbuf, GstBuffer * outbuf, GstBuffer * queued_out,
+    GstVspfilterIOMode in_mode, GstVspfilterIOMode out_mode,
+    GstBufferPool * out_pool, GQueue * queue, GstBuffer ** staged)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstVspFilterVspInfo *vsp_info = job->vsp_info;
+  GstMemory *in_gmem[GST_VIDEO_MAX_PLANES], *out_gmem[GST_VIDEO_MAX_PLANES];
+  GstBuffer *in_frame_buf;
+  gint in_stride[GST_VIDEO_MAX_PLANES] = { 0 };
+  gint out_stride[GST_VIDEO_MAX_PLANES] = { 0 };
+  GstFlowReturn ret;
+  gint in_n_mem = 0, out_n_mem = 0;
+  gint64 start;
+  gint i;
+
+  in_n_mem = gst_buffer_n_memory (inbuf);
+  out_n_mem = gst_buffer_n_memory (queued_out);
+
+  for (i = 0; i < in_n_mem; i++)
+    in_gmem[i] = gst_buffer_get_memory (inbuf, i);
+  for (i = 0; i < out_n_mem; i++)
+    out_gmem[i] = gst_buffer_get_memory (queued_out, i);
+
+  start = g_get_monotonic_time ();
+  ret = gst_vsp_filter_prepare_video_frame (space, vsp_info, in_mode,
+      inbuf, in_gmem, in_n_mem, space->in_pool,
+      vsp_info->in_info, &job->in_vframe_info, &job->in_index);
+  if (ret != GST_FLOW_OK)
+    goto start_exit;
+
+  ret = gst_vsp_filter_prepare_video_frame (space, vsp_info, out_mode,
+      queued_out, out_gmem, out_n_mem, out_pool, vsp_info->out_info,
+      &job->out_vframe_info, &job->out_index);
+  if (ret != GST_FLOW_OK)
+    goto start_exit;
+  vspfilter_stats_record (&space->stats, VSPFILTER_STAGE_PREPARE,
+      g_get_monotonic_time () - start - job->in_vframe_info.staging_usec -
+      job->out_vframe_info.staging_usec);
+
+  /* When copying inbuf to our pool's buffer, in_vframe_info has the buffer
+     which will be actually queued to the device, so we should get strides
+     from it. */
+  in_frame_buf = job->in_vframe_info.vframe.frame.buffer;
+  if (in_frame_buf && in_frame_buf != inbuf && staged)
+    *staged = gst_buffer_ref (in_frame_buf);
+
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (vsp_info->in_info); i++) {
+    in_stride[i] = get_stride ((in_frame_buf && in_frame_buf != inbuf) ?
+        in_frame_buf : inbuf, vsp_info->in_info, i);
+  }
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (vsp_info->out_info); i++)
+    out_stride[i] = get_stride (queued_out, vsp_info->out_info, i);
+
+  g_mutex_lock (&space->jobs_lock);
+  ret =
+      gst_vsp_filter_transform_frame_process (filter, vsp_info, job->tile,
+      &job->in_vframe_info, &job->out_vframe_info, in_stride, out_stride,
+      &job->in_index, &job->out_index);
+  if (ret == GST_FLOW_OK) {
+    job->inbuf = gst_buffer_ref (inbuf);
+    job->outbuf = gst_buffer_ref (outbuf);
+    g_queue_push_tail (queue, job);
+    vsp_info->n_jobs++;
+    g_cond_broadcast (&space->jobs_cond);
+  }
+  g_mutex_unlock (&space->jobs_lock);
+
+start_exit:
+  for (i = 0; i < in_n_mem; i++)
+    gst_memory_unref (in_gmem[i]);
+  for (i = 0; i < out_n_mem; i++)
+    gst_memory_unref (out_gmem[i]);
+
+  return ret;
+}
+
+/* Prepares a pair of buffers and queues them to a VSP. The frame stays in
+ * pending_jobs until gst_vsp_filter_complete_job() dequeues it. When the
+ * input has to be copied, *staged is set to the buffer of our pool it was
+ * copied to. With several scaling passes, this queues the first one. */
+static GstFlowReturn
+gst_vsp_filter_queue_job (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    GstBuffer * inbuf, GstBuffer * outbuf, GstVspfilterIOMode in_mode,
+    GstVspfilterIOMode out_mode, const GstVspFilterTile * tile,
+    gboolean partial, GstBuffer ** staged)
+{
+  GstVspFilterJob *job;
+  GstBuffer *queued_out;
+  GstBufferPool *out_pool;
+  GstFlowReturn ret;
+
+  job = g_slice_new0 (GstVspFilterJob);
+  job->vsp_info = vsp_info;
+  job->partial = partial;
+  job->tile = tile;
+  job->in_index = job->out_index = VSPFILTER_INDEX_INVALID;
+
+  queued_out = outbuf;
+  out_pool = space->out_pool;
+  if (space->n_passes > 1) {
+    ret = gst_vsp_filter_acquire_pass_buffers (space, job);
+    if (ret != GST_FLOW_OK)
+      goto queue_failed;
+    queued_out = job->pass_buf[0];
+    out_pool = space->pass_pools[0];
+    out_mode = GST_VSPFILTER_IO_AUTO;
+  }
+
+  ret = gst_vsp_filter_start_job (space, job, inbuf, outbuf, queued_out,
+      in_mode, out_mode, out_pool, &space->pending_jobs, staged);
+  if (ret == GST_FLOW_OK)
+    return ret;
+
+queue_failed:
+  g_mutex_lock (&space->jobs_lock);
+  gst_vsp_filter_free_job (space, job);
+  g_mutex_unlock (&space->jobs_lock);
+
+  return ret;
+}
+
+/* Queues the next scaling pass of a job to its VSP once the previous one
+ * is done. It reads the buffer the previous pass wrote, which is already
+ * in the pool of its video node, so nothing is copied.
+ * Must be called with jobs_lock held */
+static GstFlowReturn
+gst_vsp_filter_queue_next_pass (GstVspFilter * space, GstVspFilterJob * job)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
   GstMemory *in_gmem[GST_VIDEO_MAX_PLANES], *out_gmem[GST_VIDEO_MAX_PLANES];
-  GstVspFilterFrameInfo in_vframe_info, out_vframe_info;
+  GstVspFilterVspInfo *vsp_info;
+  GstBuffer *inbuf, *outbuf;
+  GstBufferPool *out_pool;
+  GstVspfilterIOMode out_mode;
   gint in_stride[GST_VIDEO_MAX_PLANES] = { 0 };
   gint out_stride[GST_VIDEO_MAX_PLANES] = { 0 };
   GstFlowReturn ret;
   gint in_n_mem, out_n_mem;
-  guint in_index, out_index;
   gint i;
 
-  if (G_UNLIKELY (!filter->negotiated))
-    goto unknown_format;
+  gst_vsp_filter_release_frames (space, job);
 
-  space = GST_VSP_FILTER_CAST (filter);
+  job->pass++;
+  vsp_info = job->vsp_info = space->vsps[job->pass];
+  inbuf = job->pass_buf[job->pass - 1];
+  if (job->pass + 1 < space->n_passes) {
+    outbuf = job->pass_buf[job->pass];
+    out_pool = space->pass_pools[job->pass];
+    out_mode = GST_VSPFILTER_IO_AUTO;
+  } else {
+    outbuf = job->outbuf;
+    out_pool = space->out_pool;
+    out_mode = space->prop_out_mode;
+  }
 
   in_n_mem = gst_buffer_n_memory (inbuf);
   out_n_mem = gst_buffer_n_memory (outbuf);
@@ -1605,118 +3178,2555 @@ gst_vsp_filter_transform (GstBaseTransform * trans, GstBuffer * inbuf,
   for (i = 0; i < out_n_mem; i++)
     out_gmem[i] = gst_buffer_get_memory (outbuf, i);
 
-  memset (&in_vframe_info, 0, sizeof (in_vframe_info));
-  memset (&out_vframe_info, 0, sizeof (out_vframe_info));
-
-  ret = gst_vsp_filter_prepare_video_frame (space, space->prop_in_mode, inbuf,
-      in_gmem, in_n_mem, space->in_pool, &filter->in_info,
-      &in_vframe_info, &in_index);
+  ret = gst_vsp_filter_prepare_video_frame (space, vsp_info,
+      GST_VSPFILTER_IO_AUTO, inbuf, in_gmem, in_n_mem,
+      space->pass_pools[job->pass - 1], vsp_info->in_info,
+      &job->in_vframe_info, &job->in_index);
   if (ret != GST_FLOW_OK)
-    goto transform_exit;
+    goto pass_exit;
 
-  ret = gst_vsp_filter_prepare_video_frame (space, space->prop_out_mode, outbuf,
-      out_gmem, out_n_mem, space->out_pool, &filter->out_info,
-      &out_vframe_info, &out_index);
+  ret = gst_vsp_filter_prepare_video_frame (space, vsp_info, out_mode,
+      outbuf, out_gmem, out_n_mem, out_pool, vsp_info->out_info,
+      &job->out_vframe_info, &job->out_index);
   if (ret != GST_FLOW_OK)
-    goto transform_exit;
-
-  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (&filter->in_info); i++) {
-    /* When copying inbuf to our pool's buffer, in_vframe_info has the buffer
-       which will be actually queued to the device, so we should get strides
-       from it. */
-    in_stride[i] = get_stride (
-        (in_vframe_info.vframe.frame.buffer
-            && in_vframe_info.vframe.frame.buffer != inbuf) ?
-        in_vframe_info.vframe.frame.buffer : inbuf, &filter->in_info, i);
+    goto pass_exit;
+
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (vsp_info->in_info); i++)
+    in_stride[i] = get_stride (inbuf, vsp_info->in_info, i);
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (vsp_info->out_info); i++)
+    out_stride[i] = get_stride (outbuf, vsp_info->out_info, i);
+
+  ret = gst_vsp_filter_transform_frame_process (filter, vsp_info, NULL,
+      &job->in_vframe_info, &job->out_vframe_info, in_stride, out_stride,
+      &job->in_index, &job->out_index);
+  if (ret == GST_FLOW_OK) {
+    vsp_info->n_jobs++;
+    g_cond_broadcast (&space->jobs_cond);
   }
-  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (&filter->out_info); i++)
-    out_stride[i] = get_stride (outbuf, &filter->out_info, i);
-
-  ret =
-      gst_vsp_filter_transform_frame_process (filter, &in_vframe_info,
-      &out_vframe_info, in_stride, out_stride, in_index, out_index);
-
-transform_exit:
-  if (in_vframe_info.vframe.frame.buffer)
-    gst_video_frame_unmap (&in_vframe_info.vframe.frame);
-  if (out_vframe_info.vframe.frame.buffer)
-    gst_video_frame_unmap (&out_vframe_info.vframe.frame);
 
+pass_exit:
   for (i = 0; i < in_n_mem; i++)
     gst_memory_unref (in_gmem[i]);
   for (i = 0; i < out_n_mem; i++)
     gst_memory_unref (out_gmem[i]);
 
   return ret;
+}
+
+/* Copies a frame to a buffer of our pool */
+static GstFlowReturn
+gst_vsp_filter_stage_frame (GstVspFilter * space, GstBuffer * inbuf,
+    GstBuffer ** staged)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstVideoFrame src, dest;
+  GstFlowReturn ret;
+
+  if (!gst_buffer_pool_set_active (space->in_pool, TRUE))
+    goto activate_failed;
+
+  ret = gst_buffer_pool_acquire_buffer (space->in_pool, staged, NULL);
+  if (ret != GST_FLOW_OK)
+    return ret;
+  vspfilter_stats_count (&space->stats, VSPFILTER_COUNTER_COPIES);
+
+  if (!gst_video_frame_map (&src, &filter->in_info, inbuf, GST_MAP_READ))
+    goto invalid_buffer;
+  if (!gst_video_frame_map (&dest, &filter->in_info, *staged,
+          GST_MAP_WRITE)) {
+    gst_video_frame_unmap (&src);
+    goto invalid_buffer;
+  }
+
+  gst_vsp_filter_copy_frame (space, &dest, &src, &filter->in_info);
+
+  gst_video_frame_unmap (&dest);
+  gst_video_frame_unmap (&src);
+
+  return GST_FLOW_OK;
 
   /* ERRORS */
-unknown_format:
+activate_failed:
   {
-    GST_ELEMENT_ERROR (filter, CORE, NOT_IMPLEMENTED, (NULL),
-        ("unknown format"));
-    return GST_FLOW_NOT_NEGOTIATED;
+    GST_ERROR_OBJECT (space, "Failed to activate bufferpool");
+    return GST_FLOW_ERROR;
+  }
+invalid_buffer:
+  {
+    gst_buffer_unref (*staged);
+    *staged = NULL;
+    GST_ELEMENT_ERROR (space, CORE, FAILED, (NULL),
+        ("invalid video buffer received"));
+    return GST_FLOW_ERROR;
   }
 }
 
-static gboolean
-gst_vsp_filter_set_caps (GstBaseTransform * trans, GstCaps * incaps,
-    GstCaps * outcaps)
+/* Fills the output around the area the VSP scales the picture to with the
+ * rows packed by make_border_line() */
+static GstFlowReturn
+gst_vsp_filter_fill_borders (GstVspFilter * space, GstBuffer * outbuf)
 {
-  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (trans);
-  GstVideoFilterClass *fclass;
-  GstVideoInfo in_info, out_info;
-  GstVspFilter *space;
-  GstVspFilterVspInfo *vsp_info;
-  GstBufferPool *in_newpool;
-  GstBufferPool *out_newpool;
-  guint buf_min = 0, buf_max = 0;
-  GstStructure *ins, *outs;
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  const GstVideoFormatInfo *finfo = filter->out_info.finfo;
+  GstVideoRectangle *rect = &space->borders;
+  GstVideoFrame frame;
+  guint8 *line, *dest;
+  gsize left, right, size;
+  guint i, comp, top, bottom, rows, y;
+
+  if (!gst_video_frame_map (&frame, &filter->out_info, outbuf, GST_MAP_WRITE))
+    goto invalid_buffer;
+
+  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (&frame); i++) {
+    comp = get_plane_comp (finfo, i);
+    line = space->border_line + space->border_info.offset[i];
+    size = GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, comp,
+        filter->out_info.width) * GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp);
+    left = GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, comp, rect->x) *
+        GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp);
+    right = GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, comp,
+        rect->x + rect->w) * GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp);
+    top = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, comp, rect->y);
+    bottom = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, comp,
+        rect->y + rect->h);
+    rows = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, comp);
+
+    for (y = 0; y < rows; y++) {
+      dest = (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&frame, i) +
+          y * GST_VIDEO_FRAME_PLANE_STRIDE (&frame, i);
+      if (y < top || y >= bottom) {
+        memcpy (dest, line, size);
+      } else {
+        memcpy (dest, line, left);
+        memcpy (dest + right, line + right, size - right);
+      }
+    }
+  }
 
-  space = GST_VSP_FILTER_CAST (filter);
-  fclass = GST_VIDEO_FILTER_GET_CLASS (filter);
-  vsp_info = space->vsp_info;
+  gst_video_frame_unmap (&frame);
 
-  /* input caps */
-  if (!gst_video_info_from_caps (&in_info, incaps))
-    goto invalid_caps;
+  return GST_FLOW_OK;
 
-  /* output caps */
-  if (!gst_video_info_from_caps (&out_info, outcaps))
-    goto invalid_caps;
+  /* ERRORS */
+invalid_buffer:
+  {
+    GST_ELEMENT_ERROR (space, CORE, FAILED, (NULL),
+        ("invalid video buffer received"));
+    return GST_FLOW_ERROR;
+  }
+}
 
-  /* these must match */
-  if (in_info.fps_n != out_info.fps_n || in_info.fps_d != out_info.fps_d)
-    goto format_mismatch;
+/* Queues all the tiles of a frame to one VSP back to back. They are read
+ * and written through userptr at their place in the frames. */
+static GstFlowReturn
+gst_vsp_filter_submit_tiles (GstVspFilter * space, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstVspFilterVspInfo *vsp_info;
+  GstBuffer *staged = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint i;
 
-  /* if present, these must match too */
-  if (in_info.interlace_mode != out_info.interlace_mode)
-    goto format_mismatch;
+  if (!has_tile_slack (outbuf, &filter->out_info))
+    goto no_slack;
 
-  ins = gst_caps_get_structure (incaps, 0);
-  if (!find_colorimetry (gst_structure_get_value (ins, "colorimetry"))) {
-    in_info.colorimetry.range = GST_VIDEO_COLOR_RANGE_UNKNOWN;
-    in_info.colorimetry.matrix = GST_VIDEO_COLOR_MATRIX_UNKNOWN;
+  if (!has_tile_slack (inbuf, &filter->in_info)) {
+    GST_LOG_OBJECT (space, "Copy buffer %p to tile memory", inbuf);
+    ret = gst_vsp_filter_stage_frame (space, inbuf, &staged);
+    if (ret != GST_FLOW_OK)
+      return ret;
   }
 
-  outs = gst_caps_get_structure (outcaps, 0);
-  if (!find_colorimetry (gst_structure_get_value (outs, "colorimetry"))) {
-    out_info.colorimetry.range = GST_VIDEO_COLOR_RANGE_UNKNOWN;
-    out_info.colorimetry.matrix = GST_VIDEO_COLOR_MATRIX_UNKNOWN;
+  g_mutex_lock (&space->jobs_lock);
+  vsp_info = gst_vsp_filter_pick_vsp (space);
+  g_mutex_unlock (&space->jobs_lock);
+
+  for (i = 0; i < space->n_tiles && ret == GST_FLOW_OK; i++) {
+    ret = gst_vsp_filter_queue_job (space, vsp_info,
+        staged ? staged : inbuf, outbuf, GST_VSPFILTER_IO_USERPTR,
+        GST_VSPFILTER_IO_USERPTR, &space->tiles[i], i < space->n_tiles - 1,
+        NULL);
+  }
+
+  if (staged)
+    gst_buffer_unref (staged);
+
+  return ret;
+
+  /* ERRORS */
+no_slack:
+  {
+    GST_ELEMENT_ERROR (space, RESOURCE, FAILED, (NULL),
+        ("the output buffer has no room below the planes for the tiles"));
+    return GST_FLOW_ERROR;
+  }
+}
+
+/* Queues a frame to the device. Frames larger than the device are queued
+ * as tiles. With stripes, every VSP converts its own stripe of it into the
+ * same output buffer. Only the job of the last tile or stripe hands over
+ * the output buffer. Frames scaled in passes go through a VSP each, one
+ * after the other. */
+static GstFlowReturn
+gst_vsp_filter_submit_job (GstVspFilter * space, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstVspFilterVspInfo *vsp_info;
+  GstVspfilterIOMode out_mode = space->prop_out_mode;
+  GstBuffer *staged = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint i;
+
+  if (G_UNLIKELY (!filter->negotiated))
+    goto unknown_format;
+
+  gst_vsp_filter_post_stats (space);
+  gst_vsp_filter_apply_orientation (space);
+  if (!gst_vsp_filter_apply_crop_meta (space, inbuf))
+    gst_vsp_filter_pass_crop_meta (space, inbuf, outbuf);
+  gst_vsp_filter_apply_overlays (space, inbuf);
+
+  /* The picture is written through userptr at its place in the frame,
+   * unless the BRU places it */
+  if (gst_vsp_filter_cpu_borders (space)) {
+    ret = gst_vsp_filter_fill_borders (space, outbuf);
+    if (ret != GST_FLOW_OK)
+      return ret;
+    out_mode = GST_VSPFILTER_IO_USERPTR;
+  }
+
+  if (space->n_tiles > 1)
+    return gst_vsp_filter_submit_tiles (space, inbuf, outbuf);
+
+  if (space->n_passes > 1)
+    return gst_vsp_filter_queue_job (space, space->vsps[0], inbuf, outbuf,
+        space->prop_in_mode, space->prop_out_mode, NULL, FALSE, NULL);
+
+  if (space->n_stripes > 1) {
+    /* The input copied for the first stripe is imported by the others */
+    for (i = 0; i < space->n_stripes && ret == GST_FLOW_OK; i++) {
+      ret = gst_vsp_filter_queue_job (space, space->vsps[i],
+          staged ? staged : inbuf, outbuf, space->prop_in_mode,
+          GST_VSPFILTER_IO_USERPTR, NULL, i < space->n_stripes - 1,
+          i == 0 ? &staged : NULL);
+    }
+    if (staged)
+      gst_buffer_unref (staged);
+
+    return ret;
+  }
+
+  do {
+    g_mutex_lock (&space->jobs_lock);
+    vsp_info = gst_vsp_filter_pick_vsp (space);
+    g_mutex_unlock (&space->jobs_lock);
+
+    ret = gst_vsp_filter_queue_job (space, vsp_info, inbuf, outbuf,
+        space->prop_in_mode, out_mode, NULL, FALSE, NULL);
+    /* Another VSP of the device pool takes over */
+  } while (ret != GST_FLOW_OK && vsp_info->disabled);
+
+  return ret;
+
+  /* ERRORS */
+unknown_format:
+  {
+    GST_ELEMENT_ERROR (filter, CORE, NOT_IMPLEMENTED, (NULL),
+        ("unknown format"));
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+}
+
+/* Throws away the frames in flight. Stopping the streams makes the driver
+ * give back all the queued buffers. The output task must not be running. */
+static void
+gst_vsp_filter_flush_jobs (GstVspFilter * space)
+{
+  GstVspFilterVspInfo *vsp_info;
+  GstVspFilterJob *job;
+  guint i;
+
+  g_mutex_lock (&space->jobs_lock);
+  if (g_queue_is_empty (&space->pending_jobs)) {
+    g_mutex_unlock (&space->jobs_lock);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (space, "dropping %u frames in flight",
+      g_queue_get_length (&space->pending_jobs));
+
+  for (i = 0; i < space->n_vsps; i++) {
+    vsp_info = space->vsps[i];
+    if (vsp_info->is_stream_started)
+      stop_streaming (space, vsp_info);
+    vsp_info->n_jobs = 0;
+  }
+
+  while ((job = g_queue_pop_head (&space->pending_jobs)))
+    gst_vsp_filter_free_job (space, job);
+  g_cond_broadcast (&space->jobs_cond);
+  g_mutex_unlock (&space->jobs_lock);
+}
+
+/* Pushes the output buffers of completed frames from the src pad task */
+static void
+gst_vsp_filter_output_loop (GstVspFilter * space)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM_CAST (space);
+  GstVspFilterVspInfo *vsp_info;
+  GstBuffer *outbuf = NULL;
+  GstFlowReturn ret;
+  glong waited = 0;
+  gint64 start;
+  gint ready;
+
+  g_mutex_lock (&space->jobs_lock);
+  while (g_queue_is_empty (&space->pending_jobs) && !space->flushing)
+    g_cond_wait (&space->jobs_cond, &space->jobs_lock);
+  if (space->flushing) {
+    g_mutex_unlock (&space->jobs_lock);
+    goto pause;
+  }
+  /* the oldest frame is pushed first */
+  vsp_info = ((GstVspFilterJob *) g_queue_peek_head (&space->pending_jobs))->
+      vsp_info;
+  g_mutex_unlock (&space->jobs_lock);
+
+  /* Wait outside the lock so that the streaming thread can queue more
+   * frames meanwhile. Wake up regularly to notice flushes. */
+  start = g_get_monotonic_time ();
+  do {
+    ready = wait_for_capture (space, vsp_info, 100000);
+    waited += 100000;
+  } while (ready == 0 && !space->flushing && waited < 2 * G_USEC_PER_SEC);
+  vspfilter_stats_record (&space->stats, VSPFILTER_STAGE_WAIT,
+      g_get_monotonic_time () - start);
+
+  g_mutex_lock (&space->jobs_lock);
+  if (space->flushing) {
+    g_mutex_unlock (&space->jobs_lock);
+    goto pause;
+  }
+  if (ready <= 0) {
+    if (ready == 0)
+      vspfilter_stats_count (&space->stats, VSPFILTER_COUNTER_TIMEOUTS);
+    GST_ERROR_OBJECT (space, "select %s", ready == 0 ? "timeout" : "for cap");
+    ret = GST_FLOW_ERROR;
+  } else {
+    ret = gst_vsp_filter_complete_job (space, FALSE, &outbuf);
+  }
+  space->pushing = (outbuf != NULL);
+  g_mutex_unlock (&space->jobs_lock);
+
+  if (outbuf)
+    ret = gst_pad_push (GST_BASE_TRANSFORM_SRC_PAD (trans), outbuf);
+
+  g_mutex_lock (&space->jobs_lock);
+  space->pushing = FALSE;
+  if (ret != GST_FLOW_OK)
+    space->output_flow = ret;
+  g_cond_broadcast (&space->jobs_cond);
+  g_mutex_unlock (&space->jobs_lock);
+
+  if (ret != GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (space, "pausing output task, reason %s",
+        gst_flow_get_name (ret));
+    goto pause;
+  }
+
+  return;
+
+pause:
+  gst_pad_pause_task (GST_BASE_TRANSFORM_SRC_PAD (trans));
+}
+
+static void
+gst_vsp_filter_stop_output_task (GstVspFilter * space)
+{
+  g_mutex_lock (&space->jobs_lock);
+  space->flushing = TRUE;
+  g_cond_broadcast (&space->jobs_cond);
+  g_mutex_unlock (&space->jobs_lock);
+
+  gst_pad_stop_task (GST_BASE_TRANSFORM_SRC_PAD (space));
+
+  g_mutex_lock (&space->jobs_lock);
+  space->flushing = FALSE;
+  g_mutex_unlock (&space->jobs_lock);
+}
+
+/* Waits for all the frames in flight and pushes them downstream */
+static void
+gst_vsp_filter_drain_jobs (GstVspFilter * space)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM_CAST (space);
+  GstBuffer *outbuf;
+  GstFlowReturn ret;
+  gboolean left;
+
+  if (space->async_output) {
+    /* The output task pushes them; wait until it is done */
+    g_mutex_lock (&space->jobs_lock);
+    while ((!g_queue_is_empty (&space->pending_jobs) || space->pushing) &&
+        space->output_flow == GST_FLOW_OK && !space->flushing)
+      g_cond_wait (&space->jobs_cond, &space->jobs_lock);
+    left = !g_queue_is_empty (&space->pending_jobs);
+    g_mutex_unlock (&space->jobs_lock);
+
+    if (left) {
+      gst_vsp_filter_stop_output_task (space);
+      gst_vsp_filter_flush_jobs (space);
+    }
+    return;
+  }
+
+  while (!g_queue_is_empty (&space->pending_jobs)) {
+    g_mutex_lock (&space->jobs_lock);
+    ret = gst_vsp_filter_complete_job (space, TRUE, &outbuf);
+    g_mutex_unlock (&space->jobs_lock);
+    if (ret != GST_FLOW_OK) {
+      gst_vsp_filter_flush_jobs (space);
+      break;
+    }
+
+    ret = gst_pad_push (GST_BASE_TRANSFORM_SRC_PAD (trans), outbuf);
+    if (ret != GST_FLOW_OK)
+      GST_DEBUG_OBJECT (space, "pushing a drained frame returned %s",
+          gst_flow_get_name (ret));
+  }
+}
+
+static GstFlowReturn
+gst_vsp_filter_transform (GstBaseTransform * trans, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstVspFilter *space;
+  GstBuffer *done = NULL;
+  GstFlowReturn ret;
+
+  space = GST_VSP_FILTER_CAST (trans);
+
+  ret = gst_vsp_filter_submit_job (space, inbuf, outbuf);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  g_mutex_lock (&space->jobs_lock);
+  ret = gst_vsp_filter_complete_job (space, TRUE, &done);
+  g_mutex_unlock (&space->jobs_lock);
+  if (done)
+    gst_buffer_unref (done);
+
+  return ret;
+}
+
+/* Clips a region of a frame to it, on the chroma sample grid */
+static gboolean
+get_crop_rect (GstVideoInfo * in_info, guint x, guint y, guint w, guint h,
+    GstVideoRectangle * rect)
+{
+  guint w_align, h_align;
+  guint x0, y0, x1, y1;
+
+  w_align = 1 << GST_VIDEO_FORMAT_INFO_W_SUB (in_info->finfo, 1);
+  h_align = 1 << GST_VIDEO_FORMAT_INFO_H_SUB (in_info->finfo, 1);
+
+  x0 = GST_ROUND_DOWN_N (x, w_align);
+  y0 = GST_ROUND_DOWN_N (y, h_align);
+  x1 = MIN (GST_ROUND_UP_N (x + w, w_align),
+      round_down_width (in_info->finfo, in_info->width));
+  y1 = MIN (GST_ROUND_UP_N (y + h, h_align),
+      round_down_height (in_info->finfo, in_info->height));
+  if (x0 >= x1 || y0 >= y1)
+    return FALSE;
+
+  rect->x = x0;
+  rect->y = y0;
+  rect->w = x1 - x0;
+  rect->h = y1 - y0;
+
+  return TRUE;
+}
+
+/* TRUE if the UDS scales a size of in to out in one go */
+static inline gboolean
+uds_can_scale (guint in, guint out)
+{
+  guint min, max;
+
+  uds_output_limits (in, &min, &max);
+
+  return out >= min && out <= max;
+}
+
+/* TRUE if the UDS scales a picture to an area of the output in one go,
+ * before the WPF turns it */
+static gboolean
+gst_vsp_filter_fits_uds (GstVspFilter * space, guint in_w, guint in_h,
+    guint out_w, guint out_h)
+{
+  if (SWAPS_SIZE (&space->orientation))
+    return uds_can_scale (in_w, out_h) && uds_can_scale (in_h, out_w);
+
+  return uds_can_scale (in_w, out_w) && uds_can_scale (in_h, out_h);
+}
+
+/* TRUE if a vspfilter converting frames of in_info to out_w x out_h, as
+ * turned by the WPF, applies a crop of crop_w x crop_h in the RPF: the
+ * frames are converted whole in one pass and the UDS scales the crop in
+ * one go. For vspfilterbin, before the vspfilter gets the caps. */
+gboolean
+gst_vsp_filter_can_crop (GstVspFilter * space, GstVideoInfo * in_info,
+    guint crop_w, guint crop_h, guint out_w, guint out_h)
+{
+  GstVspFilterOrientation orientation;
+  guint in_w, in_h, pic_w, pic_h;
+
+  /* the picture of add-borders is scaled from the whole input */
+  if (space->stripes > 1 || space->roi_batch || space->add_borders)
+    return FALSE;
+
+  in_w = round_down_width (in_info->finfo, in_info->width);
+  in_h = round_down_height (in_info->finfo, in_info->height);
+  if (MAX (in_w, in_h) > space->tile_size ||
+      MAX (out_w, out_h) > space->tile_size)
+    return FALSE;
+
+  gst_vsp_filter_get_orientation (space, &orientation);
+  pic_w = SWAPS_SIZE (&orientation) ? out_h : out_w;
+  pic_h = SWAPS_SIZE (&orientation) ? out_w : out_h;
+
+  /* the passes are planned for the whole input */
+  return uds_can_scale (in_w, pic_w) && uds_can_scale (in_h, pic_h) &&
+      uds_can_scale (crop_w, pic_w) && uds_can_scale (crop_h, pic_h);
+}
+
+/* Points a VSP to the region of the input it reads, the crop or else the
+ * whole frame, and to the area of the output it scales it to */
+static void
+set_picture_rects (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    GstVideoInfo * in_info, GstVideoInfo * out_info,
+    const GstVideoRectangle * crop)
+{
+  memset (&vsp_info->in_rect, 0, sizeof (GstVideoRectangle));
+  memset (&vsp_info->out_rect, 0, sizeof (GstVideoRectangle));
+  if (crop->w == 0 && !gst_vsp_filter_cpu_borders (space))
+    return;
+
+  if (crop->w > 0) {
+    vsp_info->in_rect = *crop;
+  } else {
+    vsp_info->in_rect.w = round_down_width (in_info->finfo, in_info->width);
+    vsp_info->in_rect.h = round_down_height (in_info->finfo, in_info->height);
+  }
+
+  if (gst_vsp_filter_cpu_borders (space)) {
+    vsp_info->out_rect = space->borders;
+  } else {
+    vsp_info->out_rect.w = out_info->width;
+    vsp_info->out_rect.h = out_info->height;
+  }
+}
+
+/* TRUE if a rectangle of a frame covers all of it */
+static inline gboolean
+is_whole_frame (GstVideoInfo * info, const GstVideoRectangle * rect)
+{
+  return rect->x == 0 && rect->y == 0 &&
+      rect->w == round_down_width (info->finfo, info->width) &&
+      rect->h == round_down_height (info->finfo, info->height);
+}
+
+/* Makes the VSPs read the region of the crop meta of a frame and scale it
+ * to the output size. The crop of a VSP can only change while it is
+ * stopped, so the frames in flight are pushed out first. Decoders keep
+ * the same crop for a whole stream. FALSE if the frame has a crop which
+ * is not applied, the VSPs then read the whole frame. */
+static gboolean
+gst_vsp_filter_apply_crop_meta (GstVspFilter * space, GstBuffer * inbuf)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstVspFilterVspInfo *vsp_info;
+  GstVideoCropMeta *crop;
+  GstVideoRectangle rect = { 0, };
+  gboolean applied = TRUE;
+  gint out_w, out_h;
+  guint i;
+
+  crop = gst_buffer_get_video_crop_meta (inbuf);
+  if (!gst_vsp_filter_whole_frames (space))
+    return !crop || !get_crop_rect (&filter->in_info, crop->x, crop->y,
+        crop->width, crop->height, &rect) ||
+        is_whole_frame (&filter->in_info, &rect);
+
+  out_w = space->borders.w > 0 ? space->borders.w : filter->out_info.width;
+  out_h = space->borders.w > 0 ? space->borders.h : filter->out_info.height;
+
+  if (crop && get_crop_rect (&filter->in_info, crop->x, crop->y, crop->width,
+          crop->height, &rect)) {
+    if (is_whole_frame (&filter->in_info, &rect)) {
+      memset (&rect, 0, sizeof (rect));
+    } else if (!gst_vsp_filter_fits_uds (space, rect.w, rect.h, out_w,
+            out_h)) {
+      GST_LOG_OBJECT (space, "cannot scale crop %dx%d to %dx%d, passed "
+          "downstream", rect.w, rect.h, out_w, out_h);
+      memset (&rect, 0, sizeof (rect));
+      applied = FALSE;
+    }
+  }
+
+  if (memcmp (&rect, &space->crop, sizeof (rect)) == 0)
+    return applied;
+
+  GST_DEBUG_OBJECT (space, "crop %d,%d %dx%d", rect.x, rect.y, rect.w,
+      rect.h);
+  gst_vsp_filter_drain_jobs (space);
+
+  for (i = 0; i < space->n_vsps; i++) {
+    vsp_info = space->vsps[i];
+    if (vsp_info->is_stream_started)
+      stop_streaming (space, vsp_info);
+    vsp_info->already_setup_info = FALSE;
+    set_picture_rects (space, vsp_info, &filter->in_info, &filter->out_info,
+        &rect);
+  }
+  space->crop = rect;
+
+  return applied;
+}
+
+/* Turns the pixels of an overlay rectangle like the WPF turns the picture,
+ * and places it at render */
+static GstVideoOverlayRectangle *
+turn_overlay_rectangle (const GstVspFilterOrientation * orientation,
+    GstVideoOverlayRectangle * rectangle, const GstVideoRectangle * render)
+{
+  GstVideoOverlayFormatFlags flags;
+  GstVideoOverlayRectangle *res;
+  GstVideoRectangle pixel;
+  GstVideoMeta *vmeta;
+  GstBuffer *pixels, *turned;
+  GstMapInfo in, out;
+  guint width, height, turned_width, x, y;
+
+  if (!orientation->hflip && !orientation->vflip && !orientation->rotate) {
+    res = gst_video_overlay_rectangle_copy (rectangle);
+    gst_video_overlay_rectangle_set_render_rectangle (res, render->x,
+        render->y, render->w, render->h);
+    return res;
+  }
+
+  flags = gst_video_overlay_rectangle_get_flags (rectangle);
+  pixels = gst_video_overlay_rectangle_get_pixels_unscaled_argb (rectangle,
+      flags);
+  vmeta = gst_buffer_get_video_meta (pixels);
+  width = vmeta->width;
+  height = vmeta->height;
+  turned_width = SWAPS_SIZE (orientation) ? height : width;
+
+  turned = gst_buffer_new_allocate (NULL, width * height * 4, NULL);
+  if (!gst_buffer_map (pixels, &in, GST_MAP_READ))
+    goto failed;
+  if (!gst_buffer_map (turned, &out, GST_MAP_WRITE)) {
+    gst_buffer_unmap (pixels, &in);
+    goto failed;
+  }
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
+      pixel.x = x;
+      pixel.y = y;
+      pixel.w = pixel.h = 1;
+      turn_rect (orientation, width, height, &pixel, &pixel);
+      memcpy (out.data + (pixel.y * turned_width + pixel.x) * 4,
+          in.data + vmeta->offset[0] + y * vmeta->stride[0] + x * 4, 4);
+    }
+  }
+  gst_buffer_unmap (turned, &out);
+  gst_buffer_unmap (pixels, &in);
+
+  gst_buffer_add_video_meta (turned, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_OVERLAY_COMPOSITION_FORMAT_RGB, turned_width,
+      width * height / turned_width);
+  res = gst_video_overlay_rectangle_new_raw (turned, render->x, render->y,
+      render->w, render->h, flags);
+  gst_video_overlay_rectangle_set_global_alpha (res,
+      gst_video_overlay_rectangle_get_global_alpha (rectangle));
+  gst_buffer_unref (turned);
+
+  return res;
+
+failed:
+  gst_buffer_unref (turned);
+  return NULL;
+}
+
+/* Blends the overlay composition meta left on an output frame on the CPU.
+ * The VSP only blends the overlays of frames converted in one piece, and
+ * the src caps do not have the feature for downstream to do it. The crop
+ * meta is not applied to such frames either, so the overlays are scaled
+ * from the whole input. */
+static void
+gst_vsp_filter_blend_overlays_cpu (GstVspFilter * space, GstBuffer ** outbuf)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstVideoOverlayCompositionMeta *meta;
+  GstVideoOverlayComposition *composition = NULL;
+  GstVideoOverlayRectangle *rectangle;
+  GstVideoRectangle render;
+  GstVideoFrame frame;
+  gint x, y, pic_w, pic_h;
+  guint w, h, i, n;
+
+  /* the crops have metas of their own regions */
+  if (space->roi_batch ||
+      !gst_buffer_get_video_overlay_composition_meta (*outbuf))
+    return;
+
+  *outbuf = gst_buffer_make_writable (*outbuf);
+  meta = gst_buffer_get_video_overlay_composition_meta (*outbuf);
+
+  /* the size of the picture before the WPF turns it */
+  pic_w = filter->out_info.width;
+  pic_h = filter->out_info.height;
+  if (SWAPS_SIZE (&space->orientation)) {
+    pic_w = filter->out_info.height;
+    pic_h = filter->out_info.width;
+  }
+
+  n = gst_video_overlay_composition_n_rectangles (meta->overlay);
+  for (i = 0; i < n; i++) {
+    rectangle = gst_video_overlay_composition_get_rectangle (meta->overlay,
+        i);
+    gst_video_overlay_rectangle_get_render_rectangle (rectangle, &x, &y,
+        &w, &h);
+    render.x = (gint64) x * pic_w / filter->in_info.width;
+    render.y = (gint64) y * pic_h / filter->in_info.height;
+    render.w = (gint64) w * pic_w / filter->in_info.width;
+    render.h = (gint64) h * pic_h / filter->in_info.height;
+    if (render.w <= 0 || render.h <= 0)
+      continue;
+    turn_rect (&space->orientation, pic_w, pic_h, &render, &render);
+
+    rectangle = turn_overlay_rectangle (&space->orientation, rectangle,
+        &render);
+    if (!rectangle)
+      continue;
+    if (composition)
+      gst_video_overlay_composition_add_rectangle (composition, rectangle);
+    else
+      composition = gst_video_overlay_composition_new (rectangle);
+    gst_video_overlay_rectangle_unref (rectangle);
+  }
+
+  if (composition) {
+    if (gst_video_frame_map (&frame, &filter->out_info, *outbuf,
+            GST_MAP_READWRITE)) {
+      gst_video_overlay_composition_blend (composition, &frame);
+      gst_video_frame_unmap (&frame);
+    } else {
+      GST_WARNING_OBJECT (space, "cannot map an output frame to blend its "
+          "overlays");
+    }
+    gst_video_overlay_composition_unref (composition);
+  }
+
+  gst_buffer_remove_meta (*outbuf, (GstMeta *) meta);
+}
+
+/* Gives the output the crop meta of an input frame which the VSPs did not
+ * apply, moved to where the picture is scaled and turned to */
+static void
+gst_vsp_filter_pass_crop_meta (GstVspFilter * space, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstVideoCropMeta *in_crop, *out_crop;
+  GstVideoRectangle area, rect;
+  gint x, y, w, h, area_w, area_h;
+
+  in_crop = gst_buffer_get_video_crop_meta (inbuf);
+  if (!in_crop || !gst_buffer_is_writable (outbuf))
+    return;
+
+  if (space->borders.w > 0) {
+    area = space->borders;
+  } else {
+    area.x = area.y = 0;
+    area.w = filter->out_info.width;
+    area.h = filter->out_info.height;
+  }
+
+  /* the size of the picture before it is turned */
+  area_w = SWAPS_SIZE (&space->orientation) ? area.h : area.w;
+  area_h = SWAPS_SIZE (&space->orientation) ? area.w : area.h;
+
+  x = gst_util_uint64_scale_int (in_crop->x, area_w, filter->in_info.width);
+  y = gst_util_uint64_scale_int (in_crop->y, area_h, filter->in_info.height);
+  w = gst_util_uint64_scale_int_ceil (in_crop->width, area_w,
+      filter->in_info.width);
+  h = gst_util_uint64_scale_int_ceil (in_crop->height, area_h,
+      filter->in_info.height);
+  w = MIN (w, area_w - x);
+  h = MIN (h, area_h - y);
+
+  rect.x = x;
+  rect.y = y;
+  rect.w = w;
+  rect.h = h;
+  turn_rect (&space->orientation, area_w, area_h, &rect, &rect);
+
+  out_crop = gst_buffer_get_video_crop_meta (outbuf);
+  if (!out_crop)
+    out_crop = gst_buffer_add_video_crop_meta (outbuf);
+  out_crop->x = area.x + rect.x;
+  out_crop->y = area.y + rect.y;
+  out_crop->width = rect.w;
+  out_crop->height = rect.h;
+}
+
+/* Sets the VSPs up again when the orientation changed without new caps,
+ * e.g. on an image-orientation tag. The frames in flight are pushed out
+ * first. */
+static void
+gst_vsp_filter_apply_orientation (GstVspFilter * space)
+{
+  GstVspFilterOrientation orientation;
+  GstVspFilterVspInfo *vsp_info;
+  guint i;
+
+  gst_vsp_filter_get_orientation (space, &orientation);
+  if (memcmp (&orientation, &space->orientation, sizeof (orientation)) == 0)
+    return;
+
+  /* a quarter turn waits for the caps of the turned size */
+  if (SWAPS_SIZE (&orientation) != SWAPS_SIZE (&space->orientation))
+    return;
+
+  if (space->n_tiles > 1 || space->n_passes > 1 || space->n_stripes > 1) {
+    GST_LOG_OBJECT (space, "frames in tiles, stripes or passes keep their "
+        "orientation");
+    return;
+  }
+
+  GST_DEBUG_OBJECT (space, "rotate %u hflip %d vflip %d", orientation.rotate,
+      orientation.hflip, orientation.vflip);
+  gst_vsp_filter_drain_jobs (space);
+
+  for (i = 0; i < space->n_vsps; i++) {
+    vsp_info = space->vsps[i];
+    if (vsp_info->is_stream_started)
+      stop_streaming (space, vsp_info);
+    vsp_info->already_setup_info = FALSE;
+  }
+  space->orientation = orientation;
+}
+
+/* Copies the part of an overlay rectangle inside the picture for the RPF.
+ * A copy of the rectangle is rendered at the scaled size, the one of the
+ * meta is left alone for the elements downstream. */
+static gboolean
+gst_vsp_filter_upload_overlay (GstVspFilter * space,
+    GstVspFilterOverlay * overlay, GstVideoOverlayRectangle * rectangle,
+    const GstVideoRectangle * render, const GstVideoRectangle * rect)
+{
+  GstVideoOverlayRectangle *copy;
+  GstVideoMeta *vmeta;
+  GstBuffer *pixels;
+  GstMapInfo map;
+  const guint8 *src;
+  guint8 *mem, *data;
+  gint src_stride, stride, y;
+
+  copy = gst_video_overlay_rectangle_copy (rectangle);
+  gst_video_overlay_rectangle_set_render_rectangle (copy, render->x,
+      render->y, render->w, render->h);
+
+  pixels = gst_video_overlay_rectangle_get_pixels_argb (copy,
+      GST_VIDEO_OVERLAY_FORMAT_FLAG_NONE);
+  if (!pixels || !gst_buffer_map (pixels, &map, GST_MAP_READ)) {
+    GST_WARNING_OBJECT (space, "cannot get the pixels of an overlay");
+    gst_video_overlay_rectangle_unref (copy);
+    return FALSE;
+  }
+  vmeta = gst_buffer_get_video_meta (pixels);
+  src_stride = vmeta ? vmeta->stride[0] : render->w * 4;
+
+  stride = GST_ROUND_UP_N (rect->w * 4, OVERLAY_STRIDE_ALIGN);
+  mem = g_malloc0 (stride * rect->h + TILE_ADDR_ALIGN - 1);
+  data = GSIZE_TO_POINTER (GST_ROUND_UP_N (GPOINTER_TO_SIZE (mem),
+          TILE_ADDR_ALIGN));
+
+  src = map.data + (rect->y - render->y) * src_stride +
+      (rect->x - render->x) * 4;
+  for (y = 0; y < rect->h; y++)
+    memcpy (data + y * stride, src + y * src_stride, rect->w * 4);
+
+  gst_buffer_unmap (pixels, &map);
+  gst_video_overlay_rectangle_unref (copy);
+
+  g_free (overlay->mem);
+  overlay->seqnum = gst_video_overlay_rectangle_get_seqnum (rectangle);
+  overlay->render = *render;
+  overlay->rect = *rect;
+  overlay->stride = stride;
+  overlay->size = stride * rect->h;
+  overlay->mem = mem;
+  overlay->data = data;
+
+  return TRUE;
+}
+
+static void
+gst_vsp_filter_clear_overlays (GstVspFilter * space)
+{
+  guint i;
+
+  for (i = 0; i < space->n_overlays; i++) {
+    g_free (space->overlays[i].mem);
+    memset (&space->overlays[i], 0, sizeof (GstVspFilterOverlay));
+  }
+  space->n_overlays = 0;
+}
+
+/* Has the BRU blend the rectangles of the overlay composition meta of the
+ * input over the picture. The rectangles are placed in the picture the way
+ * the crop is scaled, and uploaded once per seqnum. The frames in flight
+ * are pushed out before an upload, and the VSPs are set up again when the
+ * rectangles moved. */
+static void
+gst_vsp_filter_apply_overlays (GstVspFilter * space, GstBuffer * inbuf)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstVideoOverlayCompositionMeta *meta;
+  GstVideoOverlayRectangle *rectangles[MAX_OVERLAYS];
+  GstVideoRectangle renders[MAX_OVERLAYS], rects[MAX_OVERLAYS];
+  GstVideoRectangle old_rects[MAX_OVERLAYS];
+  GstVideoRectangle src, *render, *rect;
+  GstVspFilterOverlay *overlay;
+  GstVspFilterVspInfo *vsp_info;
+  gint x, y, pic_w, pic_h;
+  guint w, h, n_rectangles, max_overlays, n_old, n, i, k;
+  gboolean changed, moved;
+
+  if (!gst_vsp_filter_has_overlay_rpfs (space) ||
+      !gst_vsp_filter_whole_frames (space))
+    return;
+
+  max_overlays = MAX_OVERLAYS;
+  for (i = 0; i < space->n_vsps; i++)
+    max_overlays = MIN (max_overlays, space->vsps[i]->n_overlay_rpfs);
+
+  src = space->crop;
+  if (src.w == 0) {
+    src.w = filter->in_info.width;
+    src.h = filter->in_info.height;
+  }
+  pic_w = space->borders.w > 0 ? space->borders.w : filter->out_info.width;
+  pic_h = space->borders.w > 0 ? space->borders.h : filter->out_info.height;
+  /* the BRU blends before the WPF turns the picture */
+  if (SWAPS_SIZE (&space->orientation)) {
+    pic_w = pic_h;
+    pic_h = space->borders.w > 0 ? space->borders.w : filter->out_info.width;
+  }
+
+  n = 0;
+  n_rectangles = 0;
+  meta = gst_buffer_get_video_overlay_composition_meta (inbuf);
+  if (meta)
+    n_rectangles = gst_video_overlay_composition_n_rectangles (meta->overlay);
+  for (i = 0; i < n_rectangles && n < max_overlays; i++) {
+    rectangles[n] = gst_video_overlay_composition_get_rectangle (meta->overlay,
+        i);
+    gst_video_overlay_rectangle_get_render_rectangle (rectangles[n], &x, &y,
+        &w, &h);
+
+    render = &renders[n];
+    render->x = (gint64) (x - src.x) * pic_w / src.w;
+    render->y = (gint64) (y - src.y) * pic_h / src.h;
+    render->w = (gint64) w * pic_w / src.w;
+    render->h = (gint64) h * pic_h / src.h;
+
+    rect = &rects[n];
+    rect->x = CLAMP (render->x, 0, pic_w);
+    rect->y = CLAMP (render->y, 0, pic_h);
+    rect->w = CLAMP (render->x + render->w, 0, pic_w) - rect->x;
+    rect->h = CLAMP (render->y + render->h, 0, pic_h) - rect->y;
+    if (rect->w > 0 && rect->h > 0)
+      n++;
+  }
+  if (i < n_rectangles)
+    GST_LOG_OBJECT (space, "only %u overlays are blended", max_overlays);
+
+  changed = n != space->n_overlays;
+  for (i = 0; i < n && !changed; i++) {
+    overlay = &space->overlays[i];
+    changed = overlay->seqnum !=
+        gst_video_overlay_rectangle_get_seqnum (rectangles[i]) ||
+        memcmp (&renders[i], &overlay->render, sizeof (renders[i])) != 0 ||
+        memcmp (&rects[i], &overlay->rect, sizeof (rects[i])) != 0;
+  }
+  if (!changed)
+    return;
+
+  /* the RPFs read the uploads until the frames are done */
+  gst_vsp_filter_drain_jobs (space);
+
+  n_old = space->n_overlays;
+  for (i = 0; i < n_old; i++)
+    old_rects[i] = space->overlays[i].rect;
+
+  for (i = 0, k = 0; i < n; i++) {
+    overlay = &space->overlays[k];
+    if (k >= n_old || overlay->seqnum !=
+        gst_video_overlay_rectangle_get_seqnum (rectangles[i]) ||
+        memcmp (&renders[i], &overlay->render, sizeof (renders[i])) != 0 ||
+        memcmp (&rects[i], &overlay->rect, sizeof (rects[i])) != 0) {
+      if (!gst_vsp_filter_upload_overlay (space, overlay, rectangles[i],
+              &renders[i], &rects[i]))
+        continue;
+    }
+    k++;
+  }
+  for (i = k; i < MAX (n_old, n); i++) {
+    g_free (space->overlays[i].mem);
+    memset (&space->overlays[i], 0, sizeof (GstVspFilterOverlay));
+  }
+  space->n_overlays = k;
+
+  moved = k != n_old;
+  for (i = 0; i < k && !moved; i++)
+    moved = memcmp (&old_rects[i], &space->overlays[i].rect,
+        sizeof (old_rects[i])) != 0;
+  if (!moved)
+    return;
+
+  GST_DEBUG_OBJECT (space, "%u overlays", k);
+  for (i = 0; i < space->n_vsps; i++) {
+    vsp_info = space->vsps[i];
+    if (vsp_info->is_stream_started)
+      stop_streaming (space, vsp_info);
+    vsp_info->already_setup_info = FALSE;
+  }
+}
+
+/* Orders the regions of interest by their crop, so that the ones a VSP
+ * set up for one crop takes follow each other */
+static gint
+compare_rois (gconstpointer a, gconstpointer b)
+{
+  const GstVspFilterRoi *ra = a, *rb = b;
+
+  if (ra->crop.w != rb->crop.w)
+    return ra->crop.w - rb->crop.w;
+  if (ra->crop.h != rb->crop.h)
+    return ra->crop.h - rb->crop.h;
+  if (ra->crop.x != rb->crop.x)
+    return ra->crop.x - rb->crop.x;
+
+  return (gint) ra->index - (gint) rb->index;
+}
+
+/* Chooses the VSP a region of interest is queued to: the least loaded of
+ * the device pool, one already set up for its crop winning over an idle
+ * one only when it is idle too.
+ * Must be called with jobs_lock held */
+static GstVspFilterVspInfo *
+gst_vsp_filter_pick_roi_vsp (GstVspFilter * space, const GstVspFilterRoi * roi)
+{
+  GstVspFilterVspInfo *vsp_info, *best = NULL;
+  guint i, n, score, best_score = 0, best_n = 0;
+
+  for (i = 0; i < space->n_vsps; i++) {
+    n = (space->next_vsp + i) % space->n_vsps;
+    vsp_info = space->vsps[n];
+    if (vsp_info->disabled)
+      continue;
+
+    score = vsp_info->n_jobs * 2 +
+        (memcmp (&roi->crop, &vsp_info->in_rect, sizeof (roi->crop)) != 0);
+    if (!best || score < best_score) {
+      best = vsp_info;
+      best_score = score;
+      best_n = n;
+    }
+  }
+
+  /* the first VSP is never disabled */
+  if (!best)
+    return space->vsp_info;
+
+  space->next_vsp = best_n + 1;
+
+  return best;
+}
+
+/* Crops every region of interest of a frame and scales it to the output
+ * size. The regions are queued like tiles, through userptr at their place
+ * in the frame, to a VSP set up for the size of the region and its offset
+ * from the aligned address, which the RPF crops. A VSP keeps streaming
+ * while it takes regions of the same crop, so the regions are sorted by
+ * it, and the VSP is only set up again for another one. The regions are
+ * spread over the device pool and pushed together as a buffer list. */
+static GstFlowReturn
+gst_vsp_filter_process_rois (GstVspFilter * space, GstBuffer * inbuf)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstBaseTransform *trans = GST_BASE_TRANSFORM_CAST (space);
+  GstBaseTransformClass *bclass = GST_BASE_TRANSFORM_GET_CLASS (trans);
+  GstVideoRegionOfInterestMeta *roi_meta, *out_roi;
+  GstVspFilterVspInfo *vsp_info;
+  GstVspFilterRoi *roi;
+  GstVideoRectangle rect;
+  GstBufferList *list;
+  GstBuffer *outbuf, *done, *staged = NULL;
+  GArray *rois;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstMeta *meta;
+  gpointer state = NULL;
+  gboolean same;
+  guint align, phase, i;
+
+  if (G_UNLIKELY (!filter->negotiated))
+    goto unknown_format;
+
+  gst_vsp_filter_post_stats (space);
+  gst_vsp_filter_apply_orientation (space);
+
+  align = get_tile_align (filter->in_info.finfo);
+  rois = g_array_new (FALSE, TRUE, sizeof (GstVspFilterRoi));
+
+  while ((meta = gst_buffer_iterate_meta (inbuf, &state))) {
+    if (meta->info->api != GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE)
+      continue;
+    roi_meta = (GstVideoRegionOfInterestMeta *) meta;
+
+    if (!get_crop_rect (&filter->in_info, roi_meta->x, roi_meta->y,
+            roi_meta->w, roi_meta->h, &rect))
+      continue;
+    if (!gst_vsp_filter_fits_uds (space, rect.w, rect.h,
+            filter->out_info.width, filter->out_info.height)) {
+      GST_WARNING_OBJECT (space, "cannot scale ROI %dx%d to %dx%d, skipped",
+          rect.w, rect.h, filter->out_info.width, filter->out_info.height);
+      continue;
+    }
+
+    g_array_set_size (rois, rois->len + 1);
+    roi = &g_array_index (rois, GstVspFilterRoi, rois->len - 1);
+    phase = rect.x % align;
+    roi->tile.in_rect.x = rect.x - phase;
+    roi->tile.in_rect.y = rect.y;
+    roi->tile.in_rect.w = rect.w + phase;
+    roi->tile.in_rect.h = rect.h;
+    roi->tile.out_rect.w = filter->out_info.width;
+    roi->tile.out_rect.h = filter->out_info.height;
+    roi->crop.x = phase;
+    roi->crop.w = rect.w;
+    roi->crop.h = rect.h;
+    roi->meta = roi_meta;
+    roi->index = rois->len - 1;
+  }
+
+  if (rois->len == 0) {
+    GST_LOG_OBJECT (space, "no region of interest in buffer %p", inbuf);
+    g_array_free (rois, TRUE);
+    return GST_FLOW_OK;
+  }
+  g_array_sort (rois, compare_rois);
+
+  /* the bottom regions reach past the planes by up to a row */
+  if (!has_tile_slack (inbuf, &filter->in_info)) {
+    GST_LOG_OBJECT (space, "Copy buffer %p to tile memory", inbuf);
+    ret = gst_vsp_filter_stage_frame (space, inbuf, &staged);
+    if (ret != GST_FLOW_OK) {
+      g_array_free (rois, TRUE);
+      return ret;
+    }
+  }
+
+  list = gst_buffer_list_new ();
+
+  for (i = 0; i < rois->len; i++) {
+    roi = &g_array_index (rois, GstVspFilterRoi, i);
+
+    /* A VSP is stopped for another crop once it is idle. One set up for
+     * this crop takes the region as soon as it has room for the frame. */
+    g_mutex_lock (&space->jobs_lock);
+    vsp_info = gst_vsp_filter_pick_roi_vsp (space, roi);
+    same = memcmp (&roi->crop, &vsp_info->in_rect, sizeof (roi->crop)) == 0;
+    while ((same ? vsp_info->n_jobs >= space->queue_depth :
+            vsp_info->n_jobs > 0) && ret == GST_FLOW_OK) {
+      ret = gst_vsp_filter_complete_job (space, TRUE, &done);
+      if (done)
+        gst_buffer_list_add (list, done);
+    }
+    g_mutex_unlock (&space->jobs_lock);
+    if (ret != GST_FLOW_OK)
+      goto failed;
+
+    if (!same) {
+      GST_DEBUG_OBJECT (space, "%s crops %dx%d at %d", vsp_info->ip_name,
+          roi->crop.w, roi->crop.h, roi->crop.x);
+      if (vsp_info->is_stream_started)
+        stop_streaming (space, vsp_info);
+      vsp_info->already_setup_info = FALSE;
+      vsp_info->in_rect = roi->crop;
+      vsp_info->out_rect = roi->tile.out_rect;
+    }
+
+    ret = bclass->prepare_output_buffer (trans, inbuf, &outbuf);
+    if (ret != GST_FLOW_OK || outbuf == NULL)
+      goto failed;
+
+    out_roi = gst_buffer_add_video_region_of_interest_meta_id (outbuf,
+        roi->meta->roi_type, 0, 0, filter->out_info.width,
+        filter->out_info.height);
+    out_roi->id = roi->meta->id;
+    out_roi->parent_id = roi->meta->parent_id;
+
+    ret = gst_vsp_filter_queue_job (space, vsp_info,
+        staged ? staged : inbuf, outbuf, GST_VSPFILTER_IO_USERPTR,
+        GST_VSPFILTER_IO_USERPTR, &roi->tile, FALSE, NULL);
+    gst_buffer_unref (outbuf);
+    if (ret != GST_FLOW_OK)
+      goto failed;
+  }
+
+  /* the jobs point to the tiles of the regions */
+  g_mutex_lock (&space->jobs_lock);
+  while (!g_queue_is_empty (&space->pending_jobs) && ret == GST_FLOW_OK) {
+    ret = gst_vsp_filter_complete_job (space, TRUE, &done);
+    if (done)
+      gst_buffer_list_add (list, done);
+  }
+  g_mutex_unlock (&space->jobs_lock);
+  if (ret != GST_FLOW_OK)
+    goto failed;
+
+  if (staged)
+    gst_buffer_unref (staged);
+  g_array_free (rois, TRUE);
+
+  return gst_pad_push_list (GST_BASE_TRANSFORM_SRC_PAD (trans), list);
+
+  /* ERRORS */
+unknown_format:
+  {
+    GST_ELEMENT_ERROR (filter, CORE, NOT_IMPLEMENTED, (NULL),
+        ("unknown format"));
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+failed:
+  {
+    gst_vsp_filter_flush_jobs (space);
+    if (staged)
+      gst_buffer_unref (staged);
+    g_array_free (rois, TRUE);
+    gst_buffer_list_unref (list);
+    return ret;
+  }
+}
+
+/* TRUE if the device would be programmed the same way for both */
+static gboolean
+same_device_format (const GstVideoInfo * a, const GstVideoInfo * b)
+{
+  return GST_VIDEO_INFO_FORMAT (a) == GST_VIDEO_INFO_FORMAT (b) &&
+      a->width == b->width && a->height == b->height && a->size == b->size &&
+      memcmp (a->stride, b->stride, sizeof (a->stride)) == 0 &&
+      memcmp (a->offset, b->offset, sizeof (a->offset)) == 0 &&
+      a->colorimetry.matrix == b->colorimetry.matrix &&
+      a->colorimetry.range == b->colorimetry.range;
+}
+
+/* Throws away the frames of a request src pad in flight */
+static void
+gst_vsp_filter_flush_output (GstVspFilter * space, GstVspFilterOutput * out)
+{
+  GstVspFilterJob *job;
+
+  g_mutex_lock (&space->jobs_lock);
+  if (out->vsp_info && out->vsp_info->is_stream_started)
+    stop_streaming (space, out->vsp_info);
+  while ((job = g_queue_pop_head (&out->jobs))) {
+    job->vsp_info->n_jobs--;
+    gst_vsp_filter_free_job (space, job);
+  }
+  g_mutex_unlock (&space->jobs_lock);
+}
+
+static void
+gst_vsp_filter_close_output (GstVspFilter * space, GstVspFilterOutput * out)
+{
+  gst_vsp_filter_flush_output (space, out);
+
+  if (out->pool) {
+    gst_buffer_pool_set_active (out->pool, FALSE);
+    g_clear_object (&out->pool);
+  }
+  if (out->vsp_info) {
+    gst_vsp_filter_free_vsp (space, out->vsp_info);
+    out->vsp_info = NULL;
+  }
+  out->negotiated = FALSE;
+}
+
+/* Pushes a sticky event of the sink pad which a request src pad has not
+ * got yet, e.g. because it was requested during the stream */
+static void
+copy_sticky_event (GstVspFilter * space, GstVspFilterOutput * out,
+    GstEventType type)
+{
+  GstEvent *event;
+
+  event = gst_pad_get_sticky_event (out->pad, type, 0);
+  if (event) {
+    gst_event_unref (event);
+    return;
+  }
+
+  event = gst_pad_get_sticky_event (GST_BASE_TRANSFORM_SINK_PAD (space),
+      type, 0);
+  if (event)
+    gst_pad_push_event (out->pad, event);
+}
+
+/* Picks the caps of a request src pad from what downstream accepts, the
+ * way the ones of the src pad are picked, and sets its VSP up for them.
+ * Its frames are converted in one piece, so they have to fit the device
+ * and the ratios of the UDS. */
+static gboolean
+gst_vsp_filter_negotiate_output (GstVspFilter * space,
+    GstVspFilterOutput * out)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM_CAST (space);
+  GstBaseTransformClass *bclass = GST_BASE_TRANSFORM_GET_CLASS (trans);
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstVspFilterVspInfo *vsp_info = out->vsp_info;
+  GstVideoInfo *in_info = &filter->in_info;
+  GstCaps *incaps, *caps, *outcaps = NULL;
+  GstStructure *outs;
+  GstVideoInfo info;
+  gboolean ret = FALSE;
+
+  incaps = gst_pad_get_current_caps (GST_BASE_TRANSFORM_SINK_PAD (trans));
+  if (!incaps)
+    return FALSE;
+
+  caps = bclass->transform_caps (trans, GST_PAD_SINK, incaps, NULL);
+  outcaps = gst_pad_peer_query_caps (out->pad, caps);
+  gst_caps_unref (caps);
+  if (gst_caps_is_empty (outcaps)) {
+    gst_caps_unref (outcaps);
+    outcaps = NULL;
+    goto no_caps;
+  }
+  outcaps = bclass->fixate_caps (trans, GST_PAD_SINK, incaps, outcaps);
+  if (!outcaps || !gst_video_info_from_caps (&info, outcaps))
+    goto no_caps;
+
+  outs = gst_caps_get_structure (outcaps, 0);
+  if (!find_colorimetry (gst_structure_get_value (outs, "colorimetry"))) {
+    info.colorimetry.range = GST_VIDEO_COLOR_RANGE_UNKNOWN;
+    info.colorimetry.matrix = GST_VIDEO_COLOR_MATRIX_UNKNOWN;
+  }
+
+  /* The input of the tiles stays in system memory */
+  if (space->n_tiles > 1) {
+    GST_ELEMENT_WARNING (space, CORE, NEGOTIATION, (NULL),
+        ("%s is not converted along with tiles", GST_PAD_NAME (out->pad)));
+    goto done;
+  }
+  if (in_info->width > VSP_MAX_SIZE || in_info->height > VSP_MAX_SIZE ||
+      info.width > VSP_MAX_SIZE || info.height > VSP_MAX_SIZE ||
+      !gst_vsp_filter_fits_uds (space, in_info->width, in_info->height,
+          info.width, info.height)) {
+    GST_ELEMENT_WARNING (space, CORE, NEGOTIATION, (NULL),
+        ("%s cannot scale %dx%d to %dx%d in one piece",
+            GST_PAD_NAME (out->pad), in_info->width, in_info->height,
+            info.width, info.height));
+    goto done;
+  }
+
+  if (!out->pool || !same_device_format (&out->info, &info) ||
+      !same_device_format (&out->in_info, in_info)) {
+    GST_DEBUG_OBJECT (space, "%s caps %" GST_PTR_FORMAT,
+        GST_PAD_NAME (out->pad), outcaps);
+    gst_vsp_filter_flush_output (space, out);
+    vsp_info->already_setup_info = FALSE;
+
+    if (!out->pool || !same_device_format (&out->info, &info)) {
+      if (out->pool) {
+        gst_buffer_pool_set_active (out->pool, FALSE);
+        g_clear_object (&out->pool);
+      }
+      out->pool = gst_vsp_filter_setup_pool (vsp_info->v4lcap_fd,
+          V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, outcaps, info.size, 0, 1);
+      if (!out->pool) {
+        GST_ERROR_OBJECT (space, "failed to setup pool");
+        goto done;
+      }
+      vsp_info->node_configured[CAP] = FALSE;
+    }
+  }
+  out->in_info = *in_info;
+  out->info = info;
+
+  copy_sticky_event (space, out, GST_EVENT_STREAM_START);
+  if (!gst_pad_push_event (out->pad, gst_event_new_caps (outcaps))) {
+    GST_WARNING_OBJECT (space, "%s caps refused", GST_PAD_NAME (out->pad));
+    goto done;
+  }
+  copy_sticky_event (space, out, GST_EVENT_SEGMENT);
+  ret = TRUE;
+
+done:
+  if (outcaps)
+    gst_caps_unref (outcaps);
+  gst_caps_unref (incaps);
+
+  return ret;
+
+  /* ERRORS */
+no_caps:
+  {
+    GST_WARNING_OBJECT (space, "no caps downstream of %s accepted",
+        GST_PAD_NAME (out->pad));
+    goto done;
+  }
+}
+
+/* Sets the VSP of a request src pad up again when the crop or the
+ * orientation of the frames changed. It reads the region of the crop meta,
+ * or the whole frame if it cannot be scaled from it. */
+static void
+gst_vsp_filter_update_output (GstVspFilter * space, GstVspFilterOutput * out,
+    const GstVideoRectangle * crop)
+{
+  GstVspFilterVspInfo *vsp_info = out->vsp_info;
+  GstVideoRectangle in_rect = { 0, }, out_rect = { 0, };
+
+  if (crop->w > 0 && gst_vsp_filter_fits_uds (space, crop->w, crop->h,
+          out->info.width, out->info.height)) {
+    in_rect = *crop;
+    out_rect.w = out->info.width;
+    out_rect.h = out->info.height;
+  }
+
+  if (memcmp (&in_rect, &vsp_info->in_rect, sizeof (in_rect)) == 0 &&
+      memcmp (&out_rect, &vsp_info->out_rect, sizeof (out_rect)) == 0 &&
+      (!vsp_info->pipe_configured ||
+          memcmp (&space->orientation, &vsp_info->pipe_config.orientation,
+              sizeof (space->orientation)) == 0))
+    return;
+
+  if (vsp_info->is_stream_started)
+    stop_streaming (space, vsp_info);
+  vsp_info->already_setup_info = FALSE;
+  vsp_info->in_rect = in_rect;
+  vsp_info->out_rect = out_rect;
+}
+
+/* Queues an input buffer to the VSP of a request src pad, which writes the
+ * frame to a buffer of the pool of its video node. *staged is the input
+ * copied for another request src pad, or is set when this one copies it. */
+static GstFlowReturn
+gst_vsp_filter_queue_output_job (GstVspFilter * space,
+    GstVspFilterOutput * out, GstBuffer * inbuf, GstBuffer ** staged)
+{
+  GstVspFilterJob *job;
+  GstBuffer *outbuf;
+  GstFlowReturn ret;
+
+  if (!gst_buffer_pool_set_active (out->pool, TRUE)) {
+    GST_ERROR_OBJECT (space, "Failed to activate bufferpool");
+    return GST_FLOW_ERROR;
+  }
+  ret = gst_buffer_pool_acquire_buffer (out->pool, &outbuf, NULL);
+  if (ret != GST_FLOW_OK)
+    return ret;
+  gst_buffer_copy_into (outbuf, inbuf,
+      GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+
+  job = g_slice_new0 (GstVspFilterJob);
+  job->vsp_info = out->vsp_info;
+  job->in_index = job->out_index = VSPFILTER_INDEX_INVALID;
+
+  ret = gst_vsp_filter_start_job (space, job, *staged ? *staged : inbuf,
+      outbuf, outbuf, space->prop_in_mode, GST_VSPFILTER_IO_AUTO, out->pool,
+      &out->jobs, *staged ? NULL : staged);
+  if (ret != GST_FLOW_OK) {
+    g_mutex_lock (&space->jobs_lock);
+    gst_vsp_filter_free_job (space, job);
+    g_mutex_unlock (&space->jobs_lock);
+  }
+  gst_buffer_unref (outbuf);
+
+  return ret;
+}
+
+/* Queues an input buffer to the VSP of every linked request src pad before
+ * it is converted for the src pad, so that the VSPs run side by side. An
+ * input which has to be copied is only copied once for all of them. */
+static void
+gst_vsp_filter_queue_outputs (GstVspFilter * space, GstBuffer * inbuf)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  GstVspFilterOutput *out;
+  GstVideoCropMeta *meta;
+  GstVideoRectangle crop = { 0, };
+  GstBuffer *staged = NULL;
+  guint i;
+
+  if (G_UNLIKELY (!filter->negotiated))
+    return;
+
+  /* The src pad is drained here, before its VSPs are stopped */
+  gst_vsp_filter_apply_orientation (space);
+
+  meta = gst_buffer_get_video_crop_meta (inbuf);
+  if (meta && !get_crop_rect (&filter->in_info, meta->x, meta->y,
+          meta->width, meta->height, &crop))
+    memset (&crop, 0, sizeof (crop));
+
+  for (i = 0; i < MAX_OUTPUTS; i++) {
+    out = space->outputs[i];
+    if (!out)
+      continue;
+
+    if (!gst_pad_is_linked (out->pad)) {
+      out->flow = GST_FLOW_NOT_LINKED;
+      continue;
+    }
+    if (!out->negotiated || gst_pad_check_reconfigure (out->pad))
+      out->negotiated = gst_vsp_filter_negotiate_output (space, out);
+    if (!out->negotiated) {
+      out->flow = GST_FLOW_NOT_NEGOTIATED;
+      continue;
+    }
+
+    gst_vsp_filter_update_output (space, out, &crop);
+    out->flow = gst_vsp_filter_queue_output_job (space, out, inbuf, &staged);
+  }
+
+  if (staged)
+    gst_buffer_unref (staged);
+}
+
+/* Pushes the frames queued by gst_vsp_filter_queue_outputs() once they are
+ * converted, and combines their flows with the one of the src pad */
+static GstFlowReturn
+gst_vsp_filter_push_outputs (GstVspFilter * space, GstFlowReturn ret)
+{
+  GstVspFilterOutput *out;
+  GstBuffer *outbuf;
+  guint i;
+
+  for (i = 0; i < MAX_OUTPUTS; i++) {
+    out = space->outputs[i];
+    if (!out)
+      continue;
+
+    if (!g_queue_is_empty (&out->jobs)) {
+      g_mutex_lock (&space->jobs_lock);
+      out->flow = gst_vsp_filter_complete_output_job (space, out, &outbuf);
+      g_mutex_unlock (&space->jobs_lock);
+      if (out->flow != GST_FLOW_OK)
+        gst_vsp_filter_flush_output (space, out);
+      else if (outbuf)
+        out->flow = gst_pad_push (out->pad, outbuf);
+    }
+
+    gst_flow_combiner_update_pad_flow (space->flow_combiner, out->pad,
+        out->flow);
+  }
+
+  return gst_flow_combiner_update_pad_flow (space->flow_combiner,
+      GST_BASE_TRANSFORM_SRC_PAD (space), ret);
+}
+
+/* With queue-depth > 1 an input buffer is only queued to the device here,
+ * and the output buffer of the oldest frame is handed back once
+ * queue-depth frames are in flight. With async-output the output buffers
+ * are pushed by the src pad task instead, and this only waits for a free
+ * slot before queuing. */
+static GstFlowReturn
+gst_vsp_filter_generate_src_output (GstBaseTransform * trans,
+    GstBuffer ** outbuf)
+{
+  GstBaseTransformClass *bclass = GST_BASE_TRANSFORM_GET_CLASS (trans);
+  GstVspFilter *space;
+  GstBuffer *inbuf;
+  GstBuffer *newbuf = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  space = GST_VSP_FILTER_CAST (trans);
+
+  if (space->roi_batch && !gst_base_transform_is_passthrough (trans)) {
+    *outbuf = NULL;
+    inbuf = trans->queued_buf;
+    trans->queued_buf = NULL;
+    if (!inbuf)
+      return GST_FLOW_OK;
+
+    ret = gst_vsp_filter_process_rois (space, inbuf);
+    gst_buffer_unref (inbuf);
+    return ret;
+  }
+
+  if ((gst_vsp_filter_get_max_jobs (space) <= 1 && !space->async_output) ||
+      gst_base_transform_is_passthrough (trans))
+    return GST_BASE_TRANSFORM_CLASS (parent_class)->generate_output (trans,
+        outbuf);
+
+  *outbuf = NULL;
+
+  inbuf = trans->queued_buf;
+  trans->queued_buf = NULL;
+
+  if (!inbuf) {
+    if (space->async_output)
+      return GST_FLOW_OK;
+
+    /* Called again after a push; hand over what is already finished. */
+    g_mutex_lock (&space->jobs_lock);
+    ret = gst_vsp_filter_complete_job (space, FALSE, outbuf);
+    g_mutex_unlock (&space->jobs_lock);
+    return ret;
+  }
+
+  if (space->async_output) {
+    g_mutex_lock (&space->jobs_lock);
+    while (g_queue_get_length (&space->pending_jobs) >=
+        gst_vsp_filter_get_max_jobs (space) &&
+        space->output_flow == GST_FLOW_OK && !space->flushing)
+      g_cond_wait (&space->jobs_cond, &space->jobs_lock);
+    ret = space->flushing ? GST_FLOW_FLUSHING : space->output_flow;
+    g_mutex_unlock (&space->jobs_lock);
+    if (ret != GST_FLOW_OK)
+      goto leave;
+  }
+
+  ret = bclass->prepare_output_buffer (trans, inbuf, &newbuf);
+  if (ret != GST_FLOW_OK || newbuf == NULL)
+    goto leave;
+
+  ret = gst_vsp_filter_submit_job (space, inbuf, newbuf);
+  gst_buffer_unref (newbuf);
+  if (ret != GST_FLOW_OK)
+    goto leave;
+
+  if (space->async_output) {
+    gst_pad_start_task (GST_BASE_TRANSFORM_SRC_PAD (trans),
+        (GstTaskFunction) gst_vsp_filter_output_loop, space, NULL);
+  } else if (g_queue_get_length (&space->pending_jobs) >=
+      gst_vsp_filter_get_max_jobs (space)) {
+    g_mutex_lock (&space->jobs_lock);
+    ret = gst_vsp_filter_complete_job (space, TRUE, outbuf);
+    g_mutex_unlock (&space->jobs_lock);
+  }
+
+leave:
+  gst_buffer_unref (inbuf);
+
+  return ret;
+}
+
+/* With request src pads, the input buffer is converted for them while it
+ * is for the src pad. The output buffers of the src pad are then pushed
+ * here rather than by the base class, so that a src pad which is not
+ * linked does not stop the others. */
+static GstFlowReturn
+gst_vsp_filter_generate_output (GstBaseTransform * trans, GstBuffer ** outbuf)
+{
+  GstVspFilter *space;
+  GstFlowReturn ret;
+  gboolean queued;
+
+  space = GST_VSP_FILTER_CAST (trans);
+
+  if (space->n_outputs == 0)
+    return gst_vsp_filter_generate_src_output (trans, outbuf);
+
+  queued = trans->queued_buf != NULL;
+  if (queued)
+    gst_vsp_filter_queue_outputs (space, trans->queued_buf);
+
+  ret = gst_vsp_filter_generate_src_output (trans, outbuf);
+  while (ret == GST_FLOW_OK && *outbuf) {
+    ret = gst_pad_push (GST_BASE_TRANSFORM_SRC_PAD (trans), *outbuf);
+    *outbuf = NULL;
+    if (ret == GST_FLOW_OK)
+      ret = gst_vsp_filter_generate_src_output (trans, outbuf);
+  }
+
+  if (!queued)
+    return ret;
+
+  return gst_vsp_filter_push_outputs (space, ret);
+}
+
+/* Reads an image-orientation tag, e.g. "rotate-90" or "flip-rotate-270".
+ * The flipped ones are turned first and then flipped horizontally, which
+ * is the same as a flip across the axis of the rotation before it. */
+static gboolean
+parse_image_orientation (const gchar * str,
+    GstVspFilterOrientation * orientation)
+{
+  gboolean flip;
+  guint rotate;
+
+  flip = g_str_has_prefix (str, "flip-");
+  if (flip)
+    str += strlen ("flip-");
+  if (sscanf (str, "rotate-%u", &rotate) != 1 || rotate % 90 != 0 ||
+      rotate >= 360)
+    return FALSE;
+
+  orientation->rotate = rotate;
+  orientation->hflip = flip && !SWAPS_SIZE (orientation);
+  orientation->vflip = flip && SWAPS_SIZE (orientation);
+
+  return TRUE;
+}
+
+static void
+gst_vsp_filter_handle_tag (GstVspFilter * space, GstEvent * event)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM_CAST (space);
+  GstVspFilterOrientation orientation;
+  GstTagList *taglist;
+  gchar *str;
+
+  gst_event_parse_tag (event, &taglist);
+  if (!gst_tag_list_get_string (taglist, GST_TAG_IMAGE_ORIENTATION, &str))
+    return;
+
+  if (!parse_image_orientation (str, &orientation)) {
+    GST_WARNING_OBJECT (space, "unknown image-orientation %s", str);
+    g_free (str);
+    return;
+  }
+  g_free (str);
+
+  if (memcmp (&orientation, &space->tag_orientation,
+          sizeof (orientation)) == 0)
+    return;
+  space->tag_orientation = orientation;
+
+  if (space->rotation == GST_VSPFILTER_ROTATION_AUTO) {
+    /* the output size may change, and frames are no longer passed
+     * through */
+    gst_vsp_filter_get_orientation (space, &orientation);
+    if (!IS_IDENTITY (&orientation))
+      gst_base_transform_set_passthrough (trans, FALSE);
+    gst_base_transform_reconfigure_src (trans);
+  }
+}
+
+/* Hands an event of the sink pad over to the request src pads. The caps
+ * are their own, and those not negotiated yet get the stream-start and
+ * the segment along with them. */
+static void
+gst_vsp_filter_forward_event (GstVspFilter * space, GstEvent * event)
+{
+  GstVspFilterOutput *out;
+  GstPad *pads[MAX_OUTPUTS];
+  guint i, n = 0;
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS)
+    return;
+
+  GST_OBJECT_LOCK (space);
+  for (i = 0; i < MAX_OUTPUTS; i++) {
+    out = space->outputs[i];
+    if (!out)
+      continue;
+    if (!out->negotiated && GST_EVENT_IS_STICKY (event) &&
+        GST_EVENT_TYPE (event) != GST_EVENT_EOS)
+      continue;
+    pads[n++] = gst_object_ref (out->pad);
+  }
+  GST_OBJECT_UNLOCK (space);
+
+  for (i = 0; i < n; i++) {
+    gst_pad_push_event (pads[i], gst_event_ref (event));
+    gst_object_unref (pads[i]);
+  }
+}
+
+static gboolean
+gst_vsp_filter_sink_event (GstBaseTransform * trans, GstEvent * event)
+{
+  GstVspFilter *space;
+  gboolean ret;
+
+  space = GST_VSP_FILTER_CAST (trans);
+
+  /* A serialized event goes after the frames in flight, which the output
+   * task may still be pushing */
+  if (GST_EVENT_IS_SERIALIZED (event) &&
+      GST_EVENT_TYPE (event) != GST_EVENT_FLUSH_STOP)
+    gst_vsp_filter_drain_jobs (space);
+
+  gst_vsp_filter_forward_event (space, event);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_TAG:
+      gst_vsp_filter_handle_tag (space, event);
+      break;
+    case GST_EVENT_FLUSH_START:
+      g_mutex_lock (&space->jobs_lock);
+      space->flushing = TRUE;
+      g_cond_broadcast (&space->jobs_cond);
+      g_mutex_unlock (&space->jobs_lock);
+
+      /* unblock downstream first, then wait for the output task */
+      ret = GST_BASE_TRANSFORM_CLASS (parent_class)->sink_event (trans, event);
+      gst_pad_pause_task (GST_BASE_TRANSFORM_SRC_PAD (trans));
+      return ret;
+    case GST_EVENT_FLUSH_STOP:
+      gst_vsp_filter_flush_jobs (space);
+
+      g_mutex_lock (&space->jobs_lock);
+      space->flushing = FALSE;
+      space->output_flow = GST_FLOW_OK;
+      g_mutex_unlock (&space->jobs_lock);
+      gst_flow_combiner_reset (space->flow_combiner);
+      break;
+    default:
+      break;
+  }
+
+  return GST_BASE_TRANSFORM_CLASS (parent_class)->sink_event (trans, event);
+}
+
+/* The size after k of n passes spaced geometrically from in to out, so that
+ * every pass scales by about the same ratio */
+static guint
+get_pass_size (guint in, guint out, guint k, guint n, guint align)
+{
+  gdouble target = 1.0, p;
+  guint lo, hi, mid, i;
+
+  /* the n-th power of the size is in^(n - k) * out^k */
+  for (i = 0; i < n; i++)
+    target *= i < k ? out : in;
+
+  lo = MIN (in, out);
+  hi = MAX (in, out);
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    for (p = 1.0, i = 0; i < n; i++)
+      p *= mid;
+    if (p < target)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  lo = (lo + align / 2) / align * align;
+
+  return MAX (lo, align);
+}
+
+/* Finds the fewest passes which scale in to out within the UDS ratios.
+ * size[0] is in and size[*n] is out. */
+static gboolean
+plan_passes (guint in_w, guint in_h, guint out_w, guint out_h,
+    guint w_align, guint h_align, guint * n, guint width[MAX_PASSES + 1],
+    guint height[MAX_PASSES + 1])
+{
+  guint k;
+
+  for (*n = 1; *n <= MAX_PASSES; (*n)++) {
+    width[0] = in_w;
+    height[0] = in_h;
+    for (k = 1; k < *n; k++) {
+      width[k] = get_pass_size (in_w, out_w, k, *n, w_align);
+      height[k] = get_pass_size (in_h, out_h, k, *n, h_align);
+    }
+    width[*n] = out_w;
+    height[*n] = out_h;
+
+    for (k = 0; k < *n; k++) {
+      if (!uds_can_scale (width[k], width[k + 1]) ||
+          !uds_can_scale (height[k], height[k + 1]))
+        break;
+    }
+    if (k == *n)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Splits scaling ratios the UDS does not take into passes on as many VSPs.
+ * The frames in between are kept in the output format, in MMAP buffers of
+ * the input node of the VSP running the next pass, which the previous one
+ * writes as dmabuf. */
+static gboolean
+gst_vsp_filter_set_passes (GstVspFilter * space, GstVideoInfo * in_info,
+    GstVideoInfo * out_info)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (space);
+  guint width[MAX_PASSES + 1], height[MAX_PASSES + 1];
+  GstVspFilterVspInfo *vsp_info;
+  GstVideoInfo *pass_info;
+  GstBufferPool *pool;
+  GstCaps *caps;
+  guint k, n, n_reqbufs, out_w, out_h;
+
+  /* Buffers of the former passes are on the video nodes to reuse */
+  for (k = 0; k + 1 < space->n_passes; k++) {
+    if (!space->pass_pools[k])
+      continue;
+    gst_buffer_pool_set_active (space->pass_pools[k], FALSE);
+    g_clear_object (&space->pass_pools[k]);
+    n_reqbufs = 0;
+    vsp_info = space->vsps[k + 1];
+    if (!request_buffers (vsp_info->v4lout_fd,
+            V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, &n_reqbufs, V4L2_MEMORY_MMAP))
+      GST_WARNING_OBJECT (space, "reqbuf for %s failed (count = 0)",
+          vsp_info->dev_name[OUT]);
+  }
+
+  /* the size before the WPF turns the picture */
+  out_w = out_info->width;
+  out_h = out_info->height;
+  if (SWAPS_SIZE (&space->orientation)) {
+    out_w = out_info->height;
+    out_h = out_info->width;
+  }
+
+  /* the crops are scaled by other ratios, see process_rois() */
+  if (space->roi_batch) {
+    n = 1;
+  } else if (!plan_passes (round_down_width (in_info->finfo, in_info->width),
+          round_down_height (in_info->finfo, in_info->height), out_w, out_h,
+          1 << GST_VIDEO_FORMAT_INFO_W_SUB (out_info->finfo, 1),
+          1 << GST_VIDEO_FORMAT_INFO_H_SUB (out_info->finfo, 1), &n, width,
+          height)) {
+    GST_ERROR_OBJECT (space, "cannot scale %dx%d -> %dx%d in %u passes",
+        in_info->width, in_info->height, out_info->width, out_info->height,
+        MAX_PASSES);
+    goto failed;
+  }
+
+  /* The output pool is on the VSP of the last pass */
+  if (n != space->n_passes && space->out_pool) {
+    gst_buffer_pool_set_active (space->out_pool, FALSE);
+    g_clear_object (&space->out_pool);
+  }
+
+  if (n > 1 && (MAX (in_info->width, in_info->height) > space->tile_size ||
+          MAX (out_info->width, out_info->height) > space->tile_size)) {
+    GST_ERROR_OBJECT (space, "frames scaled in passes are not tiled");
+    goto failed;
+  }
+
+  if (n > space->n_vsps)
+    gst_vsp_filter_open_device_pool (space, n);
+  if (n > space->n_vsps) {
+    GST_ERROR_OBJECT (space, "scaling %dx%d -> %dx%d takes %u VSPs, found %u",
+        in_info->width, in_info->height, out_info->width, out_info->height,
+        n, space->n_vsps);
+    goto failed;
+  }
+
+  for (k = 0; k < space->n_vsps; k++) {
+    space->vsps[k]->in_info = &filter->in_info;
+    space->vsps[k]->out_info = &filter->out_info;
+  }
+  space->n_passes = n;
+
+  for (k = 0; k + 1 < n; k++) {
+    pass_info = &space->pass_info[k];
+    gst_video_info_set_format (pass_info, GST_VIDEO_INFO_FORMAT (out_info),
+        width[k + 1], height[k + 1]);
+    pass_info->colorimetry = out_info->colorimetry;
+    space->vsps[k]->out_info = pass_info;
+    space->vsps[k + 1]->in_info = pass_info;
+
+    vsp_info = space->vsps[k + 1];
+    caps = gst_video_info_to_caps (pass_info);
+    pool = gst_vsp_filter_setup_pool (vsp_info->v4lout_fd,
+        V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, caps, pass_info->size, 0,
+        MIN (space->queue_depth, VIDEO_MAX_FRAME));
+    gst_caps_unref (caps);
+    if (!pool) {
+      GST_ERROR_OBJECT (space, "failed to setup pool");
+      goto failed;
+    }
+    space->pass_pools[k] = pool;
+    vsp_info->node_configured[OUT] = FALSE;
+
+    GST_DEBUG_OBJECT (space, "pass %u on %s: %ux%u -> %ux%u", k,
+        space->vsps[k]->ip_name, width[k], height[k], width[k + 1],
+        height[k + 1]);
+  }
+
+  return TRUE;
+
+failed:
+  gst_vsp_filter_clear_pass_pools (space);
+  space->n_passes = 1;
+  return FALSE;
+}
+
+/* Pixels between the horizontal positions of tiles, for the userptr of
+ * every plane to start on TILE_ADDR_ALIGN */
+static guint
+get_tile_align (const GstVideoFormatInfo * finfo)
+{
+  guint align, i, comp;
+  gsize bytes;
+
+  for (align = 2; align < 2 * TILE_ADDR_ALIGN; align <<= 1) {
+    for (i = 0; i < GST_VIDEO_FORMAT_INFO_N_PLANES (finfo); i++) {
+      comp = get_plane_comp (finfo, i);
+      bytes = GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, comp, align) *
+          GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp);
+      if (bytes % TILE_ADDR_ALIGN)
+        break;
+    }
+    if (i == GST_VIDEO_FORMAT_INFO_N_PLANES (finfo))
+      break;
+  }
+
+  return align;
+}
+
+static guint
+gcd (guint a, guint b)
+{
+  guint t;
+
+  while (b) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+
+  return a;
+}
+
+/* Spreads n positions from 0 to last over multiples of step. FALSE if two
+ * of them are further apart than a tile. */
+static gboolean
+place_tiles (guint n, guint last, guint step, guint tile,
+    guint pos[MAX_TILES_PER_LINE])
+{
+  guint k;
+
+  for (k = 0; k < n; k++) {
+    pos[k] = (guint64) last * k / (n - 1);
+    pos[k] -= pos[k] % step;
+    if (k > 0 && (pos[k] <= pos[k - 1] || pos[k] - pos[k - 1] > tile))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Cuts one axis of the frames into as few tiles of the same size as the
+ * limit allows. Where the scaling ratio lets it, every input position maps
+ * exactly to its output position, so that the tiles start with the scaler
+ * phase of the whole frame. The positions are multiples of the aligns. */
+static gboolean
+layout_tiles (guint in_size, guint out_size, guint limit, guint in_align,
+    guint out_align, guint * n, guint * in_tile, guint * out_tile,
+    guint in_pos[MAX_TILES_PER_LINE], guint out_pos[MAX_TILES_PER_LINE],
+    gboolean * exact)
+{
+  guint in_unit, out_unit, step, last, k;
+
+  *exact = TRUE;
+  if (in_size <= limit && out_size <= limit) {
+    *n = 1;
+    *in_tile = in_size;
+    *out_tile = out_size;
+    in_pos[0] = out_pos[0] = 0;
+    return TRUE;
+  }
+
+  in_unit = in_size / gcd (in_size, out_size);
+  out_unit = out_size / gcd (in_size, out_size);
+
+  /* the smallest output distance between two exact aligned positions */
+  for (step = out_unit; step < out_size; step += out_unit) {
+    if (step % out_align == 0 && step / out_unit * in_unit % in_align == 0)
+      break;
+  }
+
+  for (*n = 2; *n <= MAX_TILES_PER_LINE && step < out_size; (*n)++) {
+    last = out_size - (out_size + *n - 1) / *n;
+    for (last -= last % step; last > 0; last -= step) {
+      *out_tile = out_size - last;
+      *in_tile = *out_tile / out_unit * in_unit;
+      if (*out_tile > limit || *in_tile > limit)
+        break;
+      if (place_tiles (*n, last, step, *out_tile, out_pos)) {
+        for (k = 0; k < *n; k++)
+          in_pos[k] = out_pos[k] / out_unit * in_unit;
+        return TRUE;
+      }
+    }
+  }
+
+  /* The tiles are scaled by a slightly different ratio */
+  *exact = FALSE;
+  for (*n = 2; *n <= MAX_TILES_PER_LINE; (*n)++) {
+    last = out_size - (out_size + *n - 1) / *n;
+    last -= last % out_align;
+    *out_tile = out_size - last;
+    last = in_size - (guint64) *out_tile * in_size / out_size;
+    last -= last % in_align;
+    *in_tile = in_size - last;
+    if (*out_tile > limit || *in_tile > limit)
+      continue;
+    if (place_tiles (*n, out_size - *out_tile, out_align, *out_tile,
+            out_pos) &&
+        place_tiles (*n, in_size - *in_tile, in_align, *in_tile, in_pos))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Cuts the frames which do not fit the device into a grid of tiles */
+static gboolean
+gst_vsp_filter_set_tiles (GstVspFilter * space, GstVideoInfo * in_info,
+    GstVideoInfo * out_info)
+{
+  guint in_x[MAX_TILES_PER_LINE], out_x[MAX_TILES_PER_LINE];
+  guint in_y[MAX_TILES_PER_LINE], out_y[MAX_TILES_PER_LINE];
+  guint nx, ny, in_w, in_h, out_w, out_h, in_width, in_height;
+  gboolean exact_x, exact_y;
+  GstVspFilterTile *tile;
+  guint x, y;
+
+  space->n_tiles = 1;
+  if (space->n_passes > 1 || space->roi_batch)
+    return TRUE;
+
+  in_width = round_down_width (in_info->finfo, in_info->width);
+  in_height = round_down_height (in_info->finfo, in_info->height);
+
+  if (!layout_tiles (in_width, out_info->width, space->tile_size,
+          get_tile_align (in_info->finfo), get_tile_align (out_info->finfo),
+          &nx, &in_w, &out_w, in_x, out_x, &exact_x) ||
+      !layout_tiles (in_height, out_info->height, space->tile_size,
+          1 << GST_VIDEO_FORMAT_INFO_H_SUB (in_info->finfo, 1),
+          1 << GST_VIDEO_FORMAT_INFO_H_SUB (out_info->finfo, 1),
+          &ny, &in_h, &out_h, in_y, out_y, &exact_y)) {
+    GST_ERROR_OBJECT (space, "cannot cut %dx%d -> %dx%d into tiles of %u",
+        in_info->width, in_info->height, out_info->width, out_info->height,
+        space->tile_size);
+    space->n_tiles = 1;
+    return FALSE;
+  }
+
+  space->n_tiles = nx * ny;
+  if (space->n_tiles == 1)
+    return TRUE;
+
+  if (!exact_x || !exact_y)
+    GST_WARNING_OBJECT (space, "the scaling ratio has no exact tiles, "
+        "seams may show");
+
+  /* row by row, the overlaps are written by the later tile */
+  for (y = 0; y < ny; y++) {
+    for (x = 0; x < nx; x++) {
+      tile = &space->tiles[y * nx + x];
+      tile->in_rect.x = in_x[x];
+      tile->in_rect.y = in_y[y];
+      tile->in_rect.w = in_w;
+      tile->in_rect.h = in_h;
+      tile->out_rect.x = out_x[x];
+      tile->out_rect.y = out_y[y];
+      tile->out_rect.w = out_w;
+      tile->out_rect.h = out_h;
+    }
+  }
+
+  GST_DEBUG_OBJECT (space, "%ux%u tiles of %ux%u -> %ux%u", nx, ny, in_w,
+      in_h, out_w, out_h);
+
+  return TRUE;
+}
+
+/* Splits the frames into bands of rows converted by a VSP each. The
+ * stripes do not overlap and the WPF cannot crop away rows taken in for
+ * the taps of the UDS, so only frames not scaled vertically are split:
+ * their rows are converted one to one and the stripes match the
+ * conversion of the whole frame. */
+static void
+gst_vsp_filter_set_stripes (GstVspFilter * space, GstVideoInfo * in_info,
+    GstVideoInfo * out_info)
+{
+  GstVspFilterVspInfo *vsp_info;
+  guint in_width, in_height, height;
+  guint align, pos, prev, k, n;
+
+  for (k = 0; k < space->n_vsps; k++) {
+    memset (&space->vsps[k]->in_rect, 0, sizeof (GstVideoRectangle));
+    memset (&space->vsps[k]->out_rect, 0, sizeof (GstVideoRectangle));
+  }
+  space->n_stripes = 1;
+
+  if (space->stripes <= 1 || space->roi_batch)
+    return;
+
+  /* the rows of a stripe would land elsewhere */
+  if (space->rotation != GST_VSPFILTER_ROTATION_0 ||
+      space->flip != GST_VSPFILTER_FLIP_NONE) {
+    GST_WARNING_OBJECT (space, "rotated or flipped frames are not split "
+        "into stripes");
+    return;
+  }
+
+  if (space->n_tiles > 1) {
+    GST_WARNING_OBJECT (space, "tiled frames are not split into stripes");
+    return;
+  }
+
+  if (space->n_passes > 1) {
+    GST_WARNING_OBJECT (space, "frames scaled in passes are not split into "
+        "stripes");
+    return;
+  }
+
+  in_width = round_down_width (in_info->finfo, in_info->width);
+  in_height = round_down_height (in_info->finfo, in_info->height);
+  height = out_info->height;
+
+  /* the vertical taps would stop at the stripe edges */
+  if (in_height != height) {
+    GST_WARNING_OBJECT (space, "frames scaled from %u to %u rows are not "
+        "split into stripes", in_height, height);
+    return;
+  }
+
+  n = MIN (space->stripes, space->n_vsps);
+  if (n < space->stripes)
+    GST_WARNING_OBJECT (space, "only %u VSPs for %u stripes", n,
+        space->stripes);
+
+  /* chroma rows of subsampled formats are not split */
+  align = MAX (1 << GST_VIDEO_FORMAT_INFO_H_SUB (in_info->finfo, 1),
+      1 << GST_VIDEO_FORMAT_INFO_H_SUB (out_info->finfo, 1));
+
+  while (n > 1 && height / n < MIN_STRIPE_HEIGHT)
+    n--;
+  if (n <= 1) {
+    GST_DEBUG_OBJECT (space, "%ux%u too small to split", out_info->width,
+        height);
+    return;
+  }
+
+  prev = 0;
+  for (k = 0; k < n; k++) {
+    if (k == n - 1) {
+      pos = height;
+    } else {
+      pos = height * (k + 1) / n;
+      pos -= pos % align;
+    }
+
+    if (pos <= prev)
+      goto no_stripes;
+
+    vsp_info = space->vsps[k];
+    vsp_info->in_rect.x = 0;
+    vsp_info->in_rect.y = prev;
+    vsp_info->in_rect.w = in_width;
+    vsp_info->in_rect.h = pos - prev;
+    vsp_info->out_rect.x = 0;
+    vsp_info->out_rect.y = prev;
+    vsp_info->out_rect.w = out_info->width;
+    vsp_info->out_rect.h = pos - prev;
+
+    GST_DEBUG_OBJECT (space, "stripe %u on %s: rows %u-%u", k,
+        vsp_info->ip_name, prev, pos - 1);
+
+    prev = pos;
+  }
+
+  space->n_stripes = n;
+  return;
+
+no_stripes:
+  GST_WARNING_OBJECT (space, "cannot split %ux%u into %u stripes",
+      out_info->width, height, n);
+  for (k = 0; k < n; k++) {
+    memset (&space->vsps[k]->in_rect, 0, sizeof (GstVideoRectangle));
+    memset (&space->vsps[k]->out_rect, 0, sizeof (GstVideoRectangle));
+  }
+}
+
+/* Unpacks border_color as a pixel of the output format */
+static void
+make_border_pixel (GstVspFilter * space, GstVideoInfo * out_info,
+    guint8 pixel[4])
+{
+  const GstVideoFormatInfo *finfo = out_info->finfo;
+  gint offset[GST_VIDEO_MAX_COMPONENTS], scale[GST_VIDEO_MAX_COMPONENTS];
+  gdouble r, g, b, y, Kr, Kb;
+
+  pixel[0] = space->border_color >> 24;
+  pixel[1] = r = (space->border_color >> 16) & 0xff;
+  pixel[2] = g = (space->border_color >> 8) & 0xff;
+  pixel[3] = b = space->border_color & 0xff;
+
+  /* The unpacked pixels of YUV formats are AYUV */
+  if (GST_VIDEO_INFO_IS_YUV (out_info)) {
+    if (!gst_video_color_matrix_get_Kr_Kb (out_info->colorimetry.matrix, &Kr,
+            &Kb)) {
+      Kr = 0.299;
+      Kb = 0.114;
+    }
+    gst_video_color_range_offsets (out_info->colorimetry.range, finfo, offset,
+        scale);
+    y = Kr * r + (1 - Kr - Kb) * g + Kb * b;
+    pixel[1] = CLAMP (offset[0] + y * scale[0] / 255 + 0.5, 0, 255);
+    pixel[2] = CLAMP (offset[1] + (b - y) / (2 * (1 - Kb)) * scale[1] / 255 +
+        0.5, 0, 255);
+    pixel[3] = CLAMP (offset[2] + (r - y) / (2 * (1 - Kr)) * scale[2] / 255 +
+        0.5, 0, 255);
+  }
+}
+
+/* Packs a few rows of the output format in border_color, enough for a row
+ * of every plane */
+static void
+make_border_line (GstVspFilter * space, GstVideoInfo * out_info)
+{
+  const GstVideoFormatInfo *finfo = out_info->finfo;
+  GstVideoInfo *info = &space->border_info;
+  gpointer data[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  guint8 pixel[4], *unpacked;
+  guint i, rows;
+
+  make_border_pixel (space, out_info, pixel);
+
+  rows = 1 << GST_VIDEO_FORMAT_INFO_H_SUB (finfo, 1);
+  gst_video_info_set_format (info, GST_VIDEO_INFO_FORMAT (out_info),
+      out_info->width, rows);
+  g_free (space->border_line);
+  space->border_line = g_malloc0 (info->size);
+
+  unpacked = g_malloc (out_info->width * 4);
+  for (i = 0; i < out_info->width; i++)
+    memcpy (unpacked + i * 4, pixel, 4);
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (info); i++) {
+    data[i] = space->border_line + info->offset[i];
+    stride[i] = info->stride[i];
+  }
+  for (i = 0; i < rows; i++)
+    finfo->pack_func (finfo, GST_VIDEO_PACK_FLAG_NONE, unpacked, 0, data,
+        stride, GST_VIDEO_CHROMA_SITE_UNKNOWN, i, out_info->width);
+  g_free (unpacked);
+}
+
+/* With add-borders, finds the largest area of the output with the display
+ * aspect ratio of the input. The BRU places the picture there over its
+ * background in the color of the borders. Without a BRU, the VSP scales
+ * into it through a userptr at its place in the output buffer and the CPU
+ * fills the borders, as the WPF has no compose rectangle. */
+static gboolean
+gst_vsp_filter_set_borders (GstVspFilter * space, GstVideoInfo * in_info,
+    GstVideoInfo * out_info)
+{
+  GstVideoRectangle *rect = &space->borders;
+  guint64 num, den;
+  guint x_align, w_align, h_align;
+  guint8 pixel[4];
+  guint in_w, in_h, i;
+
+  memset (rect, 0, sizeof (GstVideoRectangle));
+  space->bru_borders = FALSE;
+  if (!space->add_borders)
+    return TRUE;
+
+  if (!gst_vsp_filter_whole_frames (space)) {
+    GST_WARNING_OBJECT (space,
+        "no borders added to frames in tiles, stripes, passes or ROIs");
+    return TRUE;
+  }
+
+  /* the display aspect ratio of the input in output pixels */
+  num = (guint64) in_info->width * in_info->par_n * out_info->par_d;
+  den = (guint64) in_info->height * in_info->par_d * out_info->par_n;
+  if (SWAPS_SIZE (&space->orientation)) {
+    num = (guint64) in_info->height * in_info->par_d * out_info->par_d;
+    den = (guint64) in_info->width * in_info->par_n * out_info->par_n;
+  }
+
+  x_align = get_tile_align (out_info->finfo);
+  w_align = 1 << GST_VIDEO_FORMAT_INFO_W_SUB (out_info->finfo, 1);
+  h_align = 1 << GST_VIDEO_FORMAT_INFO_H_SUB (out_info->finfo, 1);
+
+  if (out_info->width * den > out_info->height * num) {
+    rect->h = out_info->height;
+    rect->w = GST_ROUND_DOWN_N ((guint) (out_info->height * num / den),
+        w_align);
+    rect->x = GST_ROUND_DOWN_N ((out_info->width - rect->w) / 2, x_align);
+  } else {
+    rect->w = out_info->width;
+    rect->h = GST_ROUND_DOWN_N ((guint) (out_info->width * den / num),
+        h_align);
+    rect->y = GST_ROUND_DOWN_N ((out_info->height - rect->h) / 2, h_align);
+  }
+
+  if (rect->w <= 0 || rect->h <= 0 || (rect->w == out_info->width &&
+          rect->h == out_info->height)) {
+    memset (rect, 0, sizeof (GstVideoRectangle));
+    return TRUE;
+  }
+
+  in_w = round_down_width (in_info->finfo, in_info->width);
+  in_h = round_down_height (in_info->finfo, in_info->height);
+  if (!gst_vsp_filter_fits_uds (space, in_w, in_h, rect->w, rect->h)) {
+    GST_ERROR_OBJECT (space, "cannot scale %ux%u -> %dx%d", in_w, in_h,
+        rect->w, rect->h);
+    memset (rect, 0, sizeof (GstVideoRectangle));
+    return FALSE;
+  }
+
+  space->bru_borders = gst_vsp_filter_has_bru_borders (space, out_info);
+  GST_DEBUG_OBJECT (space, "picture at %d,%d %dx%d, borders filled by the %s",
+      rect->x, rect->y, rect->w, rect->h, space->bru_borders ? "BRU" : "CPU");
+  if (space->bru_borders) {
+    make_border_pixel (space, out_info, pixel);
+    /* the BRU takes Cr, Y and Cb in the fields of R, G and B */
+    space->border_pixel = pixel[3] << 16 | pixel[1] << 8 | pixel[2];
+  } else {
+    make_border_line (space, out_info);
+  }
+
+  for (i = 0; i < space->n_vsps; i++)
+    set_picture_rects (space, space->vsps[i], in_info, out_info,
+        &space->crop);
+
+  return TRUE;
+}
+
+static gboolean
+gst_vsp_filter_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  GstVideoFilter *filter = GST_VIDEO_FILTER_CAST (trans);
+  GstVideoFilterClass *fclass;
+  GstVideoInfo in_info, out_info;
+  GstVspFilter *space;
+  GstVspFilterVspInfo *vsp_info;
+  GstBufferPool *in_newpool;
+  GstBufferPool *out_newpool;
+  guint buf_min = 0, buf_max = 0;
+  GstStructure *ins, *outs;
+  GstVspFilterOrientation orientation;
+  gboolean in_changed, out_changed;
+  guint i;
+
+  space = GST_VSP_FILTER_CAST (filter);
+  fclass = GST_VIDEO_FILTER_GET_CLASS (filter);
+  vsp_info = space->vsp_info;
+
+  /* input caps */
+  if (!gst_video_info_from_caps (&in_info, incaps))
+    goto invalid_caps;
+
+  /* output caps */
+  if (!gst_video_info_from_caps (&out_info, outcaps))
+    goto invalid_caps;
+
+  /* these must match */
+  if (in_info.fps_n != out_info.fps_n || in_info.fps_d != out_info.fps_d)
+    goto format_mismatch;
+
+  /* if present, these must match too */
+  if (in_info.interlace_mode != out_info.interlace_mode)
+    goto format_mismatch;
+
+  ins = gst_caps_get_structure (incaps, 0);
+  if (!find_colorimetry (gst_structure_get_value (ins, "colorimetry"))) {
+    in_info.colorimetry.range = GST_VIDEO_COLOR_RANGE_UNKNOWN;
+    in_info.colorimetry.matrix = GST_VIDEO_COLOR_MATRIX_UNKNOWN;
+  }
+
+  outs = gst_caps_get_structure (outcaps, 0);
+  if (!find_colorimetry (gst_structure_get_value (outs, "colorimetry"))) {
+    out_info.colorimetry.range = GST_VIDEO_COLOR_RANGE_UNKNOWN;
+    out_info.colorimetry.matrix = GST_VIDEO_COLOR_MATRIX_UNKNOWN;
+  }
+
+  GST_DEBUG ("reconfigured %d %d", GST_VIDEO_INFO_FORMAT (&in_info),
+      GST_VIDEO_INFO_FORMAT (&out_info));
+
+  in_changed = !filter->negotiated ||
+      !same_device_format (&filter->in_info, &in_info);
+  /* The request src pads pick their caps again with the next frame */
+  for (i = 0; i < MAX_OUTPUTS; i++) {
+    if (space->outputs[i])
+      space->outputs[i]->negotiated = FALSE;
+  }
+  out_changed = !filter->negotiated ||
+      !same_device_format (&filter->out_info, &out_info);
+
+  /* Every region of interest is scaled, even to the size of the frame,
+   * and square frames may be turned */
+  gst_vsp_filter_get_orientation (space, &orientation);
+  if (space->roi_batch || !IS_IDENTITY (&orientation))
+    gst_base_transform_set_passthrough (trans, FALSE);
+
+  /* e.g. only the framerate changed, keep streaming. The borders also
+   * depend on the pixel aspect ratios. */
+  if (!in_changed && !out_changed && !space->add_borders) {
+    GST_DEBUG_OBJECT (space, "device configuration unchanged");
+    filter->in_info = in_info;
+    filter->out_info = out_info;
+    return TRUE;
   }
 
-  GST_DEBUG ("reconfigured %d %d", GST_VIDEO_INFO_FORMAT (&in_info),
-      GST_VIDEO_INFO_FORMAT (&out_info));
+  /* For the reinitialization of entities pipeline. set_vsp_entities()
+   * only redoes the steps affected by the change. */
+  for (i = 0; i < space->n_vsps; i++) {
+    GstVspFilterVspInfo *pool_vsp = space->vsps[i];
 
-  /* For the reinitialization of entities pipeline */
-  vsp_info->already_setup_info = FALSE;
-  if (vsp_info->is_stream_started) {
-    stop_capturing (space, vsp_info->v4lout_fd, OUT,
-        V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
-    stop_capturing (space, vsp_info->v4lcap_fd, CAP,
-        V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
-    vsp_info->is_stream_started = FALSE;
+    pool_vsp->already_setup_info = FALSE;
+    pool_vsp->disabled = FALSE;
+    if (pool_vsp->is_stream_started)
+      stop_streaming (space, pool_vsp);
   }
 
+  space->orientation = orientation;
+  if (!gst_vsp_filter_set_passes (space, &in_info, &out_info))
+    goto no_passes;
+  if (!gst_vsp_filter_set_tiles (space, &in_info, &out_info))
+    goto no_tiles;
+  if ((space->n_tiles > 1 || space->n_passes > 1) &&
+      !IS_IDENTITY (&orientation))
+    goto no_orientation;
+  gst_vsp_filter_set_stripes (space, &in_info, &out_info);
+  /* set_stripes() has reset the crops of the VSPs */
+  memset (&space->crop, 0, sizeof (GstVideoRectangle));
+  gst_vsp_filter_clear_overlays (space);
+  if (!gst_vsp_filter_set_borders (space, &in_info, &out_info))
+    goto no_passes;
+  if (gst_vsp_filter_has_overlay_rpfs (space) &&
+      !gst_vsp_filter_whole_frames (space))
+    GST_WARNING_OBJECT (space, "overlays are only blended with frames "
+        "converted in one piece");
+  if (gst_vsp_filter_has_histogram (space) &&
+      !gst_vsp_filter_whole_frames (space))
+    GST_WARNING_OBJECT (space, "histograms are only added to frames "
+        "converted in one piece");
+
+  if (!in_changed && space->in_pool)
+    goto done;
+
   if (space->in_pool) {
     guint n_reqbufs = 0;
 
@@ -1729,15 +5739,22 @@ gst_vsp_filter_set_caps (GstBaseTransform * trans, GstCaps * incaps,
     }
   }
 
-  in_newpool = gst_vsp_filter_setup_pool (vsp_info->v4lout_fd,
-      V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, incaps, in_info.size, 0);
+  if (space->n_tiles > 1)
+    in_newpool = gst_vsp_filter_setup_tile_pool (incaps, 0,
+        gst_vsp_filter_get_max_frames (space));
+  else
+    in_newpool = gst_vsp_filter_setup_pool (vsp_info->v4lout_fd,
+        V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, incaps, in_info.size, 0,
+        gst_vsp_filter_get_max_frames (space));
   if (!in_newpool)
     goto pool_setup_failed;
 
   gst_object_replace ((GstObject **) & space->in_pool,
       (GstObject *) in_newpool);
   gst_object_unref (in_newpool);
+  vsp_info->node_configured[OUT] = FALSE;
 
+done:
   filter->in_info = in_info;
   filter->out_info = out_info;
   GST_BASE_TRANSFORM_CLASS (fclass)->transform_ip_on_passthrough = FALSE;
@@ -1752,6 +5769,28 @@ pool_setup_failed:
     filter->negotiated = FALSE;
     return FALSE;
   }
+no_passes:
+  {
+    GST_ELEMENT_ERROR (space, CORE, NEGOTIATION, (NULL),
+        ("cannot scale %dx%d to %dx%d", in_info.width, in_info.height,
+            out_info.width, out_info.height));
+    filter->negotiated = FALSE;
+    return FALSE;
+  }
+no_tiles:
+  {
+    GST_ELEMENT_ERROR (space, CORE, NEGOTIATION, (NULL),
+        ("frames too large for tile-size=%u", space->tile_size));
+    filter->negotiated = FALSE;
+    return FALSE;
+  }
+no_orientation:
+  {
+    GST_ELEMENT_ERROR (space, CORE, NEGOTIATION, (NULL),
+        ("frames converted in tiles or passes cannot be rotated or flipped"));
+    filter->negotiated = FALSE;
+    return FALSE;
+  }
 invalid_caps:
   {
     GST_ERROR_OBJECT (space, "invalid caps");
@@ -1787,6 +5826,12 @@ gst_vsp_filter_propose_allocation (GstBaseTransform * trans,
   if (decide_query == NULL)
     return TRUE;
 
+  /* the region of the crop meta is read by the RPF */
+  gst_query_add_allocation_meta (query, GST_VIDEO_CROP_META_API_TYPE, NULL);
+  if (gst_vsp_filter_has_overlay_rpfs (space))
+    gst_query_add_allocation_meta (query,
+        GST_VIDEO_OVERLAY_COMPOSITION_META_API_TYPE, NULL);
+
   if (!space->in_pool) {
     GstCaps *caps;
     GstVideoInfo vinfo;
@@ -1797,11 +5842,13 @@ gst_vsp_filter_propose_allocation (GstBaseTransform * trans,
 
     GST_DEBUG_OBJECT (space, "create new pool");
     space->in_pool = gst_vsp_filter_setup_pool (vsp_info->v4lout_fd,
-        V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, caps, vinfo.size, 0);
+        V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, caps, vinfo.size, 0,
+        gst_vsp_filter_get_max_frames (space));
     if (!space->in_pool) {
       GST_ERROR_OBJECT (space, "failed to setup pool");
       return FALSE;
     }
+    vsp_info->node_configured[OUT] = FALSE;
   }
 
   pool = gst_object_ref (space->in_pool);
@@ -1826,13 +5873,153 @@ gst_vsp_filter_propose_allocation (GstBaseTransform * trans,
 static gboolean gst_vsp_filter_stop (GstBaseTransform *trans) {
   GstVspFilter *space;
   gboolean ret = TRUE;
+  guint i;
 
   space = GST_VSP_FILTER_CAST (trans);
+  gst_vsp_filter_stop_output_task (space);
+  gst_vsp_filter_flush_jobs (space);
+  space->output_flow = GST_FLOW_OK;
+  gst_flow_combiner_reset (space->flow_combiner);
+  GST_INFO_OBJECT (space, "import cache: %" G_GUINT64_FORMAT " hits, %"
+      G_GUINT64_FORMAT " misses", space->cache_hits, space->cache_misses);
+  vspfilter_copier_free (space->copier);
+  space->copier = NULL;
+  dump_try_format_cache ();
+  for (i = 0; i < MAX_PASSES - 1; i++) {
+    if (space->pass_pools[i])
+      gst_buffer_pool_set_active (space->pass_pools[i], FALSE);
+  }
+  for (i = 0; i < MAX_OUTPUTS; i++) {
+    if (space->outputs[i] && space->outputs[i]->pool)
+      gst_buffer_pool_set_active (space->outputs[i]->pool, FALSE);
+  }
   if (space->in_pool)
     ret = gst_buffer_pool_set_active (space->in_pool, FALSE);
   return ret;
 }
 
+/* Any size and format the VSP converts to, the peer picks from them */
+static gboolean
+gst_vsp_filter_output_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstCaps *filter, *caps, *result;
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+      gst_query_parse_caps (query, &filter);
+      caps = gst_pad_get_pad_template_caps (pad);
+      if (filter) {
+        result = gst_caps_intersect_full (filter, caps,
+            GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref (caps);
+        caps = result;
+      }
+      gst_query_set_caps_result (query, caps);
+      gst_caps_unref (caps);
+      return TRUE;
+    default:
+      return gst_pad_query_default (pad, parent, query);
+  }
+}
+
+static GstPad *
+gst_vsp_filter_request_new_pad (GstElement * element, GstPadTemplate * templ,
+    const gchar * name, const GstCaps * caps)
+{
+  GstVspFilter *space = GST_VSP_FILTER_CAST (element);
+  GstPad *sinkpad = GST_BASE_TRANSFORM_SINK_PAD (space);
+  GstVspFilterOutput *out;
+  gchar *pad_name;
+  guint index = MAX_OUTPUTS, i;
+
+  GST_PAD_STREAM_LOCK (sinkpad);
+  GST_OBJECT_LOCK (space);
+  if (name && sscanf (name, "src_%u", &index) == 1) {
+    if (index >= MAX_OUTPUTS || space->outputs[index])
+      index = MAX_OUTPUTS;
+  } else {
+    for (i = 0; i < MAX_OUTPUTS && index == MAX_OUTPUTS; i++) {
+      if (!space->outputs[i])
+        index = i;
+    }
+  }
+  GST_OBJECT_UNLOCK (space);
+
+  if (index == MAX_OUTPUTS) {
+    GST_WARNING_OBJECT (space, "no request src pad %s, up to %d of them",
+        GST_STR_NULL (name), MAX_OUTPUTS);
+    goto failed;
+  }
+
+  out = g_new0 (GstVspFilterOutput, 1);
+  pad_name = g_strdup_printf ("src_%u", index);
+  out->pad = gst_pad_new_from_template (templ, pad_name);
+  g_free (pad_name);
+  gst_pad_set_query_function (out->pad,
+      GST_DEBUG_FUNCPTR (gst_vsp_filter_output_query));
+  g_queue_init (&out->jobs);
+  out->flow = GST_FLOW_OK;
+
+  /* In READY and above the devices are already opened */
+  if (space->vsp_info->v4lout_fd >= 0 &&
+      !gst_vsp_filter_open_output (space, out)) {
+    GST_WARNING_OBJECT (space, "no VSP left for %s",
+        GST_PAD_NAME (out->pad));
+    gst_object_unref (out->pad);
+    g_free (out);
+    goto failed;
+  }
+
+  GST_OBJECT_LOCK (space);
+  space->outputs[index] = out;
+  space->n_outputs++;
+  GST_OBJECT_UNLOCK (space);
+  GST_PAD_STREAM_UNLOCK (sinkpad);
+
+  gst_flow_combiner_add_pad (space->flow_combiner, out->pad);
+  gst_element_add_pad (element, out->pad);
+
+  return out->pad;
+
+failed:
+  GST_PAD_STREAM_UNLOCK (sinkpad);
+  return NULL;
+}
+
+static void
+gst_vsp_filter_release_pad (GstElement * element, GstPad * pad)
+{
+  GstVspFilter *space = GST_VSP_FILTER_CAST (element);
+  GstPad *sinkpad = GST_BASE_TRANSFORM_SINK_PAD (space);
+  GstVspFilterOutput *out = NULL;
+  guint i;
+
+  GST_PAD_STREAM_LOCK (sinkpad);
+  GST_OBJECT_LOCK (space);
+  for (i = 0; i < MAX_OUTPUTS; i++) {
+    if (space->outputs[i] && space->outputs[i]->pad == pad) {
+      out = space->outputs[i];
+      space->outputs[i] = NULL;
+      space->n_outputs--;
+      break;
+    }
+  }
+  GST_OBJECT_UNLOCK (space);
+
+  if (out)
+    gst_vsp_filter_close_output (space, out);
+  GST_PAD_STREAM_UNLOCK (sinkpad);
+
+  if (!out)
+    return;
+
+  gst_flow_combiner_remove_pad (space->flow_combiner, pad);
+  gst_pad_set_active (pad, FALSE);
+  gst_element_remove_pad (element, pad);
+  g_free (out);
+}
+
 static void
 gst_vsp_filter_class_init (GstVspFilterClass * klass)
 {
@@ -1875,10 +6062,152 @@ gst_vsp_filter_class_init (GstVspFilterClass * klass)
           GST_TYPE_VSPFILTER_COLOR_RANGE, DEFAULT_PROP_COLOR_RANGE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_QUEUE_DEPTH,
+      g_param_spec_uint ("queue-depth", "Queue depth",
+          "Number of frames kept in flight on the device (1 = synchronous)",
+          1, MAX_QUEUE_DEPTH, DEFAULT_PROP_QUEUE_DEPTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_ASYNC_OUTPUT,
+      g_param_spec_boolean ("async-output", "Asynchronous output",
+          "Push output buffers from a dedicated thread so that the upstream "
+          "is not blocked while the device is converting",
+          DEFAULT_PROP_ASYNC_OUTPUT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_IMPORT_CACHE_HITS,
+      g_param_spec_uint64 ("import-cache-hits", "Import cache hits",
+          "Number of imported buffers queued with the V4L2 buffer index "
+          "they had last time", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_IMPORT_CACHE_MISSES,
+      g_param_spec_uint64 ("import-cache-misses", "Import cache misses",
+          "Number of imported buffers which had to be attached to a V4L2 "
+          "buffer index again", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_COPY_THREADS,
+      g_param_spec_uint ("copy-threads", "Copy threads",
+          "Number of threads copying input buffers which can't be passed "
+          "to the device (0 = automatic)", 0, MAX_COPY_THREADS,
+          DEFAULT_PROP_COPY_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Frame counters and per-stage latency percentiles in microseconds "
+          "since the element was created", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Interval in milliseconds at which the statistics are posted as "
+          "element messages (0 = disabled)", 0, G_MAXUINT,
+          DEFAULT_PROP_STATS_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DEVICE_POOL,
+      g_param_spec_enum ("device-pool", "Device pool",
+          "Spread the frames over every VSP found besides the configured "
+          "one, queue-depth frames in flight on each",
+          GST_TYPE_VSPFILTER_DEVICE_POOL, DEFAULT_PROP_DEVICE_POOL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_STRIPES,
+      g_param_spec_uint ("stripes", "Stripes",
+          "Split every frame into bands of rows converted in parallel, "
+          "one per VSP (overrides device-pool)", 1, MAX_VSPS,
+          DEFAULT_PROP_STRIPES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_TILE_SIZE,
+      g_param_spec_uint ("tile-size", "Tile size",
+          "Largest width and height converted at once, larger frames are "
+          "converted as a grid of tiles", MIN_TILE_SIZE, VSP_MAX_SIZE,
+          DEFAULT_PROP_TILE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_ROI_BATCH,
+      g_param_spec_boolean ("roi-batch", "ROI batch",
+          "Crop every region of interest meta of a frame and scale it to "
+          "the output size, pushing the crops as a buffer list",
+          DEFAULT_PROP_ROI_BATCH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_ADD_BORDERS,
+      g_param_spec_boolean ("add-borders", "Add borders",
+          "Keep the display aspect ratio of the input and add borders to "
+          "the output when needed", DEFAULT_PROP_ADD_BORDERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_BORDER_COLOR,
+      g_param_spec_uint ("border-color", "Border color",
+          "Color of the borders in ARGB", 0, G_MAXUINT32,
+          DEFAULT_PROP_BORDER_COLOR,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_ROTATION,
+      g_param_spec_enum ("rotation", "Rotation",
+          "Clockwise rotation done by the WPF, auto follows the "
+          "image-orientation tag", GST_TYPE_VSPFILTER_ROTATION,
+          DEFAULT_PROP_ROTATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_FLIP,
+      g_param_spec_enum ("flip", "Flip",
+          "Flips done by the WPF before the rotation",
+          GST_TYPE_VSPFILTER_FLIP, DEFAULT_PROP_FLIP,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_OVERLAY,
+      g_param_spec_boolean ("overlay", "Overlay",
+          "Blend the overlay composition meta of the frames with the BRU, "
+          "using the RPFs the frames do not go through",
+          DEFAULT_PROP_OVERLAY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_GAMMA,
+      g_param_spec_double ("gamma", "Gamma",
+          "Gamma correction done by the LUT", 0.01, 10.0,
+          DEFAULT_PROP_GAMMA,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_BRIGHTNESS,
+      g_param_spec_double ("brightness", "Brightness",
+          "Brightness added by the LUT", -1.0, 1.0,
+          DEFAULT_PROP_BRIGHTNESS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_CONTRAST,
+      g_param_spec_double ("contrast", "Contrast",
+          "Contrast applied by the LUT", 0.0, 2.0,
+          DEFAULT_PROP_CONTRAST,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_CLU_FILE,
+      g_param_spec_string ("clu-file", "CLU file",
+          "3D LUT of 17 points a side in the .cube format graded by the "
+          "CLU", DEFAULT_PROP_CLU_FILE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_HISTOGRAM,
+      g_param_spec_boolean ("histogram", "Histogram",
+          "Add the histogram of each frame counted by the HGO to the output "
+          "buffer as a GstVspFilterHistogramMetaAPI meta",
+          DEFAULT_PROP_HISTOGRAM,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
   gst_element_class_add_pad_template (gstelement_class,
       gst_static_pad_template_get (&gst_vsp_filter_src_template));
   gst_element_class_add_pad_template (gstelement_class,
       gst_static_pad_template_get (&gst_vsp_filter_sink_template));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&gst_vsp_filter_request_src_template));
 
   gst_element_class_set_static_metadata (gstelement_class,
       "Colorspace and Video Size Converter with VSP1 V4L2",
@@ -1887,6 +6216,10 @@ gst_vsp_filter_class_init (GstVspFilterClass * klass)
       "Renesas Electronics Corporation");
 
   gstelement_class->change_state = gst_vsp_filter_change_state;
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_vsp_filter_request_new_pad);
+  gstelement_class->release_pad =
+      GST_DEBUG_FUNCPTR (gst_vsp_filter_release_pad);
 
   gstbasetransform_class->transform_caps =
       GST_DEBUG_FUNCPTR (gst_vsp_filter_transform_caps);
@@ -1902,6 +6235,12 @@ gst_vsp_filter_class_init (GstVspFilterClass * klass)
       GST_DEBUG_FUNCPTR (gst_vsp_filter_propose_allocation);
   gstbasetransform_class->transform =
       GST_DEBUG_FUNCPTR (gst_vsp_filter_transform);
+  gstbasetransform_class->generate_output =
+      GST_DEBUG_FUNCPTR (gst_vsp_filter_generate_output);
+  gstbasetransform_class->prepare_output_buffer =
+      GST_DEBUG_FUNCPTR (gst_vsp_filter_prepare_output_buffer);
+  gstbasetransform_class->sink_event =
+      GST_DEBUG_FUNCPTR (gst_vsp_filter_sink_event);
   gstbasetransform_class->set_caps =
       GST_DEBUG_FUNCPTR (gst_vsp_filter_set_caps);
   gstbasetransform_class->stop =
@@ -1925,10 +6264,45 @@ gst_vsp_filter_init (GstVspFilter * space)
   vsp_info->dev_name[OUT] = g_strdup (DEFAULT_PROP_VSP_DEVFILE_INPUT);
   vsp_info->dev_name[CAP] = g_strdup (DEFAULT_PROP_VSP_DEVFILE_OUTPUT);
 
-  vsp_info->resz_subdev_fd = -1;
+  vsp_info->v4lout_fd = vsp_info->v4lcap_fd = -1;
+  vsp_info->v4lsub_fd[OUT] = vsp_info->v4lsub_fd[CAP] = -1;
+  vsp_info->resz_subdev_fd = vsp_info->bru_subdev_fd = -1;
+  vsp_info->lut_subdev_fd = vsp_info->clu_subdev_fd = -1;
+  vsp_info->hgo_fd = vsp_info->hgo_subdev_fd = -1;
 
   space->vsp_info = vsp_info;
+  space->vsps[0] = vsp_info;
+  space->n_vsps = 1;
+  space->device_pool = DEFAULT_PROP_DEVICE_POOL;
+  space->stripes = DEFAULT_PROP_STRIPES;
+  space->n_stripes = 1;
+  space->tile_size = DEFAULT_PROP_TILE_SIZE;
+  space->n_tiles = 1;
+  space->n_passes = 1;
+  space->roi_batch = DEFAULT_PROP_ROI_BATCH;
+  space->add_borders = DEFAULT_PROP_ADD_BORDERS;
+  space->border_color = DEFAULT_PROP_BORDER_COLOR;
+  space->rotation = DEFAULT_PROP_ROTATION;
+  space->flip = DEFAULT_PROP_FLIP;
+  space->overlay = DEFAULT_PROP_OVERLAY;
+  space->gamma = DEFAULT_PROP_GAMMA;
+  space->brightness = DEFAULT_PROP_BRIGHTNESS;
+  space->contrast = DEFAULT_PROP_CONTRAST;
+  space->clu_file = DEFAULT_PROP_CLU_FILE;
+  space->histogram = DEFAULT_PROP_HISTOGRAM;
   space->input_color_range = DEFAULT_PROP_COLOR_RANGE;
+  space->queue_depth = DEFAULT_PROP_QUEUE_DEPTH;
+  space->async_output = DEFAULT_PROP_ASYNC_OUTPUT;
+  space->copy_threads = DEFAULT_PROP_COPY_THREADS;
+  space->stats_interval = DEFAULT_PROP_STATS_INTERVAL;
+  vspfilter_stats_reset (&space->stats);
+  g_mutex_init (&space->jobs_lock);
+  g_cond_init (&space->jobs_cond);
+  g_queue_init (&space->pending_jobs);
+  space->output_flow = GST_FLOW_OK;
+  space->flow_combiner = gst_flow_combiner_new ();
+  gst_flow_combiner_add_pad (space->flow_combiner,
+      GST_BASE_TRANSFORM_SRC_PAD (space));
 
   init_colorimetry_table();
 }
@@ -1965,6 +6339,65 @@ gst_vsp_filter_set_property (GObject * object, guint property_id,
     case PROP_INPUT_COLOR_RANGE:
       space->input_color_range = g_value_get_enum (value);
       break;
+    case PROP_QUEUE_DEPTH:
+      space->queue_depth = g_value_get_uint (value);
+      break;
+    case PROP_ASYNC_OUTPUT:
+      space->async_output = g_value_get_boolean (value);
+      break;
+    case PROP_COPY_THREADS:
+      space->copy_threads = g_value_get_uint (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      space->stats_interval = g_value_get_uint (value);
+      break;
+    case PROP_DEVICE_POOL:
+      space->device_pool = g_value_get_enum (value);
+      break;
+    case PROP_STRIPES:
+      space->stripes = g_value_get_uint (value);
+      break;
+    case PROP_TILE_SIZE:
+      space->tile_size = g_value_get_uint (value);
+      break;
+    case PROP_ROI_BATCH:
+      space->roi_batch = g_value_get_boolean (value);
+      break;
+    case PROP_ADD_BORDERS:
+      space->add_borders = g_value_get_boolean (value);
+      break;
+    case PROP_BORDER_COLOR:
+      space->border_color = g_value_get_uint (value);
+      break;
+    case PROP_ROTATION:
+      space->rotation = g_value_get_enum (value);
+      break;
+    case PROP_FLIP:
+      space->flip = g_value_get_enum (value);
+      break;
+    case PROP_OVERLAY:
+      space->overlay = g_value_get_boolean (value);
+      break;
+    case PROP_GAMMA:
+      space->gamma = g_value_get_double (value);
+      space->color_seqnum++;
+      break;
+    case PROP_BRIGHTNESS:
+      space->brightness = g_value_get_double (value);
+      space->color_seqnum++;
+      break;
+    case PROP_CONTRAST:
+      space->contrast = g_value_get_double (value);
+      space->color_seqnum++;
+      break;
+    case PROP_CLU_FILE:
+      g_free (space->clu_file);
+      space->clu_file = g_value_dup_string (value);
+      space->color_seqnum++;
+      break;
+    case PROP_HISTOGRAM:
+      space->histogram = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -1997,6 +6430,73 @@ gst_vsp_filter_get_property (GObject * object, guint property_id,
     case PROP_INPUT_COLOR_RANGE:
       g_value_set_enum (value, space->input_color_range);
       break;
+    case PROP_QUEUE_DEPTH:
+      g_value_set_uint (value, space->queue_depth);
+      break;
+    case PROP_ASYNC_OUTPUT:
+      g_value_set_boolean (value, space->async_output);
+      break;
+    case PROP_IMPORT_CACHE_HITS:
+      g_mutex_lock (&space->jobs_lock);
+      g_value_set_uint64 (value, space->cache_hits);
+      g_mutex_unlock (&space->jobs_lock);
+      break;
+    case PROP_IMPORT_CACHE_MISSES:
+      g_mutex_lock (&space->jobs_lock);
+      g_value_set_uint64 (value, space->cache_misses);
+      g_mutex_unlock (&space->jobs_lock);
+      break;
+    case PROP_COPY_THREADS:
+      g_value_set_uint (value, space->copy_threads);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, vspfilter_stats_to_structure (&space->stats));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, space->stats_interval);
+      break;
+    case PROP_DEVICE_POOL:
+      g_value_set_enum (value, space->device_pool);
+      break;
+    case PROP_STRIPES:
+      g_value_set_uint (value, space->stripes);
+      break;
+    case PROP_TILE_SIZE:
+      g_value_set_uint (value, space->tile_size);
+      break;
+    case PROP_ROI_BATCH:
+      g_value_set_boolean (value, space->roi_batch);
+      break;
+    case PROP_ADD_BORDERS:
+      g_value_set_boolean (value, space->add_borders);
+      break;
+    case PROP_BORDER_COLOR:
+      g_value_set_uint (value, space->border_color);
+      break;
+    case PROP_ROTATION:
+      g_value_set_enum (value, space->rotation);
+      break;
+    case PROP_FLIP:
+      g_value_set_enum (value, space->flip);
+      break;
+    case PROP_OVERLAY:
+      g_value_set_boolean (value, space->overlay);
+      break;
+    case PROP_GAMMA:
+      g_value_set_double (value, space->gamma);
+      break;
+    case PROP_BRIGHTNESS:
+      g_value_set_double (value, space->brightness);
+      break;
+    case PROP_CONTRAST:
+      g_value_set_double (value, space->contrast);
+      break;
+    case PROP_CLU_FILE:
+      g_value_set_string (value, space->clu_file);
+      break;
+    case PROP_HISTOGRAM:
+      g_value_set_boolean (value, space->histogram);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -2004,15 +6504,12 @@ gst_vsp_filter_get_property (GObject * object, guint property_id,
 }
 
 static gint
-queue_buffer (GstVspFilter * space, int fd, guint dev_index,
-    enum v4l2_buf_type buftype, struct v4l2_plane *planes,
+queue_buffer (GstVspFilter * space, GstVspFilterVspInfo * vsp_info, int fd,
+    guint dev_index, enum v4l2_buf_type buftype, struct v4l2_plane *planes,
     enum v4l2_memory io[MAX_DEVICES], guint buf_index)
 {
-  GstVspFilterVspInfo *vsp_info;
   struct v4l2_buffer buf;
 
-  vsp_info = space->vsp_info;
-
   CLEAR (buf);
 
   buf.type = buftype;
@@ -2031,15 +6528,12 @@ queue_buffer (GstVspFilter * space, int fd, guint dev_index,
 }
 
 static gint
-dequeue_buffer (GstVspFilter * space, int fd, guint dev_index,
-    enum v4l2_buf_type buftype, struct v4l2_plane *planes,
-    enum v4l2_memory io[MAX_DEVICES])
+dequeue_buffer (GstVspFilter * space, GstVspFilterVspInfo * vsp_info, int fd,
+    guint dev_index, enum v4l2_buf_type buftype, struct v4l2_plane *planes,
+    enum v4l2_memory io[MAX_DEVICES], guint * buf_index)
 {
-  GstVspFilterVspInfo *vsp_info;
   struct v4l2_buffer buf;
 
-  vsp_info = space->vsp_info;
-
   CLEAR (buf);
 
   buf.type = buftype;
@@ -2053,6 +6547,9 @@ dequeue_buffer (GstVspFilter * space, int fd, guint dev_index,
     return -1;
   }
 
+  if (buf_index)
+    *buf_index = buf.index;
+
   return 0;
 }
 
@@ -2068,56 +6565,252 @@ start_capturing (GstVspFilter * space, int fd, guint dev_index,
   return TRUE;
 }
 
+/* Queues the uploaded overlays to be blended with the next frame, the
+ * overlay nodes cycle through their buffers */
+static gboolean
+queue_overlays (GstVspFilter * space, GstVspFilterVspInfo * vsp_info)
+{
+  struct v4l2_buffer buf;
+  struct v4l2_plane plane;
+  guint i;
+
+  for (i = 0; i < vsp_info->pipe_config.n_overlays; i++) {
+    CLEAR (buf);
+    CLEAR (plane);
+
+    plane.m.userptr = (unsigned long) space->overlays[i].data;
+    plane.length = plane.bytesused = space->overlays[i].size;
+
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buf.memory = V4L2_MEMORY_USERPTR;
+    buf.index = vsp_info->overlay_index % vsp_info->n_overlay_bufs;
+    buf.m.planes = &plane;
+    buf.length = 1;
+
+    if (-1 == xioctl (vsp_info->overlay_fd[i], VIDIOC_QBUF, &buf)) {
+      GST_ERROR_OBJECT (space, "VIDIOC_QBUF for %s failed errno=%d",
+          vsp_info->overlay_dev_name[i], errno);
+      return FALSE;
+    }
+  }
+  vsp_info->overlay_index++;
+
+  return TRUE;
+}
+
+static gboolean
+dequeue_overlays (GstVspFilter * space, GstVspFilterVspInfo * vsp_info)
+{
+  struct v4l2_buffer buf;
+  struct v4l2_plane plane;
+  guint i;
+
+  for (i = 0; i < vsp_info->pipe_config.n_overlays; i++) {
+    CLEAR (buf);
+    CLEAR (plane);
+
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buf.memory = V4L2_MEMORY_USERPTR;
+    buf.m.planes = &plane;
+    buf.length = 1;
+
+    if (-1 == xioctl (vsp_info->overlay_fd[i], VIDIOC_DQBUF, &buf)) {
+      GST_ERROR_OBJECT (space, "VIDIOC_DQBUF for %s failed",
+          vsp_info->overlay_dev_name[i]);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Queues a buffer for the histogram of the next frame, the histogram
+ * node cycles through its buffers */
+static gboolean
+queue_histogram (GstVspFilter * space, GstVspFilterVspInfo * vsp_info)
+{
+  struct v4l2_buffer buf;
+
+  if (!vsp_info->pipe_config.histogram)
+    return TRUE;
+
+  CLEAR (buf);
+  buf.type = V4L2_BUF_TYPE_META_CAPTURE;
+  buf.memory = V4L2_MEMORY_USERPTR;
+  buf.index = vsp_info->hgo_index % vsp_info->n_hgo_bufs;
+  buf.m.userptr = (unsigned long) vsp_info->hgo_data[buf.index];
+  buf.length = HGO_DATA_SIZE;
+
+  if (-1 == xioctl (vsp_info->hgo_fd, VIDIOC_QBUF, &buf)) {
+    GST_ERROR_OBJECT (space, "VIDIOC_QBUF for %s failed errno=%d",
+        vsp_info->hgo_dev_name, errno);
+    return FALSE;
+  }
+  vsp_info->hgo_index++;
+
+  return TRUE;
+}
+
+/* Adds the histogram of the frame the VSP has completed to its output
+ * buffer */
+static gboolean
+dequeue_histogram (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    GstBuffer * outbuf)
+{
+  struct v4l2_buffer buf;
+
+  if (!vsp_info->pipe_config.histogram)
+    return TRUE;
+
+  CLEAR (buf);
+  buf.type = V4L2_BUF_TYPE_META_CAPTURE;
+  buf.memory = V4L2_MEMORY_USERPTR;
+
+  if (-1 == xioctl (vsp_info->hgo_fd, VIDIOC_DQBUF, &buf)) {
+    GST_ERROR_OBJECT (space, "VIDIOC_DQBUF for %s failed",
+        vsp_info->hgo_dev_name);
+    return FALSE;
+  }
+
+  if ((buf.flags & V4L2_BUF_FLAG_ERROR) || buf.bytesused < HGO_DATA_SIZE ||
+      buf.index >= vsp_info->n_hgo_bufs) {
+    GST_WARNING_OBJECT (space, "no histogram for the frame");
+    return TRUE;
+  }
+
+  if (outbuf)
+    vspfilter_buffer_add_histogram_meta (outbuf,
+        vsp_info->pipe_config.proc_code == V4L2_MBUS_FMT_ARGB8888_1X32 ?
+        VSPFILTER_HISTOGRAM_MAX_RGB : VSPFILTER_HISTOGRAM_LUMA,
+        vsp_info->hgo_data[buf.index]);
+
+  return TRUE;
+}
+
+/* Must be called with jobs_lock held */
+static guint
+acquire_index (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    guint dev_index, GstVspFilterFrameInfo * vframe_info)
+{
+  const VspfilterBufferKey *key;
+  gboolean hit;
+  guint index;
+
+  if (!vsp_info->index_cache[dev_index])
+    return VSPFILTER_INDEX_INVALID;
+
+  key = vframe_info->key.n_planes ? &vframe_info->key : NULL;
+  index = vspfilter_index_cache_acquire (vsp_info->index_cache[dev_index],
+      key, &hit);
+  if (key && index != VSPFILTER_INDEX_INVALID) {
+    if (hit)
+      space->cache_hits++;
+    else
+      space->cache_misses++;
+    GST_LOG_OBJECT (space, "%s buffer index %u (%s)",
+        dev_index == OUT ? "input" : "output", index, hit ? "hit" : "miss");
+  }
+
+  return index;
+}
+
 static GstFlowReturn
 gst_vsp_filter_transform_frame_process (GstVideoFilter * filter,
+    GstVspFilterVspInfo * vsp_info, const GstVspFilterTile * tile,
     GstVspFilterFrameInfo * in_vframe_info,
     GstVspFilterFrameInfo * out_vframe_info,
     gint in_stride[GST_VIDEO_MAX_PLANES], gint out_stride[GST_VIDEO_MAX_PLANES],
-    guint in_index, guint out_index)
+    guint * in_index, guint * out_index)
 {
   GstVspFilter *space;
-  GstVspFilterVspInfo *vsp_info;
-  struct timeval tv;
-  fd_set fds;
-  gint ret;
   struct v4l2_plane in_planes[VIDEO_MAX_PLANES];
   struct v4l2_plane out_planes[VIDEO_MAX_PLANES];
   GstVideoInfo *in_info;
   GstVideoInfo *out_info;
   enum v4l2_memory io[MAX_DEVICES];
+  guint n_slots[MAX_DEVICES];
+  const GstVideoRectangle *in_rect = NULL, *out_rect = NULL;
+  gsize in_offset[GST_VIDEO_MAX_PLANES] = { 0 };
+  gsize out_offset[GST_VIDEO_MAX_PLANES] = { 0 };
   gint i;
   guint in_height, plane_height;
+  gint64 start;
 
   memset (in_planes, 0, sizeof (in_planes));
   memset (out_planes, 0, sizeof (out_planes));
 
   space = GST_VSP_FILTER_CAST (filter);
-  vsp_info = space->vsp_info;
 
   GST_CAT_DEBUG_OBJECT (GST_CAT_PERFORMANCE, filter,
       "doing colorspace conversion from %s -> to %s",
       GST_VIDEO_INFO_NAME (&filter->in_info),
       GST_VIDEO_INFO_NAME (&filter->out_info));
 
-  in_info = &filter->in_info;
-  out_info = &filter->out_info;
+  in_info = vsp_info->in_info;
+  out_info = vsp_info->out_info;
 
   io[OUT] = in_vframe_info->io;
   io[CAP] = out_vframe_info->io;
+  n_slots[OUT] = in_vframe_info->n_slots;
+  n_slots[CAP] = out_vframe_info->n_slots;
 
-  if (!set_vsp_entities (space, in_info, in_stride,
-          out_info, out_stride, io)) {
+  if (!set_vsp_entities (space, vsp_info, in_info, in_stride,
+          out_info, out_stride, io, n_slots)) {
     GST_ERROR_OBJECT (space, "set_vsp_entities failed");
+    if (vsp_info != space->vsp_info && !vsp_info->output &&
+        space->n_stripes <= 1 && space->n_passes <= 1) {
+      GST_WARNING_OBJECT (space, "leaving %s out of the device pool",
+          vsp_info->ip_name);
+      vsp_info->disabled = TRUE;
+    }
+    return GST_FLOW_ERROR;
+  }
+
+  /* Tiles and stripes are queued at their place in the frames */
+  if (tile) {
+    in_rect = &tile->in_rect;
+    out_rect = &tile->out_rect;
+  } else if (vsp_info->out_rect.w > 0) {
+    out_rect = &vsp_info->out_rect;
+  }
+  for (i = 0; in_rect && i < GST_VIDEO_INFO_N_PLANES (in_info); i++)
+    in_offset[i] = get_plane_offset (in_info->finfo, i, in_rect,
+        in_stride[i]);
+  for (i = 0; out_rect && i < GST_VIDEO_INFO_N_PLANES (out_info); i++)
+    out_offset[i] = get_plane_offset (out_info->finfo, i, out_rect,
+        out_stride[i]);
+
+  /* so that the tiles of a buffer are told apart */
+  if (io[OUT] == V4L2_MEMORY_USERPTR) {
+    for (i = 0; i < in_vframe_info->key.n_planes; i++)
+      in_vframe_info->key.planes[i].id += in_offset[i];
+  }
+  if (io[CAP] == V4L2_MEMORY_USERPTR) {
+    for (i = 0; i < out_vframe_info->key.n_planes; i++)
+      out_vframe_info->key.planes[i].id += out_offset[i];
+  }
+
+  /* Buffers not coming from our pools borrow a free V4L2 buffer slot */
+  if (io[OUT] != V4L2_MEMORY_MMAP)
+    *in_index = acquire_index (space, vsp_info, OUT, in_vframe_info);
+  if (io[CAP] != V4L2_MEMORY_MMAP)
+    *out_index = acquire_index (space, vsp_info, CAP, out_vframe_info);
+  if (*in_index == VSPFILTER_INDEX_INVALID ||
+      *out_index == VSPFILTER_INDEX_INVALID) {
+    GST_ERROR_OBJECT (space, "no free V4L2 buffer (%u frames in flight)",
+        g_queue_get_length (&space->pending_jobs));
     return GST_FLOW_ERROR;
   }
 
   /* set up planes for queuing input buffers */
-  in_height = round_up_height (in_info->finfo, in_info->height);
+  in_height = in_rect ? in_rect->h :
+      round_up_height (in_info->finfo, in_info->height);
   for (i = 0; i < vsp_info->n_planes[OUT]; i++) {
     switch (in_vframe_info->io) {
       case V4L2_MEMORY_USERPTR:
         in_planes[i].m.userptr =
-            (unsigned long) in_vframe_info->vframe.frame.data[i];
+            (unsigned long) in_vframe_info->vframe.frame.data[i] +
+            in_offset[i];
         break;
       case V4L2_MEMORY_DMABUF:
         in_planes[i].m.fd = in_vframe_info->vframe.dmafd[i];
@@ -2138,6 +6831,16 @@ gst_vsp_filter_transform_frame_process (GstVideoFilter * filter,
   switch (out_vframe_info->io) {
     case V4L2_MEMORY_USERPTR:
       for (i = 0; i < vsp_info->n_planes[CAP]; i++) {
+        if (out_rect) {
+          /* only the rows of the tile or the stripe */
+          out_planes[i].m.userptr =
+              (unsigned long) out_vframe_info->vframe.frame.data[i] +
+              out_offset[i];
+          plane_height = GST_VIDEO_SUB_SCALE (
+            GST_VIDEO_FORMAT_INFO_H_SUB (out_info->finfo, i), out_rect->h);
+          out_planes[i].length = out_stride[i] * plane_height;
+          continue;
+        }
         out_planes[i].m.userptr =
             (unsigned long) out_vframe_info->vframe.frame.map[i].data;
         out_planes[i].length = out_vframe_info->vframe.frame.map[i].maxsize;
@@ -2159,12 +6862,28 @@ gst_vsp_filter_transform_frame_process (GstVideoFilter * filter,
       return GST_FLOW_ERROR;
   }
 
-  queue_buffer (space, vsp_info->v4lout_fd, OUT,
-      V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, in_planes, io, in_index);
-  queue_buffer (space, vsp_info->v4lcap_fd, CAP,
-      V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, out_planes, io, out_index);
+  start = g_get_monotonic_time ();
+  if (!queue_histogram (space, vsp_info))
+    return GST_FLOW_ERROR;
+  if (queue_buffer (space, vsp_info, vsp_info->v4lout_fd, OUT,
+          V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, in_planes, io, *in_index) < 0)
+    return GST_FLOW_ERROR;
+  if (queue_buffer (space, vsp_info, vsp_info->v4lcap_fd, CAP,
+          V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, out_planes, io, *out_index) < 0)
+    return GST_FLOW_ERROR;
+  if (!queue_overlays (space, vsp_info))
+    return GST_FLOW_ERROR;
+  vspfilter_stats_record (&space->stats, VSPFILTER_STAGE_QUEUE,
+      g_get_monotonic_time () - start);
 
   if (!vsp_info->is_stream_started) {
+    if (vsp_info->pipe_config.histogram &&
+        !start_capturing (space, vsp_info->hgo_fd, CAP,
+            V4L2_BUF_TYPE_META_CAPTURE)) {
+      GST_ERROR_OBJECT (space, "start_capturing for %s failed",
+          vsp_info->hgo_dev_name);
+      return GST_FLOW_ERROR;
+    }
     if (!start_capturing (space, vsp_info->v4lout_fd, OUT,
             V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)) {
       GST_ERROR_OBJECT (space, "start_capturing for %s failed",
@@ -2177,21 +6896,65 @@ gst_vsp_filter_transform_frame_process (GstVideoFilter * filter,
           vsp_info->dev_name[CAP]);
       return GST_FLOW_ERROR;
     }
+    for (i = 0; i < vsp_info->pipe_config.n_overlays; i++) {
+      if (!start_capturing (space, vsp_info->overlay_fd[i], OUT,
+              V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)) {
+        GST_ERROR_OBJECT (space, "start_capturing for %s failed",
+            vsp_info->overlay_dev_name[i]);
+        return GST_FLOW_ERROR;
+      }
+    }
     vsp_info->is_stream_started = TRUE;
   }
 
-  FD_ZERO (&fds);
-  FD_SET (vsp_info->v4lcap_fd, &fds);
+  return GST_FLOW_OK;
+}
+
+static gint
+wait_for_capture (GstVspFilter * space, GstVspFilterVspInfo * vsp_info,
+    glong timeout_usec)
+{
+  return vspfilter_device_poll (vsp_info->v4lcap_fd, timeout_usec);
+}
+
+/* Dequeues the next completed frame and returns its output buffer. When wait
+ * is FALSE, *outbuf is left NULL if no frame has been completed yet.
+ * Must be called with jobs_lock held. */
+static GstFlowReturn
+gst_vsp_filter_complete_job (GstVspFilter * space, gboolean wait,
+    GstBuffer ** outbuf)
+{
+  GstVspFilterVspInfo *vsp_info;
+  GstVspFilterJob *job;
+  GList *l, *next;
+  gint ret;
+  struct v4l2_plane in_planes[VIDEO_MAX_PLANES];
+  struct v4l2_plane out_planes[VIDEO_MAX_PLANES];
+  enum v4l2_memory io[MAX_DEVICES];
+  guint index;
+  gint64 start;
+
+  *outbuf = NULL;
 
-  /* Timeout. */
-  tv.tv_sec = 2;
-  tv.tv_usec = 0;
+next_job:
+  job = g_queue_peek_head (&space->pending_jobs);
+  if (!job)
+    return GST_FLOW_OK;
 
-  do
-    ret = select (vsp_info->v4lcap_fd + 1, &fds, NULL, NULL, &tv);
-  while (ret == -1 && errno == EINTR);
+  /* Frames of the device pool may be completed by the VSPs out of order.
+   * Only the VSP of the oldest frame is dequeued so that the outputs keep
+   * the order of the inputs. */
+  vsp_info = job->vsp_info;
 
+  start = g_get_monotonic_time ();
+  ret = wait_for_capture (space, vsp_info, wait ? 2 * G_USEC_PER_SEC : 0);
+  if (wait)
+    vspfilter_stats_record (&space->stats, VSPFILTER_STAGE_WAIT,
+        g_get_monotonic_time () - start);
   if (ret == 0) {
+    if (!wait)
+      return GST_FLOW_OK;
+    vspfilter_stats_count (&space->stats, VSPFILTER_COUNTER_TIMEOUTS);
     GST_ERROR_OBJECT (space, "select timeout");
     return GST_FLOW_ERROR;
   } else if (ret == -1) {
@@ -2199,22 +6962,145 @@ gst_vsp_filter_transform_frame_process (GstVideoFilter * filter,
     return GST_FLOW_ERROR;
   }
 
-  dequeue_buffer (space, vsp_info->v4lcap_fd, CAP,
-      V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, out_planes, io);
-  dequeue_buffer (space, vsp_info->v4lout_fd, OUT,
-      V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, in_planes, io);
+  memset (in_planes, 0, sizeof (in_planes));
+  memset (out_planes, 0, sizeof (out_planes));
+
+  io[OUT] = job->in_vframe_info.io;
+  io[CAP] = job->out_vframe_info.io;
+
+  start = g_get_monotonic_time ();
+  if (dequeue_buffer (space, vsp_info, vsp_info->v4lcap_fd, CAP,
+          V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, out_planes, io, &index) < 0)
+    return GST_FLOW_ERROR;
+
+  /* The device completes frames in the order they were queued */
+  for (l = space->pending_jobs.head; l; l = l->next) {
+    job = l->data;
+    if (job->vsp_info == vsp_info && job->out_index == index)
+      break;
+  }
+  if (!l) {
+    GST_ERROR_OBJECT (space, "dequeued an unknown buffer (index=%u)", index);
+    return GST_FLOW_ERROR;
+  }
+  if (l != space->pending_jobs.head)
+    GST_WARNING_OBJECT (space, "frame completed out of order (index=%u)",
+        index);
+
+  job = l->data;
+  next = l->next;
+  g_queue_delete_link (&space->pending_jobs, l);
+  vsp_info->n_jobs--;
+  g_cond_broadcast (&space->jobs_cond);
+
+  if (dequeue_buffer (space, vsp_info, vsp_info->v4lout_fd, OUT,
+          V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, in_planes, io, NULL) < 0 ||
+      !dequeue_overlays (space, vsp_info) ||
+      !dequeue_histogram (space, vsp_info, job->outbuf)) {
+    gst_vsp_filter_free_job (space, job);
+    return GST_FLOW_ERROR;
+  }
+  vspfilter_stats_record (&space->stats, VSPFILTER_STAGE_DEQUEUE,
+      g_get_monotonic_time () - start);
+
+  /* An earlier scaling pass goes on to the next VSP and keeps the place
+   * of the frame */
+  if (job->pass + 1 < space->n_passes) {
+    if (gst_vsp_filter_queue_next_pass (space, job) != GST_FLOW_OK) {
+      gst_vsp_filter_free_job (space, job);
+      return GST_FLOW_ERROR;
+    }
+    if (next)
+      g_queue_insert_before (&space->pending_jobs, next, job);
+    else
+      g_queue_push_tail (&space->pending_jobs, job);
+    goto next_job;
+  }
+
+  /* The output buffer is complete with the last stripe of the frame */
+  if (job->partial) {
+    gst_vsp_filter_free_job (space, job);
+    goto next_job;
+  }
+  vspfilter_stats_count (&space->stats, VSPFILTER_COUNTER_FRAMES);
+
+  *outbuf = job->outbuf;
+  job->outbuf = NULL;
+  gst_vsp_filter_free_job (space, job);
+  gst_vsp_filter_blend_overlays_cpu (space, outbuf);
 
   return GST_FLOW_OK;
 }
 
+/* Dequeues the frame of a request src pad and returns its output buffer.
+ * Its VSP only converts the frames of the pad, in the order they come.
+ * Must be called with jobs_lock held. */
+static GstFlowReturn
+gst_vsp_filter_complete_output_job (GstVspFilter * space,
+    GstVspFilterOutput * out, GstBuffer ** outbuf)
+{
+  GstVspFilterVspInfo *vsp_info = out->vsp_info;
+  GstVspFilterJob *job;
+  struct v4l2_plane in_planes[VIDEO_MAX_PLANES];
+  struct v4l2_plane out_planes[VIDEO_MAX_PLANES];
+  enum v4l2_memory io[MAX_DEVICES];
+  GstFlowReturn flow = GST_FLOW_ERROR;
+  gint ret;
+
+  *outbuf = NULL;
+
+  job = g_queue_pop_head (&out->jobs);
+  if (!job)
+    return GST_FLOW_OK;
+  vsp_info->n_jobs--;
+
+  ret = wait_for_capture (space, vsp_info, 2 * G_USEC_PER_SEC);
+  if (ret <= 0) {
+    if (ret == 0)
+      vspfilter_stats_count (&space->stats, VSPFILTER_COUNTER_TIMEOUTS);
+    GST_ERROR_OBJECT (space, "select %s for %s",
+        ret == 0 ? "timeout" : "failed", GST_PAD_NAME (out->pad));
+    goto done;
+  }
+
+  memset (in_planes, 0, sizeof (in_planes));
+  memset (out_planes, 0, sizeof (out_planes));
+
+  io[OUT] = job->in_vframe_info.io;
+  io[CAP] = job->out_vframe_info.io;
+
+  if (dequeue_buffer (space, vsp_info, vsp_info->v4lcap_fd, CAP,
+          V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, out_planes, io, NULL) < 0 ||
+      dequeue_buffer (space, vsp_info, vsp_info->v4lout_fd, OUT,
+          V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, in_planes, io, NULL) < 0)
+    goto done;
+
+  *outbuf = job->outbuf;
+  job->outbuf = NULL;
+  flow = GST_FLOW_OK;
+
+done:
+  gst_vsp_filter_free_job (space, job);
+
+  return flow;
+}
+
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
   GST_DEBUG_CATEGORY_INIT (vspfilter_debug, "vspfilter", 0,
       "Colorspace and Video Size Converter");
 
-  return gst_element_register (plugin, "vspfilter",
-      GST_RANK_NONE, GST_TYPE_VSP_FILTER);
+  if (!gst_element_register (plugin, "vspfilter",
+          GST_RANK_NONE, GST_TYPE_VSP_FILTER))
+    return FALSE;
+
+  if (!gst_element_register (plugin, "vspcompositor",
+          GST_RANK_NONE, GST_TYPE_VSP_COMPOSITOR))
+    return FALSE;
+
+  return gst_element_register (plugin, "vspfilterbin",
+      GST_RANK_NONE, GST_TYPE_VSP_FILTER_BIN);
 }
 
 GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
@@ -26,6 +26,8 @@
 #include <gst/gst.h>
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
+#include <gst/video/gstvideosink.h>
+#include <gst/base/gstflowcombiner.h>
 
 #include <fcntl.h>              /* low-level i/o */
 #include <unistd.h>
@@ -41,6 +43,11 @@
 #include <linux/v4l2-subdev.h>
 #include <linux/v4l2-mediabus.h>
 
+#include "vspfiltercache.h"
+#include "vspfiltercopy.h"
+#include "vspfiltermedia.h"
+#include "vspfilterstats.h"
+
 G_BEGIN_DECLS
 
 #define GST_TYPE_VSP_FILTER	          (gst_vsp_filter_get_type())
@@ -50,10 +57,10 @@ G_BEGIN_DECLS
 #define GST_IS_VIDEO_CONVERT_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_VSP_FILTER))
 #define GST_VSP_FILTER_CAST(obj)       ((GstVspFilter *)(obj))
 
-#define N_BUFFERS 1
+#define MAX_QUEUE_DEPTH 8
 
 #define MAX_DEVICES 2
-#define MAX_ENTITIES 4
+#define MAX_ENTITIES 5
 
 #define VSP_CONF_ITEM_INPUT "input-device-name="
 #define VSP_CONF_ITEM_OUTPUT "output-device-name="
@@ -77,22 +84,158 @@ typedef enum {
 
 #define DEFAULT_PROP_IO_MODE GST_VSPFILTER_IO_AUTO
 
+#define DEFAULT_PROP_QUEUE_DEPTH 1
+#define DEFAULT_PROP_ASYNC_OUTPUT FALSE
+
+#define MAX_COPY_THREADS 16
+#define DEFAULT_PROP_COPY_THREADS 0
+
+#define DEFAULT_PROP_STATS_INTERVAL 0
+
+#define MAX_VSPS 8
+
+typedef enum {
+  GST_VSPFILTER_DEVICE_POOL_NONE = 0, /* only the configured devices */
+  GST_VSPFILTER_DEVICE_POOL_ROUND_ROBIN,
+  GST_VSPFILTER_DEVICE_POOL_LEAST_LOADED
+} GstVspfilterDevicePool;
+
+#define DEFAULT_PROP_DEVICE_POOL GST_VSPFILTER_DEVICE_POOL_NONE
+
+#define DEFAULT_PROP_STRIPES 1
+/* rows of the smallest stripe */
+#define MIN_STRIPE_HEIGHT 16
+
+/* largest width and height of the video nodes and the subdev pads */
+#define VSP_MAX_SIZE 8190
+/* larger frames are converted as a grid of up to MAX_TILES tiles */
+#define MAX_TILES_PER_LINE 4
+#define MAX_TILES (MAX_TILES_PER_LINE * MAX_TILES_PER_LINE)
+#define MIN_TILE_SIZE 256
+#define DEFAULT_PROP_TILE_SIZE VSP_MAX_SIZE
+/* userptr of a tile has to start on a cache line */
+#define TILE_ADDR_ALIGN 64
+
+/* scaling beyond the UDS ratios is done in up to MAX_PASSES passes, each on
+ * its own VSP */
+#define MAX_PASSES 4
+
+#define DEFAULT_PROP_ROI_BATCH FALSE
+
+#define DEFAULT_PROP_ADD_BORDERS FALSE
+#define DEFAULT_PROP_BORDER_COLOR 0xff000000
+
+typedef enum {
+  GST_VSPFILTER_ROTATION_0 = 0,
+  GST_VSPFILTER_ROTATION_90,
+  GST_VSPFILTER_ROTATION_180,
+  GST_VSPFILTER_ROTATION_270,
+  GST_VSPFILTER_ROTATION_AUTO /* from the image-orientation tag */
+} GstVspfilterRotation;
+
+#define DEFAULT_PROP_ROTATION GST_VSPFILTER_ROTATION_0
+
+typedef enum {
+  GST_VSPFILTER_FLIP_NONE = 0,
+  GST_VSPFILTER_FLIP_HORIZONTAL = 1 << 0,
+  GST_VSPFILTER_FLIP_VERTICAL = 1 << 1,
+  GST_VSPFILTER_FLIP_BOTH = GST_VSPFILTER_FLIP_HORIZONTAL |
+      GST_VSPFILTER_FLIP_VERTICAL
+} GstVspfilterFlip;
+
+#define DEFAULT_PROP_FLIP GST_VSPFILTER_FLIP_NONE
+
+/* RPF entities of a VSP, the ones not reading the frames may feed overlay
+ * rectangles to the BRU, up to MAX_OVERLAYS of them */
+#define MAX_RPFS 5
+#define MAX_OVERLAYS 3
+/* lines of the overlay rectangles as the RPF reads them */
+#define OVERLAY_STRIDE_ALIGN 128
+#define DEFAULT_PROP_OVERLAY FALSE
+
+/* the LUT is used unless these are all left alone */
+#define DEFAULT_PROP_GAMMA 1.0
+#define DEFAULT_PROP_BRIGHTNESS 0.0
+#define DEFAULT_PROP_CONTRAST 1.0
+#define DEFAULT_PROP_CLU_FILE NULL
+
+#define DEFAULT_PROP_HISTOGRAM FALSE
+
+/* request src pads, each converting the input on a VSP of its own */
+#define MAX_OUTPUTS 4
+
 typedef struct _GstVspFilter GstVspFilter;
 typedef struct _GstVspFilterClass GstVspFilterClass;
 
 typedef struct _GstVspFilterVspInfo GstVspFilterVspInfo;
 typedef struct _GstVspFilterFrameInfo GstVspFilterFrameInfo;
-typedef union _GstVspFilterFrame GstVspFilterFrame;
-
-struct buffer {
-  void *start;
-  size_t length;
-};
+typedef struct _GstVspFilterFrame GstVspFilterFrame;
+typedef struct _GstVspFilterJob GstVspFilterJob;
+typedef struct _GstVspFilterNodeConfig GstVspFilterNodeConfig;
+typedef struct _GstVspFilterPipeConfig GstVspFilterPipeConfig;
+typedef struct _GstVspFilterOrientation GstVspFilterOrientation;
+typedef struct _GstVspFilterTile GstVspFilterTile;
+typedef struct _GstVspFilterRoi GstVspFilterRoi;
+typedef struct _GstVspFilterOverlay GstVspFilterOverlay;
+typedef struct _GstVspFilterOutput GstVspFilterOutput;
 
 enum {
   OUT = 0,
   CAP = 1,
-  RESZ = 2
+  RESZ = 2,
+  LUT = 3,
+  CLU = 4
+};
+
+/* Format and buffers of a video node used with imported buffers */
+struct _GstVspFilterNodeConfig {
+  guint width;
+  guint height;
+  guint fourcc;
+  gint stride[GST_VIDEO_MAX_PLANES];
+  enum v4l2_memory io;
+  enum v4l2_ycbcr_encoding encoding;
+  enum v4l2_quantization quant;
+  guint n_bufs;
+};
+
+/* Flips, then clockwise rotation in degrees, done by the WPF */
+struct _GstVspFilterOrientation {
+  guint rotate;
+  gboolean hflip;
+  gboolean vflip;
+};
+
+/* Subdev pad formats and links of the media pipeline */
+struct _GstVspFilterPipeConfig {
+  guint in_buf_width;
+  guint in_buf_height;
+  guint in_img_left;
+  guint in_img_top;
+  guint in_img_width;
+  guint in_img_height;
+  guint out_width;
+  guint out_height;
+  guint in_code;
+  guint out_code;
+  GstVspFilterOrientation orientation;
+  /* places of the overlays blended by the BRU, none if n_overlays is 0 */
+  guint n_overlays;
+  GstVideoRectangle overlay_rect[MAX_OVERLAYS];
+  /* code of the picture between the RPF and the WPF, RGB when it goes
+   * through the LUT or the CLU, whose tables come with color_seqnum */
+  guint proc_code;
+  gboolean lut;
+  gboolean clu;
+  guint color_seqnum;
+  /* the HGO counts the values of the picture after the LUT and the CLU,
+   * luma if proc_code is YUV, the largest of R, G and B otherwise */
+  gboolean histogram;
+  /* place of the picture in the output of the BRU before the WPF turns
+   * it, around which the BRU fills bg_color in proc_code; w is 0 when the
+   * picture is the whole output */
+  GstVideoRectangle compose;
+  guint bg_color;
 };
 
 struct _GstVspFilterVspInfo {
@@ -102,22 +245,68 @@ struct _GstVspFilterVspInfo {
   gint v4lcap_fd;
   gchar *ip_name;
   gchar *entity_name[MAX_DEVICES];
-  gint media_fd;
+  VspfilterMedia *media;
   gint v4lsub_fd[MAX_DEVICES];
   gint resz_subdev_fd;
+  gint lut_subdev_fd;
+  gint clu_subdev_fd;
+  /* RPF video nodes and subdevs of the overlays, opened with overlay=true,
+   * and the BRU blending them */
+  guint n_overlay_rpfs;
+  gchar *overlay_dev_name[MAX_OVERLAYS];
+  gchar *overlay_entity_name[MAX_OVERLAYS];
+  gint overlay_fd[MAX_OVERLAYS];
+  gint overlay_subdev_fd[MAX_OVERLAYS];
+  struct media_entity_desc overlay_entity[MAX_OVERLAYS];
+  gint bru_subdev_fd;
+  struct media_entity_desc bru_entity;
+  /* HGO and its histogram video node, opened with histogram=true, whose
+   * userptr buffers are queued in turn with the frames */
+  gchar *hgo_dev_name;
+  gint hgo_fd;
+  gint hgo_subdev_fd;
+  struct media_entity_desc hgo_entity;
+  guint n_hgo_bufs;
+  guint hgo_index;
+  guint32 *hgo_data[VIDEO_MAX_FRAME];
+  /* userptr buffers of the overlay nodes, queued in turn with the frames */
+  guint n_overlay_bufs;
+  guint overlay_index;
   guint format[MAX_DEVICES];
   enum v4l2_mbus_pixelcode code[MAX_DEVICES];
   guint n_planes[MAX_DEVICES];
   guint  n_buffers[MAX_DEVICES];
-  struct buffer buffers[MAX_DEVICES][N_BUFFERS][VIDEO_MAX_PLANES];
+  VspfilterIndexCache *index_cache[MAX_DEVICES];
   struct media_entity_desc entity[MAX_ENTITIES];
   gboolean is_stream_started;
   gboolean already_device_initialized[MAX_DEVICES];
   gboolean already_setup_info;
+  /* what is currently programmed, to skip unchanged steps on a caps change */
+  GstVspFilterNodeConfig node_config[MAX_DEVICES];
+  gint node_stride[MAX_DEVICES][GST_VIDEO_MAX_PLANES];
+  gboolean node_configured[MAX_DEVICES];
+  GstVspFilterPipeConfig pipe_config;
+  gboolean pipe_configured;
   guint16 plane_stride[MAX_DEVICES][VIDEO_MAX_PLANES];
+  /* frames queued and not dequeued yet */
+  guint n_jobs;
+  /* left out of the device pool after failing to set up */
+  gboolean disabled;
+  /* the stripe of the frame this VSP converts, the whole frame if the
+   * width of out_rect is 0 */
+  GstVideoRectangle in_rect;
+  GstVideoRectangle out_rect;
+  /* the formats of the caps, or of the pass this VSP runs */
+  GstVideoInfo *in_info;
+  GstVideoInfo *out_info;
+  /* converts the whole frames of a request src pad, without the overlays
+   * and the histogram */
+  gboolean output;
 };
 
-union _GstVspFilterFrame {
+/* A buffer of our pool imported by another VSP of the device pool is
+ * both mapped and passed as dmabuf */
+struct _GstVspFilterFrame {
   GstVideoFrame frame;
   gint dmafd[GST_VIDEO_MAX_PLANES];
 };
@@ -125,6 +314,80 @@ union _GstVspFilterFrame {
 struct _GstVspFilterFrameInfo {
   enum v4l2_memory io;
   GstVspFilterFrame vframe;
+  /* identity of an imported buffer, n_planes is 0 if unknown */
+  VspfilterBufferKey key;
+  /* V4L2 buffers wanted to cache the pool the buffer comes from */
+  guint n_slots;
+  /* time taken to get the buffer of our pool the input is copied to */
+  gint64 staging_usec;
+};
+
+/* A part of a frame converted on its own. All the tiles of a frame have the
+ * same size, the last ones of a row and a column overlap the others. */
+struct _GstVspFilterTile {
+  GstVideoRectangle in_rect;
+  GstVideoRectangle out_rect;
+};
+
+/* A region of interest of a frame, queued like a tile from the aligned
+ * address left of it. crop is the region in the tile, which the RPF
+ * reads: VSPs set up for one crop take any region of the same one. */
+struct _GstVspFilterRoi {
+  GstVspFilterTile tile;
+  GstVideoRectangle crop;
+  GstVideoRegionOfInterestMeta *meta;
+  guint index;
+};
+
+/* A rectangle of an overlay composition uploaded for an RPF. It is kept as
+ * long as the rectangle has the same seqnum and place. */
+struct _GstVspFilterOverlay {
+  guint seqnum;
+  /* the rectangle scaled to the picture, which it may overflow, and the
+   * part of it inside, which the BRU blends */
+  GstVideoRectangle render;
+  GstVideoRectangle rect;
+  /* ARGB pixels of rect, data starts on TILE_ADDR_ALIGN in mem */
+  gint stride;
+  gsize size;
+  guint8 *mem;
+  guint8 *data;
+};
+
+/* A frame which has been queued to the device and not dequeued yet */
+struct _GstVspFilterJob {
+  GstVspFilterVspInfo *vsp_info;
+  GstBuffer *inbuf;
+  GstBuffer *outbuf;
+  GstVspFilterFrameInfo in_vframe_info;
+  GstVspFilterFrameInfo out_vframe_info;
+  guint in_index;
+  guint out_index;
+  /* a stripe or a tile of a frame which the job of the last one hands
+   * over */
+  gboolean partial;
+  /* NULL unless the frame is converted as tiles */
+  const GstVspFilterTile *tile;
+  /* the pass being run and the buffers between the passes; outbuf is only
+   * written by the last one */
+  guint pass;
+  GstBuffer *pass_buf[MAX_PASSES - 1];
+};
+
+/* A request src pad. The input buffers are queued to its VSP right before
+ * the ones of the src pad, and its frames are pushed once the src pad has
+ * been handed its own. */
+struct _GstVspFilterOutput {
+  GstPad *pad;
+  /* opened in READY, the formats it is set up for and the pool of its
+   * video node the frames are written to */
+  GstVspFilterVspInfo *vsp_info;
+  GstVideoInfo in_info;
+  GstVideoInfo info;
+  gboolean negotiated;
+  GstBufferPool *pool;
+  GQueue jobs;
+  GstFlowReturn flow;
 };
 
 /**
@@ -136,11 +399,90 @@ struct _GstVspFilter {
   GstVideoFilter element;
 
   GstVspFilterVspInfo *vsp_info;
+  /* vsps[0] is vsp_info, the others only exist with a device pool */
+  GstVspFilterVspInfo *vsps[MAX_VSPS];
+  guint n_vsps;
+  guint next_vsp;
+  GstVspfilterDevicePool device_pool;
+  guint stripes;
+  /* stripes in use for the current caps, 1 if frames are not split */
+  guint n_stripes;
+  guint tile_size;
+  /* tiles of the current caps, 1 if the frames fit the device */
+  GstVspFilterTile tiles[MAX_TILES];
+  guint n_tiles;
+  /* scaling passes of the current caps, run on vsps[0] to
+   * vsps[n_passes - 1], which write to the buffers of pass_pools */
+  guint n_passes;
+  GstVideoInfo pass_info[MAX_PASSES - 1];
+  GstBufferPool *pass_pools[MAX_PASSES - 1];
+  /* every region of interest of a frame is cropped to an output buffer */
+  gboolean roi_batch;
+  /* region of the crop meta the VSPs currently read, w is 0 for none */
+  GstVideoRectangle crop;
+  gboolean add_borders;
+  guint border_color;
+  /* area of the output the picture is scaled to, w is 0 without borders,
+   * and a few rows of the output format filled with border_color */
+  GstVideoRectangle borders;
+  GstVideoInfo border_info;
+  guint8 *border_line;
+  /* the borders are the background of the BRU rather than filled by the
+   * CPU, in border_pixel in a YUV pipeline: border_color in the YUV of the
+   * output, as Cr, Y and Cb in the fields of R, G and B */
+  gboolean bru_borders;
+  guint32 border_pixel;
+  GstVspfilterRotation rotation;
+  GstVspfilterFlip flip;
+  /* from the image-orientation tag, used with rotation=auto */
+  GstVspFilterOrientation tag_orientation;
+  /* what the VSPs are set up to do */
+  GstVspFilterOrientation orientation;
+  /* the overlay composition meta of the input is blended by the BRU */
+  gboolean overlay;
+  GstVspFilterOverlay overlays[MAX_OVERLAYS];
+  guint n_overlays;
+  /* color adjustments done by the LUT and 3D LUT of the CLU, the tables
+   * are built again when color_seqnum changes */
+  gdouble gamma;
+  gdouble brightness;
+  gdouble contrast;
+  gchar *clu_file;
+  guint color_seqnum;
+  guint tables_seqnum;
+  guint32 *lut_table;
+  guint32 *clu_table;
+  /* a histogram meta is added to each output buffer */
+  gboolean histogram;
+  /* request src pads by index, added and removed with the object lock
+   * and the stream lock of the sink pad held, and the flows of all the
+   * src pads */
+  GstVspFilterOutput *outputs[MAX_OUTPUTS];
+  guint n_outputs;
+  GstFlowCombiner *flow_combiner;
   GstBufferPool *in_pool;
   GstBufferPool *out_pool;
   GstVspfilterIOMode prop_in_mode;
   GstVspfilterIOMode prop_out_mode;
   GstVspfilterColorRange input_color_range;
+  guint queue_depth;
+  gboolean async_output;
+  guint copy_threads;
+  VspfilterCopier *copier;
+  VspfilterStats stats;
+  guint stats_interval;
+  gint64 last_stats_post;
+
+  /* protects pending_jobs, the index_cache and n_jobs of the vsps and the
+   * fields below */
+  GMutex jobs_lock;
+  GCond jobs_cond;
+  GQueue pending_jobs;
+  gboolean flushing;
+  gboolean pushing;
+  GstFlowReturn output_flow;
+  guint64 cache_hits;
+  guint64 cache_misses;
 };
 
 struct _GstVspFilterClass
@@ -148,6 +490,9 @@ struct _GstVspFilterClass
   GstVideoFilterClass parent_class;
 };
 
+gboolean gst_vsp_filter_can_crop (GstVspFilter * space, GstVideoInfo * in_info,
+    guint crop_w, guint crop_h, guint out_w, guint out_h);
+
 G_END_DECLS
 
 #endif /* __GST_VIDEOCONVERT_H__ */
@@ -0,0 +1,1032 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:element-vspfilterbin
+ *
+ * Runs a chain of videocrop, videoscale, videoconvert, videoflip,
+ * capsfilter and vspfilter elements as one vspfilter, which crops the
+ * input in the RPF, scales it in the UDS, converts it and turns it in the
+ * WPF in a single pass over the frames. A chain which cannot be done that
+ * way runs as it is.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch-1.0 videotestsrc ! vspfilterbin chain="videocrop left=8 \
+ *     right=8 ! videoscale ! video/x-raw,width=1280,height=720 ! \
+ *     videoconvert ! video/x-raw,format=BGRA ! videoflip method=clockwise" \
+ *     ! fakesink
+ * ]|
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "gstvspfilterbin.h"
+
+#include <gst/video/gstvideometa.h>
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (vspfilterbin_debug);
+#define GST_CAT_DEFAULT vspfilterbin_debug
+
+/* sent through the fused vspfilter to push out its frames in flight */
+#define DRAIN_EVENT_NAME "GstVspFilterBinDrain"
+
+static GstStaticPadTemplate gst_vsp_filter_bin_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate gst_vsp_filter_bin_sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+enum
+{
+  PROP_0,
+  PROP_CHAIN
+};
+
+/* The vspfilter properties which change the picture beyond the crop, the
+ * scaling, the conversion and the orientation. Only one vspfilter of a
+ * chain may set them, and only at its end. */
+static const gchar *picture_properties[] = {
+  "add-borders", "border-color", "overlay", "gamma", "brightness",
+  "contrast", "clu-file", "histogram"
+};
+
+/* videoflip methods, as (rotation, flip) done by the WPF */
+static const struct
+{
+  GstVspfilterRotation rotation;
+  GstVspfilterFlip flip;
+} videoflip_methods[] = {
+  { GST_VSPFILTER_ROTATION_0, GST_VSPFILTER_FLIP_NONE },
+  { GST_VSPFILTER_ROTATION_90, GST_VSPFILTER_FLIP_NONE },
+  { GST_VSPFILTER_ROTATION_180, GST_VSPFILTER_FLIP_NONE },
+  { GST_VSPFILTER_ROTATION_270, GST_VSPFILTER_FLIP_NONE },
+  { GST_VSPFILTER_ROTATION_0, GST_VSPFILTER_FLIP_HORIZONTAL },
+  { GST_VSPFILTER_ROTATION_0, GST_VSPFILTER_FLIP_VERTICAL },
+  { GST_VSPFILTER_ROTATION_90, GST_VSPFILTER_FLIP_VERTICAL },
+  { GST_VSPFILTER_ROTATION_90, GST_VSPFILTER_FLIP_HORIZONTAL },
+  { GST_VSPFILTER_ROTATION_AUTO, GST_VSPFILTER_FLIP_NONE }
+};
+
+#define gst_vsp_filter_bin_parent_class parent_class
+G_DEFINE_TYPE (GstVspFilterBin, gst_vsp_filter_bin, GST_TYPE_BIN);
+
+/* The 2x2 matrix moving the pixels of a frame to the place the
+ * orientation puts them, flips first and then the clockwise rotation, with
+ * y going down */
+static void
+orientation_matrix (GstVspfilterRotation rotation, GstVspfilterFlip flip,
+    gint m[4])
+{
+  gint sx = (flip & GST_VSPFILTER_FLIP_HORIZONTAL) ? -1 : 1;
+  gint sy = (flip & GST_VSPFILTER_FLIP_VERTICAL) ? -1 : 1;
+
+  switch (rotation) {
+    case GST_VSPFILTER_ROTATION_90:
+      m[0] = 0;
+      m[1] = -sy;
+      m[2] = sx;
+      m[3] = 0;
+      break;
+    case GST_VSPFILTER_ROTATION_180:
+      m[0] = -sx;
+      m[1] = 0;
+      m[2] = 0;
+      m[3] = -sy;
+      break;
+    case GST_VSPFILTER_ROTATION_270:
+      m[0] = 0;
+      m[1] = sy;
+      m[2] = -sx;
+      m[3] = 0;
+      break;
+    default:
+      m[0] = sx;
+      m[1] = 0;
+      m[2] = 0;
+      m[3] = sy;
+      break;
+  }
+}
+
+/* Turns the frames by the orientation b after the orientation in f,
+ * neither of them following the image-orientation tag */
+static void
+compose_orientation (GstVspFilterBinFusion * f, GstVspfilterRotation rotation,
+    GstVspfilterFlip flip)
+{
+  gint a[4], b[4], m[4], c[4];
+  guint r, fl;
+
+  orientation_matrix (f->rotation, f->flip, a);
+  orientation_matrix (rotation, flip, b);
+  m[0] = b[0] * a[0] + b[1] * a[2];
+  m[1] = b[0] * a[1] + b[1] * a[3];
+  m[2] = b[2] * a[0] + b[3] * a[2];
+  m[3] = b[2] * a[1] + b[3] * a[3];
+
+  /* the orientation without a flip when there is one */
+  for (fl = GST_VSPFILTER_FLIP_NONE; fl <= GST_VSPFILTER_FLIP_BOTH; fl++) {
+    for (r = GST_VSPFILTER_ROTATION_0; r <= GST_VSPFILTER_ROTATION_270; r++) {
+      orientation_matrix (r, fl, c);
+      if (memcmp (c, m, sizeof (c)) == 0) {
+        f->rotation = r;
+        f->flip = fl;
+        return;
+      }
+    }
+  }
+  g_assert_not_reached ();
+}
+
+static inline gboolean
+is_identity (GstVspfilterRotation rotation, GstVspfilterFlip flip)
+{
+  return rotation == GST_VSPFILTER_ROTATION_0 &&
+      flip == GST_VSPFILTER_FLIP_NONE;
+}
+
+static inline gboolean
+swaps_size (GstVspfilterRotation rotation)
+{
+  return rotation == GST_VSPFILTER_ROTATION_90 ||
+      rotation == GST_VSPFILTER_ROTATION_270;
+}
+
+/* TRUE if the properties of a vspfilter which change the picture are left
+ * at their defaults */
+static gboolean
+has_default_picture (GstElement * filter)
+{
+  GObjectClass *klass = G_OBJECT_GET_CLASS (filter);
+  gboolean ret = TRUE;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (picture_properties) && ret; i++) {
+    GParamSpec *pspec;
+    GValue value = G_VALUE_INIT;
+
+    pspec = g_object_class_find_property (klass, picture_properties[i]);
+    if (!pspec)
+      continue;
+
+    g_value_init (&value, pspec->value_type);
+    g_object_get_property (G_OBJECT (filter), pspec->name, &value);
+    ret = g_param_value_defaults (pspec, &value);
+    g_value_unset (&value);
+  }
+
+  return ret;
+}
+
+/* The elements of a parsed chain from its sink to its src, NULL unless
+ * they are linked one after the other through their sink and src pads */
+static GList *
+get_chain_elements (GstBin * parsed)
+{
+  GstElement *element = NULL;
+  GList *elements = NULL;
+  GList *l;
+
+  /* the first element is fed by the sink ghost pad */
+  for (l = parsed->children; l; l = l->next) {
+    GstPad *sinkpad = gst_element_get_static_pad (l->data, "sink");
+    GstPad *peer;
+
+    if (!sinkpad)
+      continue;
+
+    peer = gst_pad_get_peer (sinkpad);
+    gst_object_unref (sinkpad);
+    if (!peer)
+      continue;
+
+    if (!GST_IS_ELEMENT (GST_OBJECT_PARENT (peer))) {
+      gst_object_unref (peer);
+      element = l->data;
+      break;
+    }
+    gst_object_unref (peer);
+  }
+
+  while (element) {
+    GstPad *srcpad, *peer;
+    GstObject *next;
+
+    elements = g_list_append (elements, element);
+
+    srcpad = gst_element_get_static_pad (element, "src");
+    if (!srcpad)
+      break;
+    peer = gst_pad_get_peer (srcpad);
+    gst_object_unref (srcpad);
+    if (!peer)
+      break;
+
+    next = GST_OBJECT_PARENT (peer);
+    element = GST_IS_ELEMENT (next) && next != GST_OBJECT_CAST (parsed) ?
+        GST_ELEMENT_CAST (next) : NULL;
+    gst_object_unref (peer);
+  }
+
+  if (g_list_length (elements) != (guint) parsed->numchildren) {
+    g_list_free (elements);
+    return NULL;
+  }
+
+  return elements;
+}
+
+/* Reads the width, height and format of a capsfilter, FALSE if it sets
+ * anything else */
+static gboolean
+get_capsfilter_fields (GstElement * element, gint * width, gint * height,
+    gchar ** format)
+{
+  GstCaps *caps = NULL;
+  GstStructure *s;
+  gboolean ret = TRUE;
+  gint i;
+
+  *width = *height = 0;
+  *format = NULL;
+
+  g_object_get (element, "caps", &caps, NULL);
+  if (!caps)
+    return TRUE;
+  if (gst_caps_is_any (caps)) {
+    gst_caps_unref (caps);
+    return TRUE;
+  }
+  if (gst_caps_get_size (caps) != 1) {
+    gst_caps_unref (caps);
+    return FALSE;
+  }
+
+  s = gst_caps_get_structure (caps, 0);
+  if (!gst_structure_has_name (s, "video/x-raw"))
+    ret = FALSE;
+
+  for (i = 0; i < gst_structure_n_fields (s) && ret; i++) {
+    const gchar *name = gst_structure_nth_field_name (s, i);
+
+    if (strcmp (name, "width") == 0)
+      ret = gst_structure_get_int (s, name, width);
+    else if (strcmp (name, "height") == 0)
+      ret = gst_structure_get_int (s, name, height);
+    else if (strcmp (name, "format") == 0)
+      ret = (*format = g_strdup (gst_structure_get_string (s, name))) != NULL;
+    else
+      ret = FALSE;
+  }
+  if (ret && (*width == 0) != (*height == 0))
+    ret = FALSE;
+
+  if (!ret) {
+    g_free (*format);
+    *format = NULL;
+  }
+  gst_caps_unref (caps);
+
+  return ret;
+}
+
+static inline gboolean
+has_crop (GstVspFilterBinFusion * f)
+{
+  return f->left || f->right || f->top || f->bottom;
+}
+
+/* Works out what a chain does to the frames and the vspfilter of it which
+ * can do it all. FALSE if one vspfilter cannot. */
+static gboolean
+gst_vsp_filter_bin_fuse (GstVspFilterBin * fbin, GstBin * parsed,
+    GstVspFilterBinFusion * f)
+{
+  GList *elements, *l;
+  GstElement *first_filter = NULL;
+  gboolean scaled = FALSE;
+  gboolean is_auto = FALSE;
+  gboolean ended = FALSE;
+  const gchar *reason = NULL;
+
+  memset (f, 0, sizeof (*f));
+  f->rotation = GST_VSPFILTER_ROTATION_0;
+  f->flip = GST_VSPFILTER_FLIP_NONE;
+
+  elements = get_chain_elements (parsed);
+  if (!elements) {
+    GST_WARNING_OBJECT (fbin, "chain is not a single line of elements");
+    return FALSE;
+  }
+
+  for (l = elements; l && !reason; l = l->next) {
+    GstElement *element = l->data;
+    GstElementFactory *factory = gst_element_get_factory (element);
+    const gchar *name = factory ? GST_OBJECT_NAME (factory) : "";
+    GstVspfilterRotation rotation = GST_VSPFILTER_ROTATION_0;
+    GstVspfilterFlip flip = GST_VSPFILTER_FLIP_NONE;
+
+    /* nothing but the output format may follow the blending and the color
+     * adjustments of a vspfilter */
+    if (ended && strcmp (name, "capsfilter") != 0) {
+      reason = "elements after the picture properties of a vspfilter";
+      break;
+    }
+
+    if (strcmp (name, "videocrop") == 0) {
+      gint left, right, top, bottom;
+
+      g_object_get (element, "left", &left, "right", &right, "top", &top,
+          "bottom", &bottom, NULL);
+      if (left < 0 || right < 0 || top < 0 || bottom < 0)
+        reason = "automatic crop";
+      else if (scaled || is_auto ||
+          !is_identity (f->rotation, f->flip))
+        reason = "crop of a scaled or turned picture";
+      f->left += left;
+      f->right += right;
+      f->top += top;
+      f->bottom += bottom;
+    } else if (strcmp (name, "videoscale") == 0) {
+      /* scales to the caps which follow */
+    } else if (strcmp (name, "videoconvert") == 0) {
+      g_free (f->format);
+      f->format = NULL;
+    } else if (strcmp (name, "capsfilter") == 0) {
+      gint width, height;
+      gchar *format;
+
+      if (!get_capsfilter_fields (element, &width, &height, &format)) {
+        reason = "caps other than the width, height and format";
+      } else if (width > 0) {
+        if (ended) {
+          reason = "size after the picture properties of a vspfilter";
+        } else {
+          f->width = width;
+          f->height = height;
+          f->swaps_size = FALSE;
+          scaled = TRUE;
+        }
+      }
+      if (format) {
+        g_free (f->format);
+        f->format = format;
+      }
+    } else if (strcmp (name, "videoflip") == 0) {
+      gint method;
+
+      g_object_get (element, "method", &method, NULL);
+      if (method < 0 || method >= (gint) G_N_ELEMENTS (videoflip_methods)) {
+        reason = "unknown videoflip method";
+      } else {
+        rotation = videoflip_methods[method].rotation;
+        flip = videoflip_methods[method].flip;
+      }
+    } else if (strcmp (name, "vspfilter") == 0) {
+      gboolean roi_batch;
+
+      g_object_get (element, "rotation", &rotation, "flip", &flip,
+          "roi-batch", &roi_batch, NULL);
+      if (roi_batch) {
+        reason = "roi-batch";
+      } else if (!has_default_picture (element)) {
+        /* its properties are kept, and apply to the whole chain */
+        f->filter = element;
+        ended = TRUE;
+      }
+      if (!first_filter)
+        first_filter = element;
+      g_free (f->format);
+      f->format = NULL;
+    } else {
+      reason = "element which is not fused";
+    }
+
+    if (reason || is_identity (rotation, flip))
+      continue;
+
+    /* the image-orientation tag only turns the frames of a chain which
+     * does not turn them otherwise, and before they get their size */
+    if (rotation == GST_VSPFILTER_ROTATION_AUTO) {
+      if (is_auto || !is_identity (f->rotation, f->flip) || scaled ||
+          f->left || f->right || f->top || f->bottom)
+        reason = "automatic orientation with another one or a size";
+      is_auto = TRUE;
+      f->rotation = rotation;
+      f->flip = flip;
+    } else if (is_auto) {
+      reason = "automatic orientation with another one";
+    } else {
+      compose_orientation (f, rotation, flip);
+      if (swaps_size (rotation))
+        f->swaps_size = !f->swaps_size;
+    }
+  }
+  g_list_free (elements);
+
+  if (!f->filter)
+    f->filter = first_filter;
+
+  /* the RPF only crops frames converted in one piece, so a vspfilter set
+   * to split them cannot do the crop */
+  if (!reason && f->filter && has_crop (f)) {
+    guint stripes, tile_size;
+
+    g_object_get (f->filter, "stripes", &stripes, "tile-size", &tile_size,
+        NULL);
+    if (stripes > 1 || tile_size < DEFAULT_PROP_TILE_SIZE)
+      reason = "crop with stripes or tiles";
+  }
+
+  if (reason) {
+    GST_WARNING_OBJECT (fbin, "cannot fuse the chain: %s", reason);
+    g_free (f->format);
+    f->format = NULL;
+    f->filter = NULL;
+    return FALSE;
+  }
+
+  /* the size of the last caps is the one of the frames as turned by
+   * whatever follows them, the cropped input is turned by the whole chain */
+  if (f->width == 0)
+    f->swaps_size = swaps_size (f->rotation);
+
+  GST_DEBUG_OBJECT (fbin, "crop %d,%d,%d,%d rotation %d flip %d size %dx%d "
+      "format %s", f->left, f->right, f->top, f->bottom, f->rotation,
+      f->flip, f->width, f->height, GST_STR_NULL (f->format));
+
+  return TRUE;
+}
+
+/* The caps of the fused vspfilter output, with the size of the cropped
+ * input when no caps of the chain gives one */
+static GstCaps *
+gst_vsp_filter_bin_get_out_caps (GstVspFilterBin * fbin,
+    GstVideoInfo * in_info)
+{
+  GstVspFilterBinFusion *f = &fbin->fusion;
+  GstCaps *caps;
+  gint width = f->width, height = f->height;
+
+  if (width == 0 && has_crop (f) && in_info) {
+    width = in_info->width - f->left - f->right;
+    height = in_info->height - f->top - f->bottom;
+  }
+
+  if (width <= 0 && !f->format)
+    return NULL;
+
+  caps = gst_caps_new_empty_simple ("video/x-raw");
+  if (f->format)
+    gst_caps_set_simple (caps, "format", G_TYPE_STRING, f->format, NULL);
+  if (width > 0)
+    gst_caps_set_simple (caps,
+        "width", G_TYPE_INT, f->swaps_size ? height : width,
+        "height", G_TYPE_INT, f->swaps_size ? width : height, NULL);
+
+  return caps;
+}
+
+/* Points the crop meta of a buffer to the crop of the chain, within the
+ * one it already has */
+static GstBuffer *
+gst_vsp_filter_bin_crop_buffer (GstVspFilterBin * fbin, GstBuffer * buf)
+{
+  GstVspFilterBinFusion *f = &fbin->fusion;
+  GstVideoCropMeta *crop;
+  gint x, y, width, height;
+
+  GST_OBJECT_LOCK (fbin);
+  if (!fbin->have_info) {
+    GST_OBJECT_UNLOCK (fbin);
+    return buf;
+  }
+  width = fbin->in_info.width;
+  height = fbin->in_info.height;
+  GST_OBJECT_UNLOCK (fbin);
+
+  buf = gst_buffer_make_writable (buf);
+
+  x = y = 0;
+  crop = gst_buffer_get_video_crop_meta (buf);
+  if (crop) {
+    x = crop->x;
+    y = crop->y;
+    width = crop->width;
+    height = crop->height;
+  } else {
+    crop = gst_buffer_add_video_crop_meta (buf);
+  }
+
+  crop->x = x + f->left;
+  crop->y = y + f->top;
+  crop->width = MAX (width - f->left - f->right, 1);
+  crop->height = MAX (height - f->top - f->bottom, 1);
+
+  return buf;
+}
+
+static gboolean
+crop_list_buffer (GstBuffer ** buf, guint idx, gpointer user_data)
+{
+  *buf = gst_vsp_filter_bin_crop_buffer (GST_VSP_FILTER_BIN_CAST (user_data),
+      *buf);
+
+  return TRUE;
+}
+
+/* Keeps the input caps to set the output size from and to crop the
+ * buffers with, before the vspfilter gets them */
+static GstPadProbeReturn
+gst_vsp_filter_bin_sink_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstVspFilterBin *fbin = GST_VSP_FILTER_BIN_CAST (user_data);
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    info->data = gst_vsp_filter_bin_crop_buffer (fbin,
+        GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+
+    list = gst_buffer_list_make_writable (list);
+    gst_buffer_list_foreach (list, crop_list_buffer, fbin);
+    info->data = list;
+  } else if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    GstVideoInfo in_info;
+    GstCaps *caps, *out_caps;
+
+    if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+      return GST_PAD_PROBE_OK;
+
+    gst_event_parse_caps (event, &caps);
+    if (!gst_video_info_from_caps (&in_info, caps))
+      return GST_PAD_PROBE_OK;
+
+    if (in_info.width <= fbin->fusion.left + fbin->fusion.right ||
+        in_info.height <= fbin->fusion.top + fbin->fusion.bottom) {
+      GST_ELEMENT_ERROR (fbin, STREAM, FORMAT, (NULL),
+          ("crop larger than the %dx%d input", in_info.width,
+              in_info.height));
+      return GST_PAD_PROBE_DROP;
+    }
+
+    GST_OBJECT_LOCK (fbin);
+    fbin->in_info = in_info;
+    fbin->have_info = TRUE;
+    GST_OBJECT_UNLOCK (fbin);
+
+    out_caps = gst_vsp_filter_bin_get_out_caps (fbin, &in_info);
+    GST_DEBUG_OBJECT (fbin, "output caps %" GST_PTR_FORMAT, out_caps);
+    g_object_set (fbin->capsfilter, "caps", out_caps, NULL);
+    if (out_caps)
+      gst_caps_unref (out_caps);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Drops the event which pushes out the frames in flight of the fused
+ * vspfilter before the chain is run as it is */
+static GstPadProbeReturn
+gst_vsp_filter_bin_src_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_DOWNSTREAM &&
+      gst_event_has_name (event, DRAIN_EVENT_NAME))
+    return GST_PAD_PROBE_DROP;
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+gst_vsp_filter_bin_clear (GstVspFilterBin * fbin)
+{
+  if (fbin->caps_probe) {
+    gst_pad_remove_probe (fbin->sinkpad, fbin->caps_probe);
+    fbin->caps_probe = 0;
+  }
+  gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (fbin->sinkpad), NULL);
+  gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (fbin->srcpad), NULL);
+
+  if (fbin->filter) {
+    gst_element_set_state (fbin->filter, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN_CAST (fbin), fbin->filter);
+    fbin->filter = NULL;
+  }
+  if (fbin->capsfilter) {
+    gst_element_set_state (fbin->capsfilter, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN_CAST (fbin), fbin->capsfilter);
+    fbin->capsfilter = NULL;
+  }
+  if (fbin->fallback) {
+    gst_element_set_state (fbin->fallback, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN_CAST (fbin), fbin->fallback);
+    fbin->fallback = NULL;
+  }
+
+  g_free (fbin->fusion.format);
+  memset (&fbin->fusion, 0, sizeof (fbin->fusion));
+  g_free (fbin->built_chain);
+  fbin->built_chain = NULL;
+  fbin->fused = FALSE;
+  fbin->have_info = FALSE;
+}
+
+/* Runs the chain as it is */
+static gboolean
+gst_vsp_filter_bin_build_fallback (GstVspFilterBin * fbin, GstBin * parsed)
+{
+  GstPad *pad;
+
+  fbin->fallback = GST_ELEMENT_CAST (parsed);
+  gst_bin_add (GST_BIN_CAST (fbin), fbin->fallback);
+
+  pad = gst_element_get_static_pad (fbin->fallback, "sink");
+  if (!pad)
+    return FALSE;
+  gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (fbin->sinkpad), pad);
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (fbin->fallback, "src");
+  if (!pad)
+    return FALSE;
+  gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (fbin->srcpad), pad);
+  gst_object_unref (pad);
+
+  return TRUE;
+}
+
+/* Runs the chain as it is in place of the fused vspfilter, which cannot
+ * crop the frames of the caps the sink pad got. The frames in flight of
+ * the vspfilter are pushed out first. The caps then go to the chain, after
+ * the other sticky events of the sink pad. */
+static gboolean
+gst_vsp_filter_bin_unfuse (GstVspFilterBin * fbin)
+{
+  GstElement *parsed;
+  GError *err = NULL;
+  GstPad *pad;
+
+  pad = gst_element_get_static_pad (fbin->filter, "sink");
+  gst_pad_send_event (pad, gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM,
+          gst_structure_new_empty (DRAIN_EVENT_NAME)));
+  gst_object_unref (pad);
+
+  parsed = gst_parse_bin_from_description (fbin->built_chain, TRUE, &err);
+  if (!parsed) {
+    GST_ELEMENT_ERROR (fbin, CORE, PAD, (NULL),
+        ("cannot parse chain \"%s\": %s", fbin->built_chain,
+            err ? err->message : "unknown error"));
+    g_clear_error (&err);
+    return FALSE;
+  }
+  g_clear_error (&err);
+  gst_object_ref_sink (parsed);
+
+  if (!gst_vsp_filter_bin_build_fallback (fbin, GST_BIN_CAST (parsed))) {
+    gst_object_unref (parsed);
+    GST_ELEMENT_ERROR (fbin, CORE, PAD, (NULL),
+        ("cannot set up chain \"%s\"", fbin->built_chain));
+    return FALSE;
+  }
+  gst_object_unref (parsed);
+  gst_element_sync_state_with_parent (fbin->fallback);
+
+  /* kept until the children are made again, without their devices */
+  gst_element_set_locked_state (fbin->filter, TRUE);
+  gst_element_set_locked_state (fbin->capsfilter, TRUE);
+  gst_element_set_state (fbin->filter, GST_STATE_NULL);
+  gst_element_set_state (fbin->capsfilter, GST_STATE_NULL);
+
+  GST_OBJECT_LOCK (fbin);
+  fbin->have_info = FALSE;
+  GST_OBJECT_UNLOCK (fbin);
+  fbin->fused = FALSE;
+
+  return TRUE;
+}
+
+/* Checks that the fused vspfilter can crop the frames of new caps, with
+ * the limits of its RPF, UDS, tiles and passes, and runs the chain as it
+ * is if it cannot. Done on the sink pad, before the caps are sent on. */
+static GstPadProbeReturn
+gst_vsp_filter_bin_caps_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstVspFilterBin *fbin = GST_VSP_FILTER_BIN_CAST (user_data);
+  GstVspFilterBinFusion *f = &fbin->fusion;
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstVideoInfo in_info;
+  GstCaps *caps;
+  gint crop_w, crop_h, width, height, out_w, out_h;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+
+  gst_event_parse_caps (event, &caps);
+  if (!gst_video_info_from_caps (&in_info, caps))
+    return GST_PAD_PROBE_OK;
+
+  crop_w = in_info.width - f->left - f->right;
+  crop_h = in_info.height - f->top - f->bottom;
+  if (crop_w <= 0 || crop_h <= 0)
+    return GST_PAD_PROBE_OK;
+
+  width = f->width > 0 ? f->width : crop_w;
+  height = f->width > 0 ? f->height : crop_h;
+  out_w = f->swaps_size ? height : width;
+  out_h = f->swaps_size ? width : height;
+
+  if (gst_vsp_filter_can_crop (GST_VSP_FILTER_CAST (fbin->filter), &in_info,
+          crop_w, crop_h, out_w, out_h))
+    return GST_PAD_PROBE_OK;
+
+  GST_ELEMENT_WARNING (fbin, STREAM, NOT_IMPLEMENTED, (NULL),
+      ("the crop of chain \"%s\" cannot be done in one vspfilter pass from "
+          "%dx%d, the chain is run as it is", fbin->built_chain,
+          in_info.width, in_info.height));
+
+  if (!gst_vsp_filter_bin_unfuse (fbin))
+    return GST_PAD_PROBE_DROP;
+  fbin->caps_probe = 0;
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Makes one vspfilter do the job of the chain */
+static gboolean
+gst_vsp_filter_bin_build_fused (GstVspFilterBin * fbin, GstBin * parsed)
+{
+  GstVspFilterBinFusion *f = &fbin->fusion;
+  GstPad *pad;
+  GstCaps *caps;
+
+  if (f->filter) {
+    fbin->filter = gst_object_ref (f->filter);
+    gst_bin_remove (parsed, f->filter);
+  } else {
+    fbin->filter = gst_element_factory_make ("vspfilter", NULL);
+    if (!fbin->filter)
+      return FALSE;
+    gst_object_ref_sink (fbin->filter);
+  }
+  f->filter = NULL;
+
+  fbin->capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  if (!fbin->capsfilter) {
+    gst_object_unref (fbin->filter);
+    fbin->filter = NULL;
+    return FALSE;
+  }
+
+  g_object_set (fbin->filter, "rotation", f->rotation, "flip", f->flip,
+      NULL);
+  caps = gst_vsp_filter_bin_get_out_caps (fbin, NULL);
+  g_object_set (fbin->capsfilter, "caps", caps, NULL);
+  if (caps)
+    gst_caps_unref (caps);
+
+  gst_bin_add (GST_BIN_CAST (fbin), fbin->filter);
+  gst_object_unref (fbin->filter);
+  gst_bin_add (GST_BIN_CAST (fbin), fbin->capsfilter);
+  if (!gst_element_link (fbin->filter, fbin->capsfilter))
+    return FALSE;
+
+  pad = gst_element_get_static_pad (fbin->filter, "sink");
+  gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (fbin->sinkpad), pad);
+  gst_pad_add_probe (pad, has_crop (f) ? GST_PAD_PROBE_TYPE_BUFFER |
+      GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM :
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, gst_vsp_filter_bin_sink_probe,
+      fbin, NULL);
+  gst_object_unref (pad);
+
+  if (has_crop (f)) {
+    pad = gst_element_get_static_pad (fbin->filter, "src");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+        gst_vsp_filter_bin_src_probe, fbin, NULL);
+    gst_object_unref (pad);
+
+    fbin->caps_probe = gst_pad_add_probe (fbin->sinkpad,
+        GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, gst_vsp_filter_bin_caps_probe,
+        fbin, NULL);
+  }
+
+  pad = gst_element_get_static_pad (fbin->capsfilter, "src");
+  gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (fbin->srcpad), pad);
+  gst_object_unref (pad);
+
+  fbin->fused = TRUE;
+
+  return TRUE;
+}
+
+/* Makes the children from the chain property unless they are already */
+static gboolean
+gst_vsp_filter_bin_build (GstVspFilterBin * fbin)
+{
+  GstElement *parsed;
+  GError *err = NULL;
+  gchar *chain;
+  gboolean ret;
+
+  GST_OBJECT_LOCK (fbin);
+  chain = g_strdup (fbin->chain ? fbin->chain : DEFAULT_PROP_CHAIN);
+  GST_OBJECT_UNLOCK (fbin);
+
+  if (g_strcmp0 (chain, fbin->built_chain) == 0) {
+    g_free (chain);
+    return TRUE;
+  }
+  gst_vsp_filter_bin_clear (fbin);
+
+  parsed = gst_parse_bin_from_description (chain, TRUE, &err);
+  if (!parsed) {
+    GST_ELEMENT_ERROR (fbin, CORE, PAD, (NULL),
+        ("cannot parse chain \"%s\": %s", chain,
+            err ? err->message : "unknown error"));
+    g_clear_error (&err);
+    g_free (chain);
+    return FALSE;
+  }
+  g_clear_error (&err);
+  gst_object_ref_sink (parsed);
+
+  if (gst_vsp_filter_bin_fuse (fbin, GST_BIN_CAST (parsed), &fbin->fusion)) {
+    ret = gst_vsp_filter_bin_build_fused (fbin, GST_BIN_CAST (parsed));
+  } else {
+    GST_ELEMENT_WARNING (fbin, STREAM, NOT_IMPLEMENTED, (NULL),
+        ("chain \"%s\" is run as it is", chain));
+    ret = gst_vsp_filter_bin_build_fallback (fbin, GST_BIN_CAST (parsed));
+  }
+  gst_object_unref (parsed);
+
+  if (!ret) {
+    GST_ELEMENT_ERROR (fbin, CORE, PAD, (NULL),
+        ("cannot set up chain \"%s\"", chain));
+    gst_vsp_filter_bin_clear (fbin);
+    g_free (chain);
+    return FALSE;
+  }
+
+  fbin->built_chain = chain;
+
+  return TRUE;
+}
+
+static GstStateChangeReturn
+gst_vsp_filter_bin_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstVspFilterBin *fbin = GST_VSP_FILTER_BIN_CAST (element);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      if (!gst_vsp_filter_bin_build (fbin))
+        return GST_STATE_CHANGE_FAILURE;
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      GST_OBJECT_LOCK (fbin);
+      fbin->have_info = FALSE;
+      GST_OBJECT_UNLOCK (fbin);
+      break;
+    default:
+      break;
+  }
+
+  return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+}
+
+static void
+gst_vsp_filter_bin_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVspFilterBin *fbin = GST_VSP_FILTER_BIN (object);
+
+  GST_OBJECT_LOCK (fbin);
+  switch (property_id) {
+    case PROP_CHAIN:
+      g_free (fbin->chain);
+      fbin->chain = g_value_dup_string (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (fbin);
+}
+
+static void
+gst_vsp_filter_bin_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVspFilterBin *fbin = GST_VSP_FILTER_BIN (object);
+
+  GST_OBJECT_LOCK (fbin);
+  switch (property_id) {
+    case PROP_CHAIN:
+      g_value_set_string (value, fbin->chain);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (fbin);
+}
+
+static void
+gst_vsp_filter_bin_finalize (GObject * obj)
+{
+  GstVspFilterBin *fbin = GST_VSP_FILTER_BIN (obj);
+
+  g_free (fbin->chain);
+  g_free (fbin->built_chain);
+  g_free (fbin->fusion.format);
+
+  G_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
+static void
+gst_vsp_filter_bin_class_init (GstVspFilterBinClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstElementClass *gstelement_class = (GstElementClass *) klass;
+
+  GST_DEBUG_CATEGORY_INIT (vspfilterbin_debug, "vspfilterbin", 0,
+      "Chain of video filters fused into one vspfilter");
+
+  gobject_class->set_property = gst_vsp_filter_bin_set_property;
+  gobject_class->get_property = gst_vsp_filter_bin_get_property;
+  gobject_class->finalize = gst_vsp_filter_bin_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_CHAIN,
+      g_param_spec_string ("chain", "Chain",
+          "Description of the chain of videocrop, videoscale, videoconvert, "
+          "videoflip, capsfilter and vspfilter elements to run as one "
+          "vspfilter", DEFAULT_PROP_CHAIN,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&gst_vsp_filter_bin_src_template));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&gst_vsp_filter_bin_sink_template));
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "Fused video filters with VSP1 V4L2",
+      "Filter/Converter/Video/Scaler/Bin",
+      "Runs a chain of crop, scale, convert and flip elements as one "
+      "vspfilter pass", "Renesas Electronics Corporation");
+
+  gstelement_class->change_state = gst_vsp_filter_bin_change_state;
+}
+
+static void
+gst_vsp_filter_bin_init (GstVspFilterBin * fbin)
+{
+  GstElementClass *klass = GST_ELEMENT_GET_CLASS (fbin);
+
+  fbin->sinkpad =
+      gst_ghost_pad_new_no_target_from_template ("sink",
+      gst_element_class_get_pad_template (klass, "sink"));
+  gst_element_add_pad (GST_ELEMENT (fbin), fbin->sinkpad);
+
+  fbin->srcpad =
+      gst_ghost_pad_new_no_target_from_template ("src",
+      gst_element_class_get_pad_template (klass, "src"));
+  gst_element_add_pad (GST_ELEMENT (fbin), fbin->srcpad);
+
+  fbin->chain = g_strdup (DEFAULT_PROP_CHAIN);
+}
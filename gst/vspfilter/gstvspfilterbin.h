@@ -0,0 +1,98 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_VSP_FILTER_BIN_H__
+#define __GST_VSP_FILTER_BIN_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "gstvspfilter.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_VSP_FILTER_BIN            (gst_vsp_filter_bin_get_type())
+#define GST_VSP_FILTER_BIN(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_VSP_FILTER_BIN,GstVspFilterBin))
+#define GST_VSP_FILTER_BIN_CAST(obj)       ((GstVspFilterBin *)(obj))
+
+/* a single vspfilter */
+#define DEFAULT_PROP_CHAIN "vspfilter"
+
+typedef struct _GstVspFilterBin GstVspFilterBin;
+typedef struct _GstVspFilterBinClass GstVspFilterBinClass;
+typedef struct _GstVspFilterBinFusion GstVspFilterBinFusion;
+
+/* What a chain of elements does to the frames, done by one vspfilter:
+ * the crop of the input, the orientation, then the output caps */
+struct _GstVspFilterBinFusion {
+  gint left;
+  gint right;
+  gint top;
+  gint bottom;
+  GstVspfilterRotation rotation;
+  GstVspfilterFlip flip;
+  /* the size of the last caps of the chain, 0 for the cropped input;
+   * swapped when the frames are turned by 90 or 270 degrees after it */
+  gint width;
+  gint height;
+  gboolean swaps_size;
+  gchar *format;
+  /* the vspfilter of the chain which does the job with its other
+   * properties, a new one if NULL */
+  GstElement *filter;
+};
+
+/**
+ * GstVspFilterBin:
+ *
+ * Opaque object data structure.
+ */
+struct _GstVspFilterBin {
+  GstBin bin;
+
+  GstPad *sinkpad;
+  GstPad *srcpad;
+
+  /* property, read with the object lock */
+  gchar *chain;
+
+  /* the chain the children were made from, in READY or above */
+  gchar *built_chain;
+  gboolean fused;
+  GstVspFilterBinFusion fusion;
+  GstElement *filter;
+  GstElement *capsfilter;
+  GstElement *fallback;
+  /* on the sink pad while the chain is fused with a crop */
+  gulong caps_probe;
+
+  /* the input caps, set with the object lock */
+  GstVideoInfo in_info;
+  gboolean have_info;
+};
+
+struct _GstVspFilterBinClass {
+  GstBinClass parent_class;
+};
+
+GType gst_vsp_filter_bin_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_VSP_FILTER_BIN_H__ */
@@ -0,0 +1,207 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/allocators/gstdmabuf.h>
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include "vspfiltercache.h"
+#include "vspfilterpool.h"
+
+GST_DEBUG_CATEGORY_EXTERN (vspfilter_debug);
+#define GST_CAT_DEFAULT vspfilter_debug
+
+/*
+ * The kernel keeps the attachment of a dmabuf (or the pinned pages of a
+ * userptr) to a V4L2 buffer as long as the same memory is queued again with
+ * the same index, so mapping each upstream buffer to a stable index avoids
+ * re-importing it every frame.
+ *
+ * A userptr is only known by its address, so this relies on the memory
+ * staying mapped while its pool is in use. The cache is dropped along with
+ * the V4L2 buffers whenever the caps are renegotiated.
+ */
+
+typedef struct _VspfilterIndexSlot VspfilterIndexSlot;
+
+struct _VspfilterIndexSlot
+{
+  VspfilterBufferKey key;
+  gboolean valid;
+  gboolean busy;
+  guint64 last_used;
+};
+
+struct _VspfilterIndexCache
+{
+  VspfilterIndexSlot *slots;
+  guint n_slots;
+  guint64 clock;
+};
+
+VspfilterIndexCache *
+vspfilter_index_cache_new (guint n_slots)
+{
+  VspfilterIndexCache *cache;
+
+  cache = g_slice_new0 (VspfilterIndexCache);
+  cache->slots = g_new0 (VspfilterIndexSlot, n_slots);
+  cache->n_slots = n_slots;
+
+  return cache;
+}
+
+void
+vspfilter_index_cache_free (VspfilterIndexCache * cache)
+{
+  if (!cache)
+    return;
+
+  g_free (cache->slots);
+  g_slice_free (VspfilterIndexCache, cache);
+}
+
+guint
+vspfilter_index_cache_get_size (VspfilterIndexCache * cache)
+{
+  return cache->n_slots;
+}
+
+/* Compares the fields of two keys, the padding of the plane entries is
+ * not copied reliably */
+static gboolean
+buffer_key_equal (const VspfilterBufferKey * a, const VspfilterBufferKey * b)
+{
+  guint i;
+
+  if (a->n_planes != b->n_planes)
+    return FALSE;
+
+  for (i = 0; i < a->n_planes; i++) {
+    if (a->planes[i].id != b->planes[i].id ||
+        a->planes[i].fd != b->planes[i].fd ||
+        a->planes[i].offset != b->planes[i].offset ||
+        a->planes[i].length != b->planes[i].length)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Returns a V4L2 buffer index which is not queued to the device. If key is
+ * given, the index last used for the same memory is preferred. Otherwise
+ * the least recently used index is recycled. */
+guint
+vspfilter_index_cache_acquire (VspfilterIndexCache * cache,
+    const VspfilterBufferKey * key, gboolean * hit)
+{
+  VspfilterIndexSlot *slot = NULL;
+  guint i;
+
+  *hit = FALSE;
+
+  if (key) {
+    for (i = 0; i < cache->n_slots; i++) {
+      if (cache->slots[i].valid && !cache->slots[i].busy &&
+          buffer_key_equal (&cache->slots[i].key, key)) {
+        slot = &cache->slots[i];
+        *hit = TRUE;
+        break;
+      }
+    }
+  }
+
+  if (!slot) {
+    for (i = 0; i < cache->n_slots; i++) {
+      if (cache->slots[i].busy)
+        continue;
+      if (!cache->slots[i].valid) {
+        slot = &cache->slots[i];
+        break;
+      }
+      if (!slot || cache->slots[i].last_used < slot->last_used)
+        slot = &cache->slots[i];
+    }
+
+    if (!slot)
+      return VSPFILTER_INDEX_INVALID;
+
+    if (key) {
+      slot->key = *key;
+      slot->valid = TRUE;
+    } else {
+      slot->valid = FALSE;
+    }
+  }
+
+  slot->busy = TRUE;
+  slot->last_used = ++cache->clock;
+
+  return slot - cache->slots;
+}
+
+void
+vspfilter_index_cache_release (VspfilterIndexCache * cache, guint index)
+{
+  if (!cache || index >= cache->n_slots)
+    return;
+
+  cache->slots[index].busy = FALSE;
+}
+
+gboolean
+vspfilter_buffer_key_from_dmabuf (VspfilterBufferKey * key,
+    GstMemory * gmem[GST_VIDEO_MAX_PLANES], guint n_planes)
+{
+  struct stat st;
+  guint i;
+
+  memset (key, 0, sizeof (*key));
+
+  key->n_planes = n_planes;
+  for (i = 0; i < n_planes; i++) {
+    key->planes[i].fd = gst_dmabuf_memory_get_fd (gmem[i]);
+    if (fstat (key->planes[i].fd, &st) < 0) {
+      GST_WARNING ("fstat for dmabuf fd %d failed", key->planes[i].fd);
+      return FALSE;
+    }
+    key->planes[i].id = st.st_ino;
+    key->planes[i].offset = gmem[i]->offset;
+    key->planes[i].length = gmem[i]->size;
+  }
+
+  return TRUE;
+}
+
+void
+vspfilter_buffer_key_from_userptr (VspfilterBufferKey * key,
+    GstVideoFrame * frame)
+{
+  guint i;
+
+  memset (key, 0, sizeof (*key));
+
+  key->n_planes = GST_VIDEO_FRAME_N_PLANES (frame);
+  for (i = 0; i < key->n_planes; i++) {
+    key->planes[i].id = (guintptr) frame->data[i];
+    key->planes[i].fd = -1;
+    key->planes[i].length = gst_buffer_get_size (frame->buffer);
+  }
+}
@@ -0,0 +1,52 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_VSPFILTER_CACHE_H__
+#define __GST_VSPFILTER_CACHE_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+typedef struct _VspfilterIndexCache VspfilterIndexCache;
+typedef struct _VspfilterBufferKey VspfilterBufferKey;
+
+/* Identifies the memory behind a buffer which is not from our pools.
+ * Only the planes up to n_planes are compared. */
+struct _VspfilterBufferKey {
+  guint n_planes;
+  struct {
+    guint64 id;           /* inode of the dmabuf or userptr address */
+    gint fd;              /* -1 for userptr */
+    gsize offset;
+    gsize length;
+  } planes[GST_VIDEO_MAX_PLANES];
+};
+
+VspfilterIndexCache * vspfilter_index_cache_new (guint n_slots);
+void vspfilter_index_cache_free (VspfilterIndexCache * cache);
+guint vspfilter_index_cache_get_size (VspfilterIndexCache * cache);
+guint vspfilter_index_cache_acquire (VspfilterIndexCache * cache,
+    const VspfilterBufferKey * key, gboolean * hit);
+void vspfilter_index_cache_release (VspfilterIndexCache * cache, guint index);
+gboolean vspfilter_buffer_key_from_dmabuf (VspfilterBufferKey * key,
+    GstMemory * gmem[GST_VIDEO_MAX_PLANES], guint n_planes);
+void vspfilter_buffer_key_from_userptr (VspfilterBufferKey * key,
+    GstVideoFrame * frame);
+
+#endif /*__GST_VSPFILTER_CACHE_H__*/
@@ -0,0 +1,214 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "vspfiltercopy.h"
+
+GST_DEBUG_CATEGORY_EXTERN (vspfilter_debug);
+#define GST_CAT_DEFAULT vspfilter_debug
+
+/*
+ * Copies planes from buffers which can't be handed to the device into
+ * MMAP buffers. The rows of all planes are split into stripes which are
+ * copied in parallel by a few worker threads and the calling thread.
+ */
+
+/* stripes smaller than this are not worth a thread wakeup */
+#define MIN_STRIPE_SIZE (256 * 1024)
+#define MAX_STRIPES 16
+#define PREFETCH_DISTANCE 256
+
+struct _VspfilterCopier
+{
+  GThreadPool *pool;
+  guint n_threads;
+
+  GMutex lock;
+  GCond cond;
+  guint pending;
+};
+
+static inline void
+copy_row (guint8 * dp, const guint8 * sp, gsize width)
+{
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  while (width >= 64) {
+    uint8x16_t v0, v1, v2, v3;
+
+    __builtin_prefetch (sp + PREFETCH_DISTANCE);
+    v0 = vld1q_u8 (sp);
+    v1 = vld1q_u8 (sp + 16);
+    v2 = vld1q_u8 (sp + 32);
+    v3 = vld1q_u8 (sp + 48);
+    vst1q_u8 (dp, v0);
+    vst1q_u8 (dp + 16, v1);
+    vst1q_u8 (dp + 32, v2);
+    vst1q_u8 (dp + 48, v3);
+    sp += 64;
+    dp += 64;
+    width -= 64;
+  }
+#endif
+  if (width)
+    memcpy (dp, sp, width);
+}
+
+static void
+copy_region (const VspfilterCopyRegion * region)
+{
+  const guint8 *sp = region->src;
+  guint8 *dp = region->dest;
+  guint i;
+
+  /* both sides packed, a plain memcpy is as good as it gets */
+  if (region->dest_stride == region->width &&
+      region->src_stride == region->width) {
+    memcpy (dp, sp, region->width * region->height);
+    return;
+  }
+
+  for (i = 0; i < region->height; i++) {
+    if (i + 1 < region->height)
+      __builtin_prefetch (sp + region->src_stride);
+    copy_row (dp, sp, region->width);
+    dp += region->dest_stride;
+    sp += region->src_stride;
+  }
+}
+
+static void
+copy_func (gpointer data, gpointer user_data)
+{
+  VspfilterCopier *copier = user_data;
+
+  copy_region (data);
+
+  g_mutex_lock (&copier->lock);
+  if (--copier->pending == 0)
+    g_cond_signal (&copier->cond);
+  g_mutex_unlock (&copier->lock);
+}
+
+VspfilterCopier *
+vspfilter_copier_new (guint n_threads)
+{
+  VspfilterCopier *copier;
+  GError *err = NULL;
+
+  copier = g_slice_new0 (VspfilterCopier);
+  g_mutex_init (&copier->lock);
+  g_cond_init (&copier->cond);
+
+  if (n_threads == 0)
+    n_threads = MIN (g_get_num_processors (), 4);
+  copier->n_threads = MAX (n_threads, 1);
+
+  /* the calling thread takes a share of the work as well */
+  if (copier->n_threads > 1) {
+    copier->pool = g_thread_pool_new (copy_func, copier,
+        copier->n_threads - 1, TRUE, &err);
+    if (!copier->pool) {
+      GST_WARNING ("failed to create copy threads: %s", err->message);
+      g_error_free (err);
+      copier->n_threads = 1;
+    }
+  }
+
+  return copier;
+}
+
+void
+vspfilter_copier_free (VspfilterCopier * copier)
+{
+  if (!copier)
+    return;
+
+  if (copier->pool)
+    g_thread_pool_free (copier->pool, TRUE, TRUE);
+  g_mutex_clear (&copier->lock);
+  g_cond_clear (&copier->cond);
+  g_slice_free (VspfilterCopier, copier);
+}
+
+guint
+vspfilter_copier_get_n_threads (VspfilterCopier * copier)
+{
+  return copier->n_threads;
+}
+
+void
+vspfilter_copier_copy (VspfilterCopier * copier,
+    const VspfilterCopyRegion * regions, guint n_regions)
+{
+  VspfilterCopyRegion stripes[MAX_STRIPES];
+  guint n_stripes = 0;
+  gsize total = 0;
+  guint per_region;
+  guint i, j;
+
+  for (i = 0; i < n_regions; i++)
+    total += regions[i].width * regions[i].height;
+
+  if (!copier->pool || total < 2 * MIN_STRIPE_SIZE) {
+    for (i = 0; i < n_regions; i++)
+      copy_region (&regions[i]);
+    return;
+  }
+
+  /* split every region in rows so that each thread gets a share */
+  per_region = MAX (MAX_STRIPES / n_regions, 1);
+  for (i = 0; i < n_regions && n_stripes < MAX_STRIPES; i++) {
+    const VspfilterCopyRegion *region = &regions[i];
+    guint n, rows, row = 0;
+
+    n = region->width * region->height / MIN_STRIPE_SIZE;
+    n = CLAMP (n, 1, MIN (per_region, copier->n_threads));
+    n = MIN (n, MAX_STRIPES - n_stripes);
+    rows = (region->height + n - 1) / n;
+
+    for (j = 0; j < n && row < region->height; j++) {
+      VspfilterCopyRegion *stripe = &stripes[n_stripes++];
+
+      *stripe = *region;
+      stripe->height = MIN (rows, region->height - row);
+      stripe->dest += (gsize) row * region->dest_stride;
+      stripe->src += (gsize) row * region->src_stride;
+      row += stripe->height;
+    }
+  }
+
+  g_mutex_lock (&copier->lock);
+  copier->pending = n_stripes - 1;
+  g_mutex_unlock (&copier->lock);
+
+  for (i = 1; i < n_stripes; i++)
+    g_thread_pool_push (copier->pool, &stripes[i], NULL);
+
+  copy_region (&stripes[0]);
+
+  g_mutex_lock (&copier->lock);
+  while (copier->pending > 0)
+    g_cond_wait (&copier->cond, &copier->lock);
+  g_mutex_unlock (&copier->lock);
+}
@@ -0,0 +1,44 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_VSPFILTER_COPY_H__
+#define __GST_VSPFILTER_COPY_H__
+
+#include <gst/gst.h>
+
+typedef struct _VspfilterCopier VspfilterCopier;
+typedef struct _VspfilterCopyRegion VspfilterCopyRegion;
+
+/* A block of rows to copy between two strided buffers */
+struct _VspfilterCopyRegion {
+  guint8 *dest;
+  const guint8 *src;
+  gint dest_stride;
+  gint src_stride;
+  gsize width;                  /* in bytes */
+  guint height;
+};
+
+VspfilterCopier * vspfilter_copier_new (guint n_threads);
+void vspfilter_copier_free (VspfilterCopier * copier);
+guint vspfilter_copier_get_n_threads (VspfilterCopier * copier);
+void vspfilter_copier_copy (VspfilterCopier * copier,
+    const VspfilterCopyRegion * regions, guint n_regions);
+
+#endif /*__GST_VSPFILTER_COPY_H__*/
@@ -0,0 +1,176 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+
+#include "vspfilterdevice.h"
+#include "vspfiltervirtual.h"
+
+GST_DEBUG_CATEGORY_EXTERN (vspfilter_debug);
+#define GST_CAT_DEFAULT vspfilter_debug
+
+static gint
+linux_open (const gchar * path, gint flags)
+{
+  return open (path, flags, 0);
+}
+
+static gint
+linux_ioctl (gint fd, gulong request, gpointer arg)
+{
+  return ioctl (fd, request, arg);
+}
+
+static gint
+linux_poll (gint fd, glong timeout_usec)
+{
+  struct timeval tv;
+  fd_set fds;
+  gint ret;
+
+  FD_ZERO (&fds);
+  FD_SET (fd, &fds);
+
+  tv.tv_sec = timeout_usec / G_USEC_PER_SEC;
+  tv.tv_usec = timeout_usec % G_USEC_PER_SEC;
+
+  do
+    ret = select (fd + 1, &fds, NULL, NULL, &tv);
+  while (ret == -1 && errno == EINTR);
+
+  return ret;
+}
+
+static gchar *
+linux_read_attr (const gchar * path)
+{
+  gchar *contents;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return NULL;
+
+  return contents;
+}
+
+static gchar **
+linux_list_dir (const gchar * path)
+{
+  const gchar *name;
+  GPtrArray *names;
+  GDir *dir;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (!dir)
+    return NULL;
+
+  names = g_ptr_array_new ();
+  while ((name = g_dir_read_name (dir)) != NULL)
+    g_ptr_array_add (names, g_strdup (name));
+  g_ptr_array_add (names, NULL);
+  g_dir_close (dir);
+
+  return (gchar **) g_ptr_array_free (names, FALSE);
+}
+
+static const VspfilterDeviceOps linux_ops = {
+  "linux",
+  linux_open,
+  close,
+  linux_ioctl,
+  stat,
+  fstat,
+  linux_poll,
+  linux_read_attr,
+  linux_list_dir,
+};
+
+const VspfilterDeviceOps *
+vspfilter_device_get_ops (void)
+{
+  static const VspfilterDeviceOps *ops;
+
+  if (g_once_init_enter (&ops)) {
+    const VspfilterDeviceOps *selected = &linux_ops;
+    const gchar *backend = g_getenv ("GST_VSP_FILTER_BACKEND");
+
+    if (backend && strcmp (backend, "virtual") == 0)
+      selected = vspfilter_virtual_get_ops ();
+    else if (backend && strcmp (backend, "linux") != 0)
+      GST_WARNING ("unknown device backend '%s', using linux", backend);
+
+    GST_INFO ("device backend: %s", selected->name);
+    g_once_init_leave (&ops, selected);
+  }
+
+  return ops;
+}
+
+gint
+vspfilter_device_open (const gchar * path, gint flags)
+{
+  return vspfilter_device_get_ops ()->open (path, flags);
+}
+
+gint
+vspfilter_device_close (gint fd)
+{
+  return vspfilter_device_get_ops ()->close (fd);
+}
+
+gint
+vspfilter_device_ioctl (gint fd, gulong request, gpointer arg)
+{
+  return vspfilter_device_get_ops ()->ioctl (fd, request, arg);
+}
+
+gint
+vspfilter_device_stat (const gchar * path, struct stat * st)
+{
+  return vspfilter_device_get_ops ()->stat (path, st);
+}
+
+gint
+vspfilter_device_fstat (gint fd, struct stat * st)
+{
+  return vspfilter_device_get_ops ()->fstat (fd, st);
+}
+
+gint
+vspfilter_device_poll (gint fd, glong timeout_usec)
+{
+  return vspfilter_device_get_ops ()->poll (fd, timeout_usec);
+}
+
+gchar *
+vspfilter_device_read_attr (const gchar * path)
+{
+  return vspfilter_device_get_ops ()->read_attr (path);
+}
+
+gchar **
+vspfilter_device_list_dir (const gchar * path)
+{
+  return vspfilter_device_get_ops ()->list_dir (path);
+}
@@ -0,0 +1,66 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef __GST_VSPFILTER_DEVICE_H__
+#define __GST_VSPFILTER_DEVICE_H__
+
+#include <gst/gst.h>
+#include <sys/stat.h>
+
+/*
+ * Every access to the V4L2 and media controller device nodes and to their
+ * sysfs attributes goes through a device backend, so that the plugin can
+ * run on top of something other than the VSP driver.
+ *
+ * The backend is chosen once per process from the GST_VSP_FILTER_BACKEND
+ * environment variable: "linux" (the default) talks to the kernel and
+ * "virtual" emulates VSP devices in software.
+ */
+typedef struct _VspfilterDeviceOps VspfilterDeviceOps;
+
+struct _VspfilterDeviceOps
+{
+  const gchar *name;
+
+  gint (*open) (const gchar * path, gint flags);
+  gint (*close) (gint fd);
+  gint (*ioctl) (gint fd, gulong request, gpointer arg);
+  gint (*stat) (const gchar * path, struct stat * st);
+  gint (*fstat) (gint fd, struct stat * st);
+  /* Returns > 0 when fd is readable, 0 on timeout and -1 on error */
+  gint (*poll) (gint fd, glong timeout_usec);
+  /* Returns the contents of a sysfs attribute, or NULL */
+  gchar *(*read_attr) (const gchar * path);
+  /* Returns the NULL-terminated entries of a sysfs directory, or NULL */
+  gchar **(*list_dir) (const gchar * path);
+};
+
+const VspfilterDeviceOps * vspfilter_device_get_ops (void);
+
+gint vspfilter_device_open (const gchar * path, gint flags);
+gint vspfilter_device_close (gint fd);
+gint vspfilter_device_ioctl (gint fd, gulong request, gpointer arg);
+gint vspfilter_device_stat (const gchar * path, struct stat * st);
+gint vspfilter_device_fstat (gint fd, struct stat * st);
+gint vspfilter_device_poll (gint fd, glong timeout_usec);
+gchar * vspfilter_device_read_attr (const gchar * path);
+gchar ** vspfilter_device_list_dir (const gchar * path);
+
+#endif /*__GST_VSPFILTER_DEVICE_H__*/
@@ -0,0 +1,546 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "vspfiltermedia.h"
+#include "vspfilterdevice.h"
+
+GST_DEBUG_CATEGORY_EXTERN (vspfilter_debug);
+#define GST_CAT_DEFAULT vspfilter_debug
+
+/*
+ * Registry of the media controller topology shared by all element
+ * instances in the process. Each media device is opened and its entities
+ * enumerated once, and the names of the V4L2 subdevs are read from sysfs
+ * once. Both are scanned again only when a lookup misses.
+ *
+ * Links are not cached as other instances enable and disable them.
+ */
+
+struct _VspfilterMedia
+{
+  gint refcount;
+  gchar *path;
+  gint fd;
+
+  GMutex lock;
+  GArray *entities;             /* struct media_entity_desc */
+};
+
+/* media device path -> VspfilterMedia */
+static GHashTable *media_devices;
+/* basename of a video node -> media device path */
+static GHashTable *media_of_video;
+/* names of /dev/v4l-subdevN, indexed by N */
+static GPtrArray *subdev_names;
+G_LOCK_DEFINE_STATIC (registry);
+
+static void
+scan_entities (VspfilterMedia * media)
+{
+  struct media_entity_desc entity;
+  guint32 id = 0;
+
+  g_array_set_size (media->entities, 0);
+
+  for (;;) {
+    memset (&entity, 0, sizeof (entity));
+    entity.id = id | MEDIA_ENT_ID_FLAG_NEXT;
+    if (vspfilter_device_ioctl (media->fd, MEDIA_IOC_ENUM_ENTITIES,
+            &entity) < 0)
+      break;
+    g_array_append_val (media->entities, entity);
+    id = entity.id;
+  }
+
+  GST_DEBUG ("%s: %u entities", media->path, media->entities->len);
+}
+
+/* Returns the path of the media device the video node belongs to */
+static gchar *
+find_media_path (const gchar * video_dev)
+{
+  gchar *resolved, *dev, *path;
+  gchar **names;
+  guint i;
+
+  resolved = realpath (video_dev, NULL);
+  dev = g_path_get_basename (resolved ? resolved : video_dev);
+  free (resolved);
+
+  path = g_hash_table_lookup (media_of_video, dev);
+  if (path) {
+    g_free (dev);
+    return g_strdup (path);
+  }
+
+  path = g_strdup_printf ("/sys/class/video4linux/%s/device", dev);
+  names = vspfilter_device_list_dir (path);
+  g_free (path);
+  path = NULL;
+
+  for (i = 0; names && names[i]; i++) {
+    if (strncmp (names[i], "media", 5) == 0) {
+      path = g_strdup_printf ("/dev/%s", names[i]);
+      break;
+    }
+  }
+  g_strfreev (names);
+
+  if (path)
+    g_hash_table_insert (media_of_video, dev, g_strdup (path));
+  else
+    g_free (dev);
+
+  return path;
+}
+
+VspfilterMedia *
+vspfilter_media_get (const gchar * video_dev)
+{
+  VspfilterMedia *media = NULL;
+  gchar *path;
+  gint fd;
+
+  G_LOCK (registry);
+  if (!media_devices) {
+    media_devices = g_hash_table_new (g_str_hash, g_str_equal);
+    media_of_video = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        g_free);
+  }
+
+  path = find_media_path (video_dev);
+  if (!path) {
+    GST_ERROR ("No media device for %s", video_dev);
+    goto leave;
+  }
+
+  media = g_hash_table_lookup (media_devices, path);
+  if (media) {
+    media->refcount++;
+    g_free (path);
+    goto leave;
+  }
+
+  fd = vspfilter_device_open (path, O_RDWR);
+  if (fd < 0) {
+    GST_ERROR ("Cannot open '%s': %d, %s", path, errno, strerror (errno));
+    g_free (path);
+    goto leave;
+  }
+
+  GST_DEBUG ("media device = %s", path);
+
+  media = g_slice_new0 (VspfilterMedia);
+  media->refcount = 1;
+  media->path = path;
+  media->fd = fd;
+  g_mutex_init (&media->lock);
+  media->entities = g_array_new (FALSE, TRUE,
+      sizeof (struct media_entity_desc));
+  scan_entities (media);
+
+  g_hash_table_insert (media_devices, media->path, media);
+
+leave:
+  G_UNLOCK (registry);
+
+  return media;
+}
+
+void
+vspfilter_media_unref (VspfilterMedia * media)
+{
+  if (!media)
+    return;
+
+  G_LOCK (registry);
+  if (--media->refcount > 0) {
+    G_UNLOCK (registry);
+    return;
+  }
+  g_hash_table_remove (media_devices, media->path);
+  G_UNLOCK (registry);
+
+  vspfilter_device_close (media->fd);
+  g_array_free (media->entities, TRUE);
+  g_mutex_clear (&media->lock);
+  g_free (media->path);
+  g_slice_free (VspfilterMedia, media);
+}
+
+gint
+vspfilter_media_get_fd (VspfilterMedia * media)
+{
+  return media->fd;
+}
+
+const gchar *
+vspfilter_media_get_path (VspfilterMedia * media)
+{
+  return media->path;
+}
+
+static gboolean
+lookup_entity (VspfilterMedia * media, const gchar * name, guint32 id,
+    struct media_entity_desc *entity)
+{
+  struct media_entity_desc *e;
+  gboolean rescanned = FALSE;
+  guint i;
+
+  g_mutex_lock (&media->lock);
+  for (;;) {
+    for (i = 0; i < media->entities->len; i++) {
+      e = &g_array_index (media->entities, struct media_entity_desc, i);
+      if ((name && strcmp (e->name, name) == 0) || (!name && e->id == id)) {
+        *entity = *e;
+        g_mutex_unlock (&media->lock);
+        return TRUE;
+      }
+    }
+
+    if (rescanned)
+      break;
+    scan_entities (media);
+    rescanned = TRUE;
+  }
+  g_mutex_unlock (&media->lock);
+
+  return FALSE;
+}
+
+gboolean
+vspfilter_media_find_entity (VspfilterMedia * media, const gchar * name,
+    struct media_entity_desc * entity)
+{
+  if (!lookup_entity (media, name, 0, entity)) {
+    GST_ERROR ("No media entity for %s", name);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+gboolean
+vspfilter_media_find_entity_by_id (VspfilterMedia * media, guint32 id,
+    struct media_entity_desc * entity)
+{
+  return lookup_entity (media, NULL, id, entity);
+}
+
+/* Enables the link from src to a sink pad of sink. The other links of src
+ * have to be disabled first, but for the one to tap_id, if not 0, which
+ * only reads what goes through src. Returns 0 on success. */
+gint
+vspfilter_media_activate_link (VspfilterMedia * media,
+    const struct media_entity_desc *src, const struct media_entity_desc *sink,
+    guint sink_pad, guint32 tap_id)
+{
+  struct media_links_enum links;
+  struct media_link_desc *target_link;
+  gint ret, i;
+
+  target_link = NULL;
+  memset (&links, 0, sizeof (links));
+  links.pads = g_malloc0 (sizeof (struct media_pad_desc) * src->pads);
+  links.links = g_malloc0 (sizeof (struct media_link_desc) * src->links);
+
+  links.entity = src->id;
+  ret = vspfilter_device_ioctl (media->fd, MEDIA_IOC_ENUM_LINKS, &links);
+  if (ret) {
+    GST_ERROR ("MEDIA_IOC_ENUM_LINKS failed");
+    goto leave;
+  }
+
+  for (i = 0; i < src->links; i++) {
+    if (links.links[i].sink.entity == sink->id &&
+        links.links[i].sink.index == sink_pad) {
+      target_link = &links.links[i];
+    } else if ((links.links[i].flags & MEDIA_LNK_FL_ENABLED) &&
+        links.links[i].sink.entity != tap_id) {
+      GST_WARNING ("An active link to %02x found.",
+          links.links[i].sink.entity);
+      ret = -1;
+      goto leave;
+    }
+  }
+
+  if (!target_link) {
+    ret = -1;
+    goto leave;
+  }
+
+  target_link->flags |= MEDIA_LNK_FL_ENABLED;
+  ret = vspfilter_device_ioctl (media->fd, MEDIA_IOC_SETUP_LINK, target_link);
+
+leave:
+  g_free (links.pads);
+  g_free (links.links);
+
+  return ret;
+}
+
+/* Disables the links from src which can be, and the ones downstream of
+ * them. Returns 0 on success. */
+gint
+vspfilter_media_deactivate_link (VspfilterMedia * media,
+    const struct media_entity_desc *src)
+{
+  struct media_links_enum links;
+  struct media_link_desc *target_link;
+  gint ret, i;
+
+  memset (&links, 0, sizeof (links));
+  links.pads = g_malloc0 (sizeof (struct media_pad_desc) * src->pads);
+  links.links = g_malloc0 (sizeof (struct media_link_desc) * src->links);
+
+  links.entity = src->id;
+  ret = vspfilter_device_ioctl (media->fd, MEDIA_IOC_ENUM_LINKS, &links);
+  if (ret) {
+    GST_ERROR ("MEDIA_IOC_ENUM_LINKS failed");
+    goto leave;
+  }
+
+  for (i = 0; i < src->links; i++) {
+    if ((links.links[i].flags & MEDIA_LNK_FL_ENABLED) &&
+        !(links.links[i].flags & MEDIA_LNK_FL_IMMUTABLE)) {
+      struct media_entity_desc next;
+
+      target_link = &links.links[i];
+      if (!vspfilter_media_find_entity_by_id (media, target_link->sink.entity,
+              &next)) {
+        GST_ERROR ("No media entity for id %d", target_link->sink.entity);
+        ret = -1;
+        goto leave;
+      }
+      ret = vspfilter_media_deactivate_link (media, &next);
+      if (ret)
+        GST_ERROR ("deactivate_link(%s) failed.", next.name);
+      target_link->flags &= ~MEDIA_LNK_FL_ENABLED;
+      ret = vspfilter_device_ioctl (media->fd, MEDIA_IOC_SETUP_LINK,
+          target_link);
+      if (ret)
+        GST_ERROR ("MEDIA_IOC_SETUP_LINK failed.");
+      GST_DEBUG ("A link from %s to %s deactivated.", src->name, next.name);
+    }
+  }
+
+leave:
+  g_free (links.pads);
+  g_free (links.links);
+
+  return ret;
+}
+
+static void
+scan_subdevs (void)
+{
+  gchar path[256];
+  gchar *name;
+  guint i;
+
+  if (subdev_names)
+    g_ptr_array_free (subdev_names, TRUE);
+  subdev_names = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0; i < 256; i++) {
+    snprintf (path, sizeof (path),
+        "/sys/class/video4linux/v4l-subdev%u/name", i);
+    name = vspfilter_device_read_attr (path);
+    if (!name)
+      break;
+    g_ptr_array_add (subdev_names, name);
+  }
+
+  GST_DEBUG ("%u subdevs", subdev_names->len);
+}
+
+/* Opens the subdev whose name starts with prefix and contains target */
+gint
+vspfilter_subdev_open (const gchar * prefix, const gchar * target,
+    gchar * path, gsize maxlen)
+{
+  gboolean rescanned = FALSE;
+  const gchar *name;
+  gint index = -1;
+  guint i;
+
+  G_LOCK (registry);
+  if (!subdev_names) {
+    scan_subdevs ();
+    rescanned = TRUE;
+  }
+
+  for (;;) {
+    for (i = 0; i < subdev_names->len; i++) {
+      name = g_ptr_array_index (subdev_names, i);
+      if ((!prefix || strncmp (name, prefix, strlen (prefix)) == 0) &&
+          strstr (name, target) != NULL) {
+        index = i;
+        break;
+      }
+    }
+
+    if (index >= 0 || rescanned)
+      break;
+    scan_subdevs ();
+    rescanned = TRUE;
+  }
+  G_UNLOCK (registry);
+
+  if (index < 0) {
+    snprintf (path, maxlen, "v4l-subdev for %s", target);
+    errno = ENOENT;
+    return -1;
+  }
+
+  snprintf (path, maxlen, "/dev/v4l-subdev%d", index);
+  return vspfilter_device_open (path, O_RDWR /* required | O_NONBLOCK */ );
+}
+
+static gint
+compare_video_pairs (gconstpointer a, gconstpointer b)
+{
+  return strcmp (((const VspfilterVideoPair *) a)->ip_name,
+      ((const VspfilterVideoPair *) b)->ip_name);
+}
+
+/* Lists the VSPs which have both an RPF input and a WPF output video node,
+ * sorted by name. The nodes are named "<ip> rpf.N input" and
+ * "<ip> wpf.N output"; the ones with the lowest node numbers are taken. */
+GList *
+vspfilter_media_find_video_pairs (void)
+{
+  GHashTable *pairs;
+  VspfilterVideoPair *pair;
+  GList *list, *l;
+  gchar path[256];
+  gchar *name, **words;
+  gchar **node;
+  guint i;
+
+  pairs = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (i = 0; i < 256; i++) {
+    snprintf (path, sizeof (path), "/sys/class/video4linux/video%u/name", i);
+    name = vspfilter_device_read_attr (path);
+    if (!name)
+      continue;
+
+    words = g_strsplit (g_strstrip (name), " ", 0);
+    g_free (name);
+
+    if (g_strv_length (words) == 3 &&
+        ((strncmp (words[1], "rpf.", 4) == 0 &&
+                strcmp (words[2], "input") == 0) ||
+            (strncmp (words[1], "wpf.", 4) == 0 &&
+                strcmp (words[2], "output") == 0))) {
+      pair = g_hash_table_lookup (pairs, words[0]);
+      if (!pair) {
+        pair = g_slice_new0 (VspfilterVideoPair);
+        pair->ip_name = g_strdup (words[0]);
+        g_hash_table_insert (pairs, pair->ip_name, pair);
+      }
+
+      node = (words[1][0] == 'r') ? &pair->input : &pair->output;
+      if (!*node)
+        *node = g_strdup_printf ("/dev/video%u", i);
+    }
+
+    g_strfreev (words);
+  }
+
+  list = g_hash_table_get_values (pairs);
+  g_hash_table_destroy (pairs);
+
+  for (l = list; l;) {
+    GList *next = l->next;
+
+    pair = l->data;
+    if (!pair->input || !pair->output) {
+      vspfilter_video_pair_free (pair);
+      list = g_list_delete_link (list, l);
+    }
+    l = next;
+  }
+
+  list = g_list_sort (list, compare_video_pairs);
+
+  GST_DEBUG ("%u VSPs with RPF and WPF video nodes", g_list_length (list));
+
+  return list;
+}
+
+/* Returns the path of the video node named "<ip> <name>", e.g.
+ * "<ip> hgo histo", or NULL if there is none */
+gchar *
+vspfilter_media_find_video_node (const gchar * ip_name, const gchar * name)
+{
+  gchar path[256];
+  gchar *attr, *wanted, *node = NULL;
+  guint i;
+
+  wanted = g_strdup_printf ("%s %s", ip_name, name);
+
+  for (i = 0; i < 256 && !node; i++) {
+    snprintf (path, sizeof (path), "/sys/class/video4linux/video%u/name", i);
+    attr = vspfilter_device_read_attr (path);
+    if (!attr)
+      continue;
+
+    if (strcmp (g_strstrip (attr), wanted) == 0)
+      node = g_strdup_printf ("/dev/video%u", i);
+    g_free (attr);
+  }
+
+  g_free (wanted);
+
+  return node;
+}
+
+/* Returns the path of the input video node of an RPF, e.g. the one named
+ * "<ip> rpf.1 input" for entity "rpf.1", or NULL if there is none */
+gchar *
+vspfilter_media_find_input_node (const gchar * ip_name, const gchar * entity)
+{
+  gchar *name, *node;
+
+  name = g_strdup_printf ("%s input", entity);
+  node = vspfilter_media_find_video_node (ip_name, name);
+  g_free (name);
+
+  return node;
+}
+
+void
+vspfilter_video_pair_free (VspfilterVideoPair * pair)
+{
+  g_free (pair->ip_name);
+  g_free (pair->input);
+  g_free (pair->output);
+  g_slice_free (VspfilterVideoPair, pair);
+}
@@ -0,0 +1,59 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_VSPFILTER_MEDIA_H__
+#define __GST_VSPFILTER_MEDIA_H__
+
+#include <gst/gst.h>
+#include <linux/media.h>
+
+typedef struct _VspfilterMedia VspfilterMedia;
+typedef struct _VspfilterVideoPair VspfilterVideoPair;
+
+/* The first RPF input and WPF output video nodes of a VSP */
+struct _VspfilterVideoPair
+{
+  gchar *ip_name;
+  gchar *input;
+  gchar *output;
+};
+
+VspfilterMedia * vspfilter_media_get (const gchar * video_dev);
+void vspfilter_media_unref (VspfilterMedia * media);
+gint vspfilter_media_get_fd (VspfilterMedia * media);
+const gchar * vspfilter_media_get_path (VspfilterMedia * media);
+gboolean vspfilter_media_find_entity (VspfilterMedia * media,
+    const gchar * name, struct media_entity_desc *entity);
+gboolean vspfilter_media_find_entity_by_id (VspfilterMedia * media,
+    guint32 id, struct media_entity_desc *entity);
+gint vspfilter_media_activate_link (VspfilterMedia * media,
+    const struct media_entity_desc *src, const struct media_entity_desc *sink,
+    guint sink_pad, guint32 tap_id);
+gint vspfilter_media_deactivate_link (VspfilterMedia * media,
+    const struct media_entity_desc *src);
+gint vspfilter_subdev_open (const gchar * prefix, const gchar * target,
+    gchar * path, gsize maxlen);
+GList * vspfilter_media_find_video_pairs (void);
+gchar * vspfilter_media_find_video_node (const gchar * ip_name,
+    const gchar * name);
+gchar * vspfilter_media_find_input_node (const gchar * ip_name,
+    const gchar * entity);
+void vspfilter_video_pair_free (VspfilterVideoPair * pair);
+
+#endif /*__GST_VSPFILTER_MEDIA_H__*/
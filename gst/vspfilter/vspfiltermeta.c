@@ -0,0 +1,117 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include <gst/video/video.h>
+
+#include "vspfiltermeta.h"
+
+GType
+vspfilter_histogram_meta_api_get_type (void)
+{
+  static volatile GType type;
+  static const gchar *tags[] = { GST_META_TAG_VIDEO_STR,
+    GST_META_TAG_VIDEO_SIZE_STR, GST_META_TAG_VIDEO_COLORSPACE_STR, NULL
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("GstVspFilterHistogramMetaAPI",
+        tags);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
+static gboolean
+histogram_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+  VspfilterHistogramMeta *hmeta = (VspfilterHistogramMeta *) meta;
+
+  hmeta->type = VSPFILTER_HISTOGRAM_LUMA;
+  hmeta->min = hmeta->max = 0;
+  hmeta->sum = 0;
+  memset (hmeta->bins, 0, sizeof (hmeta->bins));
+
+  return TRUE;
+}
+
+/* The histogram only holds for the same picture */
+static gboolean
+histogram_meta_transform (GstBuffer * dest, GstMeta * meta,
+    GstBuffer * buffer, GQuark type, gpointer data)
+{
+  VspfilterHistogramMeta *hmeta = (VspfilterHistogramMeta *) meta;
+  VspfilterHistogramMeta *dmeta;
+
+  if (!GST_META_TRANSFORM_IS_COPY (type))
+    return FALSE;
+
+  dmeta = (VspfilterHistogramMeta *) gst_buffer_add_meta (dest,
+      VSPFILTER_HISTOGRAM_META_INFO, NULL);
+  if (!dmeta)
+    return FALSE;
+
+  dmeta->type = hmeta->type;
+  dmeta->min = hmeta->min;
+  dmeta->max = hmeta->max;
+  dmeta->sum = hmeta->sum;
+  memcpy (dmeta->bins, hmeta->bins, sizeof (dmeta->bins));
+
+  return TRUE;
+}
+
+const GstMetaInfo *
+vspfilter_histogram_meta_get_info (void)
+{
+  static const GstMetaInfo *info = NULL;
+
+  if (g_once_init_enter (&info)) {
+    const GstMetaInfo *meta =
+        gst_meta_register (VSPFILTER_HISTOGRAM_META_API_TYPE,
+        "GstVspFilterHistogramMeta", sizeof (VspfilterHistogramMeta),
+        histogram_meta_init, NULL, histogram_meta_transform);
+    g_once_init_leave (&info, meta);
+  }
+
+  return info;
+}
+
+/* Adds the histogram read from the buffer of the HGO histogram node in
+ * 256 bins mode: the maximum and the minimum, the sum and the bins */
+VspfilterHistogramMeta *
+vspfilter_buffer_add_histogram_meta (GstBuffer * buffer,
+    VspfilterHistogramType type, const guint32 * data)
+{
+  VspfilterHistogramMeta *meta;
+
+  meta = (VspfilterHistogramMeta *) gst_buffer_add_meta (buffer,
+      VSPFILTER_HISTOGRAM_META_INFO, NULL);
+  if (!meta)
+    return NULL;
+
+  meta->type = type;
+  meta->max = (data[0] >> 16) & 0xff;
+  meta->min = data[0] & 0xff;
+  meta->sum = data[1];
+  memcpy (meta->bins, &data[2], sizeof (meta->bins));
+
+  return meta;
+}
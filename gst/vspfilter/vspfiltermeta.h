@@ -0,0 +1,70 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_VSPFILTER_META_H__
+#define __GST_VSPFILTER_META_H__
+
+#include <gst/gst.h>
+
+/*
+ * Histogram of the picture computed by the HGO while a frame is converted,
+ * attached to the output buffer with histogram=true.
+ *
+ * Applications do not link to the plugin. They get the meta with the API
+ * type named "GstVspFilterHistogramMetaAPI", e.g.
+ *
+ *   api = g_type_from_name ("GstVspFilterHistogramMetaAPI");
+ *   meta = (VspfilterHistogramMeta *) gst_buffer_get_meta (buffer, api);
+ *
+ * and read it with a copy of the structure below.
+ */
+
+#define VSPFILTER_HISTOGRAM_BINS 256
+
+typedef enum {
+  VSPFILTER_HISTOGRAM_LUMA,     /* Y of a YUV picture */
+  VSPFILTER_HISTOGRAM_MAX_RGB   /* the largest of R, G and B */
+} VspfilterHistogramType;
+
+typedef struct _VspfilterHistogramMeta VspfilterHistogramMeta;
+
+/* The values of the pixels of the picture, after scaling and before the
+ * overlays are blended, counted in one bin each */
+struct _VspfilterHistogramMeta {
+  GstMeta meta;
+
+  VspfilterHistogramType type;
+  guint8 min;
+  guint8 max;
+  /* of the values of all the pixels */
+  guint32 sum;
+  guint32 bins[VSPFILTER_HISTOGRAM_BINS];
+};
+
+#define VSPFILTER_HISTOGRAM_META_API_TYPE \
+    (vspfilter_histogram_meta_api_get_type ())
+#define VSPFILTER_HISTOGRAM_META_INFO \
+    (vspfilter_histogram_meta_get_info ())
+
+GType vspfilter_histogram_meta_api_get_type (void);
+const GstMetaInfo * vspfilter_histogram_meta_get_info (void);
+VspfilterHistogramMeta * vspfilter_buffer_add_histogram_meta (GstBuffer *
+    buffer, VspfilterHistogramType type, const guint32 * data);
+
+#endif /*__GST_VSPFILTER_META_H__*/
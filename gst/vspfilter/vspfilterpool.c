@@ -249,7 +249,7 @@ vspfilter_buffer_pool_alloc_buffer (GstBufferPool * bpool, GstBuffer ** buffer,
     expbuf.plane = i;
     expbuf.flags = O_CLOEXEC | O_RDWR;
 
-    ret = ioctl (self->fd, VIDIOC_EXPBUF, &expbuf);
+    ret = xioctl (self->fd, VIDIOC_EXPBUF, &expbuf);
     if (ret < 0) {
       GST_ERROR_OBJECT (self,
           "Failed to export dmabuf for %s (index:%d, plane:%d) errno=%d",
@@ -0,0 +1,141 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "vspfilterstats.h"
+
+static const gchar *stage_names[VSPFILTER_N_STAGES] = {
+  "prepare", "queue", "wait", "dequeue", "acquire", "staging"
+};
+
+static const gchar *counter_names[VSPFILTER_N_COUNTERS] = {
+  "frames", "copies", "timeouts"
+};
+
+/* Log-linear buckets: the power of two of the value selects a group of
+ * sub-buckets, the next bits below the leading one select the sub-bucket */
+static guint
+bucket_of (guint64 usec)
+{
+  guint msb, sub;
+
+  if (usec < VSPFILTER_STATS_SUB_BUCKETS)
+    return usec;
+
+  usec = MIN (usec, G_MAXUINT32);
+  msb = g_bit_nth_msf (usec, -1);
+  sub = (usec >> (msb - 3)) & (VSPFILTER_STATS_SUB_BUCKETS - 1);
+
+  return MIN ((msb - 2) * VSPFILTER_STATS_SUB_BUCKETS + sub,
+      VSPFILTER_STATS_N_BUCKETS - 1);
+}
+
+/* Upper bound of the values falling into a bucket */
+static guint64
+bucket_limit (guint bucket)
+{
+  guint msb, sub;
+
+  if (bucket < VSPFILTER_STATS_SUB_BUCKETS)
+    return bucket;
+
+  msb = bucket / VSPFILTER_STATS_SUB_BUCKETS + 2;
+  sub = bucket % VSPFILTER_STATS_SUB_BUCKETS;
+
+  return ((guint64) (VSPFILTER_STATS_SUB_BUCKETS + sub + 1) << (msb - 3)) - 1;
+}
+
+void
+vspfilter_stats_reset (VspfilterStats * stats)
+{
+  memset ((gpointer) stats, 0, sizeof (*stats));
+}
+
+void
+vspfilter_stats_record (VspfilterStats * stats, VspfilterStage stage,
+    gint64 usec)
+{
+  g_atomic_int_inc (&stats->buckets[stage][bucket_of (MAX (usec, 0))]);
+}
+
+void
+vspfilter_stats_count (VspfilterStats * stats, VspfilterCounter counter)
+{
+  g_atomic_int_inc (&stats->counters[counter]);
+}
+
+static guint64
+percentile (const gint * buckets, guint samples, guint pct)
+{
+  guint64 rank, seen = 0;
+  guint i;
+
+  if (samples == 0)
+    return 0;
+
+  rank = ((guint64) samples * pct + 99) / 100;
+  for (i = 0; i < VSPFILTER_STATS_N_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen >= rank)
+      return bucket_limit (i);
+  }
+
+  return bucket_limit (VSPFILTER_STATS_N_BUCKETS - 1);
+}
+
+/* Returns a snapshot. Percentiles are in microseconds, rounded up to the
+ * bucket resolution of 1/8 of a power of two. */
+GstStructure *
+vspfilter_stats_to_structure (VspfilterStats * stats)
+{
+  gint buckets[VSPFILTER_STATS_N_BUCKETS];
+  GstStructure *s;
+  gchar name[32];
+  guint samples;
+  guint i, j;
+
+  s = gst_structure_new_empty ("vspfilter-stats");
+
+  for (i = 0; i < VSPFILTER_N_COUNTERS; i++)
+    gst_structure_set (s, counter_names[i], G_TYPE_UINT,
+        (guint) g_atomic_int_get (&stats->counters[i]), NULL);
+
+  for (i = 0; i < VSPFILTER_N_STAGES; i++) {
+    samples = 0;
+    for (j = 0; j < VSPFILTER_STATS_N_BUCKETS; j++) {
+      buckets[j] = g_atomic_int_get (&stats->buckets[i][j]);
+      samples += buckets[j];
+    }
+
+    g_snprintf (name, sizeof (name), "%s-count", stage_names[i]);
+    gst_structure_set (s, name, G_TYPE_UINT, samples, NULL);
+    g_snprintf (name, sizeof (name), "%s-p50", stage_names[i]);
+    gst_structure_set (s, name, G_TYPE_UINT64,
+        percentile (buckets, samples, 50), NULL);
+    g_snprintf (name, sizeof (name), "%s-p95", stage_names[i]);
+    gst_structure_set (s, name, G_TYPE_UINT64,
+        percentile (buckets, samples, 95), NULL);
+    g_snprintf (name, sizeof (name), "%s-p99", stage_names[i]);
+    gst_structure_set (s, name, G_TYPE_UINT64,
+        percentile (buckets, samples, 99), NULL);
+  }
+
+  return s;
+}
@@ -0,0 +1,61 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_VSPFILTER_STATS_H__
+#define __GST_VSPFILTER_STATS_H__
+
+#include <gst/gst.h>
+
+typedef enum {
+  VSPFILTER_STAGE_PREPARE,      /* mapping or copying the buffers */
+  VSPFILTER_STAGE_QUEUE,        /* VIDIOC_QBUF */
+  VSPFILTER_STAGE_WAIT,         /* waiting for the hardware in select() */
+  VSPFILTER_STAGE_DEQUEUE,      /* VIDIOC_DQBUF */
+  VSPFILTER_STAGE_ACQUIRE,      /* acquiring an output buffer */
+  VSPFILTER_STAGE_STAGING,      /* acquiring a buffer to copy the input to,
+                                 * not part of PREPARE */
+  VSPFILTER_N_STAGES
+} VspfilterStage;
+
+typedef enum {
+  VSPFILTER_COUNTER_FRAMES,
+  VSPFILTER_COUNTER_COPIES,
+  VSPFILTER_COUNTER_TIMEOUTS,
+  VSPFILTER_N_COUNTERS
+} VspfilterCounter;
+
+/* 8 buckets per power of two of microseconds, up to about 268 seconds */
+#define VSPFILTER_STATS_SUB_BUCKETS 8
+#define VSPFILTER_STATS_N_BUCKETS (26 * VSPFILTER_STATS_SUB_BUCKETS)
+
+typedef struct _VspfilterStats VspfilterStats;
+
+/* Updated with atomic operations only, so any thread may record */
+struct _VspfilterStats {
+  volatile gint buckets[VSPFILTER_N_STAGES][VSPFILTER_STATS_N_BUCKETS];
+  volatile gint counters[VSPFILTER_N_COUNTERS];
+};
+
+void vspfilter_stats_reset (VspfilterStats * stats);
+void vspfilter_stats_record (VspfilterStats * stats, VspfilterStage stage,
+    gint64 usec);
+void vspfilter_stats_count (VspfilterStats * stats, VspfilterCounter counter);
+GstStructure * vspfilter_stats_to_structure (VspfilterStats * stats);
+
+#endif /*__GST_VSPFILTER_STATS_H__*/
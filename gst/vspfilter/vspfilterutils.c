@@ -17,10 +17,16 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/v4l2-subdev.h>
 
 #include "vspfilterutils.h"
+#include "vspfilterdevice.h"
 
 GST_DEBUG_CATEGORY_EXTERN (vspfilter_debug);
 #define GST_CAT_DEFAULT vspfilter_debug
@@ -165,6 +171,14 @@ round_up_height (const GstVideoFormatInfo *finfo, guint height)
     return height;
 }
 
+/* The output sizes the UDS can scale input to, as the driver clamps them */
+void
+uds_output_limits (guint input, guint * minimum, guint * maximum)
+{
+  *minimum = MAX ((guint64) input * 4096 / UDS_MAX_FACTOR, 1);
+  *maximum = (guint64) input * 4096 / UDS_MIN_FACTOR;
+}
+
 gint
 set_colorspace (GstVideoFormat vid_fmt, guint * fourcc,
     enum v4l2_mbus_pixelcode *code, guint * n_planes)
@@ -187,13 +201,27 @@ set_colorspace (GstVideoFormat vid_fmt, guint * fourcc,
   return -1;
 }
 
+GstVideoFormat
+get_video_format (guint fourcc)
+{
+  int nr_exts = sizeof (exts) / sizeof (exts[0]);
+  int i;
+
+  for (i = 0; i < nr_exts; i++) {
+    if (fourcc == exts[i].fourcc)
+      return exts[i].format;
+  }
+
+  return GST_VIDEO_FORMAT_UNKNOWN;
+}
+
 gint
 xioctl (gint fd, gint request, void *arg)
 {
   int r;
 
   do
-    r = ioctl (fd, request, arg);
+    r = vspfilter_device_ioctl (fd, request, arg);
   while (-1 == r && EINTR == errno);
 
   return r;
@@ -289,3 +317,292 @@ set_format (gint fd, guint width, guint height, guint format,
 
   return TRUE;
 }
+
+/*
+ * VIDIOC_TRY_FMT results never change for a given device, so they are
+ * cached for the whole process and shared by every element instance.
+ * Devices are told apart by their device number, not by the fd.
+ */
+struct try_format_key
+{
+  dev_t rdev;
+  enum v4l2_buf_type buftype;
+  guint format;
+  guint width;
+  guint height;
+};
+
+struct try_format_entry
+{
+  struct try_format_key key;
+  gboolean supported;
+  struct v4l2_pix_format_mplane result;
+  guint hits;
+};
+
+static GHashTable *try_format_cache;
+static guint try_format_misses;
+G_LOCK_DEFINE_STATIC (try_format_cache);
+
+static guint
+try_format_key_hash (gconstpointer data)
+{
+  const struct try_format_key *key = data;
+
+  return (guint) key->rdev ^ (key->buftype << 28) ^ key->format ^
+      (key->width << 16) ^ key->height;
+}
+
+static gboolean
+try_format_key_equal (gconstpointer a, gconstpointer b)
+{
+  const struct try_format_key *ka = a, *kb = b;
+
+  return ka->rdev == kb->rdev && ka->buftype == kb->buftype &&
+      ka->format == kb->format && ka->width == kb->width &&
+      ka->height == kb->height;
+}
+
+gboolean
+try_format (gint fd, guint width, guint height, guint format,
+    enum v4l2_buf_type buftype, struct v4l2_pix_format_mplane *result)
+{
+  struct try_format_entry *entry;
+  struct try_format_key key;
+  struct v4l2_format fmt;
+  struct stat st;
+  gboolean supported;
+
+  if (vspfilter_device_fstat (fd, &st) < 0)
+    return FALSE;
+
+  CLEAR (key);
+  key.rdev = st.st_rdev;
+  key.buftype = buftype;
+  key.format = format;
+  key.width = width;
+  key.height = height;
+
+  G_LOCK (try_format_cache);
+  if (!try_format_cache)
+    try_format_cache = g_hash_table_new_full (try_format_key_hash,
+        try_format_key_equal, NULL, g_free);
+
+  entry = g_hash_table_lookup (try_format_cache, &key);
+  if (entry) {
+    entry->hits++;
+    supported = entry->supported;
+    if (result)
+      *result = entry->result;
+    G_UNLOCK (try_format_cache);
+    return supported;
+  }
+  G_UNLOCK (try_format_cache);
+
+  CLEAR (fmt);
+  fmt.type = buftype;
+  fmt.fmt.pix_mp.width = width;
+  fmt.fmt.pix_mp.height = height;
+  fmt.fmt.pix_mp.pixelformat = format;
+  fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+
+  if (-1 == xioctl (fd, VIDIOC_TRY_FMT, &fmt)) {
+    /* anything but a rejected format may be transient */
+    if (errno != EINVAL)
+      return FALSE;
+    supported = FALSE;
+  } else {
+    supported = TRUE;
+  }
+
+  if (result)
+    *result = fmt.fmt.pix_mp;
+
+  entry = g_new0 (struct try_format_entry, 1);
+  entry->key = key;
+  entry->supported = supported;
+  entry->result = fmt.fmt.pix_mp;
+
+  /* another thread may have tried the same format meanwhile */
+  G_LOCK (try_format_cache);
+  try_format_misses++;
+  g_hash_table_replace (try_format_cache, &entry->key, entry);
+  G_UNLOCK (try_format_cache);
+
+  return supported;
+}
+
+/* Sets the format of a pad of a subdev, without a colorspace of its own */
+gboolean
+set_subdev_format (gint fd, guint pad, guint width, guint height, guint code)
+{
+  struct v4l2_subdev_format sfmt;
+
+  CLEAR (sfmt);
+
+  sfmt.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+  sfmt.pad = pad;
+  sfmt.format.width = width;
+  sfmt.format.height = height;
+  sfmt.format.code = code;
+  sfmt.format.field = V4L2_FIELD_NONE;
+  sfmt.format.colorspace = V4L2_COLORSPACE_SRGB;
+
+  if (-1 == xioctl (fd, VIDIOC_SUBDEV_S_FMT, &sfmt)) {
+    GST_WARNING ("VIDIOC_SUBDEV_S_FMT for pad %u errno=%d", pad, errno);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Sets the crop or the compose rectangle of a pad of a subdev, which is
+ * updated with the one the subdev has taken */
+gboolean
+set_subdev_selection (gint fd, guint pad, guint target, guint flags,
+    GstVideoRectangle * rect)
+{
+  struct v4l2_subdev_selection sel;
+
+  CLEAR (sel);
+
+  sel.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+  sel.pad = pad;
+  sel.target = target;
+  sel.flags = flags;
+  sel.r.left = rect->x;
+  sel.r.top = rect->y;
+  sel.r.width = rect->w;
+  sel.r.height = rect->h;
+
+  if (-1 == xioctl (fd, VIDIOC_SUBDEV_S_SELECTION, &sel)) {
+    GST_WARNING ("VIDIOC_SUBDEV_S_SELECTION 0x%x for pad %u errno=%d",
+        target, pad, errno);
+    return FALSE;
+  }
+
+  rect->x = sel.r.left;
+  rect->y = sel.r.top;
+  rect->w = sel.r.width;
+  rect->h = sel.r.height;
+
+  return TRUE;
+}
+
+void
+dump_try_format_cache (void)
+{
+  GHashTableIter iter;
+  struct try_format_entry *entry;
+
+  G_LOCK (try_format_cache);
+  if (!try_format_cache) {
+    G_UNLOCK (try_format_cache);
+    return;
+  }
+
+  GST_INFO ("TRY_FMT cache: %u entries, %u ioctls",
+      g_hash_table_size (try_format_cache), try_format_misses);
+
+  g_hash_table_iter_init (&iter, try_format_cache);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & entry)) {
+    GST_INFO ("  dev %u:%u %s %" GST_FOURCC_FORMAT " %ux%u -> %s %ux%u "
+        "(%u hits)", major (entry->key.rdev), minor (entry->key.rdev),
+        buftype_str (entry->key.buftype),
+        GST_FOURCC_ARGS (entry->key.format), entry->key.width,
+        entry->key.height, entry->supported ? "ok" : "rejected",
+        entry->result.width, entry->result.height, entry->hits);
+  }
+  G_UNLOCK (try_format_cache);
+}
+
+static inline guint32
+rgb_entry (gdouble r, gdouble g, gdouble b)
+{
+  return ((guint32) (CLAMP (r, 0.0, 1.0) * 255.0 + 0.5) << 16) |
+      ((guint32) (CLAMP (g, 0.0, 1.0) * 255.0 + 0.5) << 8) |
+      (guint32) (CLAMP (b, 0.0, 1.0) * 255.0 + 0.5);
+}
+
+/* Fills the LUT table with a curve doing the gamma, then the contrast
+ * around the middle level and the brightness, on the three components */
+void
+fill_lut_table (guint32 * table, gdouble gamma, gdouble brightness,
+    gdouble contrast)
+{
+  gdouble v;
+  guint i;
+
+  for (i = 0; i < LUT_SIZE; i++) {
+    v = pow (i / (gdouble) (LUT_SIZE - 1), 1.0 / gamma);
+    v = (v - 0.5) * contrast + 0.5 + brightness;
+    table[i] = rgb_entry (v, v, v);
+  }
+}
+
+/* Loads the 3D table of the CLU from a .cube file of CLU_POINTS points a
+ * side, whose red index changes the fastest as in the table. The domain
+ * is taken to be the default 0 to 1. */
+gboolean
+load_clu_table (const gchar * filename, guint32 * table)
+{
+  gchar *contents, *line, *end;
+  gchar **lines;
+  gdouble rgb[3];
+  guint size = 0, n = 0, i, k;
+  gboolean ret = FALSE;
+
+  if (!g_file_get_contents (filename, &contents, NULL, NULL)) {
+    GST_WARNING ("cannot read %s", filename);
+    return FALSE;
+  }
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (i = 0; lines[i]; i++) {
+    line = g_strstrip (lines[i]);
+    if (line[0] == '\0' || line[0] == '#')
+      continue;
+
+    /* TITLE, DOMAIN_MIN and DOMAIN_MAX are left alone */
+    if (g_ascii_isalpha (line[0])) {
+      if (g_str_has_prefix (line, "LUT_3D_SIZE"))
+        size = atoi (line + strlen ("LUT_3D_SIZE"));
+      else if (g_str_has_prefix (line, "LUT_1D_SIZE"))
+        goto bad_size;
+      continue;
+    }
+
+    if (n == CLU_SIZE)
+      goto bad_size;
+    for (k = 0; k < 3; k++) {
+      rgb[k] = g_ascii_strtod (line, &end);
+      if (end == line)
+        goto bad_line;
+      line = end;
+    }
+    table[n++] = rgb_entry (rgb[0], rgb[1], rgb[2]);
+  }
+
+  if (size != CLU_POINTS || n != CLU_SIZE)
+    goto bad_size;
+  ret = TRUE;
+
+done:
+  g_strfreev (lines);
+
+  return ret;
+
+  /* ERRORS */
+bad_size:
+  {
+    GST_WARNING ("%s is not a 3D LUT of %u points a side", filename,
+        CLU_POINTS);
+    goto done;
+  }
+bad_line:
+  {
+    GST_WARNING ("%s: invalid line %u", filename, i + 1);
+    goto done;
+  }
+}
@@ -33,6 +33,36 @@ struct colorimetry
 
 #define CLEAR(x) memset (&(x), 0, sizeof (x))
 
+/* input to output size ratios the UDS takes, in 4.12 fixed point */
+#define UDS_MIN_FACTOR 0x0100
+#define UDS_MAX_FACTOR 0xffff
+
+/* entries of the LUT table and points on each side of the 3D table of the
+ * CLU, 24 bit RGB values with red in the high bits */
+#define LUT_SIZE 256
+#define CLU_POINTS 17
+#define CLU_SIZE (CLU_POINTS * CLU_POINTS * CLU_POINTS)
+
+/* controls of the vsp1 driver, which are not in the uapi headers */
+#ifndef V4L2_CID_VSP1_LUT_TABLE
+#define V4L2_CID_VSP1_LUT_TABLE (V4L2_CID_USER_BASE | 0x1001)
+#endif
+#ifndef V4L2_CID_VSP1_CLU_TABLE
+#define V4L2_CID_VSP1_CLU_TABLE (V4L2_CID_USER_BASE | 0x1001)
+#define V4L2_CID_VSP1_CLU_MODE (V4L2_CID_USER_BASE | 0x1002)
+#define V4L2_CID_VSP1_CLU_MODE_2D 0
+#define V4L2_CID_VSP1_CLU_MODE_3D 1
+#endif
+#ifndef V4L2_CID_VSP1_HGO_MAX_RGB
+#define V4L2_CID_VSP1_HGO_MAX_RGB (V4L2_CID_USER_BASE | 0x1001)
+#define V4L2_CID_VSP1_HGO_NUM_BINS (V4L2_CID_USER_BASE | 0x1002)
+#endif
+
+/* buffer of the HGO histogram node in 256 bins mode: the maximum and the
+ * minimum, the sum and the bins, 32 bit each */
+#define HGO_NUM_BINS 256
+#define HGO_DATA_SIZE ((2 + HGO_NUM_BINS) * 4)
+
 static inline const gchar *
 buftype_str (enum v4l2_buf_type buftype)
 {
@@ -40,6 +70,8 @@ buftype_str (enum v4l2_buf_type buftype)
     return "output";
   if (buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
     return "capture";
+  if (buftype == V4L2_BUF_TYPE_META_CAPTURE)
+    return "histogram";
 
   return "unknown";
 }
@@ -52,8 +84,10 @@ guint round_down_width (const GstVideoFormatInfo *finfo, guint width);
 guint round_down_height (const GstVideoFormatInfo *finfo, guint height);
 guint round_up_width (const GstVideoFormatInfo *finfo, guint width);
 guint round_up_height (const GstVideoFormatInfo *finfo, guint height);
+void uds_output_limits (guint input, guint * minimum, guint * maximum);
 gint set_colorspace (GstVideoFormat vid_fmt, guint * fourcc,
     enum v4l2_mbus_pixelcode * code, guint * n_planes);
+GstVideoFormat get_video_format (guint fourcc);
 gint xioctl (gint fd, gint request, void * arg);
 gboolean set_format (gint fd, guint width, guint height, guint format,
     gint stride[GST_VIDEO_MAX_PLANES], enum v4l2_buf_type buftype,
@@ -61,5 +95,15 @@ gboolean set_format (gint fd, guint width, guint height, guint format,
     enum v4l2_quantization quant);
 gboolean request_buffers (gint fd, enum v4l2_buf_type buftype, guint * n_bufs,
     enum v4l2_memory io);
+gboolean try_format (gint fd, guint width, guint height, guint format,
+    enum v4l2_buf_type buftype, struct v4l2_pix_format_mplane *result);
+gboolean set_subdev_format (gint fd, guint pad, guint width, guint height,
+    guint code);
+gboolean set_subdev_selection (gint fd, guint pad, guint target, guint flags,
+    GstVideoRectangle * rect);
+void dump_try_format_cache (void);
+void fill_lut_table (guint32 * table, gdouble gamma, gdouble brightness,
+    gdouble contrast);
+gboolean load_clu_table (const gchar * filename, guint32 * table);
 
 #endif /*__GST_VSPFILTER_UTILS_H__*/
@@ -0,0 +1,2501 @@
+/* GStreamer
+ * Copyright (C) 2018 Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/media.h>
+#include <linux/v4l2-subdev.h>
+#include <linux/videodev2.h>
+
+#include <gst/video/video.h>
+
+#include "vspfiltervirtual.h"
+#include "vspfilterutils.h"
+
+GST_DEBUG_CATEGORY_EXTERN (vspfilter_debug);
+#define GST_CAT_DEFAULT vspfilter_debug
+
+/*
+ * A software emulation of VSP devices, selected with
+ * GST_VSP_FILTER_BACKEND=virtual.
+ *
+ * VIRTUAL_MAX_VSPS instances named vvspN are emulated, each with five
+ * RPFs, a UDS, a LUT, a CLU, a BRU, an HGO and a WPF entity linked like
+ * on the hardware:
+ *
+ *   /dev/video(2N)             "vvspN rpf.0 input"   output queue
+ *   /dev/video(2N+1)           "vvspN wpf.0 output"  capture queue
+ *   /dev/video(2M+N)           "vvspN rpf.1 input"   input queue
+ *   /dev/video(3M+N)           "vvspN hgo histo"     histogram queue
+ *   /dev/video(4M+3N+K-2)      "vvspN rpf.K input"   input queue, K=2..4
+ *   /dev/v4l-subdev(3N)        "vvspN rpf.0"
+ *   /dev/v4l-subdev(3N+1)      "vvspN uds.0"
+ *   /dev/v4l-subdev(3N+2)      "vvspN wpf.0"
+ *   /dev/v4l-subdev(3M+2N)     "vvspN rpf.1"
+ *   /dev/v4l-subdev(3M+2N+1)   "vvspN bru"
+ *   /dev/v4l-subdev(5M+2N)     "vvspN lut"
+ *   /dev/v4l-subdev(5M+2N+1)   "vvspN clu"
+ *   /dev/v4l-subdev(7M+N)      "vvspN hgo"
+ *   /dev/v4l-subdev(8M+3N+K-2) "vvspN rpf.K", K=2..4
+ *   /dev/mediaN
+ *
+ * where M is VIRTUAL_MAX_VSPS.
+ *
+ * Device nodes are backed by descriptors of /dev/null, so they are real
+ * file descriptors for the rest of the plugin. Queued frame pairs are
+ * converted and scaled with GstVideoConverter on one worker thread per
+ * VSP, which completes them asynchronously as the hardware does.
+ *
+ * The WPF has the V4L2_CID_HFLIP, V4L2_CID_VFLIP and V4L2_CID_ROTATE
+ * controls. It flips the picture first and then rotates it clockwise.
+ *
+ * The picture of rpf.0 goes to the first sink pad of the BRU, and the
+ * other RPFs to any of the other four. The BRU fills its output with the
+ * color of its V4L2_CID_BG_COLOR control, in the format of the pipeline
+ * (0xRRGGBB, or 0xVVYYUU in YUV), and blends its inputs over it from the first pad up, each at the compose
+ * rectangle of its pad and with its alpha, before the WPF. An RPF reads
+ * its frames through its crop, and gives those of a format without alpha
+ * the one of its V4L2_CID_ALPHA_COMPONENT control.
+ *
+ * The LUT looks the components of the picture up in the table of its
+ * V4L2_CID_VSP1_LUT_TABLE control, and the CLU in the 3D table of its
+ * V4L2_CID_VSP1_CLU_TABLE control, interpolating between the points. The
+ * picture goes through the LUT before the CLU when both are linked.
+ *
+ * The HGO counts the picture out of the LUT and the CLU, before the BRU,
+ * in the 256 bins of a V4L2_META_FMT_VSP1_HGO buffer of its histogram
+ * queue, which only takes userptr buffers. Like on the hardware, a frame
+ * does not wait for a histogram buffer.
+ */
+
+#define VIRTUAL_MAX_VSPS 4
+#define VIRTUAL_RPFS 5
+#define VIRTUAL_MAX_SIZE 8190
+#define VIRTUAL_DEF_WIDTH 1920
+#define VIRTUAL_DEF_HEIGHT 1080
+
+#define VIRTUAL_VIDEO_MAJOR 81
+#define VIRTUAL_SUBDEV_MINOR_BASE 128
+#define VIRTUAL_MEDIA_MAJOR 238
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+enum
+{
+  ENT_RPF_INPUT,
+  ENT_RPF,
+  ENT_UDS,
+  ENT_WPF,
+  ENT_WPF_OUTPUT,
+  ENT_RPF1_INPUT,
+  ENT_RPF1,
+  ENT_BRU,
+  ENT_LUT,
+  ENT_CLU,
+  ENT_HGO,
+  ENT_HGO_HISTO,
+  ENT_RPF2_INPUT,
+  ENT_RPF2,
+  ENT_RPF3_INPUT,
+  ENT_RPF3,
+  ENT_RPF4_INPUT,
+  ENT_RPF4,
+  N_ENTITIES
+};
+
+/* the BRU has the most pads, the source one last */
+#define BRU_INPUTS 5
+#define MAX_PADS (BRU_INPUTS + 1)
+
+/* media entity ids start from 1 */
+#define ENTITY_ID(ent) ((ent) + 1)
+
+enum
+{
+  QUEUE_OUT,
+  QUEUE_CAP,
+  QUEUE_RPF1,
+  QUEUE_HGO,
+  QUEUE_RPF2,
+  QUEUE_RPF3,
+  QUEUE_RPF4,
+  N_QUEUES
+};
+
+typedef enum
+{
+  NODE_VIDEO,
+  NODE_SUBDEV,
+  NODE_MEDIA
+} VirtualNodeType;
+
+static const struct
+{
+  const gchar *name;
+  guint32 type;
+  guint16 pads;
+} entities[N_ENTITIES] = {
+  {"rpf.0 input", MEDIA_ENT_T_DEVNODE_V4L, 1},
+  {"rpf.0", MEDIA_ENT_T_V4L2_SUBDEV, 2},
+  {"uds.0", MEDIA_ENT_T_V4L2_SUBDEV, 2},
+  {"wpf.0", MEDIA_ENT_T_V4L2_SUBDEV, 2},
+  {"wpf.0 output", MEDIA_ENT_T_DEVNODE_V4L, 1},
+  {"rpf.1 input", MEDIA_ENT_T_DEVNODE_V4L, 1},
+  {"rpf.1", MEDIA_ENT_T_V4L2_SUBDEV, 2},
+  {"bru", MEDIA_ENT_T_V4L2_SUBDEV, MAX_PADS},
+  {"lut", MEDIA_ENT_T_V4L2_SUBDEV, 2},
+  {"clu", MEDIA_ENT_T_V4L2_SUBDEV, 2},
+  {"hgo", MEDIA_ENT_T_V4L2_SUBDEV, 2},
+  {"hgo histo", MEDIA_ENT_T_DEVNODE_V4L, 1},
+  {"rpf.2 input", MEDIA_ENT_T_DEVNODE_V4L, 1},
+  {"rpf.2", MEDIA_ENT_T_V4L2_SUBDEV, 2},
+  {"rpf.3 input", MEDIA_ENT_T_DEVNODE_V4L, 1},
+  {"rpf.3", MEDIA_ENT_T_V4L2_SUBDEV, 2},
+  {"rpf.4 input", MEDIA_ENT_T_DEVNODE_V4L, 1},
+  {"rpf.4", MEDIA_ENT_T_V4L2_SUBDEV, 2},
+};
+
+/* the RPFs, their input nodes and the queues of these by index */
+static const guint rpf_entity[VIRTUAL_RPFS] =
+    { ENT_RPF, ENT_RPF1, ENT_RPF2, ENT_RPF3, ENT_RPF4 };
+static const guint rpf_input[VIRTUAL_RPFS] =
+    { ENT_RPF_INPUT, ENT_RPF1_INPUT, ENT_RPF2_INPUT, ENT_RPF3_INPUT,
+  ENT_RPF4_INPUT
+};
+static const guint rpf_queue[VIRTUAL_RPFS] =
+    { QUEUE_OUT, QUEUE_RPF1, QUEUE_RPF2, QUEUE_RPF3, QUEUE_RPF4 };
+
+/* a source linked to every sink pad of the BRU */
+#define BRU_LINKS(ent) \
+  {ent, 1, ENT_BRU, 0, 0}, \
+  {ent, 1, ENT_BRU, 1, 0}, \
+  {ent, 1, ENT_BRU, 2, 0}, \
+  {ent, 1, ENT_BRU, 3, 0}, \
+  {ent, 1, ENT_BRU, 4, 0}
+
+static const struct
+{
+  guint source, source_pad;
+  guint sink, sink_pad;
+  guint32 flags;
+} links[] = {
+  {ENT_RPF_INPUT, 0, ENT_RPF, 0, MEDIA_LNK_FL_IMMUTABLE | MEDIA_LNK_FL_ENABLED},
+  {ENT_RPF, 1, ENT_UDS, 0, 0},
+  {ENT_RPF, 1, ENT_WPF, 0, 0},
+  {ENT_UDS, 1, ENT_WPF, 0, 0},
+  {ENT_WPF, 1, ENT_WPF_OUTPUT, 0, MEDIA_LNK_FL_IMMUTABLE | MEDIA_LNK_FL_ENABLED},
+  {ENT_RPF1_INPUT, 0, ENT_RPF1, 0,
+      MEDIA_LNK_FL_IMMUTABLE | MEDIA_LNK_FL_ENABLED},
+  {ENT_RPF1, 1, ENT_UDS, 0, 0},
+  {ENT_RPF1, 1, ENT_WPF, 0, 0},
+  BRU_LINKS (ENT_RPF),
+  BRU_LINKS (ENT_RPF1),
+  BRU_LINKS (ENT_UDS),
+  {ENT_BRU, BRU_INPUTS, ENT_WPF, 0, 0},
+  {ENT_RPF, 1, ENT_LUT, 0, 0},
+  {ENT_UDS, 1, ENT_LUT, 0, 0},
+  {ENT_LUT, 1, ENT_CLU, 0, 0},
+  {ENT_LUT, 1, ENT_BRU, 0, 0},
+  {ENT_LUT, 1, ENT_WPF, 0, 0},
+  {ENT_RPF, 1, ENT_CLU, 0, 0},
+  {ENT_UDS, 1, ENT_CLU, 0, 0},
+  {ENT_CLU, 1, ENT_BRU, 0, 0},
+  {ENT_CLU, 1, ENT_WPF, 0, 0},
+  {ENT_RPF, 1, ENT_HGO, 0, 0},
+  {ENT_UDS, 1, ENT_HGO, 0, 0},
+  {ENT_LUT, 1, ENT_HGO, 0, 0},
+  {ENT_CLU, 1, ENT_HGO, 0, 0},
+  {ENT_HGO, 1, ENT_HGO_HISTO, 0,
+      MEDIA_LNK_FL_IMMUTABLE | MEDIA_LNK_FL_ENABLED},
+  {ENT_RPF2_INPUT, 0, ENT_RPF2, 0,
+      MEDIA_LNK_FL_IMMUTABLE | MEDIA_LNK_FL_ENABLED},
+  {ENT_RPF3_INPUT, 0, ENT_RPF3, 0,
+      MEDIA_LNK_FL_IMMUTABLE | MEDIA_LNK_FL_ENABLED},
+  {ENT_RPF4_INPUT, 0, ENT_RPF4, 0,
+      MEDIA_LNK_FL_IMMUTABLE | MEDIA_LNK_FL_ENABLED},
+  BRU_LINKS (ENT_RPF2),
+  BRU_LINKS (ENT_RPF3),
+  BRU_LINKS (ENT_RPF4),
+};
+
+#define N_LINKS G_N_ELEMENTS (links)
+
+typedef enum
+{
+  BUF_DEQUEUED,
+  BUF_QUEUED,
+  BUF_DONE
+} VirtualBufferState;
+
+typedef struct
+{
+  VirtualBufferState state;
+  struct
+  {
+    guint8 *data;               /* start of the image */
+    gpointer map;               /* mapping owned by the buffer */
+    gsize map_size;
+    gint fd;                    /* memory of an MMAP buffer */
+    struct v4l2_plane queued;   /* as passed to VIDIOC_QBUF */
+  } planes[VIDEO_MAX_PLANES];
+} VirtualBuffer;
+
+typedef struct
+{
+  enum v4l2_buf_type buftype;
+  struct v4l2_pix_format_mplane fmt;
+  enum v4l2_memory memory;
+  guint n_buffers;
+  VirtualBuffer buffers[VIDEO_MAX_FRAME];
+  GQueue queued;
+  GQueue done;
+  gboolean streaming;
+  guint32 sequence;
+} VirtualQueue;
+
+typedef struct
+{
+  gchar name[16];
+
+  GMutex lock;
+  GCond cond;
+
+  guint32 link_flags[N_LINKS];
+  struct v4l2_mbus_framefmt pad_fmt[N_ENTITIES][MAX_PADS];
+  /* the crops and the V4L2_CID_ALPHA_COMPONENT controls of the RPFs */
+  struct v4l2_rect crop[VIRTUAL_RPFS];
+  gint32 alpha[VIRTUAL_RPFS];
+  /* places of the BRU inputs in its output, and its background */
+  struct v4l2_rect compose[BRU_INPUTS];
+  gint32 bg_color;
+  gint32 hflip;
+  gint32 vflip;
+  gint32 rotate;
+  /* tables of the LUT and the CLU controls */
+  guint32 lut[LUT_SIZE];
+  guint32 clu[CLU_SIZE];
+  gint32 clu_mode;
+  /* controls of the HGO, of which only 256 bins are emulated */
+  gint32 hgo_max_rgb;
+  gint32 hgo_num_bins;
+
+  VirtualQueue queues[N_QUEUES];
+
+  GThreadPool *worker;
+  gboolean scheduled;
+  gboolean busy;
+
+  /* only used by the worker, the second converter and the frames are
+   * for flipped, rotated or blended frames, the picture data for the
+   * first input of the BRU, and the converter after them and the input
+   * data for each of its other inputs */
+  GstVideoConverter *converter[MAX_PADS];
+  GstVideoInfo conv_in[MAX_PADS];
+  GstVideoInfo conv_out[MAX_PADS];
+  guint8 *turn_data[2];
+  gsize turn_size;
+  guint8 *picture_data;
+  gsize picture_size;
+  guint8 *input_data;
+  gsize input_size;
+} VirtualVsp;
+
+#define SWAPS_SIZE(rotate) ((rotate) == 90 || (rotate) == 270)
+
+/* The way of the picture of rpf.0 to the WPF */
+typedef struct
+{
+  gboolean scaled;              /* by the UDS */
+  gboolean lut;
+  gboolean clu;
+  gboolean mixed;               /* through the BRU */
+  /* the RPFs blended over it by BRU sink pad, 0 for none */
+  guint layers[BRU_INPUTS];
+  gboolean rgb;                 /* out of the RPF in RGB */
+  gboolean histogram;           /* counted by the HGO */
+} VirtualRoute;
+
+/* An input of the BRU other than the picture: the frame read through the
+ * crop of its RPF */
+typedef struct
+{
+  GstVideoFrame frame;
+  struct v4l2_rect compose;
+  gint32 alpha;
+} VirtualLayer;
+
+/* A frame taken off the queues with the VSP lock held, and the controls
+ * it is processed with. The first layer only places the picture. */
+typedef struct
+{
+  VirtualRoute route;
+  guint index[N_QUEUES];
+  GstVideoFrame src;
+  GstVideoFrame dest;
+  guint picture_width;
+  guint picture_height;
+  VirtualLayer layers[BRU_INPUTS];
+  guint32 bg_color;
+  gint32 hflip;
+  gint32 vflip;
+  gint32 rotate;
+  gint32 max_rgb;
+  guint32 *histogram;
+} VirtualJob;
+
+typedef struct
+{
+  VirtualNodeType type;
+  VirtualVsp *vsp;
+  guint entity;
+} VirtualFile;
+
+static VirtualVsp *vsps[VIRTUAL_MAX_VSPS];
+/* fd -> VirtualFile */
+static GHashTable *files;
+G_LOCK_DEFINE_STATIC (virtual);
+
+static void process_frames (gpointer data, gpointer user_data);
+
+/* Returns the index of an RPF entity or of its input node, -1 for other
+ * entities */
+static gint
+rpf_index (guint entity)
+{
+  guint i;
+
+  for (i = 0; i < VIRTUAL_RPFS; i++) {
+    if (rpf_entity[i] == entity || rpf_input[i] == entity)
+      return i;
+  }
+
+  return -1;
+}
+
+static guint
+plane_height (const GstVideoInfo * info, guint plane)
+{
+  guint i;
+
+  for (i = 0; i < GST_VIDEO_INFO_N_COMPONENTS (info); i++) {
+    if (GST_VIDEO_INFO_COMP_PLANE (info, i) == plane)
+      return GST_VIDEO_INFO_COMP_HEIGHT (info, i);
+  }
+
+  return 0;
+}
+
+/* Adjusts a format the way VIDIOC_TRY_FMT does */
+static void
+adjust_format (struct v4l2_pix_format_mplane *pix)
+{
+  GstVideoFormat format;
+  GstVideoInfo info;
+  guint i;
+
+  format = get_video_format (pix->pixelformat);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+    pix->pixelformat = V4L2_PIX_FMT_YUYV;
+    format = GST_VIDEO_FORMAT_YUY2;
+  }
+
+  pix->width = CLAMP (pix->width, 1, VIRTUAL_MAX_SIZE);
+  pix->height = CLAMP (pix->height, 1, VIRTUAL_MAX_SIZE);
+  pix->width = round_up_width (gst_video_format_get_info (format), pix->width);
+  pix->height =
+      round_up_height (gst_video_format_get_info (format), pix->height);
+  pix->field = V4L2_FIELD_NONE;
+  pix->colorspace = V4L2_COLORSPACE_SRGB;
+
+  gst_video_info_set_format (&info, format, pix->width, pix->height);
+
+  pix->num_planes = GST_VIDEO_INFO_N_PLANES (&info);
+  for (i = 0; i < pix->num_planes; i++) {
+    pix->plane_fmt[i].bytesperline = MAX (pix->plane_fmt[i].bytesperline,
+        GST_VIDEO_INFO_PLANE_STRIDE (&info, i));
+    pix->plane_fmt[i].sizeimage =
+        pix->plane_fmt[i].bytesperline * plane_height (&info, i);
+  }
+}
+
+static VirtualVsp *
+get_vsp (guint index)
+{
+  VirtualVsp *vsp;
+  guint i;
+
+  if (index >= VIRTUAL_MAX_VSPS)
+    return NULL;
+
+  if (vsps[index])
+    return vsps[index];
+
+  vsp = g_new0 (VirtualVsp, 1);
+  snprintf (vsp->name, sizeof (vsp->name), "vvsp%u", index);
+  g_mutex_init (&vsp->lock);
+  g_cond_init (&vsp->cond);
+
+  for (i = 0; i < N_LINKS; i++)
+    vsp->link_flags[i] = links[i].flags;
+
+  /* the LUT and the CLU leave the colors alone until their tables are set */
+  for (i = 0; i < LUT_SIZE; i++)
+    vsp->lut[i] = i << 16 | i << 8 | i;
+  for (i = 0; i < CLU_SIZE; i++)
+    vsp->clu[i] = (i / (CLU_POINTS * CLU_POINTS) * 255 / (CLU_POINTS - 1)) |
+        (i / CLU_POINTS % CLU_POINTS * 255 / (CLU_POINTS - 1)) << 8 |
+        (i % CLU_POINTS * 255 / (CLU_POINTS - 1)) << 16;
+  vsp->clu_mode = V4L2_CID_VSP1_CLU_MODE_3D;
+  vsp->hgo_num_bins = HGO_NUM_BINS;
+  for (i = 0; i < VIRTUAL_RPFS; i++)
+    vsp->alpha[i] = 255;
+
+  for (i = 0; i < N_QUEUES; i++) {
+    VirtualQueue *queue = &vsp->queues[i];
+
+    queue->buftype = (i == QUEUE_CAP) ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+        V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    queue->fmt.width = VIRTUAL_DEF_WIDTH;
+    queue->fmt.height = VIRTUAL_DEF_HEIGHT;
+    queue->fmt.pixelformat = V4L2_PIX_FMT_YUYV;
+    adjust_format (&queue->fmt);
+    /* a histogram is a single plane of HGO_DATA_SIZE bytes */
+    if (i == QUEUE_HGO) {
+      queue->buftype = V4L2_BUF_TYPE_META_CAPTURE;
+      memset (&queue->fmt, 0, sizeof (queue->fmt));
+      queue->fmt.pixelformat = V4L2_META_FMT_VSP1_HGO;
+      queue->fmt.num_planes = 1;
+      queue->fmt.plane_fmt[0].sizeimage = HGO_DATA_SIZE;
+    }
+    g_queue_init (&queue->queued);
+    g_queue_init (&queue->done);
+  }
+
+  vsp->worker = g_thread_pool_new (process_frames, vsp, 1, FALSE, NULL);
+
+  vsps[index] = vsp;
+
+  return vsp;
+}
+
+/* Maps a device path to the node it emulates */
+static gboolean
+parse_path (const gchar * path, VirtualNodeType * type, guint * vsp,
+    guint * entity)
+{
+  guint n;
+  gchar c;
+
+  if (sscanf (path, "/dev/video%u%c", &n, &c) == 1 &&
+      n < 7 * VIRTUAL_MAX_VSPS) {
+    *type = NODE_VIDEO;
+    if (n >= 4 * VIRTUAL_MAX_VSPS) {
+      n -= 4 * VIRTUAL_MAX_VSPS;
+      *vsp = n / 3;
+      *entity = rpf_input[2 + n % 3];
+    } else if (n >= 3 * VIRTUAL_MAX_VSPS) {
+      *vsp = n - 3 * VIRTUAL_MAX_VSPS;
+      *entity = ENT_HGO_HISTO;
+    } else if (n >= 2 * VIRTUAL_MAX_VSPS) {
+      *vsp = n - 2 * VIRTUAL_MAX_VSPS;
+      *entity = ENT_RPF1_INPUT;
+    } else {
+      *vsp = n / 2;
+      *entity = (n % 2) ? ENT_WPF_OUTPUT : ENT_RPF_INPUT;
+    }
+    return TRUE;
+  }
+
+  if (sscanf (path, "/dev/v4l-subdev%u%c", &n, &c) == 1 &&
+      n < 11 * VIRTUAL_MAX_VSPS) {
+    *type = NODE_SUBDEV;
+    if (n >= 8 * VIRTUAL_MAX_VSPS) {
+      n -= 8 * VIRTUAL_MAX_VSPS;
+      *vsp = n / 3;
+      *entity = rpf_entity[2 + n % 3];
+    } else if (n >= 7 * VIRTUAL_MAX_VSPS) {
+      *vsp = n - 7 * VIRTUAL_MAX_VSPS;
+      *entity = ENT_HGO;
+    } else if (n >= 5 * VIRTUAL_MAX_VSPS) {
+      n -= 5 * VIRTUAL_MAX_VSPS;
+      *vsp = n / 2;
+      *entity = (n % 2) ? ENT_CLU : ENT_LUT;
+    } else if (n >= 3 * VIRTUAL_MAX_VSPS) {
+      n -= 3 * VIRTUAL_MAX_VSPS;
+      *vsp = n / 2;
+      *entity = (n % 2) ? ENT_BRU : ENT_RPF1;
+    } else {
+      *vsp = n / 3;
+      *entity = ENT_RPF + n % 3;
+    }
+    return TRUE;
+  }
+
+  if (sscanf (path, "/dev/media%u%c", &n, &c) == 1 && n < VIRTUAL_MAX_VSPS) {
+    *type = NODE_MEDIA;
+    *vsp = n;
+    *entity = 0;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+fill_stat (VirtualNodeType type, guint vsp, guint entity, struct stat *st)
+{
+  memset (st, 0, sizeof (*st));
+  st->st_mode = S_IFCHR | 0660;
+
+  switch (type) {
+    case NODE_VIDEO:
+      if (rpf_index (entity) >= 2)
+        st->st_rdev = makedev (VIRTUAL_VIDEO_MAJOR,
+            4 * VIRTUAL_MAX_VSPS + vsp * 3 + rpf_index (entity) - 2);
+      else if (entity == ENT_HGO_HISTO)
+        st->st_rdev = makedev (VIRTUAL_VIDEO_MAJOR,
+            3 * VIRTUAL_MAX_VSPS + vsp);
+      else if (entity == ENT_RPF1_INPUT)
+        st->st_rdev = makedev (VIRTUAL_VIDEO_MAJOR,
+            2 * VIRTUAL_MAX_VSPS + vsp);
+      else
+        st->st_rdev = makedev (VIRTUAL_VIDEO_MAJOR,
+            vsp * 2 + (entity == ENT_WPF_OUTPUT));
+      break;
+    case NODE_SUBDEV:
+      if (rpf_index (entity) >= 2)
+        st->st_rdev = makedev (VIRTUAL_VIDEO_MAJOR,
+            VIRTUAL_SUBDEV_MINOR_BASE + 8 * VIRTUAL_MAX_VSPS + vsp * 3 +
+            rpf_index (entity) - 2);
+      else if (entity == ENT_HGO)
+        st->st_rdev = makedev (VIRTUAL_VIDEO_MAJOR,
+            VIRTUAL_SUBDEV_MINOR_BASE + 7 * VIRTUAL_MAX_VSPS + vsp);
+      else if (entity == ENT_LUT || entity == ENT_CLU)
+        st->st_rdev = makedev (VIRTUAL_VIDEO_MAJOR,
+            VIRTUAL_SUBDEV_MINOR_BASE + 5 * VIRTUAL_MAX_VSPS + vsp * 2 +
+            (entity == ENT_CLU));
+      else if (entity == ENT_RPF1 || entity == ENT_BRU)
+        st->st_rdev = makedev (VIRTUAL_VIDEO_MAJOR,
+            VIRTUAL_SUBDEV_MINOR_BASE + 3 * VIRTUAL_MAX_VSPS + vsp * 2 +
+            (entity == ENT_BRU));
+      else
+        st->st_rdev = makedev (VIRTUAL_VIDEO_MAJOR,
+            VIRTUAL_SUBDEV_MINOR_BASE + vsp * 3 + entity - ENT_RPF);
+      break;
+    case NODE_MEDIA:
+      st->st_rdev = makedev (VIRTUAL_MEDIA_MAJOR, vsp);
+      break;
+  }
+}
+
+static VirtualFile *
+lookup_file (gint fd)
+{
+  VirtualFile *file = NULL;
+
+  G_LOCK (virtual);
+  if (files)
+    file = g_hash_table_lookup (files, GINT_TO_POINTER (fd));
+  G_UNLOCK (virtual);
+
+  return file;
+}
+
+/* Buffer memory */
+
+static gint
+alloc_memory (gsize size)
+{
+  gchar *name;
+  gint fd = -1;
+
+#ifdef SYS_memfd_create
+  fd = syscall (SYS_memfd_create, "vspfilter-virtual", MFD_CLOEXEC);
+#endif
+  if (fd < 0) {
+    fd = g_file_open_tmp ("vspfilter-virtual-XXXXXX", &name, NULL);
+    if (fd < 0)
+      return -1;
+    unlink (name);
+    g_free (name);
+  }
+
+  if (ftruncate (fd, size) < 0) {
+    close (fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static void
+unmap_buffer (VirtualQueue * queue, VirtualBuffer * buffer)
+{
+  guint i;
+
+  if (queue->memory != V4L2_MEMORY_DMABUF)
+    return;
+
+  for (i = 0; i < queue->fmt.num_planes; i++) {
+    if (buffer->planes[i].map) {
+      munmap (buffer->planes[i].map, buffer->planes[i].map_size);
+      buffer->planes[i].map = NULL;
+    }
+  }
+}
+
+static void
+free_buffers (VirtualQueue * queue)
+{
+  VirtualBuffer *buffer;
+  guint i, j;
+
+  for (i = 0; i < queue->n_buffers; i++) {
+    buffer = &queue->buffers[i];
+    if (queue->memory == V4L2_MEMORY_MMAP) {
+      for (j = 0; j < queue->fmt.num_planes; j++) {
+        if (buffer->planes[j].map)
+          munmap (buffer->planes[j].map, buffer->planes[j].map_size);
+        if (buffer->planes[j].fd >= 0)
+          close (buffer->planes[j].fd);
+      }
+    }
+    memset (buffer, 0, sizeof (*buffer));
+  }
+
+  queue->n_buffers = 0;
+}
+
+static gboolean
+alloc_buffers (VirtualQueue * queue, guint count)
+{
+  VirtualBuffer *buffer;
+  gsize size;
+  guint i, j;
+
+  for (i = 0; i < count; i++) {
+    buffer = &queue->buffers[i];
+    memset (buffer, 0, sizeof (*buffer));
+    for (j = 0; j < VIDEO_MAX_PLANES; j++)
+      buffer->planes[j].fd = -1;
+    queue->n_buffers = i + 1;
+
+    if (queue->memory != V4L2_MEMORY_MMAP)
+      continue;
+
+    for (j = 0; j < queue->fmt.num_planes; j++) {
+      size = queue->fmt.plane_fmt[j].sizeimage;
+      buffer->planes[j].fd = alloc_memory (size);
+      if (buffer->planes[j].fd < 0)
+        goto failed;
+      buffer->planes[j].map = mmap (NULL, size, PROT_READ | PROT_WRITE,
+          MAP_SHARED, buffer->planes[j].fd, 0);
+      if (buffer->planes[j].map == MAP_FAILED) {
+        buffer->planes[j].map = NULL;
+        goto failed;
+      }
+      buffer->planes[j].map_size = size;
+      buffer->planes[j].data = buffer->planes[j].map;
+    }
+  }
+
+  return TRUE;
+
+failed:
+  free_buffers (queue);
+  return FALSE;
+}
+
+/* Frame processing */
+
+/* Returns TRUE if the output of rpf.0 reaches the WPF, following the
+ * enabled links, and fills the route it takes. The HGO reads the picture
+ * on the side of the route, the other RPFs linked to the BRU are blended
+ * over it. */
+static gboolean
+find_route (VirtualVsp * vsp, VirtualRoute * route)
+{
+  guint ent = ENT_RPF, steps, i;
+  gint k;
+
+  memset (route, 0, sizeof (*route));
+  route->rgb = vsp->pad_fmt[ENT_RPF][1].code == V4L2_MBUS_FMT_ARGB8888_1X32;
+
+  for (steps = 0; ent != ENT_WPF && steps < N_ENTITIES; steps++) {
+    for (i = 0; i < N_LINKS; i++) {
+      if ((vsp->link_flags[i] & MEDIA_LNK_FL_ENABLED) &&
+          links[i].source == ent && links[i].sink_pad == 0) {
+        if (links[i].sink != ENT_HGO)
+          break;
+        route->histogram = TRUE;
+      }
+    }
+    if (i == N_LINKS)
+      return FALSE;
+
+    ent = links[i].sink;
+    route->scaled |= ent == ENT_UDS;
+    route->lut |= ent == ENT_LUT;
+    route->clu |= ent == ENT_CLU;
+    route->mixed |= ent == ENT_BRU;
+  }
+
+  for (i = 0; i < N_LINKS && route->mixed; i++) {
+    k = rpf_index (links[i].source);
+    if ((vsp->link_flags[i] & MEDIA_LNK_FL_ENABLED) && k > 0 &&
+        links[i].sink == ENT_BRU && links[i].sink_pad > 0)
+      route->layers[links[i].sink_pad] = k;
+  }
+
+  return ent == ENT_WPF;
+}
+
+/* TRUE if a queue of the VSP is streaming, the pipeline is fixed then */
+static gboolean
+is_streaming (VirtualVsp * vsp)
+{
+  guint i;
+
+  for (i = 0; i < N_QUEUES; i++) {
+    if (vsp->queues[i].streaming)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+queue_colorimetry (const struct v4l2_pix_format_mplane *pix,
+    GstVideoInfo * info)
+{
+  if (!GST_VIDEO_INFO_IS_YUV (info))
+    return;
+
+  if (pix->ycbcr_enc == V4L2_YCBCR_ENC_601)
+    info->colorimetry.matrix = GST_VIDEO_COLOR_MATRIX_BT601;
+  else if (pix->ycbcr_enc == V4L2_YCBCR_ENC_709)
+    info->colorimetry.matrix = GST_VIDEO_COLOR_MATRIX_BT709;
+
+  if (pix->quantization == V4L2_QUANTIZATION_FULL_RANGE)
+    info->colorimetry.range = GST_VIDEO_COLOR_RANGE_0_255;
+  else if (pix->quantization == V4L2_QUANTIZATION_LIM_RANGE)
+    info->colorimetry.range = GST_VIDEO_COLOR_RANGE_16_235;
+}
+
+/* Sets up a frame over the planes of a buffer. Must be called with the
+ * VSP lock held. */
+static void
+setup_frame (VirtualQueue * queue, VirtualBuffer * buffer,
+    const struct v4l2_rect *rect, GstVideoFrame * frame)
+{
+  const struct v4l2_pix_format_mplane *pix = &queue->fmt;
+  const GstVideoFormatInfo *finfo;
+  GstVideoInfo *info = &frame->info;
+  guint i, comp;
+
+  memset (frame, 0, sizeof (*frame));
+
+  gst_video_info_set_format (info, get_video_format (pix->pixelformat),
+      rect->width, rect->height);
+  queue_colorimetry (pix, info);
+  finfo = info->finfo;
+
+  for (i = 0; i < pix->num_planes; i++) {
+    for (comp = 0; GST_VIDEO_FORMAT_INFO_PLANE (finfo, comp) != i; comp++);
+
+    info->stride[i] = pix->plane_fmt[i].bytesperline;
+    info->offset[i] = 0;
+    frame->data[i] = buffer->planes[i].data +
+        GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, comp, rect->top) *
+        info->stride[i] +
+        GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, comp, rect->left) *
+        GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp);
+  }
+}
+
+static void
+convert_frame (VirtualVsp * vsp, guint n, GstVideoFrame * src,
+    GstVideoFrame * dest)
+{
+  if (!vsp->converter[n] ||
+      !gst_video_info_is_equal (&vsp->conv_in[n], &src->info) ||
+      !gst_video_info_is_equal (&vsp->conv_out[n], &dest->info)) {
+    if (vsp->converter[n])
+      gst_video_converter_free (vsp->converter[n]);
+    vsp->converter[n] = gst_video_converter_new (&src->info, &dest->info,
+        NULL);
+    vsp->conv_in[n] = src->info;
+    vsp->conv_out[n] = dest->info;
+    GST_DEBUG ("%s: converting %s %dx%d -> %s %dx%d", vsp->name,
+        GST_VIDEO_INFO_NAME (&src->info), GST_VIDEO_INFO_WIDTH (&src->info),
+        GST_VIDEO_INFO_HEIGHT (&src->info), GST_VIDEO_INFO_NAME (&dest->info),
+        GST_VIDEO_INFO_WIDTH (&dest->info),
+        GST_VIDEO_INFO_HEIGHT (&dest->info));
+  }
+
+  gst_video_converter_frame (vsp->converter[n], src, dest);
+}
+
+/* Converts an input of the BRU to the unpacked format of a picture in
+ * the input data, with the alpha of its RPF if its format has none */
+static void
+unpack_input (VirtualVsp * vsp, guint pad, VirtualLayer * layer,
+    const GstVideoFrame * picture, GstVideoFrame * unpacked)
+{
+  guint w, h, x, y;
+  guint8 *p;
+  gsize size;
+
+  w = GST_VIDEO_INFO_WIDTH (&layer->frame.info);
+  h = GST_VIDEO_INFO_HEIGHT (&layer->frame.info);
+  size = (gsize) w * h * 4;
+  if (vsp->input_size < size) {
+    g_free (vsp->input_data);
+    vsp->input_data = g_malloc (size);
+    vsp->input_size = size;
+  }
+
+  memset (unpacked, 0, sizeof (*unpacked));
+  gst_video_info_set_format (&unpacked->info,
+      GST_VIDEO_INFO_FORMAT (&picture->info), w, h);
+  unpacked->info.colorimetry = picture->info.colorimetry;
+  unpacked->data[0] = vsp->input_data;
+  convert_frame (vsp, 1 + pad, &layer->frame, unpacked);
+
+  if (GST_VIDEO_INFO_HAS_ALPHA (&layer->frame.info) || layer->alpha == 255)
+    return;
+  for (y = 0; y < h; y++) {
+    p = vsp->input_data + y * GST_VIDEO_INFO_PLANE_STRIDE (&unpacked->info,
+        0);
+    for (x = 0; x < w; x++, p += 4)
+      p[0] = layer->alpha;
+  }
+}
+
+/* Fills the unpacked output of the BRU with its background color, which
+ * is in the format of the pipeline like on the hardware: R, G and B, or
+ * Cr, Y and Cb in the same fields */
+static void
+fill_background (GstVideoFrame * frame, guint32 color)
+{
+  guint32 pixel;
+  guint32 *p;
+  guint x, y;
+
+  if (GST_VIDEO_INFO_IS_YUV (&frame->info))
+    color = (color & 0xffff) << 8 | color >> 16;
+  pixel = GUINT32_TO_BE (0xff000000 | color);
+  for (y = 0; y < GST_VIDEO_INFO_HEIGHT (&frame->info); y++) {
+    p = (guint32 *) ((guint8 *) frame->data[0] +
+        y * GST_VIDEO_INFO_PLANE_STRIDE (&frame->info, 0));
+    for (x = 0; x < GST_VIDEO_INFO_WIDTH (&frame->info); x++)
+      p[x] = pixel;
+  }
+}
+
+/* Blends an unpacked input over the output of the BRU at the compose
+ * rectangle of its sink pad, like the blend units of the hardware do:
+ *   DSTc = DSTc * (1 - SRCa) + SRCc * SRCa
+ *   DSTa = DSTa * (1 - SRCa) + SRCa */
+static void
+blend_input (GstVideoFrame * frame, const GstVideoFrame * input,
+    const struct v4l2_rect *compose)
+{
+  const guint8 *in;
+  guint8 *out;
+  guint w, h, x, y, c, a;
+
+  if (compose->left >= GST_VIDEO_INFO_WIDTH (&frame->info) ||
+      compose->top >= GST_VIDEO_INFO_HEIGHT (&frame->info))
+    return;
+  w = MIN (GST_VIDEO_INFO_WIDTH (&input->info),
+      GST_VIDEO_INFO_WIDTH (&frame->info) - compose->left);
+  h = MIN (GST_VIDEO_INFO_HEIGHT (&input->info),
+      GST_VIDEO_INFO_HEIGHT (&frame->info) - compose->top);
+  for (y = 0; y < h; y++) {
+    in = (const guint8 *) input->data[0] + y *
+        GST_VIDEO_INFO_PLANE_STRIDE (&input->info, 0);
+    out = (guint8 *) frame->data[0] + (compose->top + y) *
+        GST_VIDEO_INFO_PLANE_STRIDE (&frame->info, 0) + compose->left * 4;
+    for (x = 0; x < w; x++, in += 4, out += 4) {
+      a = in[0];
+      for (c = 1; c < 4; c++)
+        out[c] = (in[c] * a + out[c] * (255 - a) + 127) / 255;
+      out[0] = a + (out[0] * (255 - a) + 127) / 255;
+    }
+  }
+}
+
+/* Interpolates the 3D table of the CLU at the components of a pixel */
+static void
+clu_lookup (const guint32 * clu, guint8 * rgb)
+{
+  guint64 acc[3] = { 0, 0, 0 };
+  guint idx[3], frac[3], corner, k, v;
+  guint32 entry, weight;
+
+  for (k = 0; k < 3; k++) {
+    v = rgb[k] * (CLU_POINTS - 1);
+    idx[k] = MIN (v / 255, CLU_POINTS - 2);
+    frac[k] = v - idx[k] * 255;
+  }
+
+  for (corner = 0; corner < 8; corner++) {
+    weight = 1;
+    for (k = 0; k < 3; k++)
+      weight *= (corner & (1 << k)) ? frac[k] : 255 - frac[k];
+    /* red is the index which changes the fastest */
+    entry = clu[((idx[2] + !!(corner & 4)) * CLU_POINTS + idx[1] +
+            !!(corner & 2)) * CLU_POINTS + idx[0] + !!(corner & 1)];
+    for (k = 0; k < 3; k++)
+      acc[k] += (guint64) weight * ((entry >> (16 - 8 * k)) & 0xff);
+  }
+
+  for (k = 0; k < 3; k++)
+    rgb[k] = (acc[k] + 255 * 255 * 255 / 2) / (255 * 255 * 255);
+}
+
+/* Runs an unpacked picture through the LUT and the CLU of the route */
+static void
+grade_frame (VirtualVsp * vsp, const VirtualRoute * route,
+    GstVideoFrame * picture)
+{
+  guint8 *p;
+  guint x, y, k;
+
+  for (y = 0; y < GST_VIDEO_INFO_HEIGHT (&picture->info); y++) {
+    p = (guint8 *) picture->data[0] +
+        y * GST_VIDEO_INFO_PLANE_STRIDE (&picture->info, 0);
+    for (x = 0; x < GST_VIDEO_INFO_WIDTH (&picture->info); x++, p += 4) {
+      if (route->lut) {
+        for (k = 0; k < 3; k++)
+          p[k + 1] = (vsp->lut[p[k + 1]] >> (16 - 8 * k)) & 0xff;
+      }
+      if (route->clu)
+        clu_lookup (vsp->clu, p + 1);
+    }
+  }
+}
+
+/* Counts the Y or G components of an unpacked picture, or the largest of
+ * R, G and B, in a buffer of the HGO */
+static void
+count_histogram (const GstVideoFrame * picture, gboolean max_rgb,
+    guint32 * data)
+{
+  guint32 *bins = data + 2;
+  const guint8 *p;
+  guint x, y, v, min = 255, max = 0;
+  guint32 sum = 0;
+
+  memset (data, 0, HGO_DATA_SIZE);
+
+  for (y = 0; y < GST_VIDEO_INFO_HEIGHT (&picture->info); y++) {
+    p = (const guint8 *) picture->data[0] +
+        y * GST_VIDEO_INFO_PLANE_STRIDE (&picture->info, 0);
+    for (x = 0; x < GST_VIDEO_INFO_WIDTH (&picture->info); x++, p += 4) {
+      if (max_rgb)
+        v = MAX (p[1], MAX (p[2], p[3]));
+      else
+        v = GST_VIDEO_INFO_IS_YUV (&picture->info) ? p[1] : p[2];
+      bins[v]++;
+      sum += v;
+      min = MIN (min, v);
+      max = MAX (max, v);
+    }
+  }
+
+  data[0] = max << 16 | min;
+  data[1] = sum;
+}
+
+/* Converts a frame to the unpacked format of the pipeline at its size
+ * before the BRU, grades it and counts its histogram. Through the BRU, it
+ * is blended with the other inputs over the background. The output of the
+ * BRU, or the picture, is then flipped and turned, and packed to the
+ * output. */
+static void
+turn_frame (VirtualVsp * vsp, VirtualJob * job)
+{
+  const VirtualRoute *route = &job->route;
+  GstVideoFrame *dest = &job->dest;
+  GstVideoFrame turn[2], picture, unpacked;
+  GstVideoFrame *graded;
+  GstVideoFormat format;
+  guint32 *in, *out;
+  guint w, h, dw, dh, x, y, dx, dy;
+  gsize size;
+  guint i;
+
+  dw = GST_VIDEO_INFO_WIDTH (&dest->info);
+  dh = GST_VIDEO_INFO_HEIGHT (&dest->info);
+  w = SWAPS_SIZE (job->rotate) ? dh : dw;
+  h = SWAPS_SIZE (job->rotate) ? dw : dh;
+
+  format = route->rgb ? GST_VIDEO_FORMAT_ARGB : GST_VIDEO_FORMAT_AYUV;
+  if (vsp->turn_size < (gsize) dw * dh * 4) {
+    vsp->turn_size = (gsize) dw * dh * 4;
+    for (i = 0; i < 2; i++) {
+      g_free (vsp->turn_data[i]);
+      vsp->turn_data[i] = g_malloc (vsp->turn_size);
+    }
+  }
+  for (i = 0; i < 2; i++) {
+    memset (&turn[i], 0, sizeof (turn[i]));
+    gst_video_info_set_format (&turn[i].info, format, i ? dw : w,
+        i ? dh : h);
+    if (!route->rgb && GST_VIDEO_INFO_IS_YUV (&dest->info))
+      turn[i].info.colorimetry = dest->info.colorimetry;
+    turn[i].data[0] = vsp->turn_data[i];
+  }
+
+  /* the picture is the output of the BRU unless it goes through it */
+  graded = &turn[0];
+  if (route->mixed) {
+    size = (gsize) job->picture_width * job->picture_height * 4;
+    if (vsp->picture_size < size) {
+      g_free (vsp->picture_data);
+      vsp->picture_data = g_malloc (size);
+      vsp->picture_size = size;
+    }
+    memset (&picture, 0, sizeof (picture));
+    gst_video_info_set_format (&picture.info, format, job->picture_width,
+        job->picture_height);
+    picture.info.colorimetry = turn[0].info.colorimetry;
+    picture.data[0] = vsp->picture_data;
+    graded = &picture;
+  }
+
+  convert_frame (vsp, 0, &job->src, graded);
+  if (route->lut || route->clu)
+    grade_frame (vsp, route, graded);
+  if (job->histogram)
+    count_histogram (graded, job->max_rgb, job->histogram);
+
+  if (route->mixed) {
+    fill_background (&turn[0], job->bg_color);
+    if (!GST_VIDEO_INFO_HAS_ALPHA (&job->src.info) &&
+        job->layers[0].alpha != 255) {
+      for (y = 0; y < job->picture_height; y++) {
+        for (x = 0; x < job->picture_width; x++)
+          vsp->picture_data[(y * job->picture_width + x) * 4] =
+              job->layers[0].alpha;
+      }
+    }
+    blend_input (&turn[0], &picture, &job->layers[0].compose);
+    for (i = 1; i < BRU_INPUTS; i++) {
+      if (!route->layers[i])
+        continue;
+      unpack_input (vsp, i, &job->layers[i], &turn[0], &unpacked);
+      blend_input (&turn[0], &unpacked, &job->layers[i].compose);
+    }
+  }
+
+  if (!job->hflip && !job->vflip && !job->rotate) {
+    convert_frame (vsp, 1, &turn[0], dest);
+    return;
+  }
+
+  in = turn[0].data[0];
+  out = turn[1].data[0];
+  for (dy = 0; dy < dh; dy++) {
+    for (dx = 0; dx < dw; dx++) {
+      switch (job->rotate) {
+        case 90:
+          x = dy;
+          y = h - 1 - dx;
+          break;
+        case 180:
+          x = w - 1 - dx;
+          y = h - 1 - dy;
+          break;
+        case 270:
+          x = w - 1 - dy;
+          y = dx;
+          break;
+        default:
+          x = dx;
+          y = dy;
+          break;
+      }
+      if (job->hflip)
+        x = w - 1 - x;
+      if (job->vflip)
+        y = h - 1 - y;
+      out[dy * dw + dx] = in[y * w + x];
+    }
+  }
+
+  convert_frame (vsp, 1, &turn[1], dest);
+}
+
+/* A frame through the BRU also waits for a frame of each of its other
+ * inputs */
+static gboolean
+frames_ready (VirtualVsp * vsp)
+{
+  VirtualQueue *out = &vsp->queues[QUEUE_OUT];
+  VirtualQueue *cap = &vsp->queues[QUEUE_CAP];
+  VirtualQueue *queue;
+  VirtualRoute route;
+  guint i;
+
+  if (!out->streaming || !cap->streaming ||
+      g_queue_is_empty (&out->queued) || g_queue_is_empty (&cap->queued))
+    return FALSE;
+
+  find_route (vsp, &route);
+
+  for (i = 1; i < BRU_INPUTS; i++) {
+    if (!route.layers[i])
+      continue;
+    queue = &vsp->queues[rpf_queue[route.layers[i]]];
+    if (!queue->streaming || g_queue_is_empty (&queue->queued))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Must be called with the VSP lock held */
+static void
+schedule_frames (VirtualVsp * vsp)
+{
+  if (vsp->scheduled || vsp->busy || !frames_ready (vsp))
+    return;
+
+  vsp->scheduled = TRUE;
+  g_thread_pool_push (vsp->worker, vsp, NULL);
+}
+
+/* Takes the next queued buffer of a queue for a job. Must be called with
+ * the VSP lock held. */
+static VirtualBuffer *
+take_buffer (VirtualVsp * vsp, guint q, VirtualJob * job)
+{
+  VirtualQueue *queue = &vsp->queues[q];
+
+  job->index[q] = GPOINTER_TO_UINT (g_queue_pop_head (&queue->queued));
+
+  return &queue->buffers[job->index[q]];
+}
+
+/* Hands a buffer of a job back. Must be called with the VSP lock held. */
+static void
+complete_buffer (VirtualVsp * vsp, guint q, VirtualJob * job)
+{
+  VirtualQueue *queue = &vsp->queues[q];
+
+  queue->buffers[job->index[q]].state = BUF_DONE;
+  g_queue_push_tail (&queue->done, GUINT_TO_POINTER (job->index[q]));
+}
+
+static void
+process_frames (gpointer data, gpointer user_data)
+{
+  VirtualVsp *vsp = user_data;
+  VirtualQueue *out = &vsp->queues[QUEUE_OUT];
+  VirtualQueue *cap = &vsp->queues[QUEUE_CAP];
+  VirtualQueue *hgo = &vsp->queues[QUEUE_HGO];
+  VirtualRoute *route;
+  VirtualBuffer *buffer;
+  VirtualJob job;
+  struct v4l2_rect out_rect;
+  guint i, k;
+
+  g_mutex_lock (&vsp->lock);
+  vsp->scheduled = FALSE;
+
+  while (frames_ready (vsp)) {
+    memset (&job, 0, sizeof (job));
+    route = &job.route;
+    find_route (vsp, route);
+
+    out_rect.left = out_rect.top = 0;
+    out_rect.width = cap->fmt.width;
+    out_rect.height = cap->fmt.height;
+    buffer = take_buffer (vsp, QUEUE_OUT, &job);
+    setup_frame (out, buffer, &vsp->crop[0], &job.src);
+    buffer = take_buffer (vsp, QUEUE_CAP, &job);
+    setup_frame (cap, buffer, &out_rect, &job.dest);
+
+    /* the frame goes without a histogram if no buffer is queued for it */
+    if (route->histogram && hgo->streaming && !g_queue_is_empty (&hgo->queued)) {
+      buffer = take_buffer (vsp, QUEUE_HGO, &job);
+      job.histogram = (guint32 *) buffer->planes[0].data;
+    }
+
+    if (route->mixed) {
+      job.picture_width = vsp->pad_fmt[ENT_BRU][0].width;
+      job.picture_height = vsp->pad_fmt[ENT_BRU][0].height;
+      job.bg_color = vsp->bg_color;
+      for (i = 0; i < BRU_INPUTS; i++) {
+        k = route->layers[i];
+        job.layers[i].compose = vsp->compose[i];
+        job.layers[i].alpha = vsp->alpha[k];
+        if (i == 0 || k == 0)
+          continue;
+        buffer = take_buffer (vsp, rpf_queue[k], &job);
+        setup_frame (&vsp->queues[rpf_queue[k]], buffer, &vsp->crop[k],
+            &job.layers[i].frame);
+      }
+    }
+
+    job.hflip = vsp->hflip;
+    job.vflip = vsp->vflip;
+    job.rotate = vsp->rotate;
+    job.max_rgb = vsp->hgo_max_rgb;
+
+    vsp->busy = TRUE;
+    g_mutex_unlock (&vsp->lock);
+
+    if (job.hflip || job.vflip || job.rotate || route->mixed || route->lut
+        || route->clu || job.histogram)
+      turn_frame (vsp, &job);
+    else
+      convert_frame (vsp, 0, &job.src, &job.dest);
+
+    g_mutex_lock (&vsp->lock);
+    vsp->busy = FALSE;
+
+    complete_buffer (vsp, QUEUE_OUT, &job);
+    for (i = 1; i < BRU_INPUTS; i++) {
+      if (route->layers[i])
+        complete_buffer (vsp, rpf_queue[route->layers[i]], &job);
+    }
+    if (job.histogram)
+      complete_buffer (vsp, QUEUE_HGO, &job);
+    complete_buffer (vsp, QUEUE_CAP, &job);
+    g_cond_broadcast (&vsp->cond);
+  }
+  g_mutex_unlock (&vsp->lock);
+}
+
+/* Video node ioctls. All are called with the VSP lock held. */
+
+static VirtualQueue *
+node_queue (VirtualVsp * vsp, guint entity)
+{
+  switch (entity) {
+    case ENT_RPF_INPUT:
+    case ENT_RPF1_INPUT:
+    case ENT_RPF2_INPUT:
+    case ENT_RPF3_INPUT:
+    case ENT_RPF4_INPUT:
+      return &vsp->queues[rpf_queue[rpf_index (entity)]];
+    case ENT_HGO_HISTO:
+      return &vsp->queues[QUEUE_HGO];
+    default:
+      return &vsp->queues[QUEUE_CAP];
+  }
+}
+
+static VirtualQueue *
+get_queue (VirtualVsp * vsp, VirtualFile * file, enum v4l2_buf_type buftype)
+{
+  VirtualQueue *queue;
+
+  queue = node_queue (vsp, file->entity);
+  if (queue->buftype != buftype) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return queue;
+}
+
+static gint
+video_querycap (VirtualVsp * vsp, VirtualFile * file,
+    struct v4l2_capability *cap)
+{
+  memset (cap, 0, sizeof (*cap));
+  g_strlcpy ((gchar *) cap->driver, "vsp1", sizeof (cap->driver));
+  snprintf ((gchar *) cap->card, sizeof (cap->card), "%s %s", vsp->name,
+      entities[file->entity].name);
+  snprintf ((gchar *) cap->bus_info, sizeof (cap->bus_info), "platform:%s",
+      vsp->name);
+
+  cap->device_caps = V4L2_CAP_STREAMING;
+  if (file->entity == ENT_HGO_HISTO)
+    cap->device_caps |= V4L2_CAP_META_CAPTURE;
+  else if (file->entity != ENT_WPF_OUTPUT)
+    cap->device_caps |= V4L2_CAP_VIDEO_OUTPUT_MPLANE;
+  else
+    cap->device_caps |= V4L2_CAP_VIDEO_CAPTURE_MPLANE;
+  cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+
+  return 0;
+}
+
+static gint
+video_fmt (VirtualVsp * vsp, VirtualFile * file, struct v4l2_format *fmt,
+    gboolean set)
+{
+  VirtualQueue *queue;
+
+  queue = get_queue (vsp, file, fmt->type);
+  if (!queue)
+    return -1;
+
+  /* the histogram queue has a fixed format */
+  if (fmt->type == V4L2_BUF_TYPE_META_CAPTURE) {
+    fmt->fmt.meta.dataformat = V4L2_META_FMT_VSP1_HGO;
+    fmt->fmt.meta.buffersize = HGO_DATA_SIZE;
+    return 0;
+  }
+
+  adjust_format (&fmt->fmt.pix_mp);
+  if (!set)
+    return 0;
+
+  if (queue->n_buffers) {
+    errno = EBUSY;
+    return -1;
+  }
+  queue->fmt = fmt->fmt.pix_mp;
+
+  return 0;
+}
+
+static gint
+video_reqbufs (VirtualVsp * vsp, VirtualFile * file,
+    struct v4l2_requestbuffers *req)
+{
+  VirtualQueue *queue;
+
+  queue = get_queue (vsp, file, req->type);
+  if (!queue)
+    return -1;
+
+  if ((req->memory != V4L2_MEMORY_MMAP && req->memory != V4L2_MEMORY_USERPTR
+          && req->memory != V4L2_MEMORY_DMABUF) ||
+      (req->type == V4L2_BUF_TYPE_META_CAPTURE &&
+          req->memory != V4L2_MEMORY_USERPTR)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (queue->streaming) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  free_buffers (queue);
+  queue->memory = req->memory;
+
+  req->count = MIN (req->count, VIDEO_MAX_FRAME);
+  if (req->count && !alloc_buffers (queue, req->count)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  GST_DEBUG ("%s %s: %u buffers", vsp->name, entities[file->entity].name,
+      req->count);
+
+  return 0;
+}
+
+static VirtualBuffer *
+get_buffer (VirtualQueue * queue, struct v4l2_buffer *buf)
+{
+  if (buf->index >= queue->n_buffers || buf->memory != queue->memory ||
+      (V4L2_TYPE_IS_MULTIPLANAR (buf->type) && (!buf->m.planes ||
+              buf->length < queue->fmt.num_planes))) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return &queue->buffers[buf->index];
+}
+
+static gint
+video_querybuf (VirtualVsp * vsp, VirtualFile * file, struct v4l2_buffer *buf)
+{
+  VirtualQueue *queue;
+  VirtualBuffer *buffer;
+  guint i;
+
+  queue = get_queue (vsp, file, buf->type);
+  if (!queue)
+    return -1;
+  buffer = get_buffer (queue, buf);
+  if (!buffer)
+    return -1;
+
+  if (V4L2_TYPE_IS_MULTIPLANAR (buf->type)) {
+    buf->length = queue->fmt.num_planes;
+    for (i = 0; i < queue->fmt.num_planes; i++) {
+      buf->m.planes[i].length = queue->fmt.plane_fmt[i].sizeimage;
+      if (queue->memory == V4L2_MEMORY_MMAP)
+        buf->m.planes[i].m.mem_offset = (buf->index << 8 | i) << 12;
+    }
+  } else {
+    buf->length = queue->fmt.plane_fmt[0].sizeimage;
+  }
+  buf->flags = 0;
+  if (buffer->state == BUF_QUEUED)
+    buf->flags |= V4L2_BUF_FLAG_QUEUED;
+  else if (buffer->state == BUF_DONE)
+    buf->flags |= V4L2_BUF_FLAG_DONE;
+
+  return 0;
+}
+
+static gint
+video_expbuf (VirtualVsp * vsp, VirtualFile * file,
+    struct v4l2_exportbuffer *expbuf)
+{
+  VirtualQueue *queue;
+  gint fd;
+
+  queue = get_queue (vsp, file, expbuf->type);
+  if (!queue)
+    return -1;
+
+  if (queue->memory != V4L2_MEMORY_MMAP || expbuf->index >= queue->n_buffers
+      || expbuf->plane >= queue->fmt.num_planes) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  fd = fcntl (queue->buffers[expbuf->index].planes[expbuf->plane].fd,
+      (expbuf->flags & O_CLOEXEC) ? F_DUPFD_CLOEXEC : F_DUPFD, 0);
+  if (fd < 0)
+    return -1;
+
+  expbuf->fd = fd;
+
+  return 0;
+}
+
+/* Makes the memory of a queued plane accessible */
+static gboolean
+map_plane (VirtualQueue * queue, VirtualBuffer * buffer, guint i,
+    struct v4l2_plane *plane)
+{
+  gsize size;
+  off_t end;
+
+  buffer->planes[i].queued = *plane;
+
+  switch (queue->memory) {
+    case V4L2_MEMORY_MMAP:
+      return TRUE;
+    case V4L2_MEMORY_USERPTR:
+      if (!plane->m.userptr ||
+          plane->length < queue->fmt.plane_fmt[i].sizeimage)
+        return FALSE;
+      buffer->planes[i].data = (guint8 *) plane->m.userptr;
+      return TRUE;
+    case V4L2_MEMORY_DMABUF:
+      size = plane->length;
+      if (!size) {
+        end = lseek (plane->m.fd, 0, SEEK_END);
+        if (end < 0)
+          return FALSE;
+        size = end;
+      }
+      if (size < plane->data_offset + queue->fmt.plane_fmt[i].sizeimage)
+        return FALSE;
+      buffer->planes[i].map = mmap (NULL, size, PROT_READ | PROT_WRITE,
+          MAP_SHARED, plane->m.fd, 0);
+      if (buffer->planes[i].map == MAP_FAILED &&
+          queue->buftype == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+        buffer->planes[i].map = mmap (NULL, size, PROT_READ, MAP_SHARED,
+            plane->m.fd, 0);
+      if (buffer->planes[i].map == MAP_FAILED) {
+        buffer->planes[i].map = NULL;
+        return FALSE;
+      }
+      buffer->planes[i].map_size = size;
+      buffer->planes[i].data = (guint8 *) buffer->planes[i].map +
+          plane->data_offset;
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static gint
+video_qbuf (VirtualVsp * vsp, VirtualFile * file, struct v4l2_buffer *buf)
+{
+  VirtualQueue *queue;
+  VirtualBuffer *buffer;
+  struct v4l2_plane single, *planes;
+  guint i;
+
+  queue = get_queue (vsp, file, buf->type);
+  if (!queue)
+    return -1;
+  buffer = get_buffer (queue, buf);
+  if (!buffer)
+    return -1;
+
+  if (buffer->state != BUF_DEQUEUED) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* a single-planar buffer of the histogram queue is userptr */
+  planes = buf->m.planes;
+  if (!V4L2_TYPE_IS_MULTIPLANAR (buf->type)) {
+    memset (&single, 0, sizeof (single));
+    single.m.userptr = buf->m.userptr;
+    single.length = buf->length;
+    planes = &single;
+  }
+
+  for (i = 0; i < queue->fmt.num_planes; i++) {
+    if (!map_plane (queue, buffer, i, &planes[i])) {
+      unmap_buffer (queue, buffer);
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  buffer->state = BUF_QUEUED;
+  g_queue_push_tail (&queue->queued, GUINT_TO_POINTER (buf->index));
+  buf->flags |= V4L2_BUF_FLAG_QUEUED;
+
+  schedule_frames (vsp);
+
+  return 0;
+}
+
+static gint
+video_dqbuf (VirtualVsp * vsp, VirtualFile * file, struct v4l2_buffer *buf)
+{
+  VirtualQueue *queue;
+  VirtualBuffer *buffer;
+  guint index, i;
+
+  queue = get_queue (vsp, file, buf->type);
+  if (!queue)
+    return -1;
+
+  if (buf->memory != queue->memory ||
+      (V4L2_TYPE_IS_MULTIPLANAR (buf->type) && (!buf->m.planes ||
+              buf->length < queue->fmt.num_planes))) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  while (g_queue_is_empty (&queue->done)) {
+    if (!queue->streaming) {
+      errno = EINVAL;
+      return -1;
+    }
+    g_cond_wait (&vsp->cond, &vsp->lock);
+  }
+
+  index = GPOINTER_TO_UINT (g_queue_pop_head (&queue->done));
+  buffer = &queue->buffers[index];
+  unmap_buffer (queue, buffer);
+  buffer->state = BUF_DEQUEUED;
+
+  buf->index = index;
+  buf->flags = V4L2_BUF_FLAG_DONE;
+  buf->field = V4L2_FIELD_NONE;
+  buf->sequence = queue->sequence++;
+  if (!V4L2_TYPE_IS_MULTIPLANAR (buf->type)) {
+    buf->m.userptr = buffer->planes[0].queued.m.userptr;
+    buf->length = buffer->planes[0].queued.length;
+    buf->bytesused = HGO_DATA_SIZE;
+    return 0;
+  }
+  buf->length = queue->fmt.num_planes;
+  for (i = 0; i < queue->fmt.num_planes; i++) {
+    buf->m.planes[i] = buffer->planes[i].queued;
+    if (queue->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+      buf->m.planes[i].bytesused = queue->fmt.plane_fmt[i].sizeimage;
+  }
+
+  return 0;
+}
+
+/* Validates the pipeline like the driver does */
+static gboolean
+pipeline_valid (VirtualVsp * vsp)
+{
+  struct v4l2_mbus_framefmt *bru = vsp->pad_fmt[ENT_BRU];
+  struct v4l2_mbus_framefmt *wpf = vsp->pad_fmt[ENT_WPF];
+  VirtualQueue *cap = &vsp->queues[QUEUE_CAP];
+  struct v4l2_rect *crop = &vsp->crop[0];
+  VirtualQueue *queue;
+  VirtualRoute route;
+  guint width, height, i, k;
+
+  if (!find_route (vsp, &route))
+    return FALSE;
+
+  /* the size of the picture out of the RPF or the UDS, which the LUT and
+   * the CLU keep */
+  width = route.scaled ? vsp->pad_fmt[ENT_UDS][1].width : crop->width;
+  height = route.scaled ? vsp->pad_fmt[ENT_UDS][1].height : crop->height;
+  if ((route.lut && (width != vsp->pad_fmt[ENT_LUT][0].width ||
+              height != vsp->pad_fmt[ENT_LUT][0].height)) ||
+      (route.clu && (width != vsp->pad_fmt[ENT_CLU][0].width ||
+              height != vsp->pad_fmt[ENT_CLU][0].height)) ||
+      (route.histogram && (width != vsp->pad_fmt[ENT_HGO][0].width ||
+              height != vsp->pad_fmt[ENT_HGO][0].height)))
+    return FALSE;
+
+  /* every input of the BRU has the size of its sink pad and a frame
+   * around its crop, the compose rectangles may stick out of the output */
+  if (route.mixed) {
+    if (width != bru[0].width || height != bru[0].height)
+      return FALSE;
+    for (i = 1; i < BRU_INPUTS; i++) {
+      k = route.layers[i];
+      if (!k)
+        continue;
+      crop = &vsp->crop[k];
+      queue = &vsp->queues[rpf_queue[k]];
+      if (crop->width != bru[i].width || crop->height != bru[i].height ||
+          (queue->n_buffers && (crop->left + crop->width >
+                  queue->fmt.width ||
+                  crop->top + crop->height > queue->fmt.height)))
+        return FALSE;
+    }
+    width = bru[BRU_INPUTS].width;
+    height = bru[BRU_INPUTS].height;
+  }
+
+  if (route.scaled || route.lut || route.clu || route.mixed)
+    return width == wpf[0].width && height == wpf[0].height;
+
+  /* the WPF writes the crop, turned */
+  if (SWAPS_SIZE (vsp->rotate)) {
+    width = vsp->crop[0].height;
+    height = vsp->crop[0].width;
+  }
+
+  return !cap->n_buffers || (width == cap->fmt.width &&
+      height == cap->fmt.height);
+}
+
+static gint
+video_streamon (VirtualVsp * vsp, VirtualFile * file,
+    enum v4l2_buf_type * buftype)
+{
+  VirtualQueue *queue;
+
+  queue = get_queue (vsp, file, *buftype);
+  if (!queue)
+    return -1;
+
+  if (!queue->n_buffers) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!pipeline_valid (vsp)) {
+    GST_WARNING ("%s: invalid pipeline", vsp->name);
+    errno = EPIPE;
+    return -1;
+  }
+
+  queue->streaming = TRUE;
+  schedule_frames (vsp);
+
+  return 0;
+}
+
+static gint
+video_streamoff (VirtualVsp * vsp, VirtualFile * file,
+    enum v4l2_buf_type * buftype)
+{
+  VirtualQueue *queue;
+  VirtualBuffer *buffer;
+  guint i;
+
+  queue = get_queue (vsp, file, *buftype);
+  if (!queue)
+    return -1;
+
+  queue->streaming = FALSE;
+  while (vsp->busy)
+    g_cond_wait (&vsp->cond, &vsp->lock);
+
+  g_queue_clear (&queue->queued);
+  g_queue_clear (&queue->done);
+  for (i = 0; i < queue->n_buffers; i++) {
+    buffer = &queue->buffers[i];
+    if (buffer->state != BUF_DEQUEUED) {
+      unmap_buffer (queue, buffer);
+      buffer->state = BUF_DEQUEUED;
+    }
+  }
+  queue->sequence = 0;
+
+  for (i = 0; i < G_N_ELEMENTS (vsp->converter); i++) {
+    if (vsp->converter[i]) {
+      gst_video_converter_free (vsp->converter[i]);
+      vsp->converter[i] = NULL;
+    }
+  }
+  for (i = 0; i < 2; i++) {
+    g_free (vsp->turn_data[i]);
+    vsp->turn_data[i] = NULL;
+  }
+  vsp->turn_size = 0;
+  g_free (vsp->picture_data);
+  vsp->picture_data = NULL;
+  vsp->picture_size = 0;
+  g_free (vsp->input_data);
+  vsp->input_data = NULL;
+  vsp->input_size = 0;
+  g_cond_broadcast (&vsp->cond);
+
+  return 0;
+}
+
+static gint
+video_ioctl (VirtualVsp * vsp, VirtualFile * file, gulong request,
+    gpointer arg)
+{
+  switch (request) {
+    case VIDIOC_QUERYCAP:
+      return video_querycap (vsp, file, arg);
+    case VIDIOC_TRY_FMT:
+      return video_fmt (vsp, file, arg, FALSE);
+    case VIDIOC_S_FMT:
+      return video_fmt (vsp, file, arg, TRUE);
+    case VIDIOC_REQBUFS:
+      return video_reqbufs (vsp, file, arg);
+    case VIDIOC_QUERYBUF:
+      return video_querybuf (vsp, file, arg);
+    case VIDIOC_EXPBUF:
+      return video_expbuf (vsp, file, arg);
+    case VIDIOC_QBUF:
+      return video_qbuf (vsp, file, arg);
+    case VIDIOC_DQBUF:
+      return video_dqbuf (vsp, file, arg);
+    case VIDIOC_STREAMON:
+      return video_streamon (vsp, file, arg);
+    case VIDIOC_STREAMOFF:
+      return video_streamoff (vsp, file, arg);
+    default:
+      errno = ENOTTY;
+      return -1;
+  }
+}
+
+/* Subdev ioctls */
+
+static gint
+subdev_fmt (VirtualVsp * vsp, VirtualFile * file,
+    struct v4l2_subdev_format *sfmt, gboolean set)
+{
+  struct v4l2_mbus_framefmt *fmt;
+  struct v4l2_rect *crop;
+  guint source_pad = entities[file->entity].pads - 1;
+
+  if (sfmt->pad > source_pad) {
+    errno = EINVAL;
+    return -1;
+  }
+  fmt = &vsp->pad_fmt[file->entity][sfmt->pad];
+
+  if (!set) {
+    sfmt->format = *fmt;
+    return 0;
+  }
+
+  sfmt->format.width = CLAMP (sfmt->format.width, 1, VIRTUAL_MAX_SIZE);
+  sfmt->format.height = CLAMP (sfmt->format.height, 1, VIRTUAL_MAX_SIZE);
+  sfmt->format.field = V4L2_FIELD_NONE;
+
+  /* the UDS only scales by so much, its output is clamped to it */
+  if (file->entity == ENT_UDS && sfmt->pad == 1) {
+    guint min, max;
+
+    uds_output_limits (vsp->pad_fmt[ENT_UDS][0].width, &min, &max);
+    sfmt->format.width = CLAMP (sfmt->format.width, min, max);
+    uds_output_limits (vsp->pad_fmt[ENT_UDS][0].height, &min, &max);
+    sfmt->format.height = CLAMP (sfmt->format.height, min, max);
+  }
+  if (sfmt->which == V4L2_SUBDEV_FORMAT_TRY)
+    return 0;
+
+  if (is_streaming (vsp)) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  *fmt = sfmt->format;
+
+  /* the first sink format propagates to the source pad except on the UDS,
+   * and the WPF turns it */
+  if (sfmt->pad == 0 && file->entity != ENT_UDS)
+    vsp->pad_fmt[file->entity][source_pad] = *fmt;
+  if (sfmt->pad == 0 && file->entity == ENT_WPF && SWAPS_SIZE (vsp->rotate)) {
+    vsp->pad_fmt[ENT_WPF][1].width = fmt->height;
+    vsp->pad_fmt[ENT_WPF][1].height = fmt->width;
+  }
+
+  if (sfmt->pad == 0 && rpf_index (file->entity) >= 0) {
+    crop = &vsp->crop[rpf_index (file->entity)];
+    crop->left = crop->top = 0;
+    crop->width = fmt->width;
+    crop->height = fmt->height;
+  }
+
+  /* a BRU input is composed at the top left corner */
+  if (sfmt->pad < source_pad && file->entity == ENT_BRU) {
+    vsp->compose[sfmt->pad].left = vsp->compose[sfmt->pad].top = 0;
+    vsp->compose[sfmt->pad].width = fmt->width;
+    vsp->compose[sfmt->pad].height = fmt->height;
+  }
+
+  return 0;
+}
+
+/* Places a BRU input in the output, the size of the input is kept */
+static gint
+subdev_compose (VirtualVsp * vsp, struct v4l2_subdev_selection *sel,
+    gboolean set)
+{
+  struct v4l2_mbus_framefmt *sink, *source;
+
+  if (!set) {
+    sel->r = vsp->compose[sel->pad];
+    return 0;
+  }
+
+  sink = &vsp->pad_fmt[ENT_BRU][sel->pad];
+  source = &vsp->pad_fmt[ENT_BRU][BRU_INPUTS];
+  sel->r.width = sink->width;
+  sel->r.height = sink->height;
+  sel->r.left = CLAMP (sel->r.left, 0, (gint) source->width - 1);
+  sel->r.top = CLAMP (sel->r.top, 0, (gint) source->height - 1);
+  if (sel->which == V4L2_SUBDEV_FORMAT_TRY)
+    return 0;
+
+  if (is_streaming (vsp)) {
+    errno = EBUSY;
+    return -1;
+  }
+  vsp->compose[sel->pad] = sel->r;
+
+  return 0;
+}
+
+static gint
+subdev_selection (VirtualVsp * vsp, VirtualFile * file,
+    struct v4l2_subdev_selection *sel, gboolean set)
+{
+  struct v4l2_mbus_framefmt *sink;
+  gint k;
+
+  if (file->entity == ENT_BRU && sel->pad < BRU_INPUTS &&
+      sel->target == V4L2_SEL_TGT_COMPOSE)
+    return subdev_compose (vsp, sel, set);
+
+  k = rpf_index (file->entity);
+  if (k < 0 || sel->pad != 0 || sel->target != V4L2_SEL_TGT_CROP) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!set) {
+    sel->r = vsp->crop[k];
+    return 0;
+  }
+
+  sink = &vsp->pad_fmt[file->entity][0];
+  sel->r.left = CLAMP (sel->r.left, 0, (gint) sink->width - 1);
+  sel->r.top = CLAMP (sel->r.top, 0, (gint) sink->height - 1);
+  sel->r.width = CLAMP (sel->r.width, 1, sink->width - sel->r.left);
+  sel->r.height = CLAMP (sel->r.height, 1, sink->height - sel->r.top);
+  if (sel->which == V4L2_SUBDEV_FORMAT_TRY)
+    return 0;
+
+  vsp->crop[k] = sel->r;
+  vsp->pad_fmt[file->entity][1].width = sel->r.width;
+  vsp->pad_fmt[file->entity][1].height = sel->r.height;
+
+  return 0;
+}
+
+static gint
+subdev_ctrl (VirtualVsp * vsp, VirtualFile * file,
+    struct v4l2_control *ctrl, gboolean set)
+{
+  struct v4l2_mbus_framefmt *sink, *source;
+  gint32 *value, max = 1;
+
+  if (rpf_index (file->entity) >= 0 && ctrl->id == V4L2_CID_ALPHA_COMPONENT) {
+    value = &vsp->alpha[rpf_index (file->entity)];
+    max = 255;
+  } else if (file->entity == ENT_BRU && ctrl->id == V4L2_CID_BG_COLOR) {
+    value = &vsp->bg_color;
+    max = 0xffffff;
+  } else if (file->entity == ENT_WPF && ctrl->id == V4L2_CID_HFLIP) {
+    value = &vsp->hflip;
+  } else if (file->entity == ENT_WPF && ctrl->id == V4L2_CID_VFLIP) {
+    value = &vsp->vflip;
+  } else if (file->entity == ENT_WPF && ctrl->id == V4L2_CID_ROTATE) {
+    value = &vsp->rotate;
+  } else {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!set) {
+    ctrl->value = *value;
+    return 0;
+  }
+
+  /* the alpha and the background are taken with every frame */
+  if (max > 1) {
+    if (ctrl->value < 0 || ctrl->value > max) {
+      errno = ERANGE;
+      return -1;
+    }
+    *value = ctrl->value;
+  } else if (ctrl->id == V4L2_CID_ROTATE) {
+    if (ctrl->value % 90 != 0 || ctrl->value < 0 || ctrl->value >= 360) {
+      errno = ERANGE;
+      return -1;
+    }
+    /* the rotation changes the format of the source pad */
+    if (is_streaming (vsp)) {
+      errno = EBUSY;
+      return -1;
+    }
+    *value = ctrl->value;
+
+    sink = &vsp->pad_fmt[ENT_WPF][0];
+    source = &vsp->pad_fmt[ENT_WPF][1];
+    source->width = SWAPS_SIZE (*value) ? sink->height : sink->width;
+    source->height = SWAPS_SIZE (*value) ? sink->width : sink->height;
+  } else {
+    *value = ctrl->value ? 1 : 0;
+  }
+
+  return 0;
+}
+
+/* The tables of the LUT and the CLU, the mode of the CLU of which only
+ * the 3D one is emulated, and the controls of the HGO. They are fixed
+ * while streaming. */
+static gint
+subdev_ext_ctrls (VirtualVsp * vsp, VirtualFile * file,
+    struct v4l2_ext_controls *ctrls, gboolean set)
+{
+  struct v4l2_ext_control *ctrl;
+  guint32 *table[2];
+  guint32 size[2];
+  gint32 *value[2];
+  guint i;
+
+  if (ctrls->count > 2) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (i = 0; i < ctrls->count; i++) {
+    ctrl = &ctrls->controls[i];
+    ctrls->error_idx = i;
+    if (file->entity == ENT_LUT && ctrl->id == V4L2_CID_VSP1_LUT_TABLE) {
+      table[i] = vsp->lut;
+      size[i] = sizeof (vsp->lut);
+    } else if (file->entity == ENT_CLU &&
+        ctrl->id == V4L2_CID_VSP1_CLU_TABLE) {
+      table[i] = vsp->clu;
+      size[i] = sizeof (vsp->clu);
+    } else if (file->entity == ENT_CLU &&
+        ctrl->id == V4L2_CID_VSP1_CLU_MODE) {
+      table[i] = NULL;
+      value[i] = &vsp->clu_mode;
+      if (set && ctrl->value != V4L2_CID_VSP1_CLU_MODE_3D) {
+        errno = ERANGE;
+        return -1;
+      }
+      continue;
+    } else if (file->entity == ENT_HGO &&
+        ctrl->id == V4L2_CID_VSP1_HGO_NUM_BINS) {
+      table[i] = NULL;
+      value[i] = &vsp->hgo_num_bins;
+      if (set && ctrl->value != HGO_NUM_BINS) {
+        errno = ERANGE;
+        return -1;
+      }
+      continue;
+    } else if (file->entity == ENT_HGO &&
+        ctrl->id == V4L2_CID_VSP1_HGO_MAX_RGB) {
+      table[i] = NULL;
+      value[i] = &vsp->hgo_max_rgb;
+      if (set && (ctrl->value < 0 || ctrl->value > 1)) {
+        errno = ERANGE;
+        return -1;
+      }
+      continue;
+    } else {
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (ctrl->size < size[i]) {
+      ctrl->size = size[i];
+      errno = ENOSPC;
+      return -1;
+    }
+  }
+  ctrls->error_idx = ctrls->count;
+
+  if (set && is_streaming (vsp)) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  for (i = 0; i < ctrls->count; i++) {
+    ctrl = &ctrls->controls[i];
+    if (!table[i]) {
+      if (set)
+        *value[i] = ctrl->value;
+      else
+        ctrl->value = *value[i];
+    } else if (set) {
+      memcpy (table[i], ctrl->p_u32, size[i]);
+    } else {
+      memcpy (ctrl->p_u32, table[i], size[i]);
+    }
+  }
+
+  return 0;
+}
+
+static gint
+subdev_ioctl (VirtualVsp * vsp, VirtualFile * file, gulong request,
+    gpointer arg)
+{
+  switch (request) {
+    case VIDIOC_SUBDEV_G_FMT:
+      return subdev_fmt (vsp, file, arg, FALSE);
+    case VIDIOC_SUBDEV_S_FMT:
+      return subdev_fmt (vsp, file, arg, TRUE);
+    case VIDIOC_SUBDEV_G_SELECTION:
+      return subdev_selection (vsp, file, arg, FALSE);
+    case VIDIOC_SUBDEV_S_SELECTION:
+      return subdev_selection (vsp, file, arg, TRUE);
+    case VIDIOC_G_CTRL:
+      return subdev_ctrl (vsp, file, arg, FALSE);
+    case VIDIOC_S_CTRL:
+      return subdev_ctrl (vsp, file, arg, TRUE);
+    case VIDIOC_G_EXT_CTRLS:
+      return subdev_ext_ctrls (vsp, file, arg, FALSE);
+    case VIDIOC_S_EXT_CTRLS:
+      return subdev_ext_ctrls (vsp, file, arg, TRUE);
+    default:
+      errno = ENOTTY;
+      return -1;
+  }
+}
+
+/* Media controller ioctls */
+
+static gint
+media_enum_entities (VirtualVsp * vsp, struct media_entity_desc *desc)
+{
+  guint32 id = desc->id & ~MEDIA_ENT_ID_FLAG_NEXT;
+  guint ent, i;
+
+  if (desc->id & MEDIA_ENT_ID_FLAG_NEXT)
+    ent = id;                   /* the entity after id */
+  else if (id > 0)
+    ent = id - 1;
+  else
+    ent = N_ENTITIES;
+
+  if (ent >= N_ENTITIES) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset (desc, 0, sizeof (*desc));
+  desc->id = ENTITY_ID (ent);
+  snprintf (desc->name, sizeof (desc->name), "%s %s", vsp->name,
+      entities[ent].name);
+  desc->type = entities[ent].type;
+  desc->pads = entities[ent].pads;
+  for (i = 0; i < N_LINKS; i++) {
+    if (links[i].source == ent)
+      desc->links++;
+  }
+
+  return 0;
+}
+
+static void
+fill_pad (guint ent, guint pad, struct media_pad_desc *desc)
+{
+  memset (desc, 0, sizeof (*desc));
+  desc->entity = ENTITY_ID (ent);
+  desc->index = pad;
+  if ((rpf_index (ent) >= 0 && entities[ent].type == MEDIA_ENT_T_DEVNODE_V4L)
+      || (ent != ENT_WPF_OUTPUT && ent != ENT_HGO_HISTO &&
+          pad == entities[ent].pads - 1))
+    desc->flags = MEDIA_PAD_FL_SOURCE;
+  else
+    desc->flags = MEDIA_PAD_FL_SINK;
+}
+
+static gint
+media_enum_links (VirtualVsp * vsp, struct media_links_enum *le)
+{
+  guint ent = le->entity - 1;
+  guint i, n = 0;
+
+  if (le->entity == 0 || ent >= N_ENTITIES) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (le->pads) {
+    for (i = 0; i < entities[ent].pads; i++)
+      fill_pad (ent, i, &le->pads[i]);
+  }
+
+  if (le->links) {
+    for (i = 0; i < N_LINKS; i++) {
+      if (links[i].source != ent)
+        continue;
+      memset (&le->links[n], 0, sizeof (le->links[n]));
+      fill_pad (links[i].source, links[i].source_pad, &le->links[n].source);
+      fill_pad (links[i].sink, links[i].sink_pad, &le->links[n].sink);
+      le->links[n].flags = vsp->link_flags[i];
+      n++;
+    }
+  }
+
+  return 0;
+}
+
+static gint
+media_setup_link (VirtualVsp * vsp, struct media_link_desc *desc)
+{
+  gboolean enable = (desc->flags & MEDIA_LNK_FL_ENABLED) != 0;
+  guint i, target = N_LINKS;
+
+  for (i = 0; i < N_LINKS; i++) {
+    if (ENTITY_ID (links[i].source) == desc->source.entity &&
+        links[i].source_pad == desc->source.index &&
+        ENTITY_ID (links[i].sink) == desc->sink.entity &&
+        links[i].sink_pad == desc->sink.index)
+      target = i;
+  }
+
+  if (target == N_LINKS) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (vsp->link_flags[target] & MEDIA_LNK_FL_IMMUTABLE) {
+    if (!enable) {
+      errno = EINVAL;
+      return -1;
+    }
+    return 0;
+  }
+
+  if (is_streaming (vsp)) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  /* a sink pad accepts a single enabled link */
+  if (enable) {
+    for (i = 0; i < N_LINKS; i++) {
+      if (i != target && (vsp->link_flags[i] & MEDIA_LNK_FL_ENABLED) &&
+          links[i].sink == links[target].sink &&
+          links[i].sink_pad == links[target].sink_pad) {
+        errno = EBUSY;
+        return -1;
+      }
+    }
+    vsp->link_flags[target] |= MEDIA_LNK_FL_ENABLED;
+  } else {
+    vsp->link_flags[target] &= ~MEDIA_LNK_FL_ENABLED;
+  }
+
+  return 0;
+}
+
+static gint
+media_ioctl (VirtualVsp * vsp, gulong request, gpointer arg)
+{
+  struct media_device_info *info;
+
+  switch (request) {
+    case MEDIA_IOC_DEVICE_INFO:
+      info = arg;
+      memset (info, 0, sizeof (*info));
+      g_strlcpy (info->driver, "vsp1", sizeof (info->driver));
+      g_strlcpy (info->model, vsp->name, sizeof (info->model));
+      return 0;
+    case MEDIA_IOC_ENUM_ENTITIES:
+      return media_enum_entities (vsp, arg);
+    case MEDIA_IOC_ENUM_LINKS:
+      return media_enum_links (vsp, arg);
+    case MEDIA_IOC_SETUP_LINK:
+      return media_setup_link (vsp, arg);
+    default:
+      errno = ENOTTY;
+      return -1;
+  }
+}
+
+/* Backend operations */
+
+static gint
+virtual_open (const gchar * path, gint flags)
+{
+  VirtualNodeType type;
+  VirtualFile *file;
+  guint vsp, entity;
+  gint fd;
+
+  if (!parse_path (path, &type, &vsp, &entity)) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  fd = open ("/dev/null", O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  file = g_slice_new0 (VirtualFile);
+  file->type = type;
+  file->entity = entity;
+
+  G_LOCK (virtual);
+  if (!files)
+    files = g_hash_table_new (NULL, NULL);
+  file->vsp = get_vsp (vsp);
+  g_hash_table_insert (files, GINT_TO_POINTER (fd), file);
+  G_UNLOCK (virtual);
+
+  GST_DEBUG ("opened %s as fd %d", path, fd);
+
+  return fd;
+}
+
+static gint
+virtual_close (gint fd)
+{
+  VirtualFile *file;
+  VirtualQueue *queue;
+  VirtualVsp *vsp;
+  enum v4l2_buf_type buftype;
+
+  G_LOCK (virtual);
+  file = files ? g_hash_table_lookup (files, GINT_TO_POINTER (fd)) : NULL;
+  if (file)
+    g_hash_table_remove (files, GINT_TO_POINTER (fd));
+  G_UNLOCK (virtual);
+
+  /* the last close of a video node releases its queue */
+  if (file && file->type == NODE_VIDEO) {
+    vsp = file->vsp;
+    queue = node_queue (vsp, file->entity);
+    buftype = queue->buftype;
+
+    g_mutex_lock (&vsp->lock);
+    video_streamoff (vsp, file, &buftype);
+    free_buffers (queue);
+    g_mutex_unlock (&vsp->lock);
+  }
+
+  if (file)
+    g_slice_free (VirtualFile, file);
+
+  return close (fd);
+}
+
+static gint
+virtual_ioctl (gint fd, gulong request, gpointer arg)
+{
+  VirtualFile *file;
+  VirtualVsp *vsp;
+  gint ret;
+
+  file = lookup_file (fd);
+  if (!file)
+    return ioctl (fd, request, arg);
+
+  vsp = file->vsp;
+
+  g_mutex_lock (&vsp->lock);
+  switch (file->type) {
+    case NODE_VIDEO:
+      ret = video_ioctl (vsp, file, request, arg);
+      break;
+    case NODE_SUBDEV:
+      ret = subdev_ioctl (vsp, file, request, arg);
+      break;
+    case NODE_MEDIA:
+      ret = media_ioctl (vsp, request, arg);
+      break;
+    default:
+      errno = ENOTTY;
+      ret = -1;
+      break;
+  }
+  g_mutex_unlock (&vsp->lock);
+
+  return ret;
+}
+
+static gint
+virtual_stat (const gchar * path, struct stat *st)
+{
+  VirtualNodeType type;
+  guint vsp, entity;
+
+  if (!parse_path (path, &type, &vsp, &entity)) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  fill_stat (type, vsp, entity, st);
+
+  return 0;
+}
+
+static gint
+virtual_fstat (gint fd, struct stat *st)
+{
+  VirtualFile *file;
+  guint vsp;
+
+  file = lookup_file (fd);
+  if (!file)
+    return fstat (fd, st);
+
+  for (vsp = 0; vsps[vsp] != file->vsp; vsp++);
+  fill_stat (file->type, vsp, file->entity, st);
+
+  return 0;
+}
+
+static gint
+virtual_poll (gint fd, glong timeout_usec)
+{
+  VirtualFile *file;
+  VirtualQueue *queue;
+  VirtualVsp *vsp;
+  gint64 end_time;
+  gint ret = 1;
+
+  file = lookup_file (fd);
+  if (!file || file->type != NODE_VIDEO)
+    return 1;
+
+  vsp = file->vsp;
+  queue = node_queue (vsp, file->entity);
+  end_time = g_get_monotonic_time () + timeout_usec;
+
+  g_mutex_lock (&vsp->lock);
+  /* like the driver, an idle queue reports an error condition */
+  while (queue->streaming && g_queue_is_empty (&queue->done)) {
+    if (!g_cond_wait_until (&vsp->cond, &vsp->lock, end_time)) {
+      ret = g_queue_is_empty (&queue->done) ? 0 : 1;
+      break;
+    }
+  }
+  g_mutex_unlock (&vsp->lock);
+
+  return ret;
+}
+
+/* Resolves /sys/class/video4linux/<node>/<attr> */
+static gboolean
+parse_sysfs_path (const gchar * path, const gchar * attr,
+    VirtualNodeType * type, guint * vsp, guint * entity)
+{
+  gchar node[32], dev[48];
+  gint len = 0;
+
+  if (sscanf (path, "/sys/class/video4linux/%31[^/]/%n", node, &len) != 1 ||
+      len == 0 || strcmp (path + len, attr) != 0)
+    return FALSE;
+
+  snprintf (dev, sizeof (dev), "/dev/%s", node);
+
+  return parse_path (dev, type, vsp, entity) && *type != NODE_MEDIA;
+}
+
+static gchar *
+virtual_read_attr (const gchar * path)
+{
+  VirtualNodeType type;
+  guint vsp, entity;
+
+  if (!parse_sysfs_path (path, "name", &type, &vsp, &entity))
+    return NULL;
+
+  return g_strdup_printf ("vvsp%u %s\n", vsp, entities[entity].name);
+}
+
+static gchar **
+virtual_list_dir (const gchar * path)
+{
+  VirtualNodeType type;
+  guint vsp, entity;
+  gchar **names;
+
+  if (!parse_sysfs_path (path, "device", &type, &vsp, &entity))
+    return NULL;
+
+  names = g_new0 (gchar *, 2);
+  names[0] = g_strdup_printf ("media%u", vsp);
+
+  return names;
+}
+
+static const VspfilterDeviceOps virtual_ops = {
+  "virtual",
+  virtual_open,
+  virtual_close,
+  virtual_ioctl,
+  virtual_stat,
+  virtual_fstat,
+  virtual_poll,
+  virtual_read_attr,
+  virtual_list_dir,
+};
+
+const VspfilterDeviceOps *
+vspfilter_virtual_get_ops (void)
+{
+  return &virtual_ops;
+}